@@ -0,0 +1,195 @@
+// Микробенчмарк политики доступа: компиляция и поиск на 100k правил
+//
+// Использование: acl-bench [количество_правил] [количество_поисков]
+
+#include "access_policy.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* ACTIONS[] = {"allow", "deny", "bypass", "upstream:parent1"};
+const char* ZONES[] = {"com", "net", "org", "ru", "io", "de", "co.uk", "info"};
+
+std::string random_label(std::mt19937_64& rng, size_t min_length, size_t max_length) {
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    std::uniform_int_distribution<size_t> length(min_length, max_length);
+    std::uniform_int_distribution<size_t> symbol(0, sizeof(alphabet) - 2);
+    std::string label(length(rng), 'a');
+    for (char& c : label) {
+        c = alphabet[symbol(rng)];
+    }
+    return label;
+}
+
+std::string ipv4_to_string(uint32_t address) {
+    in_addr addr;
+    addr.s_addr = htonl(address);
+    char buffer[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, buffer, sizeof(buffer));
+    return buffer;
+}
+
+std::string ipv6_to_string(uint64_t hi, uint64_t lo) {
+    in6_addr addr;
+    for (int i = 0; i < 8; ++i) {
+        addr.s6_addr[i] = static_cast<uint8_t>(hi >> (56 - 8 * i));
+        addr.s6_addr[i + 8] = static_cast<uint8_t>(lo >> (56 - 8 * i));
+    }
+    char buffer[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &addr, buffer, sizeof(buffer));
+    return buffer;
+}
+
+// Выравнивание по числу символов, а не байт (названия на кириллице)
+std::string pad(const std::string& text, size_t width) {
+    size_t symbols = 0;
+    for (unsigned char c : text) {
+        if ((c & 0xC0) != 0x80) {
+            ++symbols;
+        }
+    }
+    return symbols < width ? text + std::string(width - symbols, ' ') : text;
+}
+
+template <typename Fn>
+double measure_ns(size_t iterations, Fn&& fn) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        fn(i);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    return elapsed / static_cast<double>(iterations);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t rule_count = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t lookup_count = argc > 2 ? std::stoul(argv[2]) : 2000000;
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint32_t> u32;
+    std::uniform_int_distribution<uint64_t> u64;
+    std::uniform_int_distribution<int> action(0, 3);
+    std::uniform_int_distribution<int> v4_length(8, 32);
+    std::uniform_int_distribution<int> v6_length(16, 64);
+
+    // Состав правил: 60% IPv4 CIDR, 10% IPv6 CIDR, 30% доменных суффиксов
+    size_t ipv4_rules = rule_count * 6 / 10;
+    size_t ipv6_rules = rule_count / 10;
+    size_t domain_rules = rule_count - ipv4_rules - ipv6_rules;
+
+    std::vector<std::string> lines;
+    std::vector<uint32_t> ipv4_bases;
+    std::vector<std::pair<uint64_t, uint64_t>> ipv6_bases;
+    std::vector<std::string> domains;
+    lines.reserve(rule_count);
+
+    for (size_t i = 0; i < ipv4_rules; ++i) {
+        uint32_t base = u32(rng);
+        ipv4_bases.push_back(base);
+        lines.push_back(std::string(ACTIONS[action(rng)]) + " " + ipv4_to_string(base) + "/" +
+                        std::to_string(v4_length(rng)));
+    }
+    for (size_t i = 0; i < ipv6_rules; ++i) {
+        uint64_t hi = 0x2000000000000000ULL | (u64(rng) >> 4);
+        ipv6_bases.emplace_back(hi, 0);
+        lines.push_back(std::string(ACTIONS[action(rng)]) + " " + ipv6_to_string(hi, 0) + "/" +
+                        std::to_string(v6_length(rng)));
+    }
+    for (size_t i = 0; i < domain_rules; ++i) {
+        std::string domain = random_label(rng, 4, 12) + "." + ZONES[i % (sizeof(ZONES) / sizeof(ZONES[0]))];
+        if (i % 4 == 0) {
+            domain = random_label(rng, 2, 6) + "." + domain;
+        }
+        domains.push_back(domain);
+        lines.push_back(std::string(ACTIONS[action(rng)]) + " ." + domain);
+    }
+
+    // Построение и компиляция
+    auto build_start = Clock::now();
+    CompiledPolicy policy(PolicyAction::ALLOW, "");
+    std::string error;
+    size_t rejected = 0;
+    for (const auto& line : lines) {
+        if (!policy.add_rule(line, error)) {
+            ++rejected;
+        }
+    }
+    auto compile_start = Clock::now();
+    policy.compile();
+    auto build_end = Clock::now();
+
+    double add_ms = std::chrono::duration<double, std::milli>(compile_start - build_start).count();
+    double compile_ms = std::chrono::duration<double, std::milli>(build_end - compile_start).count();
+
+    std::cout << "=== Бенчмарк политики доступа ===" << std::endl;
+    std::cout << "Правил: " << policy.rule_count() << " (отклонено " << rejected << ")" << std::endl;
+    std::cout << "Добавление: " << std::fixed << std::setprecision(1) << add_ms << " мс, "
+              << "компиляция: " << compile_ms << " мс" << std::endl;
+    std::cout << "Память политики: " << Utils::format_bytes(policy.memory_usage()) << std::endl;
+
+    // Подготовка запросов заранее, чтобы не измерять генерацию строк
+    const size_t query_pool = 65536;
+    std::vector<std::string> ipv4_hits, ipv4_random, ipv6_hits, domain_hits, domain_misses;
+    for (size_t i = 0; i < query_pool; ++i) {
+        uint32_t base = ipv4_bases[i % ipv4_bases.size()];
+        ipv4_hits.push_back(ipv4_to_string(base));
+        ipv4_random.push_back(ipv4_to_string(u32(rng)));
+        auto v6 = ipv6_bases[i % ipv6_bases.size()];
+        ipv6_hits.push_back(ipv6_to_string(v6.first, u64(rng)));
+        domain_hits.push_back("www." + domains[i % domains.size()]);
+        domain_misses.push_back(random_label(rng, 5, 10) + ".example-" + random_label(rng, 3, 5) + ".com");
+    }
+
+    struct Case {
+        const char* name;
+        const std::vector<std::string>* queries;
+    };
+    const Case cases[] = {
+        {"IPv4 (попадание)", &ipv4_hits},
+        {"IPv4 (случайный)", &ipv4_random},
+        {"IPv6 (попадание)", &ipv6_hits},
+        {"Домен (попадание)", &domain_hits},
+        {"Домен (промах)", &domain_misses},
+    };
+
+    size_t checksum = 0;
+    std::cout << std::endl << "Сценарий                    нс/поиск    совпадений" << std::endl;
+    for (const auto& test_case : cases) {
+        size_t matched = 0;
+        double ns = measure_ns(lookup_count, [&](size_t i) {
+            PolicyDecision decision = policy.evaluate((*test_case.queries)[i & (query_pool - 1)]);
+            matched += decision.matched ? 1 : 0;
+            checksum += static_cast<size_t>(decision.action);
+        });
+        std::cout << pad(test_case.name, 24) << std::right << std::setw(12) << std::setprecision(1) << ns
+                  << std::setw(13) << std::setprecision(1) << (100.0 * matched / lookup_count) << "%" << std::endl;
+    }
+
+    // Поиск по разрешенному адресу без разбора строки
+    std::vector<sockaddr_in> addresses(query_pool);
+    for (size_t i = 0; i < query_pool; ++i) {
+        addresses[i].sin_family = AF_INET;
+        addresses[i].sin_addr.s_addr = htonl(u32(rng));
+    }
+    double ns = measure_ns(lookup_count, [&](size_t i) {
+        PolicyDecision decision = policy.evaluate_address(
+            reinterpret_cast<const sockaddr*>(&addresses[i & (query_pool - 1)]));
+        checksum += static_cast<size_t>(decision.action);
+    });
+    std::cout << pad("sockaddr_in (случайный)", 24) << std::right << std::setw(12) << std::setprecision(1) << ns << std::endl;
+
+    std::cout << std::endl << "Контрольная сумма: " << checksum << std::endl;
+    return 0;
+}
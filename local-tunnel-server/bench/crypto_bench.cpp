@@ -0,0 +1,412 @@
+// Производительность шифрованных туннелей: скорость ядер ChaCha20, Poly1305
+// и AEAD на одном ядре процессора, цена проверки пароля прокси (scrypt и
+// кэш учетных данных), затем пересылка туннеля через socketpair
+// тремя шагами из relay_step.h - открытый текст (relay_step), шифрование к
+// клиенту (encode_step) и расшифровка от клиента (decode_step).
+//
+// Использование: crypto-bench [--min-time-ms N] [--relay-mb N]
+//
+// Перед замерами проверяются тестовые векторы RFC 8439, RFC 7748 и RFC 7914 и
+// совпадение векторных ядер с переносимым. Скорость пересылки считается на
+// секунду процессорного времени потока пересылки (CLOCK_THREAD_CPUTIME_ID):
+// источник и приемник работают в отдельных потоках и в замер не входят.
+// Код возврата 1, если проверка не прошла.
+
+#include "chacha20_poly1305.h"
+#include "config.h"
+#include "credential_store.h"
+#include "crypto.h"
+#include "logger.h"
+#include "memory_budget.h"
+#include "relay_step.h"
+#include "secure_channel.h"
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using ChaCha20Poly1305::Kernel;
+
+const Kernel KERNELS[] = {Kernel::SCALAR, Kernel::AVX2, Kernel::AVX512};
+
+std::vector<uint8_t> hex(const std::string& text) {
+    std::vector<uint8_t> bytes(text.size() / 2);
+    Crypto::from_hex(text, bytes.data(), bytes.size());
+    return bytes;
+}
+
+// Имя замера, дополненное пробелами до 36 символов (не байт UTF-8)
+std::string pad(const std::string& name) {
+    size_t length = 0;
+    for (char c : name) {
+        length += (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+    }
+    return "  " + name + std::string(length < 36 ? 36 - length : 1, ' ');
+}
+
+bool check(bool passed, const std::string& name) {
+    std::cout << pad(name) << (passed ? "OK" : "ОШИБКА") << std::endl;
+    return passed;
+}
+
+// RFC 8439 2.8.2, RFC 7748 6.1, RFC 7914 12 и совпадение ядер на случайных данных
+bool self_check() {
+    std::cout << "Проверка:" << std::endl;
+    Kernel selected = ChaCha20Poly1305::kernel();
+    bool ok = true;
+
+    std::vector<uint8_t> key = hex("808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f");
+    std::vector<uint8_t> nonce = hex("070000004041424344454647");
+    std::vector<uint8_t> aad = hex("50515253c0c1c2c3c4c5c6c7");
+    const std::string plaintext =
+        "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+        "sunscreen would be it.";
+    for (Kernel kernel : KERNELS) {
+        if (!ChaCha20Poly1305::set_kernel(kernel)) {
+            continue;
+        }
+        std::vector<uint8_t> data(plaintext.begin(), plaintext.end());
+        uint8_t tag[ChaCha20Poly1305::TAG_SIZE];
+        ChaCha20Poly1305::seal(key.data(), nonce.data(), aad.data(), aad.size(), data.data(), data.size(), tag);
+        bool sealed = Crypto::to_hex(tag, sizeof(tag)) == "1ae10b594f09e26a7e902ecbd0600691" &&
+                      Crypto::to_hex(data.data(), 4) == "d31a8d34";
+        bool opened = ChaCha20Poly1305::open(key.data(), nonce.data(), aad.data(), aad.size(),
+                                             data.data(), data.size(), tag) &&
+                      std::string(data.begin(), data.end()) == plaintext;
+        tag[0] ^= 1;
+        bool rejected = !ChaCha20Poly1305::open(key.data(), nonce.data(), aad.data(), aad.size(),
+                                                data.data(), data.size(), tag);
+        std::string name = std::string("RFC 8439 AEAD, ") + ChaCha20Poly1305::kernel_name(kernel);
+        ok &= check(sealed && opened && rejected, name);
+    }
+
+    std::vector<uint8_t> alice = hex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+    std::vector<uint8_t> bob = hex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb");
+    uint8_t alice_public[Crypto::KEY_SIZE];
+    uint8_t computed_bob[Crypto::KEY_SIZE];
+    uint8_t shared_alice[Crypto::KEY_SIZE];
+    uint8_t shared_bob[Crypto::KEY_SIZE];
+    Crypto::x25519_base(alice_public, alice.data());
+    Crypto::x25519_base(computed_bob, bob.data());
+    bool agreed = Crypto::x25519(shared_alice, alice.data(), computed_bob) &&
+                  Crypto::x25519(shared_bob, bob.data(), alice_public) &&
+                  Crypto::to_hex(alice_public, sizeof(alice_public)) ==
+                      "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a" &&
+                  Crypto::to_hex(shared_alice, sizeof(shared_alice)) ==
+                      "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742" &&
+                  std::memcmp(shared_alice, shared_bob, sizeof(shared_alice)) == 0;
+    ok &= check(agreed, "RFC 7748 X25519");
+
+    uint8_t derived[64];
+    const std::string password = "password";
+    const std::string salt = "NaCl";
+    bool derived_ok = Crypto::scrypt(reinterpret_cast<const uint8_t*>(password.data()), password.size(),
+                                     reinterpret_cast<const uint8_t*>(salt.data()), salt.size(), 1024, 8, 16,
+                                     derived, sizeof(derived)) &&
+                      Crypto::to_hex(derived, sizeof(derived)) ==
+                          "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+                          "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640";
+    ok &= check(derived_ok, "RFC 7914 scrypt");
+
+    // Длины вокруг границ блоков и проходов векторных ядер
+    std::vector<uint8_t> random_key(ChaCha20Poly1305::KEY_SIZE);
+    std::vector<uint8_t> random_nonce(ChaCha20Poly1305::NONCE_SIZE);
+    std::vector<uint8_t> source(5000);
+    Crypto::random_bytes(random_key.data(), random_key.size());
+    Crypto::random_bytes(random_nonce.data(), random_nonce.size());
+    Crypto::random_bytes(source.data(), source.size());
+    for (Kernel kernel : {Kernel::AVX2, Kernel::AVX512}) {
+        if (!ChaCha20Poly1305::kernel_supported(kernel)) {
+            continue;
+        }
+        bool same = true;
+        for (size_t size = 0; size <= source.size(); size += size < 1100 ? 1 : 97) {
+            std::vector<uint8_t> expected(source.begin(), source.begin() + size);
+            std::vector<uint8_t> actual = expected;
+            ChaCha20Poly1305::set_kernel(Kernel::SCALAR);
+            ChaCha20Poly1305::chacha20_xor(random_key.data(), random_nonce.data(), 7, expected.data(), size);
+            ChaCha20Poly1305::set_kernel(kernel);
+            ChaCha20Poly1305::chacha20_xor(random_key.data(), random_nonce.data(), 7, actual.data(), size);
+            same &= expected == actual;
+        }
+        std::string name = std::string("ядро ") + ChaCha20Poly1305::kernel_name(kernel) + " = scalar";
+        ok &= check(same, name);
+    }
+    ChaCha20Poly1305::set_kernel(selected);
+    return ok;
+}
+
+// Байт в секунду для операции над буфером size байт, повторяемой не меньше
+// min_time_ms
+double measure(size_t size, int min_time_ms, const std::function<void()>& operation) {
+    operation();  // Прогрев
+    uint64_t iterations = 0;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::milliseconds(min_time_ms);
+    Clock::time_point now;
+    do {
+        for (int i = 0; i < 16; ++i) {
+            operation();
+        }
+        iterations += 16;
+        now = Clock::now();
+    } while (now < deadline);
+    double seconds = std::chrono::duration<double>(now - start).count();
+    return static_cast<double>(iterations * size) / seconds;
+}
+
+void report(const std::string& name, double bytes_per_second) {
+    std::cout << pad(name) << std::fixed << std::setprecision(2)
+              << std::setw(8) << bytes_per_second / 1e9 << " ГБ/с" << std::endl;
+}
+
+void report_latency(const std::string& name, double operations_per_second) {
+    std::cout << pad(name) << std::fixed << std::setprecision(2)
+              << std::setw(8) << 1e6 / operations_per_second << " мкс/оп" << std::endl;
+}
+
+void bench_primitives(int min_time_ms) {
+    std::cout << "Примитивы (одно ядро):" << std::endl;
+    uint8_t key[ChaCha20Poly1305::KEY_SIZE];
+    uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE] = {};
+    Crypto::random_bytes(key, sizeof(key));
+    std::vector<uint8_t> data(SecureChannel::MAX_PAYLOAD);
+    uint8_t tag[ChaCha20Poly1305::TAG_SIZE];
+
+    Kernel selected = ChaCha20Poly1305::kernel();
+    for (Kernel kernel : KERNELS) {
+        if (!ChaCha20Poly1305::set_kernel(kernel)) {
+            continue;
+        }
+        report(std::string("chacha20 ") + ChaCha20Poly1305::kernel_name(kernel),
+               measure(data.size(), min_time_ms, [&] {
+                   ChaCha20Poly1305::chacha20_xor(key, nonce, 1, data.data(), data.size());
+               }));
+    }
+    ChaCha20Poly1305::set_kernel(selected);
+
+    report("poly1305", measure(data.size(), min_time_ms, [&] {
+        ChaCha20Poly1305::poly1305(tag, key, data.data(), data.size());
+    }));
+    for (size_t record : {size_t(1024), size_t(16 * 1024), SecureChannel::MAX_RECORD}) {
+        size_t payload = record - SecureChannel::OVERHEAD;
+        uint8_t header[SecureChannel::HEADER] = {};
+        report("seal запись " + std::to_string(record / 1024) + " КБ, " + ChaCha20Poly1305::kernel_name(selected),
+               measure(payload, min_time_ms, [&] {
+                   ChaCha20Poly1305::seal(key, nonce, header, sizeof(header), data.data(), payload, tag);
+               }));
+    }
+}
+
+// Проверка пароля прокси: scrypt с параметрами по умолчанию, тот же scrypt
+// для неизвестного имени и повторный вход через кэш учетных данных
+void bench_auth(int min_time_ms) {
+    std::string path = "/tmp/crypto-bench-" + std::to_string(getpid()) + ".json";
+    {
+        std::ofstream file(path);
+        file << "{\"authentication\": {\"enabled\": true, \"username\": \"bench\", "
+                "\"password\": \"bench-password\"}}";
+    }
+    Config config(path);
+    unlink(path.c_str());
+    MemoryBudget memory;
+    CredentialStore store(memory);
+    if (!store.load(config)) {
+        return;
+    }
+    std::cout << "Аутентификация (одно ядро):" << std::endl;
+    report_latency("scrypt n=16384 r=8", measure(1, min_time_ms, [&] {
+        store.verify_password("bench", "wrong-password");
+    }));
+    report_latency("неизвестный пользователь", measure(1, min_time_ms, [&] {
+        store.verify_password("nobody", "bench-password");
+    }));
+    report_latency("повторный вход (кэш)", measure(1, min_time_ms, [&] {
+        store.verify_password("bench", "bench-password");
+    }));
+}
+
+double thread_cpu_seconds() {
+    timespec now{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) / 1e9;
+}
+
+enum class Mode {
+    PLAIN,
+    SEAL,
+    OPEN
+};
+
+// Пара каналов с общими ключами, как после согласования в CONNECT
+bool handshake(TunnelIdentity& identity, SecureChannel& client, SecureChannel& server) {
+    std::string reply;
+    std::string server_key;
+    return server.accept(client.offer(), identity, reply) && client.complete(reply, "", server_key);
+}
+
+// Пересылка total байт открытого текста из in[1] в out[0]. Источник пишет
+// открытый текст или, для OPEN, записи клиента; приемник проверяет, что
+// получено ровно total байт полезной нагрузки
+double bench_relay(Mode mode, TunnelIdentity& identity, size_t total, bool& ok) {
+    int in[2];
+    int out[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, out) < 0) {
+        std::cerr << "Не удалось создать socketpair" << std::endl;
+        std::exit(2);
+    }
+    SecureChannel client;
+    SecureChannel server;
+    if (mode != Mode::PLAIN && !handshake(identity, client, server)) {
+        std::cerr << "Не удалось согласовать ключи" << std::endl;
+        std::exit(2);
+    }
+
+    std::thread source([&, fd = in[0]] {
+        std::vector<char> block(SecureChannel::MAX_RECORD, 'x');
+        size_t left = total;
+        while (left > 0) {
+            size_t payload = std::min(left, SecureChannel::MAX_PAYLOAD);
+            size_t size = payload;
+            if (mode == Mode::OPEN) {
+                size = client.seal(block.data(), payload);
+            }
+            if (send(fd, block.data(), size, MSG_NOSIGNAL) != static_cast<ssize_t>(size)) {
+                break;
+            }
+            left -= payload;
+        }
+        shutdown(fd, SHUT_WR);
+    });
+
+    size_t delivered = 0;
+    bool intact = true;
+    std::thread sink([&, fd = out[1]] {
+        std::vector<char> block(SecureChannel::MAX_RECORD);
+        size_t pending = 0;
+        ssize_t received;
+        while ((received = recv(fd, block.data() + pending, block.size() - pending, 0)) > 0) {
+            if (mode != Mode::SEAL) {
+                delivered += static_cast<size_t>(received);
+                continue;
+            }
+            // Записи к клиенту расшифровываются, как это сделал бы клиент
+            pending += static_cast<size_t>(received);
+            size_t offset = 0;
+            while (pending - offset >= SecureChannel::HEADER) {
+                size_t size = SecureChannel::record_size(block.data() + offset);
+                if (size == 0 || pending - offset < size) {
+                    intact &= size != 0;
+                    break;
+                }
+                size_t payload = 0;
+                intact &= client.open(block.data() + offset, payload);
+                delivered += payload;
+                offset += size;
+            }
+            std::memmove(block.data(), block.data() + offset, pending - offset);
+            pending -= offset;
+        }
+    });
+
+    MemoryBudget budget;
+    ConnectionQuota quota(budget, 0);
+    AdaptiveBuffer buffer(quota);
+    PosixSocketOps ops;
+    TunnelFraming framing;
+    framing.channel = &server;
+    RelayStatus status = RelayStatus::OK;
+    double cpu_start = thread_cpu_seconds();
+    while (status == RelayStatus::OK) {
+        size_t moved = 0;
+        switch (mode) {
+        case Mode::PLAIN:
+            status = relay_step(ops, in[1], out[0], buffer, moved);
+            break;
+        case Mode::SEAL:
+            status = encode_step(ops, in[1], out[0], buffer, framing, moved);
+            break;
+        case Mode::OPEN:
+            status = decode_step(ops, in[1], out[0], buffer, framing, moved);
+            break;
+        }
+    }
+    double cpu = thread_cpu_seconds() - cpu_start;
+
+    shutdown(out[0], SHUT_WR);
+    source.join();
+    sink.join();
+    for (int fd : {in[0], in[1], out[0], out[1]}) {
+        close(fd);
+    }
+    ok &= status == RelayStatus::CLOSED && intact && delivered == total;
+    return static_cast<double>(total) / cpu;
+}
+
+bool bench_tunnel(size_t total) {
+    // Настройки по умолчанию: шифрование включено, ключ сервера создается
+    Config config("/nonexistent/crypto-bench.json");
+    TunnelIdentity identity;
+    identity.configure(config);
+    std::cout << "Пересылка туннеля, " << total / (1024 * 1024)
+              << " МБ (на секунду процессора потока пересылки):" << std::endl;
+
+    bool ok = true;
+    double plain = bench_relay(Mode::PLAIN, identity, total, ok);
+    double sealed = bench_relay(Mode::SEAL, identity, total, ok);
+    double opened = bench_relay(Mode::OPEN, identity, total, ok);
+    report("relay_step (открытый текст)", plain);
+    report("encode_step (к клиенту)", sealed);
+    report("decode_step (от клиента)", opened);
+    std::cout << "  доля открытого текста: seal " << std::setprecision(0) << 100 * sealed / plain << "%, open "
+              << 100 * opened / plain << "%" << std::endl;
+    return check(ok, "данные доставлены без искажений");
+}
+
+void usage() {
+    std::cerr << "Использование: crypto-bench [--min-time-ms N] [--relay-mb N]" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int min_time_ms = 300;
+    size_t relay_mb = 512;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--min-time-ms" && has_value) {
+            min_time_ms = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--relay-mb" && has_value) {
+            relay_mb = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    Logger::init("ERROR", "/dev/null");
+
+    std::cout << "Ядро ChaCha20: " << ChaCha20Poly1305::kernel_name(ChaCha20Poly1305::kernel()) << std::endl;
+    bool ok = self_check();
+    if (!ok) {
+        return 1;
+    }
+    bench_primitives(min_time_ms);
+    bench_auth(min_time_ms);
+    ok &= bench_tunnel(relay_mb * 1024 * 1024);
+    return ok ? 0 : 1;
+}
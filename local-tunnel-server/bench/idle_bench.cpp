@@ -0,0 +1,276 @@
+// Проверка режима простаивающих туннелей: открывает N туннелей через
+// работающий сервер к локальному эхо-серверу, ждет их парковки и измеряет
+// прирост резидентной памяти процесса сервера на один туннель.
+//
+// Использование: idle-bench <pid_сервера> [хост:порт_прокси] [туннелей] [ожидание_с] [лимит_КБ]
+//
+// Сервер должен быть запущен с server.idle_park_after меньше времени ожидания,
+// max_connections не меньше числа туннелей и бюджетом памяти, достаточным
+// для одновременных рукопожатий. Код возврата 1, если на туннель приходится
+// больше лимита (по умолчанию 16 КБ) или запаркованный туннель не ответил.
+
+#include "utils.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Значение поля (в КБ) из /proc/<pid>/status
+long read_status_field(int pid, const std::string& field) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0) {
+            return std::stol(line.substr(field.size() + 1));
+        }
+    }
+    return -1;
+}
+
+void raise_file_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Эхо-сервер на epoll: один поток на все соединения
+class EchoSink {
+public:
+    bool start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            listen(listen_fd_, 4096) < 0) {
+            return false;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        epoll_fd_ = epoll_create1(0);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listen_fd_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+
+        running_ = true;
+        thread_ = std::thread(&EchoSink::loop, this);
+        return true;
+    }
+
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    int port() const { return port_; }
+    size_t accepted() const { return accepted_.load(); }
+
+private:
+    int listen_fd_{-1};
+    int epoll_fd_{-1};
+    int port_{0};
+    std::atomic<bool> running_{false};
+    std::atomic<size_t> accepted_{0};
+    std::thread thread_;
+
+    void loop() {
+        epoll_event events[256];
+        char buffer[4096];
+        while (running_) {
+            int count = epoll_wait(epoll_fd_, events, 256, 200);
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd_) {
+                    int client = accept(listen_fd_, nullptr, nullptr);
+                    if (client >= 0) {
+                        epoll_event event{};
+                        event.events = EPOLLIN;
+                        event.data.fd = client;
+                        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client, &event);
+                        accepted_.fetch_add(1);
+                    }
+                    continue;
+                }
+                ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    close(fd);
+                    continue;
+                }
+                ssize_t sent = send(fd, buffer, received, MSG_NOSIGNAL);
+                (void)sent;
+            }
+        }
+    }
+};
+
+int open_tunnel(const sockaddr_in& proxy, int target_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&proxy), sizeof(proxy)) < 0) {
+        close(fd);
+        return -1;
+    }
+    std::string request = "CONNECT 127.0.0.1:" + std::to_string(target_port) + " HTTP/1.1\r\n\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        close(fd);
+        return -1;
+    }
+
+    Utils::set_socket_timeouts(fd, 10);
+    std::string response;
+    char c;
+    while (response.size() < 1024 && recv(fd, &c, 1, 0) == 1) {
+        response += c;
+        if (response.size() >= 4 && response.compare(response.size() - 4, 4, "\r\n\r\n") == 0) {
+            break;
+        }
+    }
+    if (response.compare(0, 12, "HTTP/1.1 200") != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool ping(int fd) {
+    const char message[] = "ping";
+    if (send(fd, message, 4, MSG_NOSIGNAL) != 4) {
+        return false;
+    }
+    char reply[4];
+    size_t total = 0;
+    while (total < 4) {
+        ssize_t received = recv(fd, reply + total, 4 - total, 0);
+        if (received <= 0) {
+            return false;
+        }
+        total += received;
+    }
+    return std::memcmp(reply, message, 4) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Использование: idle-bench <pid_сервера> [хост:порт_прокси] [туннелей] "
+                     "[ожидание_с] [лимит_КБ]" << std::endl;
+        return 2;
+    }
+    int pid = std::stoi(argv[1]);
+    std::string proxy_address = argc > 2 ? argv[2] : "127.0.0.1:8080";
+    size_t tunnels = argc > 3 ? std::stoul(argv[3]) : 10000;
+    int settle_seconds = argc > 4 ? std::stoi(argv[4]) : 10;
+    double limit_kb = argc > 5 ? std::stod(argv[5]) : 16.0;
+
+    raise_file_limit();
+
+    std::string proxy_host;
+    int proxy_port = 0;
+    if (!Utils::parse_address(proxy_address, proxy_host, proxy_port)) {
+        std::cerr << "Некорректный адрес прокси: " << proxy_address << std::endl;
+        return 2;
+    }
+    sockaddr_in proxy{};
+    proxy.sin_family = AF_INET;
+    proxy.sin_port = htons(static_cast<uint16_t>(proxy_port));
+    inet_pton(AF_INET, proxy_host.c_str(), &proxy.sin_addr);
+
+    EchoSink sink;
+    if (!sink.start()) {
+        std::cerr << "Не удалось запустить эхо-сервер" << std::endl;
+        return 2;
+    }
+
+    long rss_before = read_status_field(pid, "VmRSS");
+    if (rss_before < 0) {
+        std::cerr << "Процесс " << pid << " не найден" << std::endl;
+        return 2;
+    }
+
+    // Туннели открываются несколькими потоками
+    std::vector<int> sockets;
+    std::mutex sockets_mutex;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> failed{0};
+    auto open_start = Clock::now();
+    std::vector<std::thread> openers;
+    for (int t = 0; t < 8; ++t) {
+        openers.emplace_back([&]() {
+            while (next.fetch_add(1) < tunnels) {
+                int fd = open_tunnel(proxy, sink.port());
+                if (fd < 0) {
+                    failed.fetch_add(1);
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(sockets_mutex);
+                sockets.push_back(fd);
+            }
+        });
+    }
+    for (auto& opener : openers) {
+        opener.join();
+    }
+    double open_seconds = std::chrono::duration<double>(Clock::now() - open_start).count();
+
+    std::cout << "Открыто туннелей: " << sockets.size() << " из " << tunnels
+              << " за " << std::fixed << std::setprecision(1) << open_seconds << " с"
+              << " (ошибок: " << failed.load() << ")" << std::endl;
+    std::cout << "Ожидание парковки " << settle_seconds << " с..." << std::endl;
+    std::this_thread::sleep_for(std::chrono::seconds(settle_seconds));
+
+    long rss_after = read_status_field(pid, "VmRSS");
+    long threads = read_status_field(pid, "Threads");
+    double per_tunnel_kb = sockets.empty() ? 0.0
+        : static_cast<double>(rss_after - rss_before) / static_cast<double>(sockets.size());
+
+    std::cout << "RSS сервера: " << rss_before << " КБ -> " << rss_after << " КБ" << std::endl;
+    std::cout << "Потоков сервера: " << threads << std::endl;
+    std::cout << "На туннель: " << std::setprecision(2) << per_tunnel_kb << " КБ (лимит "
+              << limit_kb << " КБ)" << std::endl;
+
+    // Запаркованные туннели должны возобновляться при данных
+    size_t sample = std::min<size_t>(sockets.size(), 100);
+    size_t alive = 0;
+    for (size_t i = 0; i < sample; ++i) {
+        alive += ping(sockets[i * sockets.size() / std::max<size_t>(sample, 1)]) ? 1 : 0;
+    }
+    std::cout << "Ответили после парковки: " << alive << " из " << sample << std::endl;
+
+    for (int fd : sockets) {
+        close(fd);
+    }
+    sink.stop();
+
+    bool ok = !sockets.empty() && failed.load() == 0 && per_tunnel_kb < limit_kb && alive == sample;
+    std::cout << (ok ? "OK" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,677 @@
+// Микробенчмарки компонентов горячего пути: разбор стартовой строки запросов
+// прокси, журнал, функции Utils, цикл пересылки туннеля через socketpair,
+// сжатие кадров LZ4 и подготовка заголовков обычного HTTP запроса.
+// Для каждого замера выводятся нс/оп, выделений памяти на операцию и, где
+// есть полезная нагрузка, байт в секунду.
+//
+// Использование:
+//   microbench [--filter подстрока] [--min-time-ms N] [--json файл]
+//              [--baseline файл] [--threshold процент]
+//   microbench --compare базовый.json новый.json [--threshold процент]
+//
+// Число итераций подбирается так, чтобы замер длился не меньше min-time-ms;
+// замер повторяется три раза, в отчет идет медиана. С --baseline после
+// замеров результаты сравниваются с сохраненными, --compare сравнивает два
+// сохраненных файла. Код возврата 1, если какой-либо замер стал медленнее
+// больше чем на threshold процентов или выделяет память чаще.
+
+#include "http_cache.h"
+#include "http_filter.h"
+#include "http_request.h"
+#include "logger.h"
+#include "lz4.h"
+#include "memory_budget.h"
+#include "socks5.h"
+#include "utils.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Подсчет выделений памяти всей программы
+namespace {
+std::atomic<uint64_t> g_allocations{0};
+}
+
+void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Не дает компилятору выбросить вычисление результата
+template <typename T>
+inline void keep(T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Состояние одного прогона: замер идет от reset_timer (или начала прогона)
+// до stop_timer (или конца прогона)
+class State {
+public:
+    explicit State(uint64_t iterations) : iterations_(iterations) { reset_timer(); }
+
+    uint64_t iterations() const { return iterations_; }
+    void set_bytes(uint64_t bytes) { bytes_ = bytes; }
+
+    void reset_timer() {
+        start_ = Clock::now();
+        allocations_start_ = g_allocations.load(std::memory_order_relaxed);
+    }
+
+    void stop_timer() {
+        if (!stopped_) {
+            elapsed_ns_ = std::chrono::duration<double, std::nano>(Clock::now() - start_).count();
+            allocations_ = g_allocations.load(std::memory_order_relaxed) - allocations_start_;
+            stopped_ = true;
+        }
+    }
+
+    double elapsed_ns() const { return elapsed_ns_; }
+    uint64_t allocations() const { return allocations_; }
+    uint64_t bytes() const { return bytes_; }
+
+private:
+    uint64_t iterations_;
+    Clock::time_point start_;
+    uint64_t allocations_start_{0};
+    double elapsed_ns_{0};
+    uint64_t allocations_{0};
+    uint64_t bytes_{0};
+    bool stopped_{false};
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(State&)> run;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations{0};
+    double ns_per_op{0};
+    double allocs_per_op{0};
+    double bytes_per_second{0};
+};
+
+std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+void add(const std::string& name, std::function<void(State&)> run) {
+    registry().push_back(Benchmark{name, std::move(run)});
+}
+
+Result run_once(const Benchmark& benchmark, uint64_t iterations) {
+    State state(iterations);
+    benchmark.run(state);
+    state.stop_timer();
+    Result result;
+    result.name = benchmark.name;
+    result.iterations = iterations;
+    result.ns_per_op = state.elapsed_ns() / static_cast<double>(iterations);
+    result.allocs_per_op = static_cast<double>(state.allocations()) / static_cast<double>(iterations);
+    if (state.bytes() > 0 && state.elapsed_ns() > 0) {
+        result.bytes_per_second = static_cast<double>(state.bytes()) * 1e9 / state.elapsed_ns();
+    }
+    return result;
+}
+
+// Подбор числа итераций и медиана трех замеров
+Result measure(const Benchmark& benchmark, double min_time_ns) {
+    uint64_t iterations = 1;
+    Result result = run_once(benchmark, iterations);
+    while (result.ns_per_op * static_cast<double>(iterations) < min_time_ns && iterations < 1000000000ULL) {
+        double elapsed = std::max(result.ns_per_op * static_cast<double>(iterations), 1.0);
+        double factor = std::min(std::max(min_time_ns / elapsed * 1.4, 2.0), 100.0);
+        iterations = static_cast<uint64_t>(static_cast<double>(iterations) * factor);
+        result = run_once(benchmark, iterations);
+    }
+    std::vector<Result> runs{result, run_once(benchmark, iterations), run_once(benchmark, iterations)};
+    std::sort(runs.begin(), runs.end(),
+              [](const Result& a, const Result& b) { return a.ns_per_op < b.ns_per_op; });
+    return runs[1];
+}
+
+// Замеры
+
+const std::string CONNECT_LINE = "CONNECT www.example.com:443 HTTP/1.1";
+const std::string ABSOLUTE_LINE = "GET http://static.example.com:8080/assets/app.js?v=1234 HTTP/1.1";
+
+const std::string RESPONSE_HEAD =
+    "HTTP/1.1 200 OK\r\n"
+    "Date: Sun, 18 Oct 2026 10:00:00 GMT\r\n"
+    "Server: nginx\r\n"
+    "Content-Type: application/javascript\r\n"
+    "Content-Length: 48211\r\n"
+    "Last-Modified: Thu, 01 Oct 2026 08:00:00 GMT\r\n"
+    "ETag: \"5f3a-bc53\"\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: public, max-age=3600\r\n";
+
+void register_parsers() {
+    add("parse/connect", [](State& state) {
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            HttpRequest::RequestLine request;
+            HttpRequest::Error error = HttpRequest::parse_connect(CONNECT_LINE, request);
+            keep(error);
+            keep(request.port);
+        }
+    });
+
+    add("parse/absolute_url", [](State& state) {
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            HttpRequest::RequestLine request;
+            HttpRequest::Error error = HttpRequest::parse_absolute(ABSOLUTE_LINE, request);
+            keep(error);
+            keep(request.port);
+        }
+    });
+
+    add("parse/response_header", [](State& state) {
+        std::string value;
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            bool found = HttpCache::header(RESPONSE_HEAD, "cache-control", value);
+            keep(found);
+        }
+    });
+
+    add("parse/socks5_request", [](State& state) {
+        std::string request("\x05\x01\x00\x03", 4);
+        std::string host = "www.example.com";
+        request += static_cast<char>(host.size());
+        request += host;
+        request += std::string("\x01\xbb", 2);
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(request.data());
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            uint8_t command = 0;
+            std::string parsed_host;
+            int port = 0;
+            ssize_t consumed = Socks5::parse_request(data, request.size(), command, parsed_host, port);
+            keep(consumed);
+            keep(port);
+        }
+    });
+}
+
+void register_logger() {
+    // Сообщение каждого прогона уходит в /dev/null: и консоль, и файл
+    add("logger/info", [](State& state) {
+        const std::string message = "Новое подключение от 192.168.1.10:53211";
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            Logger::info(message);
+        }
+    });
+
+    // Отфильтрованное по уровню сообщение с конкатенацией, как в местах вызова
+    add("logger/debug_filtered", [](State& state) {
+        const std::string host = "www.example.com";
+        const int port = 443;
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            Logger::debug("Подключение к " + host + ":" + std::to_string(port));
+        }
+    });
+
+    // Сообщение места с ограничением частоты, почти всегда подавляемое
+    add("logger/rate_limited", [](State& state) {
+        static LogSite& site = Logger::site("microbench.rate_limited");
+        const std::string message = "Таймаут чтения заголовков";
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            Logger::warning(site, message);
+        }
+    });
+}
+
+void register_utils() {
+    add("utils/split", [](State& state) {
+        const std::string methods = "GET,HEAD,POST,PUT,DELETE,CONNECT,OPTIONS";
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            std::vector<std::string> parts = Utils::split(methods, ',');
+            keep(parts);
+        }
+    });
+
+    add("utils/trim", [](State& state) {
+        const std::string value = "   keep-alive, Upgrade \t ";
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            std::string trimmed = Utils::trim(value);
+            keep(trimmed);
+        }
+    });
+
+    add("utils/parse_address", [](State& state) {
+        const std::string address = "proxy.example.com:3128";
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            std::string host;
+            int port = 0;
+            bool parsed = Utils::parse_address(address, host, port);
+            keep(parsed);
+            keep(port);
+        }
+    });
+
+    add("utils/format_bytes", [](State& state) {
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            std::string text = Utils::format_bytes(123456789 + i);
+            keep(text);
+        }
+    });
+}
+
+// Цикл пересылки туннеля: recv в AdaptiveBuffer из одного socketpair и send
+// в другой. Источник и приемник - отдельные потоки; одна операция - одна
+// пара recv/send
+void register_relay() {
+    add("relay/socketpair", [](State& state) {
+        int in[2];
+        int out[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, out) < 0) {
+            std::cerr << "Не удалось создать socketpair" << std::endl;
+            std::exit(2);
+        }
+
+        std::thread source([fd = in[0]] {
+            std::vector<char> block(64 * 1024, 'x');
+            while (send(fd, block.data(), block.size(), MSG_NOSIGNAL) > 0) {
+            }
+        });
+        std::thread sink([fd = out[1]] {
+            std::vector<char> block(64 * 1024);
+            while (recv(fd, block.data(), block.size(), 0) > 0) {
+            }
+        });
+
+        MemoryBudget budget;
+        ConnectionQuota quota(budget, 0);
+        AdaptiveBuffer buffer(quota);
+        uint64_t bytes = 0;
+        state.reset_timer();
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            if (!buffer.ensure()) {
+                break;
+            }
+            ssize_t received = recv(in[1], buffer.data(), buffer.size(), 0);
+            if (received <= 0) {
+                break;
+            }
+            buffer.on_read(static_cast<size_t>(received));
+            iovec iov{buffer.data(), static_cast<size_t>(received)};
+            if (!Utils::send_all(out[0], &iov, 1)) {
+                break;
+            }
+            bytes += static_cast<uint64_t>(received);
+        }
+        state.stop_timer();
+        state.set_bytes(bytes);
+
+        // Закрытие концов, которыми владеет цикл, завершает оба потока
+        shutdown(in[1], SHUT_RDWR);
+        shutdown(out[0], SHUT_RDWR);
+        source.join();
+        sink.join();
+        for (int fd : {in[0], in[1], out[0], out[1]}) {
+            close(fd);
+        }
+    });
+}
+
+// Сжатие кадров туннеля: 16 КБ текстового ответа (заголовки и JSON) и
+// случайных данных, как в зашифрованном TLS потоке
+void register_compression() {
+    std::string text;
+    for (int i = 0; text.size() < 16 * 1024; ++i) {
+        text += RESPONSE_HEAD;
+        text += "\r\n{\"id\": " + std::to_string(i * 7919 % 100000) + ", \"name\": \"item-" + std::to_string(i) +
+                "\", \"tags\": [\"proxy\", \"tunnel\"], \"active\": " + (i % 3 ? "true" : "false") + "}\n";
+    }
+    text.resize(16 * 1024);
+    std::string random(16 * 1024, '\0');
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    for (char& c : random) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        c = static_cast<char>(seed);
+    }
+
+    auto compress = [](const std::string& input) {
+        return [input](State& state) {
+            std::vector<uint8_t> output(Lz4::bound(input.size()));
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data());
+            for (uint64_t i = 0; i < state.iterations(); ++i) {
+                size_t size = Lz4::compress(data, input.size(), output.data(), input.size() - 1);
+                keep(size);
+            }
+            state.set_bytes(state.iterations() * input.size());
+        };
+    };
+    add("lz4/compress_text", compress(text));
+    add("lz4/compress_random", compress(random));
+
+    add("lz4/decompress_text", [text](State& state) {
+        std::vector<uint8_t> packed(Lz4::bound(text.size()));
+        size_t size = Lz4::compress(reinterpret_cast<const uint8_t*>(text.data()), text.size(),
+                                    packed.data(), packed.size());
+        std::vector<uint8_t> output(text.size());
+        state.reset_timer();
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            size_t produced = 0;
+            bool valid = Lz4::decompress(packed.data(), size, output.data(), output.size(), produced);
+            keep(valid);
+        }
+        state.set_bytes(state.iterations() * text.size());
+    });
+}
+
+// Заголовки обычного HTTP запроса для пересылки цели: прежняя сборка
+// строками с заменой Host и цепочка фильтров над участками буфера приема
+// (только Host и полный набор фильтров). Одна операция - один запрос
+void register_http_filters() {
+    const std::string request_line = "GET /assets/app.js?v=1234 HTTP/1.1\r\n";
+    const std::string block =
+        "Host: static.example.com:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+        "Accept: */*\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Referer: http://static.example.com:8080/index.html\r\n"
+        "Cookie: session=8f3a9c2e71d04b5a; theme=dark\r\n"
+        "Proxy-Connection: keep-alive\r\n"
+        "If-None-Match: \"5f3a-bc53\"\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "\r\n";
+    const std::string host = "static.example.com";
+    const std::string client_ip = "192.168.1.20";
+
+    add("headers/concat_host", [=](State& state) {
+        std::string line;
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            std::string request = request_line;
+            size_t offset = 0;
+            while (true) {
+                size_t eol = block.find('\n', offset);
+                size_t end = eol > offset && block[eol - 1] == '\r' ? eol - 1 : eol;
+                line.assign(block, offset, end - offset);
+                offset = eol + 1;
+                if (line.empty()) {
+                    request += "\r\n";
+                    break;
+                }
+                if (line.find("Host:") == 0) {
+                    request += "Host: " + host + "\r\n";
+                } else {
+                    request += line + "\r\n";
+                }
+            }
+            keep(request);
+        }
+        state.set_bytes(state.iterations() * (request_line.size() + block.size()));
+    });
+
+    auto filter = [=](const HttpFilterChain::Settings& settings) {
+        return [=](State& state) {
+            HttpFilterChain chain(settings);
+            HttpHeaders headers;
+            std::vector<iovec> parts;
+            std::string_view fields(block.data(), block.size() - 2);
+            HttpFilterContext context{host, client_ip};
+            state.reset_timer();
+            for (uint64_t i = 0; i < state.iterations(); ++i) {
+                headers.parse(fields);
+                chain.apply(context, headers);
+                parts.clear();
+                parts.push_back(iovec{const_cast<char*>(request_line.data()), request_line.size()});
+                headers.gather(parts);
+                parts.push_back(iovec{const_cast<char*>(block.data() + block.size() - 2), 2});
+                keep(parts);
+            }
+            state.set_bytes(state.iterations() * (request_line.size() + block.size()));
+        };
+    };
+    add("headers/filter_host", filter(HttpFilterChain::Settings()));
+
+    HttpFilterChain::Settings full;
+    full.via = "1.1 cvpn";
+    full.forwarded_for = true;
+    full.strip = {"Proxy-Connection"};
+    full.inject = {"*.example.com X-Route: static"};
+    add("headers/filter_full", filter(full));
+}
+
+// Результаты в JSON: по одному замеру на строку, что упрощает и чтение
+// обратно, и просмотр разницы в системе контроля версий
+void write_json(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << "    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+            << std::fixed << std::setprecision(2)
+            << ", \"ns_per_op\": " << result.ns_per_op
+            << ", \"allocs_per_op\": " << result.allocs_per_op
+            << std::setprecision(0)
+            << ", \"bytes_per_second\": " << result.bytes_per_second << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+double json_number(const std::string& line, const std::string& field) {
+    size_t position = line.find("\"" + field + "\":");
+    if (position == std::string::npos) {
+        return 0;
+    }
+    return std::strtod(line.c_str() + position + field.size() + 3, nullptr);
+}
+
+bool read_json(const std::string& path, std::map<std::string, Result>& results) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::string key = "\"name\": \"";
+        size_t start = line.find(key);
+        if (start == std::string::npos) {
+            continue;
+        }
+        start += key.size();
+        size_t end = line.find('"', start);
+        if (end == std::string::npos) {
+            continue;
+        }
+        Result result;
+        result.name = line.substr(start, end - start);
+        result.iterations = static_cast<uint64_t>(json_number(line, "iterations"));
+        result.ns_per_op = json_number(line, "ns_per_op");
+        result.allocs_per_op = json_number(line, "allocs_per_op");
+        result.bytes_per_second = json_number(line, "bytes_per_second");
+        results[result.name] = result;
+    }
+    return true;
+}
+
+// Сравнение с базовыми результатами; true - регрессий нет. Выделения памяти
+// детерминированы, поэтому регрессией считается рост хотя бы на половину
+// выделения на операцию
+bool compare(const std::map<std::string, Result>& baseline, const std::vector<Result>& current,
+             double threshold) {
+    bool ok = true;
+    // Заголовок выровнен вручную: setw считает байты, а не символы
+    std::cout << "замер                       " << "  было нс/оп" << "       стало" << "  разница"
+              << "     выделений" << std::endl;
+    for (const Result& result : current) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) {
+            std::cout << std::left << std::setw(28) << result.name << std::right << "  нет в базовых" << std::endl;
+            continue;
+        }
+        const Result& base = it->second;
+        double change = base.ns_per_op > 0 ? 100.0 * (result.ns_per_op - base.ns_per_op) / base.ns_per_op : 0.0;
+        bool slower = change > threshold;
+        bool allocates = result.allocs_per_op >= base.allocs_per_op + 0.5;
+        std::ostringstream allocations;
+        allocations << std::fixed << std::setprecision(1) << base.allocs_per_op << "->" << result.allocs_per_op;
+        std::cout << std::left << std::setw(28) << result.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << base.ns_per_op << std::setw(12) << result.ns_per_op
+                  << std::setw(8) << std::showpos << change << std::noshowpos << "%" << std::setw(14)
+                  << allocations.str();
+        if (slower || allocates) {
+            std::cout << "  РЕГРЕССИЯ";
+            ok = false;
+        } else if (change < -threshold) {
+            std::cout << "  быстрее";
+        }
+        std::cout << std::endl;
+    }
+    return ok;
+}
+
+void report(const Result& result) {
+    std::cout << std::left << std::setw(28) << result.name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << result.ns_per_op << " нс/оп" << std::setprecision(2) << std::setw(8)
+              << result.allocs_per_op << " выд/оп";
+    if (result.bytes_per_second > 0) {
+        std::cout << std::setprecision(1) << std::setw(10) << result.bytes_per_second / (1024 * 1024) << " МБ/с";
+    }
+    std::cout << std::setw(12) << result.iterations << " итераций" << std::endl;
+}
+
+void usage() {
+    std::cerr << "Использование: microbench [--filter подстрока] [--min-time-ms N] [--json файл]\n"
+              << "                          [--baseline файл] [--threshold процент]\n"
+              << "               microbench --compare базовый.json новый.json [--threshold процент]"
+              << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string json_path;
+    std::string baseline_path;
+    std::vector<std::string> compare_paths;
+    double min_time_ms = 200;
+    double threshold = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value) {
+            filter = argv[++i];
+        } else if (arg == "--min-time-ms" && has_value) {
+            min_time_ms = std::max(1.0, std::atof(argv[++i]));
+        } else if (arg == "--json" && has_value) {
+            json_path = argv[++i];
+        } else if (arg == "--baseline" && has_value) {
+            baseline_path = argv[++i];
+        } else if (arg == "--threshold" && has_value) {
+            threshold = std::atof(argv[++i]);
+        } else if (arg == "--compare" && i + 2 < argc) {
+            compare_paths = {argv[i + 1], argv[i + 2]};
+            i += 2;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    if (!compare_paths.empty()) {
+        std::map<std::string, Result> baseline;
+        std::map<std::string, Result> current;
+        if (!read_json(compare_paths[0], baseline) || !read_json(compare_paths[1], current)) {
+            std::cerr << "Не удалось прочитать результаты" << std::endl;
+            return 2;
+        }
+        std::vector<Result> results;
+        for (const auto& entry : current) {
+            results.push_back(entry.second);
+        }
+        return compare(baseline, results, threshold) ? 0 : 1;
+    }
+
+    // Журнал пишет и в консоль, и в файл: оба направлены в /dev/null, а
+    // отчет выводится через сохраненный буфер консоли
+    std::ofstream null_stream("/dev/null");
+    std::streambuf* console = std::cout.rdbuf(null_stream.rdbuf());
+    Logger::init("INFO", "/dev/null");
+    Logger::set_rate_limit(1, 1);
+    std::cout.rdbuf(console);
+
+    register_parsers();
+    register_logger();
+    register_utils();
+    register_relay();
+    register_compression();
+    register_http_filters();
+
+    std::vector<Result> results;
+    for (const Benchmark& benchmark : registry()) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        std::cout.rdbuf(null_stream.rdbuf());
+        Result result = measure(benchmark, min_time_ms * 1e6);
+        std::cout.rdbuf(console);
+        report(result);
+        results.push_back(result);
+    }
+
+    if (!json_path.empty()) {
+        write_json(json_path, results);
+    }
+    if (!baseline_path.empty()) {
+        std::map<std::string, Result> baseline;
+        if (!read_json(baseline_path, baseline)) {
+            std::cerr << "Не удалось прочитать базовые результаты: " << baseline_path << std::endl;
+            return 2;
+        }
+        std::cout << std::endl;
+        return compare(baseline, results, threshold) ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,611 @@
+// Сценарии передачи данных туннелей в симуляторе сети (bench/sim_network.h):
+// виртуальное время, каналы с пропускной способностью, задержкой и
+// потерями. Туннель прокси повторяет ProxyHandler: строка CONNECT
+// разбирается HttpRequest::parse_connect, данные пересылаются через
+// relay_step с адаптивными буферами под настоящим MemoryBudget. Вместо
+// потока на туннель - обработчики событий, блокирующая отправка моделируется
+// остановкой туннеля до освобождения буфера сокета.
+//
+// Использование: netsim [--scenario имя] [--seed N] [--tunnels N]
+//
+// Сценарии:
+//   slow-clients  клиенты 10 Мбит/с, общий канал к серверу 1 Гбит/с,
+//                 RTT 200 мс, 1000 туннелей по 256 КБ
+//   lossy         то же с потерей 1% сегментов на каналах клиентов
+//   backpressure  клиент 1 Мбит/с, ответ 8 МБ: память прокси ограничена
+//                 буферами сокетов, ответ не накапливается в прокси
+//   determinism   повтор с тем же seed дает тот же результат, с другим - иной
+//
+// Для каждого сценария печатаются виртуальное и реальное время, число
+// событий, пропускная способность, справедливость (индекс Джайна по
+// скоростям туннелей) и пиковая память прокси. Код возврата 1, если
+// проверка сценария не прошла.
+
+#include "sim_network.h"
+#include "http_request.h"
+#include "memory_budget.h"
+#include "relay_step.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t REQUEST_BYTES = 400;
+constexpr size_t SOCKET_BUFFER = 256 * 1024;
+constexpr size_t HANDSHAKE_LIMIT = 8192;
+const std::string ESTABLISHED = "HTTP/1.1 200 Connection established\r\n\r\n";
+
+struct Scenario {
+    std::string name;
+    int tunnels{1000};
+    LinkSpec client;            // Канал клиента в каждую сторону
+    LinkSpec origin;            // Общий канал прокси - сервер в каждую сторону
+    size_t response_bytes{256 * 1024};
+    int64_t stagger_us{1000000};  // Начала туннелей равномерно в этом интервале
+};
+
+struct Result {
+    int completed{0};
+    int refused{0};
+    int64_t sim_us{0};
+    uint64_t events{0};
+    double wall_ms{0};
+    double goodput_bps{0};       // Байты ответов за время от первого начала до последнего завершения
+    double fairness{0};
+    double median_ms{0};
+    double max_ms{0};
+    size_t peak_buffers{0};      // Пик MemoryBudget (накладные расходы и буферы туннелей)
+    size_t peak_sockets{0};      // Пик байт в буферах сокетов прокси
+    uint64_t digest{0};
+};
+
+class World;
+
+// Туннель прокси
+class SimTunnel {
+public:
+    SimTunnel(World& world, int client, size_t reserved);
+
+private:
+    World& world_;
+    SimNetwork& network_;
+    SimSocketOps ops_;
+    ConnectionQuota quota_;
+    AdaptiveBuffer upstream_buffer_;
+    AdaptiveBuffer downstream_buffer_;
+    int client_;
+    int target_{-1};
+    std::string handshake_;
+    bool closed_{false};
+    int blocked_on_{-1};        // Сокет, на отправке в который стоит туннель
+    int64_t last_activity_{0};
+    bool idle_check_pending_{false};
+
+    void on_handshake();
+    void on_connected(int target);
+    void on_writable(int socket);
+    void transfer();
+    bool relay(int source, int destination, AdaptiveBuffer& buffer);
+    void schedule_idle_check();
+    void close();
+};
+
+// Клиенты, прокси и серверы одного прогона
+class World {
+public:
+    World(const Scenario& scenario, uint64_t seed) : scenario_(scenario), network_(seed) {
+        origin_up_ = network_.add_link(scenario.origin);
+        origin_down_ = network_.add_link(scenario.origin);
+    }
+
+    SimNetwork& network() { return network_; }
+    MemoryBudget& budget() { return budget_; }
+
+    Result run() {
+        auto wall_start = std::chrono::steady_clock::now();
+        starts_.assign(static_cast<size_t>(scenario_.tunnels), -1);
+        finishes_.assign(static_cast<size_t>(scenario_.tunnels), -1);
+        clients_.resize(static_cast<size_t>(scenario_.tunnels));
+        for (int i = 0; i < scenario_.tunnels; ++i) {
+            int64_t start = scenario_.stagger_us > 0
+                ? std::uniform_int_distribution<int64_t>(0, scenario_.stagger_us - 1)(network_.random())
+                : 0;
+            network_.at(start, [this, i] { start_client(i); });
+        }
+        sample_memory();
+        network_.run();
+
+        Result result;
+        result.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall_start).count();
+        result.sim_us = network_.now();
+        result.events = network_.events();
+        result.refused = refused_;
+        result.peak_buffers = budget_.peak();
+        result.peak_sockets = peak_sockets_;
+
+        std::vector<double> durations;
+        std::vector<double> rates;
+        int64_t first_start = INT64_MAX;
+        int64_t last_finish = 0;
+        uint64_t digest = 1469598103934665603ULL;
+        for (size_t i = 0; i < finishes_.size(); ++i) {
+            digest = (digest ^ static_cast<uint64_t>(finishes_[i])) * 1099511628211ULL;
+            if (finishes_[i] < 0) {
+                continue;
+            }
+            ++result.completed;
+            int64_t duration = std::max<int64_t>(1, finishes_[i] - starts_[i]);
+            durations.push_back(duration / 1000.0);
+            rates.push_back(static_cast<double>(scenario_.response_bytes) / duration);
+            first_start = std::min(first_start, starts_[i]);
+            last_finish = std::max(last_finish, finishes_[i]);
+        }
+        result.digest = (digest ^ result.events) * 1099511628211ULL;
+
+        if (!durations.empty()) {
+            std::sort(durations.begin(), durations.end());
+            result.median_ms = durations[durations.size() / 2];
+            result.max_ms = durations.back();
+            result.goodput_bps = 8e6 * static_cast<double>(scenario_.response_bytes) * result.completed /
+                                 static_cast<double>(std::max<int64_t>(1, last_finish - first_start));
+            // Индекс Джайна: 1 - все туннели получили одинаковую скорость
+            double sum = 0;
+            double squares = 0;
+            for (double rate : rates) {
+                sum += rate;
+                squares += rate * rate;
+            }
+            result.fairness = sum * sum / (static_cast<double>(rates.size()) * squares);
+        }
+        return result;
+    }
+
+    // Подключение прокси к серверу: соединение готово через RTT
+    template <typename Callback>
+    void dial(Callback on_connected) {
+        int64_t rtt = scenario_.origin.latency_us * 2;
+        network_.after(rtt, [this, on_connected] {
+            auto sockets = network_.connect(origin_up_, origin_down_, SOCKET_BUFFER, SOCKET_BUFFER);
+            proxy_sockets_.push_back(sockets.first);
+            start_origin(sockets.second);
+            on_connected(sockets.first);
+        });
+    }
+
+private:
+    Scenario scenario_;
+    SimNetwork network_;
+    MemoryBudget budget_;
+    int origin_up_{-1};
+    int origin_down_{-1};
+    int refused_{0};
+    std::vector<std::unique_ptr<SimTunnel>> tunnels_;
+    std::vector<int> proxy_sockets_;
+    size_t peak_sockets_{0};
+    int active_clients_{0};
+    std::vector<int64_t> starts_;
+    std::vector<int64_t> finishes_;
+
+    struct ClientState {
+        bool established{false};
+        size_t received{0};
+        std::string reply;
+    };
+    std::vector<std::unique_ptr<ClientState>> clients_;
+
+    // Клиент: CONNECT, после ответа 200 - запрос, затем чтение ответа
+    void start_client(int index) {
+        starts_[static_cast<size_t>(index)] = network_.now();
+        ++active_clients_;
+        int up = network_.add_link(scenario_.client);
+        int down = network_.add_link(scenario_.client);
+        auto sockets = network_.connect(up, down, SOCKET_BUFFER, SOCKET_BUFFER);
+        int client = sockets.first;
+        int proxy = sockets.second;
+        proxy_sockets_.push_back(proxy);
+
+        clients_[static_cast<size_t>(index)] = std::make_unique<ClientState>();
+        ClientState* state = clients_[static_cast<size_t>(index)].get();
+        std::string line = "CONNECT t" + std::to_string(index) + ".example:443 HTTP/1.1\r\n"
+                           "Host: t" + std::to_string(index) + ".example:443\r\n\r\n";
+        network_.send(client, line.size(), line);
+
+        network_.on_readable(client, [this, index, client, state] {
+            char data[16 * 1024];
+            while (true) {
+                ssize_t received = network_.recv(client, state->established ? nullptr : data, sizeof(data));
+                if (received < 0) {
+                    return;
+                }
+                if (received == 0) {
+                    network_.on_readable(client, nullptr);
+                    if (state->received < scenario_.response_bytes) {
+                        --active_clients_;  // Прокси закрыл туннель раньше ответа
+                    }
+                    return;
+                }
+                if (!state->established) {
+                    state->reply.append(data, static_cast<size_t>(received));
+                    if (state->reply.size() < ESTABLISHED.size()) {
+                        continue;
+                    }
+                    state->established = true;
+                    if (state->reply.compare(0, 12, "HTTP/1.1 200") != 0) {
+                        network_.shutdown(client);
+                        continue;
+                    }
+                    state->received = state->reply.size() - ESTABLISHED.size();
+                    network_.send(client, REQUEST_BYTES);
+                    continue;
+                }
+                state->received += static_cast<size_t>(received);
+                if (state->received >= scenario_.response_bytes && finishes_[static_cast<size_t>(index)] < 0) {
+                    finishes_[static_cast<size_t>(index)] = network_.now();
+                    --active_clients_;
+                    network_.shutdown(client);
+                }
+            }
+        });
+
+        if (!budget_.admit_connection(budget_.connection_overhead())) {
+            ++refused_;
+            network_.shutdown(proxy);
+            return;
+        }
+        tunnels_.push_back(std::make_unique<SimTunnel>(*this, proxy, budget_.connection_overhead()));
+    }
+
+    // Сервер: после запроса отправляет ответ и закрывает соединение
+    void start_origin(int socket) {
+        auto requested = std::make_shared<size_t>(0);
+        network_.on_readable(socket, [this, socket, requested] {
+            ssize_t received;
+            while ((received = network_.recv(socket, nullptr, SIZE_MAX)) > 0) {
+                bool complete = *requested < REQUEST_BYTES;
+                *requested += static_cast<size_t>(received);
+                if (complete && *requested >= REQUEST_BYTES) {
+                    network_.send(socket, scenario_.response_bytes);
+                    network_.shutdown(socket);
+                }
+            }
+        });
+    }
+
+    // Память в буферах сокетов прокси - раз в 10 мс, пока есть клиенты
+    void sample_memory() {
+        size_t total = 0;
+        for (int socket : proxy_sockets_) {
+            total += network_.queued(socket);
+        }
+        peak_sockets_ = std::max(peak_sockets_, total);
+        if (active_clients_ > 0 || network_.now() <= scenario_.stagger_us) {
+            network_.after(10000, [this] { sample_memory(); });
+        }
+    }
+};
+
+SimTunnel::SimTunnel(World& world, int client, size_t reserved)
+    : world_(world),
+      network_(world.network()),
+      ops_{world.network()},
+      quota_(world.budget(), reserved),
+      upstream_buffer_(quota_),
+      downstream_buffer_(quota_),
+      client_(client) {
+    network_.on_readable(client_, [this] { on_handshake(); });
+}
+
+void SimTunnel::on_handshake() {
+    char data[1024];
+    ssize_t received;
+    while ((received = network_.recv(client_, data, sizeof(data))) > 0) {
+        handshake_.append(data, static_cast<size_t>(received));
+    }
+    if (received == 0 || handshake_.size() > HANDSHAKE_LIMIT) {
+        close();
+        return;
+    }
+    size_t end = handshake_.find("\r\n\r\n");
+    if (end == std::string::npos) {
+        return;
+    }
+
+    HttpRequest::RequestLine request;
+    if (HttpRequest::parse_connect(handshake_.substr(0, handshake_.find("\r\n")), request) !=
+        HttpRequest::Error::NONE) {
+        std::string reply = "HTTP/1.1 400 Bad Request\r\n\r\n";
+        network_.send(client_, reply.size(), reply);
+        close();
+        return;
+    }
+    network_.on_readable(client_, nullptr);
+    world_.dial([this](int target) { on_connected(target); });
+}
+
+void SimTunnel::on_connected(int target) {
+    target_ = target;
+    if (closed_) {
+        network_.shutdown(target_);
+        return;
+    }
+    network_.send(client_, ESTABLISHED.size(), ESTABLISHED);
+    last_activity_ = network_.now();
+    network_.on_readable(client_, [this] { transfer(); });
+    network_.on_readable(target_, [this] { transfer(); });
+    network_.on_writable(client_, [this] { on_writable(client_); });
+    network_.on_writable(target_, [this] { on_writable(target_); });
+    transfer();
+}
+
+void SimTunnel::on_writable(int socket) {
+    if (blocked_on_ == socket) {
+        blocked_on_ = -1;
+        transfer();
+    }
+}
+
+// Тело цикла start_data_transfer: за проход - по одному шагу в каждом
+// направлении, где есть данные или FIN
+void SimTunnel::transfer() {
+    bool progress = true;
+    while (progress && !closed_ && blocked_on_ < 0) {
+        progress = false;
+        if (network_.readable(client_) > 0 || network_.eof(client_)) {
+            if (!relay(client_, target_, upstream_buffer_)) {
+                return;
+            }
+            progress = true;
+        }
+        if (blocked_on_ >= 0) {
+            break;
+        }
+        if (network_.readable(target_) > 0 || network_.eof(target_)) {
+            if (!relay(target_, client_, downstream_buffer_)) {
+                return;
+            }
+            progress = true;
+        }
+    }
+    schedule_idle_check();
+}
+
+bool SimTunnel::relay(int source, int destination, AdaptiveBuffer& buffer) {
+    size_t moved = 0;
+    if (relay_step(ops_, source, destination, buffer, moved) != RelayStatus::OK) {
+        close();
+        return false;
+    }
+    last_activity_ = network_.now();
+    if (!network_.writable(destination)) {
+        blocked_on_ = destination;
+    }
+    return true;
+}
+
+// Простаивающий туннель отдает буферы, как по таймауту poll в ProxyHandler
+void SimTunnel::schedule_idle_check() {
+    int64_t idle_release_us = static_cast<int64_t>(quota_.budget().idle_release_ms()) * 1000;
+    if (idle_check_pending_ || closed_ || idle_release_us <= 0) {
+        return;
+    }
+    idle_check_pending_ = true;
+    network_.at(last_activity_ + idle_release_us, [this, idle_release_us] {
+        idle_check_pending_ = false;
+        if (closed_) {
+            return;
+        }
+        if (network_.now() - last_activity_ >= idle_release_us) {
+            upstream_buffer_.release();
+            downstream_buffer_.release();
+        } else {
+            schedule_idle_check();
+        }
+    });
+}
+
+void SimTunnel::close() {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    network_.on_readable(client_, nullptr);
+    network_.on_writable(client_, nullptr);
+    network_.shutdown(client_);
+    if (target_ >= 0) {
+        network_.on_readable(target_, nullptr);
+        network_.on_writable(target_, nullptr);
+        network_.shutdown(target_);
+    }
+    upstream_buffer_.release();
+    downstream_buffer_.release();
+    quota_.release_all();
+}
+
+std::string format_rate(double bps) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    if (bps >= 1e9) {
+        out << bps / 1e9 << " Гбит/с";
+    } else {
+        out << bps / 1e6 << " Мбит/с";
+    }
+    return out.str();
+}
+
+std::string format_size(size_t bytes) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << bytes / 1048576.0 << " МБ";
+    return out.str();
+}
+
+void report(const Scenario& scenario, const Result& result) {
+    std::cout << scenario.name << ": " << result.completed << "/" << scenario.tunnels << " туннелей";
+    if (result.refused > 0) {
+        std::cout << " (отказано " << result.refused << ")";
+    }
+    std::cout << std::fixed << std::setprecision(2)
+              << ", виртуальное время " << result.sim_us / 1e6 << " с"
+              << ", реальное " << result.wall_ms / 1000 << " с"
+              << ", событий " << result.events << "\n"
+              << "  пропускная способность " << format_rate(result.goodput_bps)
+              << ", справедливость " << std::setprecision(3) << result.fairness
+              << std::setprecision(0)
+              << ", длительность туннеля медиана " << result.median_ms << " мс, макс " << result.max_ms << " мс\n"
+              << "  пик памяти прокси: буферы " << format_size(result.peak_buffers)
+              << ", сокеты " << format_size(result.peak_sockets) << std::endl;
+}
+
+bool check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cout << "  НЕ ПРОЙДЕНО: " << message << std::endl;
+    }
+    return condition;
+}
+
+LinkSpec link(double bandwidth_bps, int64_t latency_us, double loss = 0) {
+    LinkSpec spec;
+    spec.bandwidth_bps = bandwidth_bps;
+    spec.latency_us = latency_us;
+    spec.jitter_us = latency_us / 20;
+    spec.loss = loss;
+    return spec;
+}
+
+// 10 Мбит/с у клиента, 1 Гбит/с к серверу, RTT 200 мс (90 + 10 мс в одну сторону)
+Scenario slow_clients(int tunnels) {
+    Scenario scenario;
+    scenario.name = "slow-clients";
+    scenario.tunnels = tunnels;
+    scenario.client = link(10e6, 90000);
+    scenario.origin = link(1e9, 10000);
+    return scenario;
+}
+
+bool run_slow_clients(uint64_t seed, int tunnels) {
+    Scenario scenario = slow_clients(tunnels);
+    Result result = World(scenario, seed).run();
+    report(scenario, result);
+
+    // Ответ в 256 КБ на 10 Мбит/с - 0.2 с; с рукопожатием (3 RTT) и окном
+    // туннель не должен длиться больше 2 с
+    bool ok = check(result.completed == scenario.tunnels, "не все туннели завершились");
+    ok &= check(result.max_ms < 2000, "туннель длился дольше 2 с");
+    ok &= check(result.fairness > 0.9, "скорости туннелей неравномерны");
+    ok &= check(result.peak_buffers <= static_cast<size_t>(scenario.tunnels) * (1u << 20),
+                "буферы превысили квоту соединений");
+    return ok;
+}
+
+bool run_lossy(uint64_t seed, int tunnels) {
+    Scenario clean = slow_clients(tunnels);
+    Scenario lossy = clean;
+    lossy.name = "lossy";
+    lossy.client.loss = 0.01;
+    Result clean_result = World(clean, seed).run();
+    Result result = World(lossy, seed).run();
+    report(lossy, result);
+
+    // Повтор потерянного сегмента задерживает туннель на таймаут, но не
+    // останавливает передачу
+    bool ok = check(result.completed == lossy.tunnels, "не все туннели завершились");
+    ok &= check(result.median_ms < clean_result.median_ms * 2, "медиана длительности выросла больше чем вдвое");
+    ok &= check(result.goodput_bps > clean_result.goodput_bps * 0.5, "пропускная способность упала больше чем вдвое");
+    return ok;
+}
+
+bool run_backpressure(uint64_t seed) {
+    Scenario scenario;
+    scenario.name = "backpressure";
+    scenario.tunnels = 4;
+    scenario.client = link(1e6, 20000);
+    scenario.origin = link(1e9, 1000);
+    scenario.response_bytes = 8u << 20;
+    scenario.stagger_us = 0;
+    Result result = World(scenario, seed).run();
+    report(scenario, result);
+
+    // Прокси держит не больше буферов сокетов и своих буферов: ответ сервера
+    // ждет в сервере, а не в памяти прокси
+    size_t per_tunnel = 4 * SOCKET_BUFFER + 2 * MemoryBudget().max_buffer();
+    bool ok = check(result.completed == scenario.tunnels, "не все туннели завершились");
+    ok &= check(result.peak_sockets + result.peak_buffers <= per_tunnel * static_cast<size_t>(scenario.tunnels),
+                "прокси накапливает ответ вместо обратного давления");
+    ok &= check(result.goodput_bps > 0.8 * 4e6, "медленные клиенты получают меньше 80% своего канала");
+    return ok;
+}
+
+bool run_determinism(uint64_t seed) {
+    Scenario scenario = slow_clients(100);
+    scenario.name = "determinism";
+    Result first = World(scenario, seed).run();
+    Result second = World(scenario, seed).run();
+    Result other = World(scenario, seed + 1).run();
+    std::cout << "determinism: digest " << std::hex << first.digest << " / " << second.digest
+              << ", seed+1 " << other.digest << std::dec << std::endl;
+
+    bool ok = check(first.digest == second.digest && first.events == second.events,
+                    "повтор с тем же seed дал другой результат");
+    ok &= check(first.digest != other.digest, "другой seed дал тот же результат");
+    return ok;
+}
+
+void usage() {
+    std::cerr << "Использование: netsim [--scenario slow-clients|lossy|backpressure|determinism]"
+                 " [--seed N] [--tunnels N]" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string only;
+    uint64_t seed = 1;
+    int tunnels = 1000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scenario" && has_value) {
+            only = argv[++i];
+        } else if (arg == "--seed" && has_value) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--tunnels" && has_value) {
+            tunnels = std::max(1, std::atoi(argv[++i]));
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    bool ok = true;
+    bool matched = false;
+    auto selected = [&](const char* name) {
+        bool run = only.empty() || only == name;
+        matched |= run;
+        return run;
+    };
+    if (selected("slow-clients")) {
+        ok &= run_slow_clients(seed, tunnels);
+    }
+    if (selected("lossy")) {
+        ok &= run_lossy(seed, tunnels);
+    }
+    if (selected("backpressure")) {
+        ok &= run_backpressure(seed);
+    }
+    if (selected("determinism")) {
+        ok &= run_determinism(seed);
+    }
+    if (!matched) {
+        usage();
+        return 2;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+// Масштабирование по рабочим потокам: запускает сервер в этом же процессе
+// с 1, 2, ... N рабочими и измеряет число туннелей в секунду (CONNECT,
+// обмен одним сообщением с эхо-сервером, закрытие).
+//
+// Использование: scaling-bench [макс_рабочих] [длительность_с] [клиентов_на_рабочего] [порт]
+//
+// По умолчанию N - число доступных процессу процессоров. Клиенты и эхо-сервер
+// работают на тех же процессорах, что и сервер, поэтому результат - нижняя
+// оценка; для чистого замера сервер ограничивается через server.cpu_set,
+// а бенчмарк запускается через taskset на остальных процессорах.
+
+#include "vpn_server.h"
+#include "cpu_topology.h"
+#include "logger.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void raise_file_limit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Эхо-сервер на epoll: один поток на все соединения
+class EchoSink {
+public:
+    bool start() {
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            listen(listen_fd_, 4096) < 0) {
+            return false;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length);
+        port_ = ntohs(address.sin_port);
+
+        epoll_fd_ = epoll_create1(0);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = listen_fd_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+
+        running_ = true;
+        thread_ = std::thread(&EchoSink::loop, this);
+        return true;
+    }
+
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        close(epoll_fd_);
+        close(listen_fd_);
+    }
+
+    int port() const { return port_; }
+
+private:
+    int listen_fd_{-1};
+    int epoll_fd_{-1};
+    int port_{0};
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+
+    void loop() {
+        epoll_event events[256];
+        char buffer[4096];
+        while (running_) {
+            int count = epoll_wait(epoll_fd_, events, 256, 200);
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd_) {
+                    int client = accept(listen_fd_, nullptr, nullptr);
+                    if (client >= 0) {
+                        epoll_event event{};
+                        event.events = EPOLLIN;
+                        event.data.fd = client;
+                        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client, &event);
+                    }
+                    continue;
+                }
+                ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    close(fd);
+                    continue;
+                }
+                ssize_t sent = send(fd, buffer, received, MSG_NOSIGNAL);
+                (void)sent;
+            }
+        }
+    }
+};
+
+// Один туннель: CONNECT, ответ 200, эхо сообщения, закрытие
+bool run_tunnel(const sockaddr_in& proxy, const std::string& request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    Utils::set_socket_timeouts(fd, 10);
+    bool ok = false;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&proxy), sizeof(proxy)) == 0 &&
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(request.size())) {
+        std::string response;
+        char buffer[512];
+        while (response.find("\r\n\r\n") == std::string::npos && response.size() < 1024) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                break;
+            }
+            response.append(buffer, received);
+        }
+        if (response.compare(0, 12, "HTTP/1.1 200") == 0 &&
+            send(fd, "ping", 4, MSG_NOSIGNAL) == 4) {
+            size_t total = 0;
+            while (total < 4) {
+                ssize_t received = recv(fd, buffer + total, 4 - total, 0);
+                if (received <= 0) {
+                    break;
+                }
+                total += received;
+            }
+            ok = total == 4 && std::memcmp(buffer, "ping", 4) == 0;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+std::string write_config(int workers, int port) {
+    std::string path = "/tmp/scaling-bench-" + std::to_string(getpid()) + ".json";
+    std::ofstream file(path, std::ios::trunc);
+    file << "{\n"
+         << "    \"server\": {\n"
+         << "        \"host\": \"127.0.0.1\",\n"
+         << "        \"port\": " << port << ",\n"
+         << "        \"max_connections\": 100000,\n"
+         << "        \"listen_backlog\": 4096,\n"
+         << "        \"idle_park_after\": 0,\n"
+         << "        \"workers\": " << workers << ",\n"
+         << "        \"pin_workers\": true\n"
+         << "    },\n"
+         << "    \"metrics\": {\n"
+         << "        \"file\": \"\"\n"
+         << "    }\n"
+         << "}\n";
+    return path;
+}
+
+struct Result {
+    double rate;
+    size_t failures;
+};
+
+Result measure(int workers, int port, int target_port, int clients, int seconds) {
+    std::string path = write_config(workers, port);
+    VPNServer server(path);
+    if (!server.start()) {
+        std::remove(path.c_str());
+        return Result{0, 0};
+    }
+
+    sockaddr_in proxy{};
+    proxy.sin_family = AF_INET;
+    proxy.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &proxy.sin_addr);
+    std::string request = "CONNECT 127.0.0.1:" + std::to_string(target_port) + " HTTP/1.1\r\n\r\n";
+
+    std::atomic<bool> running{true};
+    std::atomic<size_t> completed{0};
+    std::atomic<size_t> failures{0};
+    std::vector<std::thread> threads;
+    auto started = Clock::now();
+    for (int i = 0; i < clients; ++i) {
+        threads.emplace_back([&] {
+            while (running.load(std::memory_order_relaxed)) {
+                if (run_tunnel(proxy, request)) {
+                    completed.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    failures.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running.store(false);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+
+    server.stop();
+    std::remove(path.c_str());
+    return Result{completed.load() / elapsed, failures.load()};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int max_workers = argc > 1 ? std::stoi(argv[1])
+                               : static_cast<int>(Topology::available_cpus().size());
+    int seconds = argc > 2 ? std::stoi(argv[2]) : 5;
+    int clients_per_worker = argc > 3 ? std::stoi(argv[3]) : 4;
+    int base_port = argc > 4 ? std::stoi(argv[4]) : 18180;
+
+    raise_file_limit();
+    Logger::init("ERROR");
+
+    EchoSink sink;
+    if (!sink.start()) {
+        std::cerr << "Не удалось запустить эхо-сервер" << std::endl;
+        return 2;
+    }
+
+    std::cout << "Процессоров доступно: " << Topology::available_cpus().size()
+              << ", длительность замера: " << seconds << " с" << std::endl;
+    // setw считает байты, поэтому заголовок с кириллицей выровнен вручную
+    std::cout << "рабочих   клиентов    туннелей/с      ускорение   ошибок" << std::endl;
+
+    double baseline = 0;
+    for (int workers = 1; workers <= max_workers; ++workers) {
+        int clients = clients_per_worker * workers;
+        // Свой порт на каждый замер: сокеты прошлого сервера еще в TIME_WAIT
+        Result result = measure(workers, base_port + workers, sink.port(), clients, seconds);
+        if (workers == 1) {
+            baseline = result.rate;
+        }
+        std::cout << std::left << std::setw(10) << workers << std::setw(12) << clients
+                  << std::setw(16) << std::fixed << std::setprecision(0) << result.rate
+                  << std::setw(12) << std::setprecision(2)
+                  << (baseline > 0 ? result.rate / baseline : 0.0)
+                  << result.failures << std::endl;
+    }
+
+    sink.stop();
+    return 0;
+}
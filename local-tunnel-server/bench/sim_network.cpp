@@ -0,0 +1,203 @@
+#include "sim_network.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+SimNetwork::SimNetwork(uint64_t seed) : random_(seed) {}
+
+void SimNetwork::at(int64_t time, std::function<void()> action) {
+    queue_.push(Event{std::max(time, now_), random_(), sequence_++, std::move(action)});
+}
+
+void SimNetwork::run(int64_t deadline) {
+    while (!queue_.empty() && queue_.top().time <= deadline) {
+        // Событие извлекается до выполнения: действие может планировать новые
+        Event event = std::move(const_cast<Event&>(queue_.top()));
+        queue_.pop();
+        now_ = event.time;
+        ++events_;
+        event.action();
+    }
+}
+
+int SimNetwork::add_link(const LinkSpec& spec) {
+    links_.push_back(Link{spec, 0});
+    return static_cast<int>(links_.size() - 1);
+}
+
+std::pair<int, int> SimNetwork::connect(int link_forward, int link_backward, size_t send_buffer, size_t receive_buffer) {
+    int first = static_cast<int>(sockets_.size());
+    int second = first + 1;
+    sockets_.emplace_back();
+    sockets_.emplace_back();
+    for (int socket : {first, second}) {
+        Socket& entry = sockets_[socket];
+        entry.peer = socket == first ? second : first;
+        entry.link = socket == first ? link_forward : link_backward;
+        entry.send_capacity = send_buffer;
+        entry.receive_capacity = receive_buffer;
+    }
+    return {first, second};
+}
+
+ssize_t SimNetwork::recv(int socket, char* data, size_t size) {
+    Socket& entry = sockets_[socket];
+    if (entry.receive_queue.empty()) {
+        if (entry.eof) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    size_t taken = 0;
+    while (taken < size && !entry.receive_queue.empty()) {
+        Chunk& chunk = entry.receive_queue.front();
+        size_t part = std::min(chunk.size, size - taken);
+        if (!chunk.text.empty() && data != nullptr) {
+            std::memcpy(data + taken, chunk.text.data(), std::min(part, chunk.text.size()));
+            chunk.text.erase(0, std::min(part, chunk.text.size()));
+        }
+        chunk.size -= part;
+        taken += part;
+        if (chunk.size == 0) {
+            entry.receive_queue.pop_front();
+        }
+    }
+    entry.received -= taken;
+
+    // Окно отправителя открывается, когда обновление окна дойдет до него
+    int peer = entry.peer;
+    after(links_[entry.link].spec.latency_us, [this, peer, taken] {
+        sockets_[peer].in_flight -= taken;
+        pump(peer);
+    });
+    return static_cast<ssize_t>(taken);
+}
+
+void SimNetwork::send(int socket, size_t size, const std::string& text) {
+    Socket& entry = sockets_[socket];
+    if (size == 0 || entry.fin_requested) {
+        return;
+    }
+    entry.send_queue.push_back(Chunk{size, text});
+    entry.send_queued += size;
+    pump(socket);
+}
+
+void SimNetwork::shutdown(int socket) {
+    sockets_[socket].fin_requested = true;
+    pump(socket);
+}
+
+size_t SimNetwork::readable(int socket) const {
+    return sockets_[socket].received;
+}
+
+bool SimNetwork::eof(int socket) const {
+    const Socket& entry = sockets_[socket];
+    return entry.eof && entry.receive_queue.empty();
+}
+
+bool SimNetwork::writable(int socket) const {
+    return !blocked(sockets_[socket]);
+}
+
+size_t SimNetwork::queued(int socket) const {
+    const Socket& entry = sockets_[socket];
+    return entry.send_queued + entry.unacked + entry.received;
+}
+
+void SimNetwork::on_readable(int socket, std::function<void()> callback) {
+    sockets_[socket].readable_callback = std::move(callback);
+}
+
+void SimNetwork::on_writable(int socket, std::function<void()> callback) {
+    sockets_[socket].writable_callback = std::move(callback);
+}
+
+void SimNetwork::pump(int socket) {
+    Socket& entry = sockets_[socket];
+    const Socket& peer = sockets_[entry.peer];
+    int peer_id = entry.peer;
+
+    while (!entry.send_queue.empty() && entry.in_flight < peer.receive_capacity) {
+        Chunk& chunk = entry.send_queue.front();
+        size_t bytes = std::min({chunk.size, SEGMENT, peer.receive_capacity - entry.in_flight});
+        std::string text;
+        if (!chunk.text.empty()) {
+            text = chunk.text.substr(0, bytes);
+            chunk.text.erase(0, text.size());
+        }
+        chunk.size -= bytes;
+        if (chunk.size == 0) {
+            entry.send_queue.pop_front();
+        }
+        entry.send_queued -= bytes;
+        entry.unacked += bytes;
+        entry.in_flight += bytes;
+
+        int64_t arrival = transmit(entry, bytes);
+        int64_t ack = arrival + links_[peer.link].spec.latency_us;
+        at(arrival, [this, peer_id, bytes, text] {
+            Socket& receiver = sockets_[peer_id];
+            receiver.receive_queue.push_back(Chunk{bytes, text});
+            receiver.received += bytes;
+            notify(peer_id, true);
+        });
+        at(ack, [this, socket, bytes] {
+            Socket& sender = sockets_[socket];
+            bool was_blocked = blocked(sender);
+            sender.unacked -= bytes;
+            if (was_blocked && !blocked(sender)) {
+                notify(socket, false);
+            }
+        });
+    }
+
+    if (entry.send_queue.empty() && entry.fin_requested && !entry.fin_sent) {
+        entry.fin_sent = true;
+        at(transmit(entry, 0), [this, peer_id] {
+            sockets_[peer_id].eof = true;
+            notify(peer_id, true);
+        });
+    }
+}
+
+int64_t SimNetwork::transmit(Socket& socket, size_t bytes) {
+    Link& link = links_[socket.link];
+    const LinkSpec& spec = link.spec;
+
+    // Сегменты одного канала передаются по очереди
+    int64_t depart = std::max(now_, link.free_at);
+    int64_t duration = static_cast<int64_t>(static_cast<double>(bytes) * 8e6 / spec.bandwidth_bps);
+    link.free_at = depart + duration;
+
+    int64_t delay = spec.latency_us;
+    if (spec.jitter_us > 0) {
+        delay += std::uniform_int_distribution<int64_t>(-spec.jitter_us, spec.jitter_us)(random_);
+    }
+    int64_t arrival = depart + duration + std::max<int64_t>(0, delay);
+
+    // Потерянный сегмент доходит повтором после таймаута; последующие
+    // сегменты ждут его. Доставка строго позже предыдущего сегмента:
+    // одновременные события идут в порядке seed и могли бы обогнать его
+    if (bytes > 0 && spec.loss > 0 && std::uniform_real_distribution<double>(0, 1)(random_) < spec.loss) {
+        arrival += std::max(MIN_RTO_US, 4 * spec.latency_us);
+    }
+    arrival = std::max(arrival, socket.last_arrival + 1);
+    socket.last_arrival = arrival;
+    return arrival;
+}
+
+void SimNetwork::notify(int socket, bool readable) {
+    // Уведомление - отдельное событие: одновременные пробуждения разных
+    // соединений упорядочиваются по seed, а не по глубине вызовов
+    after(0, [this, socket, readable] {
+        Socket& entry = sockets_[socket];
+        std::function<void()> callback = readable ? entry.readable_callback : entry.writable_callback;
+        if (callback) {
+            callback();
+        }
+    });
+}
@@ -0,0 +1,139 @@
+#ifndef SIM_NETWORK_H
+#define SIM_NETWORK_H
+
+// Детерминированный симулятор сети в одном потоке: виртуальное время,
+// каналы с пропускной способностью, задержкой, разбросом задержки и
+// потерями, TCP-подобные соединения с буферами сокетов и окном получателя.
+// Одновременные события упорядочиваются по seed, поэтому прогон с тем же
+// seed повторяется байт в байт. Данные по соединениям не копируются -
+// передаются только объемы, кроме явно переданного текста (рукопожатия).
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct LinkSpec {
+    double bandwidth_bps{1e9};
+    int64_t latency_us{0};    // Задержка в одну сторону
+    int64_t jitter_us{0};     // Равномерный разброс +-jitter_us
+    double loss{0};           // Доля сегментов, доставленных только повтором
+};
+
+class SimNetwork {
+public:
+    static constexpr size_t SEGMENT = 16 * 1024;    // Сегмент (как при GSO)
+    static constexpr int64_t MIN_RTO_US = 200000;   // Минимальный таймаут повтора TCP
+
+    explicit SimNetwork(uint64_t seed);
+
+    int64_t now() const { return now_; }
+    uint64_t events() const { return events_; }
+
+    // Планирование действия на момент time (мкс виртуального времени)
+    void at(int64_t time, std::function<void()> action);
+    void after(int64_t delay, std::function<void()> action) { at(now_ + delay, std::move(action)); }
+    // Выполнение событий до опустошения очереди или до deadline
+    void run(int64_t deadline = INT64_MAX);
+
+    std::mt19937_64& random() { return random_; }
+
+    // Канал в одну сторону; несколько соединений через один канал делят
+    // его пропускную способность в порядке очереди
+    int add_link(const LinkSpec& spec);
+
+    // Соединение: first отправляет через link_forward, second - через
+    // link_backward. Возвращает номера двух сокетов
+    std::pair<int, int> connect(int link_forward, int link_backward, size_t send_buffer, size_t receive_buffer);
+
+    // Сокеты. send принимает все байты (как блокирующая отправка), но пока
+    // writable() == false, отправитель считается заблокированным в send.
+    // text - содержимое для получателя, иначе передается только объем.
+    ssize_t recv(int socket, char* data, size_t size);
+    void send(int socket, size_t size, const std::string& text = std::string());
+    void shutdown(int socket);  // FIN после уже отправленных данных
+    size_t readable(int socket) const;
+    bool eof(int socket) const;
+    bool writable(int socket) const;
+    size_t queued(int socket) const;  // Байты в буферах сокета: неотправленные, неподтвержденные и непрочитанные
+
+    // Уведомления о новых данных (или FIN) и об освобождении буфера отправки
+    void on_readable(int socket, std::function<void()> callback);
+    void on_writable(int socket, std::function<void()> callback);
+
+private:
+    struct Event {
+        int64_t time;
+        uint64_t order;       // Порядок одновременных событий - по seed
+        uint64_t sequence;
+        std::function<void()> action;
+    };
+    struct Later {
+        bool operator()(const Event& a, const Event& b) const {
+            if (a.time != b.time) return a.time > b.time;
+            if (a.order != b.order) return a.order > b.order;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    struct Link {
+        LinkSpec spec;
+        int64_t free_at{0};   // Когда канал освободится от уже переданных сегментов
+    };
+
+    struct Chunk {
+        size_t size;
+        std::string text;
+    };
+
+    struct Socket {
+        int peer{-1};
+        int link{-1};
+        size_t send_capacity{0};
+        size_t receive_capacity{0};
+        std::deque<Chunk> send_queue;
+        size_t send_queued{0};         // Еще не отправлено в канал
+        size_t unacked{0};             // В канале, без подтверждения - занимает буфер отправки
+        size_t in_flight{0};           // Не прочитано получателем - занимает его окно
+        std::deque<Chunk> receive_queue;
+        size_t received{0};
+        int64_t last_arrival{0};       // Доставка в порядке отправки
+        bool fin_requested{false};
+        bool fin_sent{false};
+        bool eof{false};
+        std::function<void()> readable_callback;
+        std::function<void()> writable_callback;
+    };
+
+    int64_t now_{0};
+    uint64_t events_{0};
+    uint64_t sequence_{0};
+    std::mt19937_64 random_;
+    std::priority_queue<Event, std::vector<Event>, Later> queue_;
+    std::vector<Link> links_;
+    std::deque<Socket> sockets_;   // Ссылки на элементы не меняются при добавлении
+
+    bool blocked(const Socket& socket) const { return socket.send_queued + socket.unacked > socket.send_capacity; }
+    void pump(int socket);
+    int64_t transmit(Socket& socket, size_t bytes);
+    void notify(int socket, bool readable);
+};
+
+// Операции с сокетами для relay_step поверх симулятора
+struct SimSocketOps {
+    SimNetwork& network;
+
+    ssize_t recv(int socket, char* data, size_t size) { return network.recv(socket, data, size); }
+    bool send(int socket, const char*, size_t size) {
+        network.send(socket, size);
+        return true;
+    }
+};
+
+#endif // SIM_NETWORK_H
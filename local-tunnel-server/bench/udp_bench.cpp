@@ -0,0 +1,293 @@
+// Пропускная способность UDP ретранслятора в датаграммах в секунду: клиенты
+// открывают SOCKS5 UDP ASSOCIATE через работающий сервер и гоняют датаграммы
+// к локальному UDP эхо-серверу, держа в полете не больше окна датаграмм.
+// Для сравнения тот же замер выполняется напрямую к эхо-серверу.
+//
+// Использование: udp-bench [хост:порт_прокси] [длительность_с] [размер] [окно] [клиентов]
+//
+// Сервер должен быть запущен с udp.enabled и без authentication.enabled.
+// Код возврата 1, если через ретранслятор не вернулось ни одной датаграммы.
+
+#include "socks5.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t BATCH = 64;
+
+// Эхо-сервер: пачками принимает датаграммы и отправляет их обратно
+class UdpEcho {
+public:
+    bool start() {
+        fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        int buffer = 4 * 1024 * 1024;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+        setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+        timeval timeout{0, 100000};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (fd_ < 0 || bind(fd_, reinterpret_cast<sockaddr*>(&address), length) < 0 ||
+            getsockname(fd_, reinterpret_cast<sockaddr*>(&address_), &length) < 0) {
+            return false;
+        }
+        running_.store(true);
+        thread_ = std::thread(&UdpEcho::loop, this);
+        return true;
+    }
+
+    void stop() {
+        running_.store(false);
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        close(fd_);
+    }
+
+    const sockaddr_in& address() const { return address_; }
+
+private:
+    void loop() {
+        std::vector<char> buffers(BATCH * 2048);
+        std::vector<mmsghdr> messages(BATCH);
+        std::vector<iovec> iovecs(BATCH);
+        std::vector<sockaddr_storage> sources(BATCH);
+        while (running_.load()) {
+            for (size_t i = 0; i < BATCH; ++i) {
+                iovecs[i] = {buffers.data() + i * 2048, 2048};
+                std::memset(&messages[i].msg_hdr, 0, sizeof(msghdr));
+                messages[i].msg_hdr.msg_name = &sources[i];
+                messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+                messages[i].msg_hdr.msg_iov = &iovecs[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            int received = recvmmsg(fd_, messages.data(), BATCH, MSG_WAITFORONE, nullptr);
+            if (received <= 0) {
+                continue;
+            }
+            for (int i = 0; i < received; ++i) {
+                iovecs[i].iov_len = messages[i].msg_len;
+            }
+            sendmmsg(fd_, messages.data(), static_cast<unsigned int>(received), 0);
+        }
+    }
+
+    int fd_{-1};
+    sockaddr_in address_{};
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+};
+
+struct Totals {
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> received{0};
+};
+
+bool exchange(int fd, const std::string& request, size_t reply_size, std::string& reply) {
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        return false;
+    }
+    reply.resize(reply_size);
+    size_t total = 0;
+    while (total < reply_size) {
+        ssize_t received = recv(fd, &reply[total], reply_size - total, 0);
+        if (received <= 0) {
+            return false;
+        }
+        total += static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// UDP ASSOCIATE: возвращает управляющее соединение и адрес ретранслятора
+int associate(const sockaddr_in& proxy, sockaddr_in& relay) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&proxy), sizeof(proxy)) < 0) {
+        close(fd);
+        return -1;
+    }
+    std::string greeting("\x05\x01\x00", 3);
+    std::string request("\x05\x03\x00", 3);
+    request += Socks5::encode_address(nullptr);
+    std::string reply;
+    // Ответ на запрос с IPv4 адресом - 10 байт
+    if (!exchange(fd, greeting + request, 2 + 10, reply) ||
+        reply[1] != Socks5::NO_AUTH || reply[3] != Socks5::SUCCEEDED || reply[5] != Socks5::IPV4) {
+        close(fd);
+        return -1;
+    }
+    relay = sockaddr_in{};
+    relay.sin_family = AF_INET;
+    std::memcpy(&relay.sin_addr, &reply[6], 4);
+    std::memcpy(&relay.sin_port, &reply[10], 2);
+    return fd;
+}
+
+// Один клиент: держит в полете до window датаграмм, пока не истечет время
+void run_client(const sockaddr_in& destination, const std::string& datagram, size_t window,
+                Clock::time_point deadline, Totals& totals) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int buffer = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&destination), sizeof(destination)) < 0) {
+        close(fd);
+        return;
+    }
+
+    std::vector<mmsghdr> out(BATCH);
+    std::vector<iovec> out_iovecs(BATCH, iovec{const_cast<char*>(datagram.data()), datagram.size()});
+    for (size_t i = 0; i < BATCH; ++i) {
+        std::memset(&out[i].msg_hdr, 0, sizeof(msghdr));
+        out[i].msg_hdr.msg_iov = &out_iovecs[i];
+        out[i].msg_hdr.msg_iovlen = 1;
+    }
+    std::vector<char> buffers(BATCH * 2048);
+    std::vector<mmsghdr> in(BATCH);
+    std::vector<iovec> in_iovecs(BATCH);
+
+    size_t in_flight = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    while (Clock::now() < deadline) {
+        size_t room = std::min(window - in_flight, BATCH);
+        if (room > 0) {
+            int count = sendmmsg(fd, out.data(), static_cast<unsigned int>(room), 0);
+            if (count > 0) {
+                in_flight += static_cast<size_t>(count);
+                sent += static_cast<uint64_t>(count);
+            }
+        }
+
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, 50) <= 0) {
+            in_flight = 0;  // Окно потеряно - начинаем заново
+            continue;
+        }
+        for (size_t i = 0; i < BATCH; ++i) {
+            in_iovecs[i] = {buffers.data() + i * 2048, 2048};
+            std::memset(&in[i].msg_hdr, 0, sizeof(msghdr));
+            in[i].msg_hdr.msg_iov = &in_iovecs[i];
+            in[i].msg_hdr.msg_iovlen = 1;
+        }
+        int count = recvmmsg(fd, in.data(), BATCH, MSG_DONTWAIT, nullptr);
+        if (count > 0) {
+            received += static_cast<uint64_t>(count);
+            in_flight -= std::min(in_flight, static_cast<size_t>(count));
+        }
+    }
+    totals.sent += sent;
+    totals.received += received;
+    close(fd);
+}
+
+struct Result {
+    uint64_t sent;
+    uint64_t received;
+};
+
+Result measure(const std::vector<sockaddr_in>& destinations, const std::string& datagram,
+               size_t window, int seconds) {
+    Totals totals;
+    auto deadline = Clock::now() + std::chrono::seconds(seconds);
+    std::vector<std::thread> threads;
+    for (const sockaddr_in& destination : destinations) {
+        threads.emplace_back(run_client, std::cref(destination), std::cref(datagram), window,
+                             deadline, std::ref(totals));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return Result{totals.sent.load(), totals.received.load()};
+}
+
+void report(const std::string& title, const Result& result, size_t payload, int seconds) {
+    double pps = static_cast<double>(result.received) / seconds;
+    double loss = result.sent ? 100.0 * (1.0 - static_cast<double>(result.received) / result.sent) : 0.0;
+    std::cout << std::fixed << std::setprecision(0) << std::setw(10) << pps << " датаграмм/с  "
+              << std::setprecision(1) << std::setw(8) << pps * payload * 8 / 1e6 << " Мбит/с  потери "
+              << std::setprecision(2) << std::setw(5) << loss << "%  " << title << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string proxy_address = argc > 1 ? argv[1] : "127.0.0.1:8080";
+    int seconds = argc > 2 ? std::stoi(argv[2]) : 5;
+    size_t payload = argc > 3 ? std::stoul(argv[3]) : 64;
+    size_t window = argc > 4 ? std::stoul(argv[4]) : 256;
+    int clients = argc > 5 ? std::stoi(argv[5]) : 1;
+    payload = std::max<size_t>(1, std::min<size_t>(payload, 2048 - 10));
+    window = std::max<size_t>(1, window);
+
+    std::string proxy_host;
+    int proxy_port = 0;
+    if (!Utils::parse_address(proxy_address, proxy_host, proxy_port)) {
+        std::cerr << "Некорректный адрес прокси: " << proxy_address << std::endl;
+        return 2;
+    }
+    sockaddr_in proxy{};
+    proxy.sin_family = AF_INET;
+    proxy.sin_port = htons(static_cast<uint16_t>(proxy_port));
+    inet_pton(AF_INET, proxy_host.c_str(), &proxy.sin_addr);
+
+    UdpEcho echo;
+    if (!echo.start()) {
+        std::cerr << "Не удалось запустить UDP эхо-сервер" << std::endl;
+        return 2;
+    }
+
+    // Датаграмма для ретранслятора - с заголовком SOCKS5 адреса эхо-сервера
+    std::string body(payload, 'x');
+    uint8_t header[22];
+    size_t header_size = Socks5::write_udp_header(header, reinterpret_cast<const sockaddr*>(&echo.address()));
+    std::string relayed(reinterpret_cast<const char*>(header), header_size);
+    relayed += body;
+
+    std::vector<int> controls;
+    std::vector<sockaddr_in> relays;
+    for (int i = 0; i < clients; ++i) {
+        sockaddr_in relay{};
+        int control = associate(proxy, relay);
+        if (control < 0) {
+            std::cerr << "Не удалось открыть UDP ассоциацию через " << proxy_address << std::endl;
+            for (int fd : controls) {
+                close(fd);
+            }
+            echo.stop();
+            return 2;
+        }
+        controls.push_back(control);
+        relays.push_back(relay);
+    }
+
+    std::cout << "Датаграмма " << payload << " байт, окно " << window << ", клиентов " << clients
+              << ", " << seconds << " с" << std::endl;
+    Result direct = measure(std::vector<sockaddr_in>(clients, echo.address()), body, window, seconds);
+    report("напрямую", direct, payload, seconds);
+    Result relayed_result = measure(relays, relayed, window, seconds);
+    report("через прокси", relayed_result, payload, seconds);
+
+    for (int fd : controls) {
+        close(fd);
+    }
+    echo.stop();
+    return relayed_result.received > 0 ? 0 : 1;
+}
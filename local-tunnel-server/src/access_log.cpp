@@ -0,0 +1,457 @@
+#include "access_log.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+
+namespace {
+
+// Двоичные поля записываются в порядке little-endian независимо от платформы
+void put_u8(std::string& out, uint8_t value) {
+    out.push_back(static_cast<char>(value));
+}
+
+void put_u16(std::string& out, uint16_t value) {
+    for (int i = 0; i < 2; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+void put_u32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+void put_u64(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+uint64_t get_le(const char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Размер записи без строк и поля длины
+constexpr size_t FIXED_SIZE = 8 + 8 + 4 + 4 + 4 + 8 + 8 + 2 + 2 + 1 + 1 + 1 + 2;
+constexpr size_t MAX_RECORD_SIZE = FIXED_SIZE + 255 + 65535;
+
+void append_json_string(std::string& out, const std::string& value) {
+    out.push_back('"');
+    for (unsigned char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out.push_back(static_cast<char>(c));
+                }
+        }
+    }
+    out.push_back('"');
+}
+
+}  // namespace
+
+constexpr char AccessLog::MAGIC[8];
+
+AccessLog::AccessLog() {
+}
+
+AccessLog::~AccessLog() {
+    stop();
+}
+
+void AccessLog::configure(const Config& config) {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    Format format = config.get_access_log_format() == "binary" ? Format::BINARY : Format::JSON;
+    std::string path = config.get_access_log_file();
+
+    // Смена файла или формата - новый файл при следующей записи
+    if (path != path_ || format != format_.load()) {
+        reopen_requested_ = true;
+    }
+    path_ = path;
+    format_.store(format);
+    max_size_ = static_cast<uint64_t>(std::max(0, config.get_access_log_max_size_mb())) * 1024 * 1024;
+    rotate_seconds_ = std::max(0, config.get_access_log_rotate_seconds());
+    flush_ms_ = std::max(10, config.get_access_log_flush_ms());
+    max_pending_ = static_cast<size_t>(std::max(64, config.get_access_log_buffer_kb())) * 1024;
+    enabled_.store(config.is_access_log_enabled() && !path_.empty());
+}
+
+bool AccessLog::start() {
+    if (running_.load()) {
+        return true;
+    }
+    running_.store(true);
+    thread_ = std::make_unique<std::thread>(&AccessLog::loop, this);
+    return true;
+}
+
+void AccessLog::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        running_.store(false);
+    }
+    queue_cv_.notify_all();
+    if (thread_ && thread_->joinable()) {
+        thread_->join();  // Поток дописывает очередь перед выходом
+    }
+    thread_.reset();
+}
+
+void AccessLog::write(const AccessRecord& record) {
+    static MetricValue& records = Metrics::counter("access_log_records_total");
+    static MetricValue& dropped = Metrics::counter("access_log_dropped_total");
+
+    if (!enabled() || !running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Кодирование выполняется в потоке обработчика, под блокировкой - только вставка
+    std::string encoded = format_.load(std::memory_order_relaxed) == Format::BINARY
+        ? encode_binary(record)
+        : encode_json(record);
+
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (pending_bytes_ + encoded.size() > max_pending_) {
+            dropped.add();
+            return;
+        }
+        pending_bytes_ += encoded.size();
+        pending_.push_back(std::move(encoded));
+        wake = pending_.size() >= BATCH_RECORDS;
+    }
+    records.add();
+    if (wake) {
+        queue_cv_.notify_one();
+    }
+}
+
+void AccessLog::loop() {
+    std::vector<std::string> batch;
+
+    while (true) {
+        int flush_ms;
+        {
+            std::lock_guard<std::mutex> lock(settings_mutex_);
+            flush_ms = flush_ms_;
+        }
+
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait_for(lock, std::chrono::milliseconds(flush_ms), [this] {
+                return !running_.load() || pending_.size() >= BATCH_RECORDS;
+            });
+            stopping = !running_.load();
+            batch.swap(pending_);
+            pending_bytes_ = 0;
+        }
+
+        flush(batch);
+        batch.clear();
+
+        if (stopping) {
+            break;
+        }
+    }
+    close_file();
+}
+
+void AccessLog::flush(std::vector<std::string>& batch) {
+    static MetricValue& errors = Metrics::counter("access_log_write_errors_total");
+
+    bool reopen;
+    uint64_t max_size;
+    int rotate_seconds;
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex_);
+        reopen = reopen_requested_;
+        reopen_requested_ = false;
+        max_size = max_size_;
+        rotate_seconds = rotate_seconds_;
+    }
+
+    if (reopen && fd_ >= 0) {
+        // Файл другого формата не дописывается - он уходит в ротацию
+        if (open_format_ != format_.load() && file_size_ > 0) {
+            rotate();
+        } else {
+            close_file();
+        }
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    size_t batch_bytes = 0;
+    for (const auto& record : batch) {
+        batch_bytes += record.size();
+    }
+
+    // Ротация до записи: пачка целиком попадает в один файл.
+    // Файл из одного заголовка не ротируется.
+    size_t header_size = open_format_ == Format::BINARY ? sizeof(MAGIC) : 0;
+    if (fd_ >= 0 && file_size_ > header_size) {
+        bool by_size = max_size > 0 && file_size_ + batch_bytes > max_size;
+        bool by_time = rotate_seconds > 0 &&
+                       Clock::now() - opened_at_ >= std::chrono::seconds(rotate_seconds);
+        if (by_size || by_time) {
+            rotate();
+        }
+    }
+    if (fd_ < 0 && !open_file()) {
+        errors.add();
+        return;
+    }
+
+    // Записи уходят в файл пачками по IOV_MAX за один системный вызов
+    std::vector<iovec> iov;
+    iov.reserve(std::min<size_t>(batch.size(), IOV_MAX));
+    size_t index = 0;
+    size_t offset = 0;  // Уже записанная часть batch[index]
+    while (index < batch.size()) {
+        iov.clear();
+        for (size_t i = index; i < batch.size() && iov.size() < IOV_MAX; ++i) {
+            size_t skip = (i == index) ? offset : 0;
+            iov.push_back(iovec{const_cast<char*>(batch[i].data()) + skip, batch[i].size() - skip});
+        }
+
+        ssize_t written = writev(fd_, iov.data(), static_cast<int>(iov.size()));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errors.add();
+            Logger::error("Ошибка записи журнала доступа: " + std::string(strerror(errno)));
+            close_file();
+            return;
+        }
+        file_size_ += static_cast<uint64_t>(written);
+
+        // Частичная запись: продвигаемся на записанное число байт
+        size_t remaining = static_cast<size_t>(written);
+        while (index < batch.size() && remaining >= batch[index].size() - offset) {
+            remaining -= batch[index].size() - offset;
+            offset = 0;
+            ++index;
+        }
+        offset += remaining;
+    }
+}
+
+bool AccessLog::open_file() {
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex_);
+        open_path_ = path_;
+    }
+    open_format_ = format_.load();
+    if (open_path_.empty()) {
+        return false;
+    }
+
+    fd_ = open(open_path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        Logger::error("Не удалось открыть журнал доступа " + open_path_ + ": " + strerror(errno));
+        return false;
+    }
+
+    struct stat info{};
+    fstat(fd_, &info);
+    file_size_ = static_cast<uint64_t>(info.st_size);
+    opened_at_ = Clock::now();
+
+    // Существующий файл другого формата не дописывается
+    if (file_size_ > 0) {
+        char header[sizeof(MAGIC)] = {};
+        int reader = open(open_path_.c_str(), O_RDONLY | O_CLOEXEC);
+        bool is_binary = reader >= 0 &&
+                         read(reader, header, sizeof(header)) == static_cast<ssize_t>(sizeof(header)) &&
+                         std::memcmp(header, MAGIC, sizeof(MAGIC)) == 0;
+        if (reader >= 0) {
+            close(reader);
+        }
+        if (is_binary != (open_format_ == Format::BINARY)) {
+            rotate();
+            return fd_ >= 0;
+        }
+    }
+
+    if (file_size_ == 0 && open_format_ == Format::BINARY) {
+        if (::write(fd_, MAGIC, sizeof(MAGIC)) == static_cast<ssize_t>(sizeof(MAGIC))) {
+            file_size_ = sizeof(MAGIC);
+        }
+    }
+    return true;
+}
+
+void AccessLog::close_file() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    file_size_ = 0;
+}
+
+void AccessLog::rotate() {
+    static MetricValue& rotations = Metrics::counter("access_log_rotations_total");
+
+    std::string path = open_path_;
+    close_file();
+
+    // Имя с временем ротации; при совпадении добавляется номер
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    std::string rotated = path + "." + stamp;
+    struct stat info{};
+    for (int suffix = 1; stat(rotated.c_str(), &info) == 0; ++suffix) {
+        rotated = path + "." + stamp + "-" + std::to_string(suffix);
+    }
+    if (std::rename(path.c_str(), rotated.c_str()) != 0) {
+        Logger::error("Не удалось выполнить ротацию журнала доступа " + path + ": " + strerror(errno));
+        return;  // Следующая пачка повторит попытку
+    }
+    rotations.add();
+    Logger::info("Журнал доступа сохранен как " + rotated);
+    open_file();
+}
+
+std::string AccessLog::encode_json(const AccessRecord& record) {
+    std::string out;
+    out.reserve(256);
+    out += "{\"ts\":" + std::to_string(record.start_unix_ms);
+    out += ",\"id\":" + std::to_string(record.connection_id);
+    out += ",\"client\":";
+    append_json_string(out, record.client_ip);
+    out += ",\"client_port\":" + std::to_string(record.client_port);
+    out += ",\"target\":";
+    append_json_string(out, record.target_host);
+    out += ",\"target_port\":" + std::to_string(record.target_port);
+    out += ",\"protocol\":\"" + std::string(protocol_name(record.protocol)) + "\"";
+    out += ",\"resolve_us\":" + std::to_string(record.resolve_us);
+    out += ",\"connect_us\":" + std::to_string(record.connect_us);
+    out += ",\"bytes_from_client\":" + std::to_string(record.bytes_from_client);
+    out += ",\"bytes_from_target\":" + std::to_string(record.bytes_from_target);
+    out += ",\"duration_ms\":" + std::to_string(record.duration_ms);
+    out += ",\"reason\":\"" + std::string(reason_name(record.reason)) + "\"}\n";
+    return out;
+}
+
+std::string AccessLog::encode_binary(const AccessRecord& record) {
+    std::string ip = record.client_ip.substr(0, 255);
+    std::string host = record.target_host.substr(0, 65535);
+
+    std::string out;
+    out.reserve(4 + FIXED_SIZE + ip.size() + host.size());
+    put_u32(out, static_cast<uint32_t>(FIXED_SIZE + ip.size() + host.size()));
+    put_u64(out, record.connection_id);
+    put_u64(out, record.start_unix_ms);
+    put_u32(out, record.duration_ms);
+    put_u32(out, record.resolve_us);
+    put_u32(out, record.connect_us);
+    put_u64(out, record.bytes_from_client);
+    put_u64(out, record.bytes_from_target);
+    put_u16(out, record.client_port);
+    put_u16(out, record.target_port);
+    put_u8(out, static_cast<uint8_t>(record.protocol));
+    put_u8(out, static_cast<uint8_t>(record.reason));
+    put_u8(out, static_cast<uint8_t>(ip.size()));
+    out += ip;
+    put_u16(out, static_cast<uint16_t>(host.size()));
+    out += host;
+    return out;
+}
+
+size_t AccessLog::decode_binary(const char* data, size_t size, AccessRecord& record) {
+    if (size < 4) {
+        return 0;
+    }
+    size_t length = static_cast<size_t>(get_le(data, 4));
+    if (length < FIXED_SIZE || length > MAX_RECORD_SIZE || size < 4 + length) {
+        return 0;
+    }
+
+    const char* p = data + 4;
+    record.connection_id = get_le(p, 8); p += 8;
+    record.start_unix_ms = get_le(p, 8); p += 8;
+    record.duration_ms = static_cast<uint32_t>(get_le(p, 4)); p += 4;
+    record.resolve_us = static_cast<uint32_t>(get_le(p, 4)); p += 4;
+    record.connect_us = static_cast<uint32_t>(get_le(p, 4)); p += 4;
+    record.bytes_from_client = get_le(p, 8); p += 8;
+    record.bytes_from_target = get_le(p, 8); p += 8;
+    record.client_port = static_cast<uint16_t>(get_le(p, 2)); p += 2;
+    record.target_port = static_cast<uint16_t>(get_le(p, 2)); p += 2;
+    record.protocol = static_cast<AccessProtocol>(get_le(p, 1)); p += 1;
+    record.reason = static_cast<CloseReason>(get_le(p, 1)); p += 1;
+
+    size_t ip_length = static_cast<size_t>(get_le(p, 1)); p += 1;
+    if (FIXED_SIZE + ip_length > length) {
+        return 0;
+    }
+    record.client_ip.assign(p, ip_length); p += ip_length;
+    size_t host_length = static_cast<size_t>(get_le(p, 2)); p += 2;
+    if (FIXED_SIZE + ip_length + host_length != length) {
+        return 0;
+    }
+    record.target_host.assign(p, host_length);
+    return 4 + length;
+}
+
+const char* AccessLog::protocol_name(AccessProtocol protocol) {
+    switch (protocol) {
+        case AccessProtocol::UNKNOWN: return "unknown";
+        case AccessProtocol::CONNECT: return "connect";
+        case AccessProtocol::HTTP: return "http";
+        case AccessProtocol::BINARY: return "binary";
+        case AccessProtocol::SOCKS5: return "socks5";
+        case AccessProtocol::SOCKS5_UDP: return "socks5-udp";
+    }
+    return "unknown";
+}
+
+const char* AccessLog::reason_name(CloseReason reason) {
+    switch (reason) {
+        case CloseReason::CLIENT_CLOSED: return "client_closed";
+        case CloseReason::TARGET_CLOSED: return "target_closed";
+        case CloseReason::BAD_REQUEST: return "bad_request";
+        case CloseReason::DENIED: return "denied";
+        case CloseReason::REJECTED: return "rejected";
+        case CloseReason::CONNECT_FAILED: return "connect_failed";
+        case CloseReason::IO_ERROR: return "io_error";
+        case CloseReason::NO_MEMORY: return "no_memory";
+        case CloseReason::SHUTDOWN: return "shutdown";
+        case CloseReason::CACHE_HIT: return "cache_hit";
+        case CloseReason::DETACHED: return "detached";
+        case CloseReason::AUTH_FAILED: return "auth_failed";
+    }
+    return "unknown";
+}
@@ -0,0 +1,129 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+class Config;
+
+// Протокол, которым клиент запросил туннель
+enum class AccessProtocol : uint8_t {
+    UNKNOWN = 0,
+    CONNECT = 1,
+    HTTP = 2,
+    BINARY = 3,
+    SOCKS5 = 4,
+    SOCKS5_UDP = 5
+};
+
+// Причина закрытия туннеля
+enum class CloseReason : uint8_t {
+    CLIENT_CLOSED = 0,   // Клиент закрыл соединение
+    TARGET_CLOSED = 1,   // Цель закрыла соединение
+    BAD_REQUEST = 2,     // Запрос не разобран или заголовки не дочитаны
+    DENIED = 3,          // Запрещено политикой доступа
+    REJECTED = 4,        // Отклонено автоматом отключения
+    CONNECT_FAILED = 5,  // Не удалось подключиться к цели
+    IO_ERROR = 6,        // Ошибка чтения или отправки
+    NO_MEMORY = 7,       // Превышена квота памяти
+    SHUTDOWN = 8,        // Остановка сервера
+    CACHE_HIT = 9,       // Ответ отдан из кэша HTTP без подключения к цели
+    DETACHED = 10,       // Клиент отключился, цель ждет возобновления сессии
+    AUTH_FAILED = 11     // Нет учетных данных или они неверны
+};
+
+// Одна запись журнала доступа на туннель
+struct AccessRecord {
+    uint64_t connection_id{0};
+    uint64_t start_unix_ms{0};
+    uint32_t duration_ms{0};
+    uint32_t resolve_us{0};
+    uint32_t connect_us{0};
+    uint64_t bytes_from_client{0};
+    uint64_t bytes_from_target{0};
+    std::string client_ip;
+    uint16_t client_port{0};
+    std::string target_host;
+    uint16_t target_port{0};
+    AccessProtocol protocol{AccessProtocol::UNKNOWN};
+    CloseReason reason{CloseReason::CLIENT_CLOSED};
+};
+
+// Журнал доступа: одна компактная запись на туннель в формате JSON lines
+// или в двоичном формате. Обработчики только кодируют запись и кладут ее
+// в очередь; отдельный поток пишет накопленные записи одним writev() и
+// выполняет ротацию по размеру и времени. При переполнении очереди записи
+// отбрасываются (access_log_dropped_total), а не задерживают обработчики.
+class AccessLog {
+public:
+    enum class Format { JSON, BINARY };
+
+    // Заголовок двоичного файла
+    static constexpr char MAGIC[8] = {'C', 'V', 'P', 'N', 'A', 'C', 'C', '1'};
+
+    AccessLog();
+    ~AccessLog();
+
+    void configure(const Config& config);
+    bool start();
+    void stop();
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    void write(const AccessRecord& record);
+
+    // Кодирование и разбор записей (используется утилитой просмотра)
+    static std::string encode_json(const AccessRecord& record);
+    static std::string encode_binary(const AccessRecord& record);
+    // Возвращает длину разобранной записи или 0, если данных не хватает
+    // либо запись повреждена
+    static size_t decode_binary(const char* data, size_t size, AccessRecord& record);
+
+    static const char* protocol_name(AccessProtocol protocol);
+    static const char* reason_name(CloseReason reason);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Настройки (меняются при перезагрузке)
+    std::atomic<bool> enabled_{false};
+    std::atomic<Format> format_{Format::JSON};
+    std::mutex settings_mutex_;
+    std::string path_;
+    uint64_t max_size_{0};
+    int rotate_seconds_{0};
+    int flush_ms_{1000};
+    size_t max_pending_{0};
+    bool reopen_requested_{false};
+
+    // Очередь закодированных записей
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::vector<std::string> pending_;
+    size_t pending_bytes_{0};
+
+    // Состояние потока записи
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> thread_;
+    int fd_{-1};
+    std::string open_path_;
+    Format open_format_{Format::JSON};
+    uint64_t file_size_{0};
+    Clock::time_point opened_at_{};
+
+    static constexpr size_t BATCH_RECORDS = 256;
+
+    void loop();
+    void flush(std::vector<std::string>& batch);
+    bool open_file();
+    void close_file();
+    void rotate();
+};
+
+#endif // ACCESS_LOG_H
@@ -0,0 +1,676 @@
+#include "access_policy.h"
+#include "logger.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+PrefixKey mask_key(const PrefixKey& key, int length) {
+    PrefixKey masked;
+    if (length <= 0) {
+        return masked;
+    }
+    if (length <= 64) {
+        masked.hi = key.hi & (~0ULL << (64 - length));
+        return masked;
+    }
+    masked.hi = key.hi;
+    masked.lo = length >= 128 ? key.lo : key.lo & (~0ULL << (128 - length));
+    return masked;
+}
+
+int common_prefix(const PrefixKey& a, const PrefixKey& b) {
+    uint64_t diff = a.hi ^ b.hi;
+    if (diff != 0) {
+        return __builtin_clzll(diff);
+    }
+    diff = a.lo ^ b.lo;
+    if (diff != 0) {
+        return 64 + __builtin_clzll(diff);
+    }
+    return 128;
+}
+
+// Доменные имена - ASCII, локаль для приведения регистра не нужна
+inline unsigned char ascii_lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c | 0x20) : c;
+}
+
+// FNV-1a по метке в нижнем регистре
+uint64_t hash_label(const char* label, size_t length) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= ascii_lower(static_cast<unsigned char>(label[i]));
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool label_equals(const char* stored, const char* label, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (static_cast<unsigned char>(stored[i]) != ascii_lower(static_cast<unsigned char>(label[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool is_valid_domain(const std::string& domain) {
+    if (domain.empty() || domain.size() > 253) {
+        return false;
+    }
+    for (char c : domain) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '.' && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// PrefixTrie
+// ---------------------------------------------------------------------------
+
+uint32_t PrefixTrie::make_node(const PrefixKey& key, int length, int rule) {
+    Node node;
+    node.key = mask_key(key, length);
+    node.length = static_cast<uint8_t>(length);
+    node.rule = rule;
+    nodes_.push_back(node);
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+void PrefixTrie::insert(const PrefixKey& raw_key, int length, int rule) {
+    // Корень - всегда пустой префикс нулевой длины
+    if (nodes_.empty()) {
+        make_node(PrefixKey{}, 0, -1);
+    }
+
+    PrefixKey key = mask_key(raw_key, length);
+    uint32_t current = 0;
+
+    while (true) {
+        if (nodes_[current].length == length) {
+            nodes_[current].rule = rule;  // Повторное правило перекрывает предыдущее
+            return;
+        }
+
+        int branch = key.bit(nodes_[current].length);
+        uint32_t child = nodes_[current].child[branch];
+        if (child == NONE) {
+            uint32_t leaf = make_node(key, length, rule);
+            nodes_[current].child[branch] = leaf;
+            return;
+        }
+
+        int child_length = nodes_[child].length;
+        int common = std::min(common_prefix(nodes_[child].key, key), std::min(child_length, length));
+        if (common == child_length) {
+            current = child;
+            continue;
+        }
+
+        // Разделение ребра: новый префикс короче дочернего или расходится с ним
+        if (common == length) {
+            uint32_t middle = make_node(key, length, rule);
+            nodes_[middle].child[nodes_[child].key.bit(length)] = child;
+            nodes_[current].child[branch] = middle;
+            return;
+        }
+
+        uint32_t middle = make_node(key, common, -1);
+        uint32_t leaf = make_node(key, length, rule);
+        nodes_[middle].child[key.bit(common)] = leaf;
+        nodes_[middle].child[nodes_[child].key.bit(common)] = child;
+        nodes_[current].child[branch] = middle;
+        return;
+    }
+}
+
+void PrefixTrie::relayout(uint32_t index, std::vector<Node>& out) {
+    uint32_t position = static_cast<uint32_t>(out.size());
+    out.push_back(nodes_[index]);
+    for (int branch = 0; branch < 2; ++branch) {
+        uint32_t child = nodes_[index].child[branch];
+        if (child != NONE) {
+            out[position].child[branch] = static_cast<uint32_t>(out.size());
+            relayout(child, out);
+        }
+    }
+}
+
+void PrefixTrie::compile() {
+    if (nodes_.empty()) {
+        return;
+    }
+    // Перекладываем узлы в порядке обхода в глубину: левый потомок
+    // оказывается сразу за родителем в той же кэш-линии или соседней
+    std::vector<Node> ordered;
+    ordered.reserve(nodes_.size());
+    relayout(0, ordered);
+    nodes_.swap(ordered);
+
+    jump_.clear();
+    if (nodes_.size() >= JUMP_MIN_NODES) {
+        build_jump_table();
+    }
+}
+
+void PrefixTrie::build_jump_table() {
+    jump_.resize(size_t(1) << JUMP_BITS);
+    for (size_t prefix = 0; prefix < jump_.size(); ++prefix) {
+        PrefixKey key;
+        key.hi = static_cast<uint64_t>(prefix) << (64 - JUMP_BITS);
+
+        uint32_t current = 0;
+        int best = -1;
+        while (current != NONE) {
+            const Node& node = nodes_[current];
+            // Узлы длиннее таблицы (и узел ровно на границе, потомка которого
+            // выбирает следующий бит адреса) проверяются уже при поиске
+            if (node.length >= JUMP_BITS) {
+                break;
+            }
+            if (node.length > 0 && common_prefix(node.key, key) < node.length) {
+                current = NONE;
+                break;
+            }
+            if (node.rule >= 0) {
+                best = node.rule;
+            }
+            current = node.child[key.bit(node.length)];
+        }
+        jump_[prefix] = JumpEntry{current, best};
+    }
+}
+
+int PrefixTrie::walk(uint32_t current, int best, const PrefixKey& key) const {
+    while (current != NONE) {
+        const Node& node = nodes_[current];
+        if (node.length > 0 && common_prefix(node.key, key) < node.length) {
+            break;
+        }
+        if (node.rule >= 0) {
+            best = node.rule;
+        }
+        if (node.length >= 128) {
+            break;
+        }
+        current = node.child[key.bit(node.length)];
+    }
+    return best;
+}
+
+int PrefixTrie::lookup(const PrefixKey& key) const {
+    if (nodes_.empty()) {
+        return -1;
+    }
+    if (!jump_.empty()) {
+        const JumpEntry& entry = jump_[key.hi >> (64 - JUMP_BITS)];
+        return walk(entry.node, entry.rule, key);
+    }
+    return walk(0, -1, key);
+}
+
+// ---------------------------------------------------------------------------
+// DomainTrie
+// ---------------------------------------------------------------------------
+
+DomainTrie::DomainTrie() {
+    nodes_.emplace_back();
+}
+
+uint32_t DomainTrie::find_or_add_child(uint32_t node, const std::string& label) {
+    std::string index_key = std::to_string(node) + '\0' + label;
+    auto it = build_index_.find(index_key);
+    if (it != build_index_.end()) {
+        return it->second;
+    }
+
+    uint32_t child = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+    build_edges_.push_back(BuildEdge{node, hash_label(label.data(), label.size()), label, child});
+    build_index_.emplace(std::move(index_key), child);
+    return child;
+}
+
+void DomainTrie::insert(const std::string& domain, bool exact, int rule) {
+    uint32_t current = 0;
+    size_t end = domain.size();
+    while (end > 0) {
+        size_t dot = domain.rfind('.', end - 1);
+        size_t start = (dot == std::string::npos) ? 0 : dot + 1;
+        if (end > start) {
+            std::string label = domain.substr(start, end - start);
+            std::transform(label.begin(), label.end(), label.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            current = find_or_add_child(current, label);
+        }
+        if (dot == std::string::npos) {
+            break;
+        }
+        end = dot;
+    }
+
+    if (exact) {
+        nodes_[current].exact_rule = rule;
+    } else {
+        nodes_[current].suffix_rule = rule;
+    }
+}
+
+uint64_t DomainTrie::edge_slot(uint32_t parent, uint64_t label_hash) {
+    uint64_t x = label_hash ^ (static_cast<uint64_t>(parent) * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 29;
+    return x;
+}
+
+void DomainTrie::compile() {
+    // Нумерация узлов в порядке обхода в ширину - верхние уровни дерева
+    // (зоны первого и второго уровня) оказываются компактно в начале массива
+    std::vector<std::vector<uint32_t>> children(nodes_.size());
+    for (uint32_t i = 0; i < build_edges_.size(); ++i) {
+        children[build_edges_[i].parent].push_back(i);
+    }
+
+    std::vector<uint32_t> new_index(nodes_.size(), 0);
+    std::vector<uint32_t> order;
+    order.reserve(nodes_.size());
+    order.push_back(0);
+    for (size_t head = 0; head < order.size(); ++head) {
+        for (uint32_t edge : children[order[head]]) {
+            new_index[build_edges_[edge].child] = static_cast<uint32_t>(order.size());
+            order.push_back(build_edges_[edge].child);
+        }
+    }
+
+    std::vector<Node> nodes(nodes_.size());
+    for (uint32_t position = 0; position < order.size(); ++position) {
+        nodes[position] = nodes_[order[position]];
+    }
+    nodes_.swap(nodes);
+
+    // Хеш-таблица ребер с заполнением не более 50%
+    size_t capacity = 16;
+    while (capacity < build_edges_.size() * 2) {
+        capacity <<= 1;
+    }
+    edges_.assign(capacity, Edge{});
+    edge_mask_ = capacity - 1;
+    labels_.clear();
+
+    for (uint32_t position = 0; position < order.size(); ++position) {
+        for (uint32_t edge_index : children[order[position]]) {
+            const BuildEdge& edge = build_edges_[edge_index];
+            size_t slot = edge_slot(position, edge.hash) & edge_mask_;
+            while (edges_[slot].child != NONE) {
+                slot = (slot + 1) & edge_mask_;
+            }
+            edges_[slot] = Edge{edge.hash, position, new_index[edge.child],
+                                static_cast<uint32_t>(labels_.size()),
+                                static_cast<uint32_t>(edge.label.size())};
+            labels_ += edge.label;
+        }
+    }
+
+    build_edges_.clear();
+    build_edges_.shrink_to_fit();
+    build_index_.clear();
+    labels_.shrink_to_fit();
+}
+
+uint32_t DomainTrie::find_child(uint32_t node, uint64_t hash, const char* label, size_t length) const {
+    if (edges_.empty()) {
+        return NONE;
+    }
+    size_t slot = edge_slot(node, hash) & edge_mask_;
+    while (true) {
+        const Edge& edge = edges_[slot];
+        if (edge.child == NONE) {
+            return NONE;
+        }
+        if (edge.parent == node && edge.hash == hash && edge.label_length == length &&
+            label_equals(labels_.data() + edge.label_offset, label, length)) {
+            return edge.child;
+        }
+        slot = (slot + 1) & edge_mask_;
+    }
+}
+
+int DomainTrie::lookup(const std::string& host) const {
+    size_t end = host.size();
+    while (end > 0 && host[end - 1] == '.') {
+        --end;
+    }
+
+    uint32_t current = 0;
+    int best = nodes_[0].suffix_rule;
+    while (end > 0) {
+        size_t dot = host.rfind('.', end - 1);
+        size_t start = (dot == std::string::npos) ? 0 : dot + 1;
+        size_t length = end - start;
+
+        uint32_t child = find_child(current, hash_label(host.data() + start, length),
+                                    host.data() + start, length);
+        if (child == NONE) {
+            return best;
+        }
+        current = child;
+        if (nodes_[current].suffix_rule >= 0) {
+            best = nodes_[current].suffix_rule;
+        }
+        if (dot == std::string::npos) {
+            break;
+        }
+        end = dot;
+    }
+
+    // Имя разобрано полностью - точное правило важнее суффиксного
+    return nodes_[current].exact_rule >= 0 ? nodes_[current].exact_rule : best;
+}
+
+size_t DomainTrie::memory_usage() const {
+    return nodes_.capacity() * sizeof(Node) + edges_.capacity() * sizeof(Edge) + labels_.capacity();
+}
+
+// ---------------------------------------------------------------------------
+// CompiledPolicy
+// ---------------------------------------------------------------------------
+
+CompiledPolicy::CompiledPolicy(PolicyAction default_action, const std::string& default_upstream)
+    : default_action_(default_action), default_upstream_(default_upstream) {
+}
+
+bool CompiledPolicy::add_rule(const std::string& line, std::string& error) {
+    std::istringstream iss(line);
+    std::string action_text, pattern;
+    if (!(iss >> action_text >> pattern)) {
+        error = "ожидается '<действие> <шаблон>'";
+        return false;
+    }
+
+    PolicyRule rule;
+    rule.text = Utils::trim(line);
+    if (!AccessPolicy::parse_action(action_text, rule.action, rule.upstream)) {
+        error = "неизвестное действие '" + action_text + "'";
+        return false;
+    }
+
+    int index = static_cast<int>(rules_.size());
+
+    // CIDR или одиночный адрес
+    size_t slash = pattern.find('/');
+    PrefixKey key;
+    bool is_ipv6 = false;
+    if (AccessPolicy::parse_ip(pattern.substr(0, slash), key, is_ipv6)) {
+        int max_length = is_ipv6 ? 128 : 32;
+        int length = max_length;
+        if (slash != std::string::npos) {
+            try {
+                length = std::stoi(pattern.substr(slash + 1));
+            } catch (const std::exception&) {
+                length = -1;
+            }
+            if (length < 0 || length > max_length) {
+                error = "неверная длина префикса в '" + pattern + "'";
+                return false;
+            }
+        }
+        (is_ipv6 ? ipv6_ : ipv4_).insert(key, length, index);
+        ++prefix_rules_;
+        rules_.push_back(std::move(rule));
+        return true;
+    }
+    if (slash != std::string::npos) {
+        error = "неверный CIDR '" + pattern + "'";
+        return false;
+    }
+
+    // Доменное имя
+    bool exact = false;
+    if (pattern[0] == '=') {
+        exact = true;
+        pattern.erase(0, 1);
+    } else if (pattern.compare(0, 2, "*.") == 0) {
+        pattern.erase(0, 2);
+    } else if (pattern[0] == '.') {
+        pattern.erase(0, 1);
+    }
+    if (!is_valid_domain(pattern)) {
+        error = "неверное доменное имя '" + pattern + "'";
+        return false;
+    }
+
+    domains_.insert(pattern, exact, index);
+    rules_.push_back(std::move(rule));
+    return true;
+}
+
+void CompiledPolicy::compile() {
+    ipv4_.compile();
+    ipv6_.compile();
+    domains_.compile();
+    rules_.shrink_to_fit();
+}
+
+PolicyDecision CompiledPolicy::make_decision(int rule) const {
+    PolicyDecision decision;
+    if (rule < 0) {
+        decision.action = default_action_;
+        decision.upstream = default_upstream_;
+        return decision;
+    }
+    decision.action = rules_[rule].action;
+    decision.upstream = rules_[rule].upstream;
+    decision.matched = true;
+    decision.rule_index = rule;
+    return decision;
+}
+
+PolicyDecision CompiledPolicy::evaluate(const std::string& host) const {
+    // IP литерал начинается с цифры (IPv4), скобки или содержит ':' (IPv6) -
+    // для обычных имен разбор адреса не выполняется
+    bool maybe_ip = !host.empty() &&
+                    (std::isdigit(static_cast<unsigned char>(host[0])) || host[0] == '[' ||
+                     host.find(':') != std::string::npos);
+    if (maybe_ip) {
+        PrefixKey key;
+        bool is_ipv6 = false;
+        bool parsed = (host.size() > 2 && host.front() == '[' && host.back() == ']')
+                          ? AccessPolicy::parse_ip(host.substr(1, host.size() - 2), key, is_ipv6)
+                          : AccessPolicy::parse_ip(host, key, is_ipv6);
+        if (parsed) {
+            return make_decision((is_ipv6 ? ipv6_ : ipv4_).lookup(key));
+        }
+    }
+    return make_decision(domains_.lookup(host));
+}
+
+PolicyDecision CompiledPolicy::evaluate_address(const sockaddr* addr) const {
+    PrefixKey key;
+    if (addr->sa_family == AF_INET) {
+        const sockaddr_in* v4 = reinterpret_cast<const sockaddr_in*>(addr);
+        key.hi = static_cast<uint64_t>(ntohl(v4->sin_addr.s_addr)) << 32;
+        return make_decision(ipv4_.lookup(key));
+    }
+    if (addr->sa_family == AF_INET6) {
+        const sockaddr_in6* v6 = reinterpret_cast<const sockaddr_in6*>(addr);
+        const uint8_t* bytes = v6->sin6_addr.s6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr)) {
+            uint32_t v4 = (static_cast<uint32_t>(bytes[12]) << 24) | (static_cast<uint32_t>(bytes[13]) << 16) |
+                          (static_cast<uint32_t>(bytes[14]) << 8) | bytes[15];
+            key.hi = static_cast<uint64_t>(v4) << 32;
+            return make_decision(ipv4_.lookup(key));
+        }
+        for (int i = 0; i < 8; ++i) {
+            key.hi = (key.hi << 8) | bytes[i];
+            key.lo = (key.lo << 8) | bytes[i + 8];
+        }
+        return make_decision(ipv6_.lookup(key));
+    }
+    return make_decision(-1);
+}
+
+size_t CompiledPolicy::memory_usage() const {
+    return ipv4_.memory_usage() + ipv6_.memory_usage() + domains_.memory_usage() +
+           rules_.capacity() * sizeof(PolicyRule);
+}
+
+// ---------------------------------------------------------------------------
+// AccessPolicy
+// ---------------------------------------------------------------------------
+
+AccessPolicy::AccessPolicy()
+    : policy_(std::make_shared<CompiledPolicy>(PolicyAction::ALLOW, "")) {
+}
+
+bool AccessPolicy::load(const Config& config) {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+
+    PolicyAction default_action;
+    std::string default_upstream;
+    if (!parse_action(config.get_acl_default_action(), default_action, default_upstream)) {
+        Logger::error("Неизвестное действие политики по умолчанию: " + config.get_acl_default_action());
+        return false;
+    }
+
+    auto policy = std::make_shared<CompiledPolicy>(default_action, default_upstream);
+    size_t rejected = 0;
+
+    auto add_line = [&](const std::string& raw, const std::string& source) {
+        std::string line = Utils::trim(raw);
+        if (line.empty() || line[0] == '#') {
+            return;
+        }
+        std::string error;
+        if (!policy->add_rule(line, error)) {
+            ++rejected;
+            Logger::warning("Пропущено правило политики (" + source + "): " + error);
+        }
+    };
+
+    for (const auto& rule : config.get_acl_rules()) {
+        add_line(rule, "config");
+    }
+
+    std::string rules_file = config.get_acl_rules_file();
+    if (!rules_file.empty()) {
+        std::ifstream file(rules_file);
+        if (!file.is_open()) {
+            Logger::error("Не удалось открыть файл правил политики: " + rules_file +
+                          ", сохраняется текущая политика");
+            return false;
+        }
+        std::string line;
+        int line_number = 0;
+        while (std::getline(file, line)) {
+            ++line_number;
+            add_line(line, rules_file + ":" + std::to_string(line_number));
+        }
+    }
+
+    policy->compile();
+
+    size_t rule_count = policy->rule_count();
+    size_t memory = policy->memory_usage();
+    std::atomic_store(&policy_, std::shared_ptr<const CompiledPolicy>(std::move(policy)));
+
+    Logger::info("Политика доступа загружена: правил " + std::to_string(rule_count) +
+                 ", пропущено " + std::to_string(rejected) +
+                 ", память " + Utils::format_bytes(memory));
+    return true;
+}
+
+std::shared_ptr<const CompiledPolicy> AccessPolicy::current() const {
+    return std::atomic_load(&policy_);
+}
+
+bool AccessPolicy::parse_action(const std::string& text, PolicyAction& action, std::string& upstream) {
+    upstream.clear();
+    if (text == "allow") {
+        action = PolicyAction::ALLOW;
+    } else if (text == "deny") {
+        action = PolicyAction::DENY;
+    } else if (text == "bypass") {
+        action = PolicyAction::BYPASS;
+    } else if (text.compare(0, 9, "upstream:") == 0 && text.size() > 9) {
+        action = PolicyAction::UPSTREAM;
+        upstream = text.substr(9);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string AccessPolicy::action_to_string(PolicyAction action) {
+    switch (action) {
+        case PolicyAction::ALLOW: return "allow";
+        case PolicyAction::DENY: return "deny";
+        case PolicyAction::BYPASS: return "bypass";
+        case PolicyAction::UPSTREAM: return "upstream";
+    }
+    return "allow";
+}
+
+bool AccessPolicy::parse_ip(const std::string& text, PrefixKey& key, bool& is_ipv6) {
+    // Быстрый разбор IPv4 в точечной нотации без обращения к inet_pton
+    uint32_t address = 0;
+    uint32_t octet = 0;
+    int digits = 0;
+    int dots = 0;
+    bool plain_ipv4 = !text.empty();
+    for (char c : text) {
+        if (c >= '0' && c <= '9') {
+            octet = octet * 10 + static_cast<uint32_t>(c - '0');
+            if (++digits > 3 || octet > 255) {
+                plain_ipv4 = false;
+                break;
+            }
+        } else if (c == '.' && digits > 0 && dots < 3) {
+            address = (address << 8) | octet;
+            octet = 0;
+            digits = 0;
+            ++dots;
+        } else {
+            plain_ipv4 = false;
+            break;
+        }
+    }
+    if (plain_ipv4 && dots == 3 && digits > 0) {
+        key.hi = static_cast<uint64_t>((address << 8) | octet) << 32;
+        key.lo = 0;
+        is_ipv6 = false;
+        return true;
+    }
+
+    in_addr v4;
+    if (inet_pton(AF_INET, text.c_str(), &v4) == 1) {
+        key.hi = static_cast<uint64_t>(ntohl(v4.s_addr)) << 32;
+        key.lo = 0;
+        is_ipv6 = false;
+        return true;
+    }
+
+    in6_addr v6;
+    if (inet_pton(AF_INET6, text.c_str(), &v6) == 1) {
+        key.hi = 0;
+        key.lo = 0;
+        for (int i = 0; i < 8; ++i) {
+            key.hi = (key.hi << 8) | v6.s6_addr[i];
+            key.lo = (key.lo << 8) | v6.s6_addr[i + 8];
+        }
+        is_ipv6 = true;
+        return true;
+    }
+    return false;
+}
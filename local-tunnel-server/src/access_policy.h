@@ -0,0 +1,195 @@
+#ifndef ACCESS_POLICY_H
+#define ACCESS_POLICY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <sys/socket.h>
+#include "config.h"
+
+// Действие политики для целевого адреса
+enum class PolicyAction : uint8_t {
+    ALLOW = 0,     // Разрешить прямое подключение
+    DENY = 1,      // Запретить подключение
+    BYPASS = 2,    // Подключаться напрямую, минуя вышестоящие прокси
+    UPSTREAM = 3   // Подключаться через указанный вышестоящий прокси
+};
+
+// Результат проверки политики
+struct PolicyDecision {
+    PolicyAction action{PolicyAction::ALLOW};
+    bool matched{false};        // true - сработало явное правило, false - действие по умолчанию
+    int rule_index{-1};         // Индекс правила в скомпилированной политике
+    std::string upstream;       // Имя вышестоящего прокси для UPSTREAM
+};
+
+// Разобранное правило политики (исходный текст сохраняется для логов)
+struct PolicyRule {
+    PolicyAction action{PolicyAction::ALLOW};
+    std::string upstream;
+    std::string text;
+};
+
+// 128-битный ключ для IPv4 (в старших 32 битах) и IPv6 адресов
+struct PrefixKey {
+    uint64_t hi{0};
+    uint64_t lo{0};
+
+    int bit(int index) const {
+        return index < 64 ? static_cast<int>((hi >> (63 - index)) & 1)
+                          : static_cast<int>((lo >> (127 - index)) & 1);
+    }
+};
+
+// Radix-дерево префиксов со сжатием путей. Узлы лежат в одном плоском
+// массиве в порядке обхода в глубину, дочерние узлы адресуются индексами.
+// Для больших деревьев строится таблица прямого перехода по первым 16 битам
+// адреса, после чего поиск проходит лишь несколько оставшихся узлов.
+class PrefixTrie {
+public:
+    void insert(const PrefixKey& key, int length, int rule);
+    void compile();
+    int lookup(const PrefixKey& key) const;
+
+    size_t node_count() const { return nodes_.size(); }
+    size_t memory_usage() const {
+        return nodes_.capacity() * sizeof(Node) + jump_.capacity() * sizeof(JumpEntry);
+    }
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+    static constexpr int JUMP_BITS = 16;
+    static constexpr size_t JUMP_MIN_NODES = 4096;
+
+    struct Node {
+        PrefixKey key;
+        uint32_t child[2]{NONE, NONE};
+        int32_t rule{-1};
+        uint8_t length{0};
+    };
+
+    // Состояние поиска после первых JUMP_BITS бит адреса
+    struct JumpEntry {
+        uint32_t node;
+        int32_t rule;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<JumpEntry> jump_;
+
+    uint32_t make_node(const PrefixKey& key, int length, int rule);
+    void relayout(uint32_t index, std::vector<Node>& out);
+    void build_jump_table();
+    int walk(uint32_t current, int best, const PrefixKey& key) const;
+};
+
+// Дерево доменных суффиксов по меткам в обратном порядке
+// ("www.example.com" -> "com" -> "example" -> "www").
+// Ребра всех узлов хранятся в одной хеш-таблице с открытой адресацией
+// по ключу (родитель, хеш метки), так что переход по метке стоит
+// одну-две выборки независимо от числа соседей.
+class DomainTrie {
+public:
+    DomainTrie();
+
+    void insert(const std::string& domain, bool exact, int rule);
+    void compile();
+    int lookup(const std::string& host) const;
+
+    size_t node_count() const { return nodes_.size(); }
+    size_t memory_usage() const;
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    struct Node {
+        int32_t suffix_rule{-1};
+        int32_t exact_rule{-1};
+    };
+
+    struct Edge {
+        uint64_t hash;
+        uint32_t parent;
+        uint32_t child{NONE};
+        uint32_t label_offset;
+        uint32_t label_length;
+    };
+
+    // Ребра на этапе построения
+    struct BuildEdge {
+        uint32_t parent;
+        uint64_t hash;
+        std::string label;
+        uint32_t child;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<Edge> edges_;
+    size_t edge_mask_{0};
+    std::vector<BuildEdge> build_edges_;
+    std::unordered_map<std::string, uint32_t> build_index_;
+    std::string labels_;
+
+    static uint64_t edge_slot(uint32_t parent, uint64_t label_hash);
+    uint32_t find_child(uint32_t node, uint64_t hash, const char* label, size_t length) const;
+    uint32_t find_or_add_child(uint32_t node, const std::string& label);
+};
+
+// Неизменяемая скомпилированная политика
+class CompiledPolicy {
+public:
+    CompiledPolicy(PolicyAction default_action, const std::string& default_upstream);
+
+    // Добавление правила вида "<действие> <шаблон>", где действие -
+    // allow, deny, bypass или upstream:<имя>, а шаблон - CIDR, IP адрес,
+    // доменный суффикс (".example.com", "*.example.com", "example.com")
+    // или точное имя ("=example.com")
+    bool add_rule(const std::string& line, std::string& error);
+    void compile();
+
+    // Проверка по имени хоста или IP литералу
+    PolicyDecision evaluate(const std::string& host) const;
+
+    // Проверка по разрешенному адресу (только CIDR правила)
+    PolicyDecision evaluate_address(const sockaddr* addr) const;
+
+    size_t rule_count() const { return rules_.size(); }
+    size_t memory_usage() const;
+    const PolicyRule& rule(int index) const { return rules_[index]; }
+    bool has_prefix_rules() const { return prefix_rules_ > 0; }
+
+private:
+    PolicyAction default_action_;
+    std::string default_upstream_;
+    std::vector<PolicyRule> rules_;
+    size_t prefix_rules_{0};
+
+    PrefixTrie ipv4_;
+    PrefixTrie ipv6_;
+    DomainTrie domains_;
+
+    PolicyDecision make_decision(int rule) const;
+};
+
+// Точка доступа к актуальной политике. Обработчики берут снимок через
+// current(), перезагрузка собирает новую политику и атомарно подменяет указатель.
+class AccessPolicy {
+public:
+    AccessPolicy();
+
+    bool load(const Config& config);
+    std::shared_ptr<const CompiledPolicy> current() const;
+
+    static bool parse_action(const std::string& text, PolicyAction& action, std::string& upstream);
+    static std::string action_to_string(PolicyAction action);
+    static bool parse_ip(const std::string& text, PrefixKey& key, bool& is_ipv6);
+
+private:
+    std::shared_ptr<const CompiledPolicy> policy_;
+    std::mutex load_mutex_;
+};
+
+#endif // ACCESS_POLICY_H
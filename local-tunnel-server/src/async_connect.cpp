@@ -0,0 +1,204 @@
+#include "async_connect.h"
+#include "utils.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+AsyncConnect::State::~State() {
+    if (socket >= 0) {
+        close(socket);
+    }
+}
+
+AsyncConnect::AsyncConnect(Resolver& resolver, const std::string& host, int port,
+                           int timeout_ms, AddressFilter filter)
+    : resolver_(resolver), host_(host), port_(port), timeout_ms_(timeout_ms),
+      filter_(std::move(filter)), state_(std::make_shared<State>()) {
+}
+
+AsyncConnect::~AsyncConnect() {
+    // Незавершенное подключение закроет последний владелец состояния
+}
+
+void AsyncConnect::begin_connect(State& state, size_t index) {
+    state.address_index = index;
+    state.connect_started = Clock::now();
+    if (state.connect_deadline == Clock::time_point{}) {
+        state.connect_deadline = state.connect_started + std::chrono::milliseconds(state.timeout_ms);
+    }
+    state.connect_errno = 0;
+
+    const sockaddr_storage& address = state.result.addresses[index];
+    int fd = socket(address.ss_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        state.connect_errno = errno;
+        return;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&address), state.result.lengths[index]) < 0 &&
+        errno != EINPROGRESS) {
+        state.connect_errno = errno;
+        close(fd);
+        return;
+    }
+    state.socket = fd;
+}
+
+void AsyncConnect::start() {
+    started_ = Clock::now();
+
+    std::shared_ptr<State> state = state_;
+    state->timeout_ms = timeout_ms_;
+    AddressFilter filter = filter_;
+    resolver_.resolve_async(host_, port_, [state, filter](const ResolveResult& result) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->result = result;
+        state->resolved_at = Clock::now();
+        if (result.ok()) {
+            // Запрещенные политикой адреса пропускаются; подключение
+            // запрещено, только если запрещены все
+            state->denied = true;
+            for (size_t index = 0; index < result.addresses.size(); ++index) {
+                if (!filter || filter(reinterpret_cast<const sockaddr*>(&result.addresses[index]))) {
+                    state->denied = false;
+                    begin_connect(*state, index);
+                    break;
+                }
+            }
+        }
+        state->done = true;
+        state->cv.notify_all();
+    });
+}
+
+bool AsyncConnect::wait_connected(int socket, int timeout_ms, int& error) {
+    pollfd pfd{};
+    pfd.fd = socket;
+    pfd.events = POLLOUT;
+
+    int ready;
+    do {
+        ready = poll(&pfd, 1, std::max(0, timeout_ms));
+    } while (ready < 0 && errno == EINTR);
+
+    if (ready == 0) {
+        error = ETIMEDOUT;
+        return false;
+    }
+    if (ready < 0) {
+        error = errno;
+        return false;
+    }
+
+    socklen_t length = sizeof(error);
+    if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        error = errno;
+        return false;
+    }
+    return error == 0;
+}
+
+AsyncConnect::Status AsyncConnect::finish(int& socket, std::string& error) {
+    socket = -1;
+    Clock::time_point resolve_deadline = started_ + std::chrono::milliseconds(timeout_ms_);
+
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    if (!state_->cv.wait_until(lock, resolve_deadline, [this] { return state_->done; })) {
+        error = "таймаут разрешения имени";
+        return Status::TIMEOUT;
+    }
+    State& state = *state_;
+
+    if (!state.result.ok()) {
+        error = std::string("ошибка DNS резолва: ") + gai_strerror(state.result.error);
+        return Status::RESOLVE_FAILED;
+    }
+    if (state.denied) {
+        error = "адрес запрещен политикой";
+        return Status::DENIED;
+    }
+
+    // Первый разрешенный адрес подключается заранее, остальные - по очереди
+    // при неудаче. Таймаут подключения отсчитывается от первого connect(),
+    // а не от начала обработки: чтение заголовков его не расходует
+    size_t count = state.result.addresses.size();
+    for (size_t index = state.address_index; index < count; ++index) {
+        if (index != state.address_index) {
+            if (filter_ && !filter_(reinterpret_cast<const sockaddr*>(&state.result.addresses[index]))) {
+                continue;
+            }
+            begin_connect(state, index);
+        }
+        if (state.socket < 0) {
+            error = strerror(state.connect_errno);
+            continue;
+        }
+
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            state.connect_deadline - Clock::now()).count());
+        Clock::time_point wait_start = Clock::now();
+        int connect_error = 0;
+        if (!wait_connected(state.socket, remaining, connect_error)) {
+            close(state.socket);
+            state.socket = -1;
+            error = strerror(connect_error);
+            if (connect_error == ETIMEDOUT) {
+                return Status::TIMEOUT;
+            }
+            continue;
+        }
+
+        // Если подключение завершилось, пока дочитывались заголовки, точное
+        // время неизвестно - его оценивает RTT рукопожатия из TCP_INFO
+        Clock::time_point now = Clock::now();
+        connect_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - state.connect_started).count();
+        if (now - wait_start < std::chrono::microseconds(100)) {
+            tcp_info info{};
+            socklen_t length = sizeof(info);
+            if (getsockopt(state.socket, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 && info.tcpi_rtt > 0) {
+                connect_us_ = std::min<int64_t>(connect_us_, info.tcpi_rtt);
+            }
+        }
+
+        int flags = fcntl(state.socket, F_GETFL, 0);
+        fcntl(state.socket, F_SETFL, flags & ~O_NONBLOCK);
+        socket = state.socket;
+        state.socket = -1;
+        return Status::CONNECTED;
+    }
+
+    return Status::CONNECT_FAILED;
+}
+
+std::string AsyncConnect::address() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (!state_->done || state_->result.addresses.empty()) {
+        return "";
+    }
+    return Utils::address_to_string(reinterpret_cast<const sockaddr*>(
+        &state_->result.addresses[state_->address_index]));
+}
+
+int64_t AsyncConnect::resolve_us() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (!state_->done) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(state_->resolved_at - started_).count();
+}
+
+bool AsyncConnect::resolved_from_cache() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->done && state_->result.from_cache;
+}
@@ -0,0 +1,82 @@
+#ifndef ASYNC_CONNECT_H
+#define ASYNC_CONNECT_H
+
+#include <string>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "resolver.h"
+
+// Подключение к цели, которое начинается заранее и завершается позже.
+// start() запускает разрешение имени; как только адрес известен, в том же
+// потоке резолвера выполняется неблокирующий connect(). Обработчик тем
+// временем дочитывает заголовки клиента и вызывает finish().
+class AsyncConnect {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Проверка адреса после разрешения имени; false - подключение запрещено
+    using AddressFilter = std::function<bool(const sockaddr*)>;
+
+    enum class Status {
+        CONNECTED,
+        RESOLVE_FAILED,
+        DENIED,
+        CONNECT_FAILED,
+        TIMEOUT
+    };
+
+    AsyncConnect(Resolver& resolver, const std::string& host, int port,
+                 int timeout_ms, AddressFilter filter);
+    ~AsyncConnect();
+
+    void start();
+
+    // Ожидает завершения подключения. При успехе socket - блокирующий
+    // подключенный сокет, владение переходит вызывающему.
+    Status finish(int& socket, std::string& error);
+
+    // Адрес, к которому выполнено (или запрещено) подключение
+    std::string address() const;
+
+    // Длительности этапов в микросекундах (для оценки выигрыша)
+    int64_t resolve_us() const;
+    int64_t connect_us() const { return connect_us_; }
+    Clock::time_point started() const { return started_; }
+    bool resolved_from_cache() const;
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done{false};
+        ResolveResult result;
+        bool denied{false};
+        size_t address_index{0};
+        int socket{-1};
+        int connect_errno{0};
+        Clock::time_point resolved_at{};
+        Clock::time_point connect_started{};
+        Clock::time_point connect_deadline{};
+        int timeout_ms{0};
+
+        ~State();
+    };
+
+    Resolver& resolver_;
+    std::string host_;
+    int port_;
+    int timeout_ms_;
+    AddressFilter filter_;
+    std::shared_ptr<State> state_;
+    Clock::time_point started_{};
+    int64_t connect_us_{0};
+
+    static void begin_connect(State& state, size_t index);
+    static bool wait_connected(int socket, int timeout_ms, int& error);
+};
+
+#endif // ASYNC_CONNECT_H
@@ -0,0 +1,512 @@
+#include "chacha20_poly1305.h"
+#include "uint128.h"
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHACHA20_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using ChaCha20Poly1305::Kernel;
+
+inline uint32_t load32(const uint8_t* in) {
+    uint32_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;  // little-endian
+}
+
+inline uint64_t load64(const uint8_t* in) {
+    uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+// Начальное состояние: константы, ключ, счетчик и nonce
+void init_state(uint32_t state[16], const uint8_t key[32], const uint8_t nonce[12], uint32_t counter) {
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; ++i) {
+        state[4 + i] = load32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; ++i) {
+        state[13 + i] = load32(nonce + 4 * i);
+    }
+}
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d = rotl(d ^ a, 16);  \
+    c += d; b = rotl(b ^ c, 12);  \
+    a += b; d = rotl(d ^ a, 8);   \
+    c += d; b = rotl(b ^ c, 7);
+
+void block(const uint32_t state[16], uint8_t out[64]) {
+    uint32_t x[16];
+    std::memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; ++i) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; ++i) {
+        uint32_t word = x[i] + state[i];
+        std::memcpy(out + 4 * i, &word, sizeof(word));
+    }
+}
+
+// Переносимое ядро: по блоку; используется и для хвоста векторных ядер
+void xor_scalar(uint32_t state[16], uint8_t* data, size_t size) {
+    uint8_t stream[64];
+    while (size > 0) {
+        block(state, stream);
+        ++state[12];
+        size_t part = size < 64 ? size : 64;
+        for (size_t i = 0; i < part; ++i) {
+            data[i] ^= stream[i];
+        }
+        data += part;
+        size -= part;
+    }
+}
+
+#ifdef CHACHA20_X86
+
+// Векторные ядра: в каждом регистре - одно слово состояния для 8 (16)
+// блоков подряд, после раундов регистры транспонируются в блоки потока.
+
+__attribute__((target("avx2")))
+inline __m256i rotl_avx2(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+}
+
+#define QUARTER_ROUND_AVX2(a, b, c, d)                                              \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+    c = _mm256_add_epi32(c, d); b = rotl_avx2(_mm256_xor_si256(b, c), 12);          \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);  \
+    c = _mm256_add_epi32(c, d); b = rotl_avx2(_mm256_xor_si256(b, c), 7);
+
+// Транспонирование 8 слов (v[0..7]) восьми блоков: out[j] - эти слова блока j
+__attribute__((target("avx2")))
+inline void transpose_avx2(const __m256i v[8], __m256i out[8]) {
+    __m256i t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(v[4], v[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(v[6], v[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(v[6], v[7]);
+
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    out[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    out[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    out[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    out[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    out[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    out[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    out[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    out[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+__attribute__((target("avx2")))
+void xor_avx2(uint32_t state[16], uint8_t* data, size_t size) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    while (size >= 512) {
+        __m256i input[16];
+        __m256i x[16];
+        for (int i = 0; i < 16; ++i) {
+            input[i] = _mm256_set1_epi32(static_cast<int>(state[i]));
+        }
+        input[12] = _mm256_add_epi32(input[12], lanes);
+        for (int i = 0; i < 16; ++i) {
+            x[i] = input[i];
+        }
+
+        for (int round = 0; round < 10; ++round) {
+            QUARTER_ROUND_AVX2(x[0], x[4], x[8], x[12]);
+            QUARTER_ROUND_AVX2(x[1], x[5], x[9], x[13]);
+            QUARTER_ROUND_AVX2(x[2], x[6], x[10], x[14]);
+            QUARTER_ROUND_AVX2(x[3], x[7], x[11], x[15]);
+            QUARTER_ROUND_AVX2(x[0], x[5], x[10], x[15]);
+            QUARTER_ROUND_AVX2(x[1], x[6], x[11], x[12]);
+            QUARTER_ROUND_AVX2(x[2], x[7], x[8], x[13]);
+            QUARTER_ROUND_AVX2(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i) {
+            x[i] = _mm256_add_epi32(x[i], input[i]);
+        }
+
+        __m256i low[8];
+        __m256i high[8];
+        transpose_avx2(x, low);
+        transpose_avx2(x + 8, high);
+        for (int j = 0; j < 8; ++j) {
+            __m256i* first = reinterpret_cast<__m256i*>(data + 64 * j);
+            __m256i* second = reinterpret_cast<__m256i*>(data + 64 * j + 32);
+            _mm256_storeu_si256(first, _mm256_xor_si256(_mm256_loadu_si256(first), low[j]));
+            _mm256_storeu_si256(second, _mm256_xor_si256(_mm256_loadu_si256(second), high[j]));
+        }
+
+        state[12] += 8;
+        data += 512;
+        size -= 512;
+    }
+    xor_scalar(state, data, size);
+}
+
+#define QUARTER_ROUND_AVX512(a, b, c, d)                                    \
+    a = _mm512_add_epi32(a, b); d = _mm512_rol_epi32(_mm512_xor_si512(d, a), 16); \
+    c = _mm512_add_epi32(c, d); b = _mm512_rol_epi32(_mm512_xor_si512(b, c), 12); \
+    a = _mm512_add_epi32(a, b); d = _mm512_rol_epi32(_mm512_xor_si512(d, a), 8);  \
+    c = _mm512_add_epi32(c, d); b = _mm512_rol_epi32(_mm512_xor_si512(b, c), 7);
+
+__attribute__((target("avx512f")))
+void xor_avx512(uint32_t state[16], uint8_t* data, size_t size) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    while (size >= 1024) {
+        __m512i input[16];
+        __m512i x[16];
+        for (int i = 0; i < 16; ++i) {
+            input[i] = _mm512_set1_epi32(static_cast<int>(state[i]));
+        }
+        input[12] = _mm512_add_epi32(input[12], lanes);
+        for (int i = 0; i < 16; ++i) {
+            x[i] = input[i];
+        }
+
+        for (int round = 0; round < 10; ++round) {
+            QUARTER_ROUND_AVX512(x[0], x[4], x[8], x[12]);
+            QUARTER_ROUND_AVX512(x[1], x[5], x[9], x[13]);
+            QUARTER_ROUND_AVX512(x[2], x[6], x[10], x[14]);
+            QUARTER_ROUND_AVX512(x[3], x[7], x[11], x[15]);
+            QUARTER_ROUND_AVX512(x[0], x[5], x[10], x[15]);
+            QUARTER_ROUND_AVX512(x[1], x[6], x[11], x[12]);
+            QUARTER_ROUND_AVX512(x[2], x[7], x[8], x[13]);
+            QUARTER_ROUND_AVX512(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i) {
+            x[i] = _mm512_add_epi32(x[i], input[i]);
+        }
+
+        // Для каждой четверки слов: после распаковки в 128-битной полосе L
+        // регистра rows[r] лежат эти слова блока 4L + r
+        __m512i rows[4][4];
+        for (int group = 0; group < 4; ++group) {
+            const __m512i* v = x + 4 * group;
+            __m512i t0 = _mm512_unpacklo_epi32(v[0], v[1]);
+            __m512i t1 = _mm512_unpackhi_epi32(v[0], v[1]);
+            __m512i t2 = _mm512_unpacklo_epi32(v[2], v[3]);
+            __m512i t3 = _mm512_unpackhi_epi32(v[2], v[3]);
+            rows[group][0] = _mm512_unpacklo_epi64(t0, t2);
+            rows[group][1] = _mm512_unpackhi_epi64(t0, t2);
+            rows[group][2] = _mm512_unpacklo_epi64(t1, t3);
+            rows[group][3] = _mm512_unpackhi_epi64(t1, t3);
+        }
+        for (int r = 0; r < 4; ++r) {
+            __m512i a = _mm512_shuffle_i32x4(rows[0][r], rows[1][r], 0x44);
+            __m512i b = _mm512_shuffle_i32x4(rows[0][r], rows[1][r], 0xee);
+            __m512i c = _mm512_shuffle_i32x4(rows[2][r], rows[3][r], 0x44);
+            __m512i d = _mm512_shuffle_i32x4(rows[2][r], rows[3][r], 0xee);
+            __m512i blocks[4] = {
+                _mm512_shuffle_i32x4(a, c, 0x88),
+                _mm512_shuffle_i32x4(a, c, 0xdd),
+                _mm512_shuffle_i32x4(b, d, 0x88),
+                _mm512_shuffle_i32x4(b, d, 0xdd)
+            };
+            for (int lane = 0; lane < 4; ++lane) {
+                uint8_t* out = data + 64 * (4 * lane + r);
+                _mm512_storeu_si512(out, _mm512_xor_si512(_mm512_loadu_si512(out), blocks[lane]));
+            }
+        }
+
+        state[12] += 16;
+        data += 1024;
+        size -= 1024;
+    }
+    xor_avx2(state, data, size);
+}
+
+#endif  // CHACHA20_X86
+
+Kernel detect_kernel() {
+#ifdef CHACHA20_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return Kernel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return Kernel::AVX2;
+    }
+#endif
+    return Kernel::SCALAR;
+}
+
+std::atomic<int> selected_kernel{-1};
+
+Kernel current_kernel() {
+    int value = selected_kernel.load(std::memory_order_relaxed);
+    if (value < 0) {
+        value = static_cast<int>(detect_kernel());
+        selected_kernel.store(value, std::memory_order_relaxed);
+    }
+    return static_cast<Kernel>(value);
+}
+
+// --- Poly1305: 130-битный аккумулятор в трех частях по 44 (42) бита ---
+
+constexpr uint64_t MASK44 = 0xfffffffffffULL;
+constexpr uint64_t MASK42 = 0x3ffffffffffULL;
+
+class Poly1305 {
+public:
+    explicit Poly1305(const uint8_t key[32]) {
+        uint64_t t0 = load64(key);
+        uint64_t t1 = load64(key + 8);
+        r_[0] = t0 & 0xffc0fffffffULL;
+        r_[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+        r_[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+        pad_[0] = load64(key + 16);
+        pad_[1] = load64(key + 24);
+    }
+
+    void update(const uint8_t* data, size_t size) {
+        if (used_ > 0) {
+            size_t part = size < 16 - used_ ? size : 16 - used_;
+            std::memcpy(buffer_ + used_, data, part);
+            used_ += part;
+            data += part;
+            size -= part;
+            if (used_ < 16) {
+                return;
+            }
+            blocks(buffer_, 16, 1ULL << 40);
+            used_ = 0;
+        }
+        size_t whole = size & ~static_cast<size_t>(15);
+        if (whole > 0) {
+            blocks(data, whole, 1ULL << 40);
+        }
+        std::memcpy(buffer_, data + whole, size - whole);
+        used_ = size - whole;
+    }
+
+    // Дополнение нулями до границы 16 байт (как требует AEAD)
+    void pad16() {
+        if (used_ > 0) {
+            std::memset(buffer_ + used_, 0, 16 - used_);
+            blocks(buffer_, 16, 1ULL << 40);
+            used_ = 0;
+        }
+    }
+
+    void finish(uint8_t tag[16]) {
+        if (used_ > 0) {
+            buffer_[used_] = 1;
+            std::memset(buffer_ + used_ + 1, 0, 15 - used_);
+            blocks(buffer_, 16, 0);
+            used_ = 0;
+        }
+
+        uint64_t h0 = h_[0], h1 = h_[1], h2 = h_[2];
+        uint64_t c;
+        c = h1 >> 44; h1 &= MASK44; h2 += c;
+        c = h2 >> 42; h2 &= MASK42; h0 += c * 5;
+        c = h0 >> 44; h0 &= MASK44; h1 += c;
+        c = h1 >> 44; h1 &= MASK44; h2 += c;
+        c = h2 >> 42; h2 &= MASK42; h0 += c * 5;
+        c = h0 >> 44; h0 &= MASK44; h1 += c;
+
+        // h - p; если не отрицательно, берется оно
+        uint64_t g0 = h0 + 5;
+        c = g0 >> 44; g0 &= MASK44;
+        uint64_t g1 = h1 + c;
+        c = g1 >> 44; g1 &= MASK44;
+        uint64_t g2 = h2 + c - (1ULL << 42);
+        c = (g2 >> 63) - 1;
+        g0 &= c;
+        g1 &= c;
+        g2 &= c;
+        c = ~c;
+        h0 = (h0 & c) | g0;
+        h1 = (h1 & c) | g1;
+        h2 = (h2 & c) | g2;
+
+        uint64_t t0 = pad_[0], t1 = pad_[1];
+        h0 += t0 & MASK44;
+        c = h0 >> 44; h0 &= MASK44;
+        h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + c;
+        c = h1 >> 44; h1 &= MASK44;
+        h2 += ((t1 >> 24) & MASK42) + c;
+        h2 &= MASK42;
+
+        uint64_t out0 = h0 | (h1 << 44);
+        uint64_t out1 = (h1 >> 20) | (h2 << 24);
+        std::memcpy(tag, &out0, sizeof(out0));
+        std::memcpy(tag + 8, &out1, sizeof(out1));
+    }
+
+private:
+    uint64_t r_[3];
+    uint64_t h_[3] = {0, 0, 0};
+    uint64_t pad_[2];
+    uint8_t buffer_[16];
+    size_t used_{0};
+
+    void blocks(const uint8_t* data, size_t size, uint64_t high_bit) {
+        const uint64_t r0 = r_[0], r1 = r_[1], r2 = r_[2];
+        const uint64_t s1 = r1 * (5 << 2);
+        const uint64_t s2 = r2 * (5 << 2);
+        uint64_t h0 = h_[0], h1 = h_[1], h2 = h_[2];
+
+        for (; size >= 16; data += 16, size -= 16) {
+            uint64_t t0 = load64(data);
+            uint64_t t1 = load64(data + 8);
+            h0 += t0 & MASK44;
+            h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+            h2 += ((t1 >> 24) & MASK42) | high_bit;
+
+            uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+            uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+            uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+            uint64_t c = static_cast<uint64_t>(d0 >> 44);
+            h0 = static_cast<uint64_t>(d0) & MASK44;
+            d1 += c;
+            c = static_cast<uint64_t>(d1 >> 44);
+            h1 = static_cast<uint64_t>(d1) & MASK44;
+            d2 += c;
+            c = static_cast<uint64_t>(d2 >> 42);
+            h2 = static_cast<uint64_t>(d2) & MASK42;
+            h0 += c * 5;
+            c = h0 >> 44;
+            h0 &= MASK44;
+            h1 += c;
+        }
+        h_[0] = h0;
+        h_[1] = h1;
+        h_[2] = h2;
+    }
+};
+
+// Тег AEAD: aad, шифртекст (каждый дополнен до 16 байт) и их длины
+void aead_tag(uint8_t tag[16], const uint8_t key[32], const uint8_t nonce[12],
+              const uint8_t* aad, size_t aad_size, const uint8_t* data, size_t size) {
+    uint32_t state[16];
+    uint8_t one_time_key[64];
+    init_state(state, key, nonce, 0);
+    block(state, one_time_key);
+
+    Poly1305 mac(one_time_key);
+    mac.update(aad, aad_size);
+    mac.pad16();
+    mac.update(data, size);
+    mac.pad16();
+    uint64_t lengths[2] = {aad_size, size};
+    mac.update(reinterpret_cast<const uint8_t*>(lengths), sizeof(lengths));
+    mac.finish(tag);
+    std::memset(one_time_key, 0, sizeof(one_time_key));
+}
+
+}  // namespace
+
+namespace ChaCha20Poly1305 {
+
+const char* kernel_name(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::AVX512: return "avx512";
+        case Kernel::AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+bool kernel_supported(Kernel kernel) {
+    return static_cast<int>(kernel) <= static_cast<int>(detect_kernel());
+}
+
+Kernel kernel() {
+    return current_kernel();
+}
+
+bool set_kernel(Kernel kernel) {
+    if (!kernel_supported(kernel)) {
+        return false;
+    }
+    selected_kernel.store(static_cast<int>(kernel), std::memory_order_relaxed);
+    return true;
+}
+
+void chacha20_xor(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], uint32_t counter,
+                  uint8_t* data, size_t size) {
+    uint32_t state[16];
+    init_state(state, key, nonce, counter);
+    switch (current_kernel()) {
+#ifdef CHACHA20_X86
+        case Kernel::AVX512:
+            xor_avx512(state, data, size);
+            break;
+        case Kernel::AVX2:
+            xor_avx2(state, data, size);
+            break;
+#endif
+        default:
+            xor_scalar(state, data, size);
+            break;
+    }
+}
+
+void poly1305(uint8_t tag[TAG_SIZE], const uint8_t key[32], const uint8_t* data, size_t size) {
+    Poly1305 mac(key);
+    mac.update(data, size);
+    mac.finish(tag);
+}
+
+void seal(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE],
+          const uint8_t* aad, size_t aad_size, uint8_t* data, size_t size, uint8_t tag[TAG_SIZE]) {
+    chacha20_xor(key, nonce, 1, data, size);
+    aead_tag(tag, key, nonce, aad, aad_size, data, size);
+}
+
+bool open(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE],
+          const uint8_t* aad, size_t aad_size, uint8_t* data, size_t size, const uint8_t tag[TAG_SIZE]) {
+    uint8_t expected[TAG_SIZE];
+    aead_tag(expected, key, nonce, aad, aad_size, data, size);
+    uint8_t difference = 0;
+    for (size_t i = 0; i < TAG_SIZE; ++i) {
+        difference |= expected[i] ^ tag[i];
+    }
+    if (difference != 0) {
+        return false;
+    }
+    chacha20_xor(key, nonce, 1, data, size);
+    return true;
+}
+
+}  // namespace ChaCha20Poly1305
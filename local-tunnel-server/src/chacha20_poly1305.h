@@ -0,0 +1,43 @@
+#ifndef CHACHA20_POLY1305_H
+#define CHACHA20_POLY1305_H
+
+#include <cstddef>
+#include <cstdint>
+
+// AEAD ChaCha20-Poly1305 (RFC 8439) с шифрованием на месте. Ядро ChaCha20
+// выбирается при первом вызове по возможностям процессора: AVX-512
+// (16 блоков за проход), AVX2 (8 блоков) или переносимое; Poly1305 -
+// 64-битная арифметика с частями по 44 бита.
+namespace ChaCha20Poly1305 {
+    constexpr size_t KEY_SIZE = 32;
+    constexpr size_t NONCE_SIZE = 12;
+    constexpr size_t TAG_SIZE = 16;
+
+    enum class Kernel {
+        SCALAR,
+        AVX2,
+        AVX512
+    };
+
+    const char* kernel_name(Kernel kernel);
+    bool kernel_supported(Kernel kernel);
+    Kernel kernel();
+    // Принудительный выбор ядра (для бенчмарков); false - не поддерживается
+    bool set_kernel(Kernel kernel);
+
+    // XOR данных с потоком ключа начиная с блока counter
+    void chacha20_xor(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE], uint32_t counter,
+                      uint8_t* data, size_t size);
+
+    void poly1305(uint8_t tag[TAG_SIZE], const uint8_t key[32], const uint8_t* data, size_t size);
+
+    // Шифрование data на месте и вычисление тега по aad и шифртексту
+    void seal(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE],
+              const uint8_t* aad, size_t aad_size, uint8_t* data, size_t size, uint8_t tag[TAG_SIZE]);
+
+    // Проверка тега и расшифровка на месте; при неверном теге data не меняется
+    bool open(const uint8_t key[KEY_SIZE], const uint8_t nonce[NONCE_SIZE],
+              const uint8_t* aad, size_t aad_size, uint8_t* data, size_t size, const uint8_t tag[TAG_SIZE]);
+}
+
+#endif // CHACHA20_POLY1305_H
@@ -0,0 +1,228 @@
+#include "circuit_breaker.h"
+#include "logger.h"
+#include "metrics.h"
+#include <algorithm>
+#include <functional>
+
+CircuitBreakerRegistry::CircuitBreakerRegistry() {
+    Metrics::register_provider("circuit_breaker", [this](std::ostream& out) {
+        render_metrics(out);
+    });
+}
+
+CircuitBreakerRegistry::~CircuitBreakerRegistry() {
+    Metrics::unregister_provider("circuit_breaker");
+}
+
+void CircuitBreakerRegistry::configure(const Config& config) {
+    enabled_.store(config.is_breaker_enabled());
+    window_ms_.store(std::max(1, config.get_breaker_window()) * 1000);
+    min_requests_.store(std::max(1, config.get_breaker_min_requests()));
+    failure_rate_.store(std::min(100, std::max(1, config.get_breaker_failure_rate())));
+    slow_call_ms_.store(std::max(1, config.get_breaker_slow_call_ms()));
+    slow_call_rate_.store(std::min(101, std::max(1, config.get_breaker_slow_call_rate())));
+    open_ms_.store(std::max(1, config.get_breaker_open_seconds()) * 1000);
+    half_open_probes_.store(std::max(1, config.get_breaker_half_open_probes()));
+    max_entries_.store(static_cast<size_t>(std::max(SHARD_COUNT, static_cast<size_t>(
+        std::max(0, config.get_breaker_max_entries())))));
+}
+
+std::string CircuitBreakerRegistry::make_key(const std::string& host, int port) {
+    return host + ":" + std::to_string(port);
+}
+
+CircuitBreakerRegistry::Shard& CircuitBreakerRegistry::shard_for(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % SHARD_COUNT];
+}
+
+int64_t CircuitBreakerRegistry::current_epoch() const {
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        Clock::now().time_since_epoch()).count();
+    return now_ms / std::max(1, window_ms_.load(std::memory_order_relaxed) / BUCKET_COUNT);
+}
+
+CircuitBreakerRegistry::Entry& CircuitBreakerRegistry::touch(Shard& shard, const std::string& key) {
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_position);
+        return it->second;
+    }
+
+    // Ограничение размера: вытесняем давно не использованную запись
+    size_t limit = max_entries_.load(std::memory_order_relaxed) / SHARD_COUNT;
+    while (!shard.lru.empty() && shard.entries.size() >= limit) {
+        shard.entries.erase(shard.lru.back());
+        shard.lru.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    shard.lru.push_front(key);
+    Entry& entry = shard.entries[key];
+    entry.lru_position = shard.lru.begin();
+    return entry;
+}
+
+void CircuitBreakerRegistry::trip(Entry& entry, const std::string& key, const std::string& reason) {
+    entry.state = BreakerState::OPEN;
+    entry.open_until = Clock::now() + std::chrono::milliseconds(open_ms_.load(std::memory_order_relaxed));
+    entry.probes_in_flight = 0;
+    entry.probe_successes = 0;
+    trips_.fetch_add(1, std::memory_order_relaxed);
+    Logger::warning("Автомат отключения для " + key + " разомкнут: " + reason);
+}
+
+CircuitBreakerRegistry::Permit CircuitBreakerRegistry::acquire(const std::string& host, int port) {
+    if (!is_enabled()) {
+        return Permit::ALLOWED;
+    }
+
+    std::string key = make_key(host, port);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        return Permit::ALLOWED;  // Запись создается только при первом результате
+    }
+    Entry& entry = touch(shard, key);
+
+    if (entry.state == BreakerState::OPEN) {
+        if (Clock::now() < entry.open_until) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return Permit::REJECTED;
+        }
+        entry.state = BreakerState::HALF_OPEN;
+        entry.probes_in_flight = 0;
+        entry.probe_successes = 0;
+    }
+
+    if (entry.state == BreakerState::HALF_OPEN) {
+        if (entry.probes_in_flight >= half_open_probes_.load(std::memory_order_relaxed)) {
+            rejected_.fetch_add(1, std::memory_order_relaxed);
+            return Permit::REJECTED;
+        }
+        ++entry.probes_in_flight;
+        return Permit::PROBE;
+    }
+
+    return Permit::ALLOWED;
+}
+
+void CircuitBreakerRegistry::record(const std::string& host, int port, Permit permit,
+                                    Outcome outcome, int64_t latency_ms) {
+    if (!is_enabled() || permit == Permit::REJECTED) {
+        return;
+    }
+
+    std::string key = make_key(host, port);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (outcome == Outcome::SUCCESS && permit == Permit::ALLOWED &&
+        shard.entries.find(key) == shard.entries.end() &&
+        latency_ms < slow_call_ms_.load(std::memory_order_relaxed)) {
+        return;  // Быстрые успешные подключения к новым целям не занимают место в таблице
+    }
+
+    Entry& entry = touch(shard, key);
+    bool slow = outcome == Outcome::SUCCESS && latency_ms >= slow_call_ms_.load(std::memory_order_relaxed);
+
+    if (permit == Permit::PROBE) {
+        if (entry.state != BreakerState::HALF_OPEN) {
+            return;
+        }
+        entry.probes_in_flight = std::max(0, entry.probes_in_flight - 1);
+        if (outcome == Outcome::IGNORED) {
+            return;
+        }
+        if (outcome == Outcome::FAILURE || slow) {
+            trip(entry, key, outcome == Outcome::FAILURE ? "пробное подключение не удалось"
+                                                         : "пробное подключение слишком медленное");
+            return;
+        }
+        if (++entry.probe_successes >= half_open_probes_.load(std::memory_order_relaxed)) {
+            entry.state = BreakerState::CLOSED;
+            for (auto& bucket : entry.buckets) {
+                bucket = Bucket{};
+            }
+            Logger::info("Автомат отключения для " + key + " замкнут");
+        }
+        return;
+    }
+
+    if (outcome == Outcome::IGNORED || entry.state != BreakerState::CLOSED) {
+        return;
+    }
+
+    // Учет в текущем интервале скользящего окна
+    int64_t epoch = current_epoch();
+    Bucket& bucket = entry.buckets[epoch % BUCKET_COUNT];
+    if (bucket.epoch != epoch) {
+        bucket = Bucket{};
+        bucket.epoch = epoch;
+    }
+    ++bucket.calls;
+    if (outcome == Outcome::FAILURE) {
+        ++bucket.failures;
+    } else if (slow) {
+        ++bucket.slow;
+    }
+
+    uint64_t calls = 0, failures = 0, slow_calls = 0;
+    for (const auto& b : entry.buckets) {
+        if (b.epoch > epoch - BUCKET_COUNT) {
+            calls += b.calls;
+            failures += b.failures;
+            slow_calls += b.slow;
+        }
+    }
+
+    if (calls < static_cast<uint64_t>(min_requests_.load(std::memory_order_relaxed))) {
+        return;
+    }
+    if (failures * 100 >= calls * static_cast<uint64_t>(failure_rate_.load(std::memory_order_relaxed))) {
+        trip(entry, key, "ошибок " + std::to_string(failures) + " из " + std::to_string(calls));
+    } else if (slow_calls * 100 >= calls * static_cast<uint64_t>(slow_call_rate_.load(std::memory_order_relaxed))) {
+        trip(entry, key, "медленных подключений " + std::to_string(slow_calls) + " из " + std::to_string(calls));
+    }
+}
+
+std::string CircuitBreakerRegistry::state_to_string(BreakerState state) {
+    switch (state) {
+        case BreakerState::CLOSED: return "closed";
+        case BreakerState::OPEN: return "open";
+        case BreakerState::HALF_OPEN: return "half_open";
+    }
+    return "closed";
+}
+
+void CircuitBreakerRegistry::render_metrics(std::ostream& out) {
+    const size_t max_listed = 100;
+    size_t entries = 0;
+    size_t open = 0;
+    size_t half_open = 0;
+    std::string listed;
+
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        entries += shard.entries.size();
+        for (const auto& item : shard.entries) {
+            if (item.second.state == BreakerState::CLOSED) {
+                continue;
+            }
+            (item.second.state == BreakerState::OPEN ? open : half_open)++;
+            if (open + half_open <= max_listed) {
+                listed += "circuit_breaker_state{target=\"" + item.first + "\",state=\"" +
+                          state_to_string(item.second.state) + "\"} 1\n";
+            }
+        }
+    }
+
+    out << "circuit_breaker_entries " << entries << "\n"
+        << "circuit_breaker_open " << open << "\n"
+        << "circuit_breaker_half_open " << half_open << "\n"
+        << "circuit_breaker_trips_total " << trips_.load() << "\n"
+        << "circuit_breaker_rejected_total " << rejected_.load() << "\n"
+        << "circuit_breaker_evictions_total " << evictions_.load() << "\n"
+        << listed;
+}
@@ -0,0 +1,108 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+#include "config.h"
+
+// Состояние автомата отключения для пункта назначения (host, port)
+enum class BreakerState : uint8_t {
+    CLOSED = 0,     // Подключения разрешены, ведется статистика
+    OPEN = 1,       // Подключения отклоняются без попытки
+    HALF_OPEN = 2   // Пропускается ограниченное число пробных подключений
+};
+
+// Реестр автоматов отключения. Хранится в шардированной хеш-таблице
+// ограниченного размера: при переполнении шарда вытесняется запись,
+// которая дольше всех не использовалась.
+class CircuitBreakerRegistry {
+public:
+    // Разрешение на подключение, выданное acquire()
+    enum class Permit : uint8_t {
+        REJECTED = 0,  // Автомат разомкнут - подключаться нельзя
+        ALLOWED = 1,   // Обычное подключение
+        PROBE = 2      // Пробное подключение в полуоткрытом состоянии
+    };
+
+    // Итог подключения для record()
+    enum class Outcome : uint8_t {
+        SUCCESS = 0,
+        FAILURE = 1,
+        IGNORED = 2    // Попытка не состоялась по причинам, не связанным с целью
+    };
+
+    CircuitBreakerRegistry();
+    ~CircuitBreakerRegistry();
+
+    void configure(const Config& config);
+    bool is_enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    Permit acquire(const std::string& host, int port);
+    void record(const std::string& host, int port, Permit permit, Outcome outcome, int64_t latency_ms);
+
+    void render_metrics(std::ostream& out);
+
+    static std::string state_to_string(BreakerState state);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t SHARD_COUNT = 16;
+    static constexpr int BUCKET_COUNT = 10;
+
+    // Интервал скользящего окна статистики
+    struct Bucket {
+        int64_t epoch{-1};
+        uint32_t calls{0};
+        uint32_t failures{0};
+        uint32_t slow{0};
+    };
+
+    struct Entry {
+        BreakerState state{BreakerState::CLOSED};
+        Clock::time_point open_until{};
+        Bucket buckets[BUCKET_COUNT];
+        int probes_in_flight{0};
+        int probe_successes{0};
+        std::list<std::string>::iterator lru_position;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> lru;  // Начало - недавно использованные
+    };
+
+    Shard shards_[SHARD_COUNT];
+
+    // Настройки (меняются при перезагрузке конфигурации)
+    std::atomic<bool> enabled_{true};
+    std::atomic<int> window_ms_{30000};
+    std::atomic<int> min_requests_{5};
+    std::atomic<int> failure_rate_{50};
+    std::atomic<int> slow_call_ms_{3000};
+    std::atomic<int> slow_call_rate_{100};
+    std::atomic<int> open_ms_{15000};
+    std::atomic<int> half_open_probes_{1};
+    std::atomic<size_t> max_entries_{10000};
+
+    // Счетчики
+    std::atomic<uint64_t> trips_{0};
+    std::atomic<uint64_t> rejected_{0};
+    std::atomic<uint64_t> evictions_{0};
+
+    Shard& shard_for(const std::string& key);
+    Entry& touch(Shard& shard, const std::string& key);
+    void trip(Entry& entry, const std::string& key, const std::string& reason);
+    int64_t current_epoch() const;
+
+    static std::string make_key(const std::string& host, int port);
+};
+
+#endif // CIRCUIT_BREAKER_H
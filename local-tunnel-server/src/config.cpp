@@ -16,21 +16,163 @@ void Config::set_defaults() {
     max_connections_ = 100;
     buffer_size_ = 4096;
     timeout_ = 30;
+    listen_backlog_ = 1024;
+    max_open_files_ = 0;      // 0 - поднять мягкий лимит до жесткого
+    idle_park_after_ = 60;    // 0 - не парковать простаивающие туннели
+    workers_ = 0;             // 0 - по одному на процессор из cpu_set
+    cpu_set_ = "";            // Пусто - все доступные процессоры
+    pin_workers_ = true;
     
     // Настройки логирования по умолчанию
     log_level_ = "INFO";
     log_file_ = "vpn_server.log";
     log_format_ = "[%Y-%m-%d %H:%M:%S] [%l] %v";
+    log_rate_limit_ = 20;          // Сообщений в секунду на место вызова (0 - без ограничения)
+    log_rate_burst_ = 50;
+    log_debug_sample_one_in_ = 1;  // Отладка каждого соединения
     
     // Настройки аутентификации по умолчанию
     auth_enabled_ = false;
     username_ = "admin";
     password_ = "password123";
+    auth_users_file_.clear();       // Пусто - единственный пользователь username/password
+    auth_cache_ttl_seconds_ = 300;  // Срок проверенного пароля в кэше (0 - без кэша)
+    auth_cache_entries_ = 4096;
+    auth_failure_limit_ = 10;       // Неудач с одного адреса за окно (0 - без ограничения)
+    auth_failure_window_seconds_ = 60;
+    
+    // Политика доступа по умолчанию: всё разрешено
+    acl_default_action_ = "allow";
+    acl_rules_.clear();
+    acl_rules_file_.clear();
+    
+    // Вышестоящие прокси по умолчанию не заданы
+    upstream_parents_.clear();
+    upstream_pool_size_ = 2;
+    upstream_connect_timeout_ = 5;
+    upstream_health_interval_ = 5;
+    upstream_max_idle_ = 30;
+    upstream_failure_threshold_ = 3;
+    
+    // Автоматы отключения: размыкание при 50% ошибок из минимум 5 попыток за 30 с
+    breaker_enabled_ = true;
+    breaker_window_ = 30;
+    breaker_min_requests_ = 5;
+    breaker_failure_rate_ = 50;
+    breaker_slow_call_ms_ = 3000;
+    breaker_slow_call_rate_ = 100;
+    breaker_open_seconds_ = 15;
+    breaker_half_open_probes_ = 1;
+    breaker_max_entries_ = 10000;
+    
+    // Метрики по умолчанию не выгружаются в файл
+    metrics_file_.clear();
+    metrics_interval_ = 10;
+    
+    // DNS: положительные ответы кэшируются на минуту, ошибки - на 5 секунд
+    dns_cache_ttl_ = 60;
+    dns_negative_ttl_ = 5;
+    dns_cache_size_ = 4096;
+    dns_workers_ = 4;
+    
+    // Подключение к цели начинается до окончания заголовков клиента
+    connect_timeout_ = 10;
+    handshake_pipelining_ = true;
+    max_header_size_ = 65536;
+    
+    // Бюджет памяти: 512 МБ на сервер, 1 МБ на соединение, буферы 4-256 КБ
+    memory_total_mb_ = 512;
+    memory_pressure_percent_ = 90;
+    memory_connection_kb_ = 1024;
+    memory_connection_overhead_kb_ = 64;
+    memory_max_buffer_kb_ = 256;
+    memory_idle_release_seconds_ = 5;
+    
+    // Трассировка выключена (0); при включении - каждое N-е соединение
+    trace_sample_one_in_ = 0;
+    trace_ring_size_ = 4096;
+    trace_file_ = "trace.json";
+    
+    // Журнал доступа: JSON lines, ротация при 100 МБ или раз в сутки
+    access_log_enabled_ = true;
+    access_log_file_ = "access.log";
+    access_log_format_ = "json";
+    access_log_max_size_mb_ = 100;
+    access_log_rotate_seconds_ = 86400;
+    access_log_flush_ms_ = 1000;
+    access_log_buffer_kb_ = 4096;
+    
+    // Топ-10 по каждому измерению, эскиз 4 x 2048, полураспад счетчиков раз в минуту
+    heavy_hitters_enabled_ = true;
+    heavy_hitters_top_k_ = 10;
+    heavy_hitters_width_ = 2048;
+    heavy_hitters_depth_ = 4;
+    heavy_hitters_decay_seconds_ = 60;
+    
+    // Снимок статистики для cvpnctl раз в секунду
+    stats_enabled_ = false;
+    stats_file_ = "/dev/shm/cvpn-stats";
+    stats_interval_ms_ = 1000;
+    
+    // Пачки по 32 датаграммы, отображение живет минуту без ответов, ассоциация - 5 минут
+    udp_enabled_ = true;
+    udp_batch_size_ = 32;
+    udp_buffer_kb_ = 1024;
+    udp_mapping_idle_seconds_ = 60;
+    udp_session_idle_seconds_ = 300;
+    udp_max_sessions_ = 1024;
+    udp_max_mappings_ = 256;
+    udp_gso_ = true;
+    udp_gro_ = true;
+    
+    // 64 МБ ответов, объекты больше 1 МБ не сохраняются; одновременные
+    // запросы URL ждут общую загрузку до 10 секунд
+    http_cache_enabled_ = true;
+    http_cache_max_size_mb_ = 64;
+    http_cache_max_object_kb_ = 1024;
+    http_cache_collapse_timeout_ms_ = 10000;
+    
+    // Захват выключен; огибающая - интервалы по 10 мс, не больше 256 на туннель
+    capture_enabled_ = false;
+    capture_file_ = "capture.bin";
+    capture_max_size_mb_ = 256;
+    capture_slot_ms_ = 10;
+    capture_max_events_ = 256;
+    
+    // Шифрование по запросу клиента; без ключа он создается при запуске
+    encryption_enabled_ = true;
+    encryption_private_key_ = "";
+    
+    // Сжатие по запросу клиента
+    compression_enabled_ = true;
+    
+    // Сессии по запросу клиента: цель ждет переподключения 30 секунд,
+    // повторить можно последние 256 КБ, отправленные клиенту
+    sessions_enabled_ = true;
+    session_grace_seconds_ = 30;
+    session_replay_kb_ = 256;
+    max_sessions_ = 1024;
+    
+    // Отвод выключен; пустой фильтр - любой клиент или цель
+    tap_enabled_ = false;
+    tap_file_ = "tap.pcapng";
+    tap_client_ = "";
+    tap_target_host_ = "";
+    tap_target_port_ = 0;
+    tap_max_size_mb_ = 256;
+
+    // Заголовки пересылаются как есть, кроме Host
+    http_rewrite_host_ = true;
+    http_via_ = "";
+    http_forwarded_for_ = false;
+    http_strip_headers_.clear();
+    http_inject_headers_.clear();
 }
 
 void Config::load_config() {
     try {
-        if (parse_json_file()) {
+        loaded_ = parse_json_file();
+        if (loaded_) {
             // Logger::info("Конфигурация успешно загружена из " + config_file_);
             std::cout << "Конфигурация успешно загружена из " + config_file_ << std::endl;
         } else {
@@ -58,6 +200,13 @@ bool Config::parse_json_file() {
         content += line;
     }
     file.close();
+    
+    // Недописанный или поврежденный файл не применяется: иначе часть ключей
+    // молча получила бы значения по умолчанию
+    if (!is_balanced(content)) {
+        std::cerr << "Конфигурация " + config_file_ + " не является объектом JSON" << std::endl;
+        return false;
+    }
 
     // Простой парсинг JSON (без библиотеки)
     // Ищем ключи и значения в формате "key": value
@@ -126,16 +275,388 @@ bool Config::parse_json_file() {
         }
     }
     
+    // Логирование
+    std::string logging = extract_section(content, "logging");
+    if (!logging.empty()) {
+        read_string(logging, "level", log_level_);
+        read_string(logging, "file", log_file_);
+        read_int(logging, "rate_limit", log_rate_limit_);
+        read_int(logging, "rate_burst", log_rate_burst_);
+        read_int(logging, "debug_sample_one_in", log_debug_sample_one_in_);
+    }
+    
+    // Аутентификация клиентов (используется SOCKS5)
+    std::string authentication = extract_section(content, "authentication");
+    if (!authentication.empty()) {
+        read_bool(authentication, "enabled", auth_enabled_);
+        read_string(authentication, "username", username_);
+        read_string(authentication, "password", password_);
+        read_string(authentication, "users_file", auth_users_file_);
+        read_int(authentication, "cache_ttl_seconds", auth_cache_ttl_seconds_);
+        read_int(authentication, "cache_entries", auth_cache_entries_);
+        read_int(authentication, "failure_limit", auth_failure_limit_);
+        read_int(authentication, "failure_window_seconds", auth_failure_window_seconds_);
+    }
+    
+    // Дополнительные серверные настройки
+    std::string server = extract_section(content, "server");
+    if (!server.empty()) {
+        read_int(server, "listen_backlog", listen_backlog_);
+        read_int(server, "max_open_files", max_open_files_);
+        read_int(server, "idle_park_after", idle_park_after_);
+        read_int(server, "workers", workers_);
+        read_string(server, "cpu_set", cpu_set_);
+        read_bool(server, "pin_workers", pin_workers_);
+    }
+    
+    // Политика доступа и маршрутизации
+    std::string acl = extract_section(content, "acl");
+    if (!acl.empty()) {
+        read_string(acl, "default_action", acl_default_action_);
+        read_string(acl, "rules_file", acl_rules_file_);
+        acl_rules_.clear();
+        read_string_list(acl, "rules", acl_rules_);
+    }
+    
+    // Вышестоящие прокси
+    std::string upstream = extract_section(content, "upstream");
+    if (!upstream.empty()) {
+        upstream_parents_.clear();
+        read_string_list(upstream, "parents", upstream_parents_);
+        read_int(upstream, "pool_size", upstream_pool_size_);
+        read_int(upstream, "connect_timeout", upstream_connect_timeout_);
+        read_int(upstream, "health_check_interval", upstream_health_interval_);
+        read_int(upstream, "max_idle", upstream_max_idle_);
+        read_int(upstream, "failure_threshold", upstream_failure_threshold_);
+    }
+    
+    // Автоматы отключения
+    std::string breaker = extract_section(content, "circuit_breaker");
+    if (!breaker.empty()) {
+        read_bool(breaker, "enabled", breaker_enabled_);
+        read_int(breaker, "window", breaker_window_);
+        read_int(breaker, "min_requests", breaker_min_requests_);
+        read_int(breaker, "failure_rate", breaker_failure_rate_);
+        read_int(breaker, "slow_call_ms", breaker_slow_call_ms_);
+        read_int(breaker, "slow_call_rate", breaker_slow_call_rate_);
+        read_int(breaker, "open_seconds", breaker_open_seconds_);
+        read_int(breaker, "half_open_probes", breaker_half_open_probes_);
+        read_int(breaker, "max_entries", breaker_max_entries_);
+    }
+    
+    // Выгрузка метрик
+    std::string metrics = extract_section(content, "metrics");
+    if (!metrics.empty()) {
+        read_string(metrics, "file", metrics_file_);
+        read_int(metrics, "interval", metrics_interval_);
+    }
+    
+    // DNS резолвер
+    std::string dns = extract_section(content, "dns");
+    if (!dns.empty()) {
+        read_int(dns, "cache_ttl", dns_cache_ttl_);
+        read_int(dns, "negative_ttl", dns_negative_ttl_);
+        read_int(dns, "cache_size", dns_cache_size_);
+        read_int(dns, "workers", dns_workers_);
+    }
+    
+    // Установление туннеля
+    std::string handshake = extract_section(content, "handshake");
+    if (!handshake.empty()) {
+        read_int(handshake, "connect_timeout", connect_timeout_);
+        read_bool(handshake, "pipelining", handshake_pipelining_);
+        read_int(handshake, "max_header_size", max_header_size_);
+    }
+    
+    // Бюджет памяти
+    std::string memory = extract_section(content, "memory");
+    if (!memory.empty()) {
+        read_int(memory, "total_mb", memory_total_mb_);
+        read_int(memory, "pressure_percent", memory_pressure_percent_);
+        read_int(memory, "connection_kb", memory_connection_kb_);
+        read_int(memory, "connection_overhead_kb", memory_connection_overhead_kb_);
+        read_int(memory, "max_buffer_kb", memory_max_buffer_kb_);
+        read_int(memory, "idle_release_seconds", memory_idle_release_seconds_);
+    }
+    
+    // Трассировка этапов соединений
+    std::string tracing = extract_section(content, "tracing");
+    if (!tracing.empty()) {
+        read_int(tracing, "sample_one_in", trace_sample_one_in_);
+        read_int(tracing, "ring_size", trace_ring_size_);
+        read_string(tracing, "file", trace_file_);
+    }
+    
+    // Журнал доступа
+    std::string access_log = extract_section(content, "access_log");
+    if (!access_log.empty()) {
+        read_bool(access_log, "enabled", access_log_enabled_);
+        read_string(access_log, "file", access_log_file_);
+        read_string(access_log, "format", access_log_format_);
+        read_int(access_log, "max_size_mb", access_log_max_size_mb_);
+        read_int(access_log, "rotate_seconds", access_log_rotate_seconds_);
+        read_int(access_log, "flush_ms", access_log_flush_ms_);
+        read_int(access_log, "buffer_kb", access_log_buffer_kb_);
+    }
+    
+    // Самые нагруженные цели и клиенты
+    std::string heavy_hitters = extract_section(content, "heavy_hitters");
+    if (!heavy_hitters.empty()) {
+        read_bool(heavy_hitters, "enabled", heavy_hitters_enabled_);
+        read_int(heavy_hitters, "top_k", heavy_hitters_top_k_);
+        read_int(heavy_hitters, "width", heavy_hitters_width_);
+        read_int(heavy_hitters, "depth", heavy_hitters_depth_);
+        read_int(heavy_hitters, "decay_seconds", heavy_hitters_decay_seconds_);
+    }
+    
+    // Сегмент статистики в разделяемой памяти
+    std::string stats = extract_section(content, "stats");
+    if (!stats.empty()) {
+        read_bool(stats, "enabled", stats_enabled_);
+        read_string(stats, "file", stats_file_);
+        read_int(stats, "interval_ms", stats_interval_ms_);
+    }
+    
+    // UDP ретранслятор
+    std::string udp = extract_section(content, "udp");
+    if (!udp.empty()) {
+        read_bool(udp, "enabled", udp_enabled_);
+        read_int(udp, "batch_size", udp_batch_size_);
+        read_int(udp, "buffer_kb", udp_buffer_kb_);
+        read_int(udp, "mapping_idle_seconds", udp_mapping_idle_seconds_);
+        read_int(udp, "session_idle_seconds", udp_session_idle_seconds_);
+        read_int(udp, "max_sessions", udp_max_sessions_);
+        read_int(udp, "max_mappings", udp_max_mappings_);
+        read_bool(udp, "gso", udp_gso_);
+        read_bool(udp, "gro", udp_gro_);
+    }
+    
+    // Кэш HTTP ответов
+    std::string http_cache = extract_section(content, "http_cache");
+    if (!http_cache.empty()) {
+        read_bool(http_cache, "enabled", http_cache_enabled_);
+        read_int(http_cache, "max_size_mb", http_cache_max_size_mb_);
+        read_int(http_cache, "max_object_kb", http_cache_max_object_kb_);
+        read_int(http_cache, "collapse_timeout_ms", http_cache_collapse_timeout_ms_);
+    }
+    
+    // Захват нагрузки
+    std::string capture = extract_section(content, "capture");
+    if (!capture.empty()) {
+        read_bool(capture, "enabled", capture_enabled_);
+        read_string(capture, "file", capture_file_);
+        read_int(capture, "max_size_mb", capture_max_size_mb_);
+        read_int(capture, "slot_ms", capture_slot_ms_);
+        read_int(capture, "max_events", capture_max_events_);
+    }
+    
+    // Шифрованные туннели
+    std::string encryption = extract_section(content, "encryption");
+    if (!encryption.empty()) {
+        read_bool(encryption, "enabled", encryption_enabled_);
+        read_string(encryption, "private_key", encryption_private_key_);
+    }
+    
+    // Сжатие туннелей
+    std::string compression = extract_section(content, "compression");
+    if (!compression.empty()) {
+        read_bool(compression, "enabled", compression_enabled_);
+    }
+    
+    // Возобновление сессий
+    std::string sessions = extract_section(content, "sessions");
+    if (!sessions.empty()) {
+        read_bool(sessions, "enabled", sessions_enabled_);
+        read_int(sessions, "grace_seconds", session_grace_seconds_);
+        read_int(sessions, "replay_kb", session_replay_kb_);
+        read_int(sessions, "max_sessions", max_sessions_);
+    }
+    
+    // Отвод туннелей в pcapng
+    std::string tap = extract_section(content, "tap");
+    if (!tap.empty()) {
+        read_bool(tap, "enabled", tap_enabled_);
+        read_string(tap, "file", tap_file_);
+        read_string(tap, "client", tap_client_);
+        read_string(tap, "target_host", tap_target_host_);
+        read_int(tap, "target_port", tap_target_port_);
+        read_int(tap, "max_size_mb", tap_max_size_mb_);
+    }
+
+    // Фильтры заголовков обычного HTTP
+    std::string filters = extract_section(content, "http_filters");
+    if (!filters.empty()) {
+        read_bool(filters, "rewrite_host", http_rewrite_host_);
+        read_string(filters, "via", http_via_);
+        read_bool(filters, "forwarded_for", http_forwarded_for_);
+        http_strip_headers_.clear();
+        read_string_list(filters, "strip", http_strip_headers_);
+        http_inject_headers_.clear();
+        read_string_list(filters, "inject", http_inject_headers_);
+    }
+    
+    return true;
+}
+
+bool Config::is_balanced(const std::string& content) {
+    // Один объект верхнего уровня с парными скобками вне строк
+    size_t first = content.find_first_not_of(" \t\r\n");
+    size_t last = content.find_last_not_of(" \t\r\n");
+    if (first == std::string::npos || content[first] != '{' || content[last] != '}') {
+        return false;
+    }
+    std::string stack;
+    bool in_string = false;
+    for (size_t i = first; i <= last; ++i) {
+        char c = content[i];
+        if (in_string) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                in_string = false;
+            }
+            continue;
+        }
+        if (c == '"') {
+            in_string = true;
+        } else if (c == '{' || c == '[') {
+            stack += c;
+        } else if (c == '}' || c == ']') {
+            if (stack.empty() || stack.back() != (c == '}' ? '{' : '[')) {
+                return false;
+            }
+            stack.pop_back();
+            if (stack.empty() && i != last) {
+                return false;
+            }
+        }
+    }
+    return stack.empty() && !in_string;
+}
+
+std::string Config::extract_section(const std::string& content, const std::string& name) {
+    // Возвращает текст объекта "name": { ... } с учетом вложенных скобок
+    size_t key = content.find("\"" + name + "\"");
+    if (key == std::string::npos) {
+        return "";
+    }
+    size_t open = content.find_first_of("{[", key);
+    if (open == std::string::npos || content[open] != '{') {
+        return "";
+    }
+    
+    int depth = 0;
+    bool in_string = false;
+    for (size_t i = open; i < content.size(); ++i) {
+        char c = content[i];
+        if (in_string) {
+            if (c == '\\') {
+                ++i;
+            } else if (c == '"') {
+                in_string = false;
+            }
+            continue;
+        }
+        if (c == '"') {
+            in_string = true;
+        } else if (c == '{') {
+            ++depth;
+        } else if (c == '}' && --depth == 0) {
+            return content.substr(open, i - open + 1);
+        }
+    }
+    return "";
+}
+
+bool Config::read_string(const std::string& scope, const std::string& key, std::string& value) {
+    size_t start = scope.find("\"" + key + "\"");
+    if (start == std::string::npos) {
+        return false;
+    }
+    size_t colon = scope.find(':', start);
+    size_t quote_start = scope.find('"', colon);
+    if (colon == std::string::npos || quote_start == std::string::npos) {
+        return false;
+    }
+    size_t quote_end = scope.find('"', quote_start + 1);
+    if (quote_end == std::string::npos) {
+        return false;
+    }
+    value = scope.substr(quote_start + 1, quote_end - quote_start - 1);
     return true;
 }
 
-bool Config::reload() {
+bool Config::read_int(const std::string& scope, const std::string& key, int& value) {
+    size_t start = scope.find("\"" + key + "\"");
+    if (start == std::string::npos) {
+        return false;
+    }
+    size_t colon = scope.find(':', start);
+    size_t num_start = scope.find_first_of("-0123456789", colon);
+    if (colon == std::string::npos || num_start == std::string::npos) {
+        return false;
+    }
+    size_t num_end = scope.find_first_not_of("-0123456789", num_start);
     try {
-        load_config();
+        value = std::stoi(scope.substr(num_start, num_end - num_start));
         return true;
-    } catch (const std::exception& e) {
-        // Logger::error("Ошибка при перезагрузке конфигурации: " + std::string(e.what()));
-        std::cerr << "Ошибка при перезагрузке конфигурации: " + std::string(e.what()) << std::endl;
+    } catch (...) {
         return false;
     }
-}
\ No newline at end of file
+}
+
+bool Config::read_bool(const std::string& scope, const std::string& key, bool& value) {
+    size_t start = scope.find("\"" + key + "\"");
+    if (start == std::string::npos) {
+        return false;
+    }
+    size_t colon = scope.find(':', start);
+    size_t word = scope.find_first_not_of(" \t\r\n", colon + 1);
+    if (colon == std::string::npos || word == std::string::npos) {
+        return false;
+    }
+    if (scope.compare(word, 4, "true") == 0) {
+        value = true;
+        return true;
+    }
+    if (scope.compare(word, 5, "false") == 0) {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+bool Config::read_string_list(const std::string& scope, const std::string& key,
+                              std::vector<std::string>& values) {
+    size_t start = scope.find("\"" + key + "\"");
+    if (start == std::string::npos) {
+        return false;
+    }
+    size_t open = scope.find('[', start);
+    size_t close = scope.find(']', open);
+    if (open == std::string::npos || close == std::string::npos) {
+        return false;
+    }
+    
+    size_t pos = open;
+    while (true) {
+        size_t quote_start = scope.find('"', pos + 1);
+        if (quote_start == std::string::npos || quote_start > close) {
+            break;
+        }
+        size_t quote_end = scope.find('"', quote_start + 1);
+        if (quote_end == std::string::npos) {
+            break;
+        }
+        values.push_back(scope.substr(quote_start + 1, quote_end - quote_start - 1));
+        pos = quote_end;
+        // Строка может содержать ']' - пересчитываем конец массива
+        if (quote_end > close) {
+            close = scope.find(']', quote_end);
+            if (close == std::string::npos) {
+                break;
+            }
+        }
+    }
+    return true;
+}
@@ -1,7 +1,10 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
 
 class Config {
 public:
@@ -13,22 +16,163 @@ public:
     int get_max_connections() const { return max_connections_; }
     int get_buffer_size() const { return buffer_size_; }
     int get_timeout() const { return timeout_; }
+    int get_listen_backlog() const { return listen_backlog_; }
+    int get_max_open_files() const { return max_open_files_; }
+    int get_idle_park_after() const { return idle_park_after_; }
+    int get_workers() const { return workers_; }
+    std::string get_cpu_set() const { return cpu_set_; }
+    bool is_pin_workers() const { return pin_workers_; }
+    
+    // Трассировка этапов соединений
+    int get_trace_sample_one_in() const { return trace_sample_one_in_; }
+    int get_trace_ring_size() const { return trace_ring_size_; }
+    std::string get_trace_file() const { return trace_file_; }
+    
+    // Журнал доступа
+    bool is_access_log_enabled() const { return access_log_enabled_; }
+    std::string get_access_log_file() const { return access_log_file_; }
+    std::string get_access_log_format() const { return access_log_format_; }
+    int get_access_log_max_size_mb() const { return access_log_max_size_mb_; }
+    int get_access_log_rotate_seconds() const { return access_log_rotate_seconds_; }
+    int get_access_log_flush_ms() const { return access_log_flush_ms_; }
+    int get_access_log_buffer_kb() const { return access_log_buffer_kb_; }
+    
+    // Самые нагруженные цели и клиенты
+    bool is_heavy_hitters_enabled() const { return heavy_hitters_enabled_; }
+    int get_heavy_hitters_top_k() const { return heavy_hitters_top_k_; }
+    int get_heavy_hitters_width() const { return heavy_hitters_width_; }
+    int get_heavy_hitters_depth() const { return heavy_hitters_depth_; }
+    int get_heavy_hitters_decay_seconds() const { return heavy_hitters_decay_seconds_; }
+    
+    // Сегмент статистики в разделяемой памяти
+    bool is_stats_enabled() const { return stats_enabled_; }
+    std::string get_stats_file() const { return stats_file_; }
+    int get_stats_interval_ms() const { return stats_interval_ms_; }
+    
+    // UDP ретранслятор (SOCKS5 UDP ASSOCIATE)
+    bool is_udp_enabled() const { return udp_enabled_; }
+    int get_udp_batch_size() const { return udp_batch_size_; }
+    int get_udp_buffer_kb() const { return udp_buffer_kb_; }
+    int get_udp_mapping_idle_seconds() const { return udp_mapping_idle_seconds_; }
+    int get_udp_session_idle_seconds() const { return udp_session_idle_seconds_; }
+    int get_udp_max_sessions() const { return udp_max_sessions_; }
+    int get_udp_max_mappings() const { return udp_max_mappings_; }
+    bool is_udp_gso() const { return udp_gso_; }
+    bool is_udp_gro() const { return udp_gro_; }
+    
+    // Кэш ответов на обычные HTTP запросы
+    bool is_http_cache_enabled() const { return http_cache_enabled_; }
+    int get_http_cache_max_size_mb() const { return http_cache_max_size_mb_; }
+    int get_http_cache_max_object_kb() const { return http_cache_max_object_kb_; }
+    int get_http_cache_collapse_timeout_ms() const { return http_cache_collapse_timeout_ms_; }
+    
+    // Захват нагрузки для воспроизведения
+    bool is_capture_enabled() const { return capture_enabled_; }
+    std::string get_capture_file() const { return capture_file_; }
+    int get_capture_max_size_mb() const { return capture_max_size_mb_; }
+    int get_capture_slot_ms() const { return capture_slot_ms_; }
+    int get_capture_max_events() const { return capture_max_events_; }
+    
+    // Шифрованные туннели
+    bool is_encryption_enabled() const { return encryption_enabled_; }
+    std::string get_encryption_private_key() const { return encryption_private_key_; }
+    
+    // Сжатие туннелей
+    bool is_compression_enabled() const { return compression_enabled_; }
+    
+    // Возобновление сессий
+    bool is_sessions_enabled() const { return sessions_enabled_; }
+    int get_session_grace_seconds() const { return session_grace_seconds_; }
+    int get_session_replay_kb() const { return session_replay_kb_; }
+    int get_max_sessions() const { return max_sessions_; }
+    
+    // Отвод туннелей в pcapng
+    bool is_tap_enabled() const { return tap_enabled_; }
+    std::string get_tap_file() const { return tap_file_; }
+    std::string get_tap_client() const { return tap_client_; }
+    std::string get_tap_target_host() const { return tap_target_host_; }
+    int get_tap_target_port() const { return tap_target_port_; }
+    int get_tap_max_size_mb() const { return tap_max_size_mb_; }
+
+    // Фильтры заголовков обычного HTTP
+    bool is_http_rewrite_host() const { return http_rewrite_host_; }
+    std::string get_http_via() const { return http_via_; }
+    bool is_http_forwarded_for() const { return http_forwarded_for_; }
+    std::vector<std::string> get_http_strip_headers() const { return http_strip_headers_; }
+    std::vector<std::string> get_http_inject_headers() const { return http_inject_headers_; }
     
     // Геттеры для настроек логирования
     std::string get_log_level() const { return log_level_; }
     std::string get_log_file() const { return log_file_; }
     std::string get_log_format() const { return log_format_; }
+    int get_log_rate_limit() const { return log_rate_limit_; }
+    int get_log_rate_burst() const { return log_rate_burst_; }
+    int get_log_debug_sample_one_in() const { return log_debug_sample_one_in_; }
     
     // Геттеры для аутентификации
     bool is_auth_enabled() const { return auth_enabled_; }
     std::string get_username() const { return username_; }
     std::string get_password() const { return password_; }
+    std::string get_auth_users_file() const { return auth_users_file_; }
+    int get_auth_cache_ttl_seconds() const { return auth_cache_ttl_seconds_; }
+    int get_auth_cache_entries() const { return auth_cache_entries_; }
+    int get_auth_failure_limit() const { return auth_failure_limit_; }
+    int get_auth_failure_window_seconds() const { return auth_failure_window_seconds_; }
     
-    // Перезагрузка конфигурации
-    bool reload();
+    // Геттеры для политики доступа
+    std::string get_acl_default_action() const { return acl_default_action_; }
+    std::vector<std::string> get_acl_rules() const { return acl_rules_; }
+    std::string get_acl_rules_file() const { return acl_rules_file_; }
+    
+    // Геттеры для вышестоящих прокси
+    std::vector<std::string> get_upstream_parents() const { return upstream_parents_; }
+    int get_upstream_pool_size() const { return upstream_pool_size_; }
+    int get_upstream_connect_timeout() const { return upstream_connect_timeout_; }
+    int get_upstream_health_interval() const { return upstream_health_interval_; }
+    int get_upstream_max_idle() const { return upstream_max_idle_; }
+    int get_upstream_failure_threshold() const { return upstream_failure_threshold_; }
+    
+    // Геттеры для автоматов отключения недоступных целей
+    bool is_breaker_enabled() const { return breaker_enabled_; }
+    int get_breaker_window() const { return breaker_window_; }
+    int get_breaker_min_requests() const { return breaker_min_requests_; }
+    int get_breaker_failure_rate() const { return breaker_failure_rate_; }
+    int get_breaker_slow_call_ms() const { return breaker_slow_call_ms_; }
+    int get_breaker_slow_call_rate() const { return breaker_slow_call_rate_; }
+    int get_breaker_open_seconds() const { return breaker_open_seconds_; }
+    int get_breaker_half_open_probes() const { return breaker_half_open_probes_; }
+    int get_breaker_max_entries() const { return breaker_max_entries_; }
+    
+    // Геттеры для выгрузки метрик
+    std::string get_metrics_file() const { return metrics_file_; }
+    int get_metrics_interval() const { return metrics_interval_; }
+    
+    // Геттеры для DNS резолвера
+    int get_dns_cache_ttl() const { return dns_cache_ttl_; }
+    int get_dns_negative_ttl() const { return dns_negative_ttl_; }
+    int get_dns_cache_size() const { return dns_cache_size_; }
+    int get_dns_workers() const { return dns_workers_; }
+    
+    // Геттеры для установления туннеля
+    int get_connect_timeout() const { return connect_timeout_; }
+    bool is_handshake_pipelining() const { return handshake_pipelining_; }
+    int get_max_header_size() const { return max_header_size_; }
+    
+    // Геттеры для бюджета памяти
+    int get_memory_total_mb() const { return memory_total_mb_; }
+    int get_memory_pressure_percent() const { return memory_pressure_percent_; }
+    int get_memory_connection_kb() const { return memory_connection_kb_; }
+    int get_memory_connection_overhead_kb() const { return memory_connection_overhead_kb_; }
+    int get_memory_max_buffer_kb() const { return memory_max_buffer_kb_; }
+    int get_memory_idle_release_seconds() const { return memory_idle_release_seconds_; }
+    
+    // false - файл не прочитан или не разобран, действуют значения по умолчанию
+    bool is_loaded() const { return loaded_; }
+    std::string get_config_file() const { return config_file_; }
     
 private:
     std::string config_file_;
+    bool loaded_{false};
     
     // Серверные настройки
     std::string server_host_;
@@ -36,21 +180,184 @@ private:
     int max_connections_;
     int buffer_size_;
     int timeout_;
+    int listen_backlog_;
+    int max_open_files_;
+    int idle_park_after_;
+    int workers_;
+    std::string cpu_set_;
+    bool pin_workers_;
+    
+    // Трассировка
+    int trace_sample_one_in_;
+    int trace_ring_size_;
+    std::string trace_file_;
+    
+    // Журнал доступа
+    bool access_log_enabled_;
+    std::string access_log_file_;
+    std::string access_log_format_;
+    int access_log_max_size_mb_;
+    int access_log_rotate_seconds_;
+    int access_log_flush_ms_;
+    int access_log_buffer_kb_;
+    
+    // Самые нагруженные цели и клиенты
+    bool heavy_hitters_enabled_;
+    int heavy_hitters_top_k_;
+    int heavy_hitters_width_;
+    int heavy_hitters_depth_;
+    int heavy_hitters_decay_seconds_;
+    
+    // Сегмент статистики
+    bool stats_enabled_;
+    std::string stats_file_;
+    int stats_interval_ms_;
+    
+    // UDP ретранслятор
+    bool udp_enabled_;
+    int udp_batch_size_;
+    int udp_buffer_kb_;
+    int udp_mapping_idle_seconds_;
+    int udp_session_idle_seconds_;
+    int udp_max_sessions_;
+    int udp_max_mappings_;
+    bool udp_gso_;
+    bool udp_gro_;
+    
+    // Кэш HTTP ответов
+    bool http_cache_enabled_;
+    int http_cache_max_size_mb_;
+    int http_cache_max_object_kb_;
+    int http_cache_collapse_timeout_ms_;
+    
+    // Захват нагрузки
+    bool capture_enabled_;
+    std::string capture_file_;
+    int capture_max_size_mb_;
+    int capture_slot_ms_;
+    int capture_max_events_;
+    
+    // Шифрованные туннели
+    bool encryption_enabled_;
+    std::string encryption_private_key_;
+    
+    // Сжатие туннелей
+    bool compression_enabled_;
+    
+    // Возобновление сессий
+    bool sessions_enabled_;
+    int session_grace_seconds_;
+    int session_replay_kb_;
+    int max_sessions_;
+    
+    // Отвод туннелей в pcapng
+    bool tap_enabled_;
+    std::string tap_file_;
+    std::string tap_client_;
+    std::string tap_target_host_;
+    int tap_target_port_;
+    int tap_max_size_mb_;
+
+    // Фильтры заголовков обычного HTTP
+    bool http_rewrite_host_;
+    std::string http_via_;
+    bool http_forwarded_for_;
+    std::vector<std::string> http_strip_headers_;
+    std::vector<std::string> http_inject_headers_;
     
     // Настройки логирования
     std::string log_level_;
     std::string log_file_;
     std::string log_format_;
+    int log_rate_limit_;
+    int log_rate_burst_;
+    int log_debug_sample_one_in_;
     
     // Настройки аутентификации
     bool auth_enabled_;
     std::string username_;
     std::string password_;
+    std::string auth_users_file_;
+    int auth_cache_ttl_seconds_;
+    int auth_cache_entries_;
+    int auth_failure_limit_;
+    int auth_failure_window_seconds_;
+    
+    // Политика доступа и маршрутизации
+    std::string acl_default_action_;
+    std::vector<std::string> acl_rules_;
+    std::string acl_rules_file_;
+    
+    // Вышестоящие прокси
+    std::vector<std::string> upstream_parents_;
+    int upstream_pool_size_;
+    int upstream_connect_timeout_;
+    int upstream_health_interval_;
+    int upstream_max_idle_;
+    int upstream_failure_threshold_;
+    
+    // Автоматы отключения
+    bool breaker_enabled_;
+    int breaker_window_;
+    int breaker_min_requests_;
+    int breaker_failure_rate_;
+    int breaker_slow_call_ms_;
+    int breaker_slow_call_rate_;
+    int breaker_open_seconds_;
+    int breaker_half_open_probes_;
+    int breaker_max_entries_;
+    
+    // Выгрузка метрик
+    std::string metrics_file_;
+    int metrics_interval_;
+    
+    // DNS резолвер
+    int dns_cache_ttl_;
+    int dns_negative_ttl_;
+    int dns_cache_size_;
+    int dns_workers_;
+    
+    // Установление туннеля
+    int connect_timeout_;
+    bool handshake_pipelining_;
+    int max_header_size_;
+    
+    // Бюджет памяти
+    int memory_total_mb_;
+    int memory_pressure_percent_;
+    int memory_connection_kb_;
+    int memory_connection_overhead_kb_;
+    int memory_max_buffer_kb_;
+    int memory_idle_release_seconds_;
     
     // Загрузка конфигурации
     void load_config();
     void set_defaults();
     bool parse_json_file();
+    
+    // Вспомогательные функции разбора секций JSON
+    static bool is_balanced(const std::string& content);
+    static std::string extract_section(const std::string& content, const std::string& name);
+    static bool read_string(const std::string& scope, const std::string& key, std::string& value);
+    static bool read_int(const std::string& scope, const std::string& key, int& value);
+    static bool read_bool(const std::string& scope, const std::string& key, bool& value);
+    static bool read_string_list(const std::string& scope, const std::string& key,
+                                 std::vector<std::string>& values);
+};
+
+// Актуальная конфигурация сервера. Config после создания не меняется:
+// перезагрузка разбирает файл в новый объект и атомарно подменяет снимок.
+// Обработчик берет снимок один раз на соединение, служебные потоки - на
+// каждую итерацию
+class SharedConfig {
+public:
+    explicit SharedConfig(std::shared_ptr<const Config> config) : config_(std::move(config)) {}
+
+    std::shared_ptr<const Config> current() const { return std::atomic_load(&config_); }
+    void publish(std::shared_ptr<const Config> config) { std::atomic_store(&config_, std::move(config)); }
+
+private:
+    std::shared_ptr<const Config> config_;
 };
 
 #endif // CONFIG_H
\ No newline at end of file
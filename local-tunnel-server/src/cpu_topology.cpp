@@ -0,0 +1,101 @@
+#include "cpu_topology.h"
+#include "utils.h"
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cstring>
+
+namespace Topology {
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> available = available_cpus();
+    if (Utils::trim(list).empty()) {
+        return available;
+    }
+
+    std::vector<int> cpus;
+    for (const auto& part : Utils::split(list, ',')) {
+        std::string range = Utils::trim(part);
+        if (range.empty()) {
+            continue;
+        }
+        try {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                // Недоступные процессу процессоры пропускаются
+                if (std::find(available.begin(), available.end(), cpu) != available.end() &&
+                    std::find(cpus.begin(), cpus.end(), cpu) == cpus.end()) {
+                    cpus.push_back(cpu);
+                }
+            }
+        } catch (...) {
+            continue;
+        }
+    }
+    return cpus.empty() ? available : cpus;
+}
+
+std::vector<int> available_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        cpus.push_back(0);
+    }
+    return cpus;
+}
+
+int cpu_node(int cpu) {
+    // Каталог процессора содержит ссылку nodeN на его NUMA узел
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return 0;
+    }
+    int node = 0;
+    while (dirent* entry = readdir(dir)) {
+        if (std::strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = std::atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool prefer_node(int node) {
+#ifdef SYS_set_mempolicy
+    // MPOL_PREFERRED без зависимости от libnuma
+    const int MPOL_PREFERRED_MODE = 1;
+    unsigned long mask[16] = {};
+    if (node < 0 || node >= static_cast<int>(sizeof(mask) * 8)) {
+        return false;
+    }
+    mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, mask, sizeof(mask) * 8) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+}  // namespace Topology
@@ -0,0 +1,27 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <string>
+#include <vector>
+
+namespace Topology {
+    // Разбор списка процессоров вида "0-3,8,10-11"; пустая строка - все
+    // доступные процессу процессоры
+    std::vector<int> parse_cpu_list(const std::string& list);
+
+    // Процессоры, на которых процессу разрешено выполняться
+    std::vector<int> available_cpus();
+
+    // NUMA узел процессора (0, если топология неизвестна)
+    int cpu_node(int cpu);
+
+    // Закрепление текущего потока за процессором. Потоки, созданные
+    // этим потоком, наследуют закрепление.
+    bool pin_current_thread(int cpu);
+
+    // Предпочтительное выделение памяти текущего потока (и создаваемых
+    // им потоков) на указанном NUMA узле
+    bool prefer_node(int node);
+}
+
+#endif // CPU_TOPOLOGY_H
@@ -0,0 +1,459 @@
+#include "credential_store.h"
+#include "config.h"
+#include "logger.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "utils.h"
+#include <strings.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+namespace {
+
+constexpr size_t SALT_SIZE = 16;
+constexpr size_t DERIVED_SIZE = 32;
+
+// Имя пользователя - одно слово без ':' (разделитель Basic) и символов,
+// которые пришлось бы экранировать в метках метрик
+bool valid_name(const std::string& name) {
+    return !name.empty() && name.size() <= 255 &&
+           name.find_first_of(":\"\\ \t") == std::string::npos;
+}
+
+bool starts_with_scheme(const std::string& value, const char* scheme, std::string& rest) {
+    size_t size = std::strlen(scheme);
+    if (value.size() <= size || strncasecmp(value.c_str(), scheme, size) != 0 || value[size] != ' ') {
+        return false;
+    }
+    rest = Utils::trim(value.substr(size + 1));
+    return true;
+}
+
+std::string derive(const std::string& password, const std::string& salt, uint64_t n, uint32_t r, uint32_t p) {
+    uint8_t out[DERIVED_SIZE];
+    if (!Crypto::scrypt(reinterpret_cast<const uint8_t*>(password.data()), password.size(),
+                        reinterpret_cast<const uint8_t*>(salt.data()), salt.size(), n, r, p, out, sizeof(out))) {
+        return std::string();
+    }
+    return std::string(reinterpret_cast<const char*>(out), sizeof(out));
+}
+
+std::string token_digest(const std::string& token) {
+    uint8_t digest[Crypto::HASH_SIZE];
+    Crypto::sha256(reinterpret_cast<const uint8_t*>(token.data()), token.size(), digest);
+    return Crypto::to_hex(digest, sizeof(digest));
+}
+
+}  // namespace
+
+CredentialStore::CredentialStore(MemoryBudget& memory)
+    : memory_(memory), snapshot_(std::make_shared<const Snapshot>()),
+      scrypt_slots_(std::max(1u, std::thread::hardware_concurrency())) {
+    if (!Crypto::random_bytes(cache_key_, sizeof(cache_key_))) {
+        // Без ключа кэш остается корректным, но записи предсказуемы
+        std::memset(cache_key_, 0, sizeof(cache_key_));
+        Logger::warning("Нет случайного ключа кэша учетных данных");
+    }
+    Metrics::register_provider("auth", [this](std::ostream& out) { render_metrics(out); });
+}
+
+CredentialStore::~CredentialStore() {
+    Metrics::unregister_provider("auth");
+}
+
+bool CredentialStore::load(const Config& config) {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    cache_ttl_seconds_.store(std::max(0, config.get_auth_cache_ttl_seconds()));
+    shard_capacity_.store(std::max<size_t>(1, static_cast<size_t>(std::max(0, config.get_auth_cache_entries())) /
+                                                  CACHE_SHARDS));
+    failure_limit_.store(std::max(0, config.get_auth_failure_limit()));
+    failure_window_seconds_.store(std::max(1, config.get_auth_failure_window_seconds()));
+
+    std::shared_ptr<const Snapshot> previous = current();
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->generation = ++generation_;
+    size_t rejected = 0;
+
+    auto user_for = [&](const std::string& name) -> User& {
+        User& user = snapshot->users[name];
+        if (!user.counters) {
+            auto old = previous->users.find(name);
+            user.counters = old != previous->users.end() ? old->second.counters
+                                                         : std::make_shared<AuthCounters>();
+        }
+        return user;
+    };
+
+    std::string users_file = config.get_auth_users_file();
+    if (!users_file.empty()) {
+        std::ifstream file(users_file);
+        if (!file.is_open()) {
+            Logger::error("Не удалось открыть файл пользователей: " + users_file +
+                          ", сохраняется текущий список");
+            return false;
+        }
+        std::string raw;
+        int line_number = 0;
+        while (std::getline(file, raw)) {
+            ++line_number;
+            std::string line = Utils::trim(raw);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            size_t space = line.find_first_of(" \t");
+            std::string name = line.substr(0, space);
+            std::string secret = space == std::string::npos ? std::string() : Utils::trim(line.substr(space));
+            std::string source = users_file + ":" + std::to_string(line_number);
+            PasswordHash hash;
+            if (!valid_name(name)) {
+                ++rejected;
+                Logger::warning("Пропущен пользователь (" + source + "): недопустимое имя");
+            } else if (secret.compare(0, 6, "token$") == 0 && secret.size() == 6 + 2 * Crypto::HASH_SIZE) {
+                user_for(name);
+                snapshot->tokens[secret.substr(6)] = name;
+            } else if (parse_secret(secret, hash)) {
+                if (snapshot->dummy.n == 0) {
+                    snapshot->dummy = hash;
+                }
+                user_for(name).passwords.push_back(std::move(hash));
+            } else {
+                ++rejected;
+                Logger::warning("Пропущен пользователь (" + source + "): неверный формат секрета");
+            }
+        }
+    } else if (config.is_auth_enabled()) {
+        // Единственный пользователь конфигурации; хэш только в памяти
+        PasswordHash hash;
+        if (!parse_secret(hash_password(config.get_password()), hash)) {
+            Logger::error("Не удалось вычислить хэш пароля, сохраняется текущий список");
+            return false;
+        }
+        snapshot->dummy = hash;
+        user_for(config.get_username()).passwords.push_back(std::move(hash));
+    }
+
+    // Неизвестное имя проверяется с параметрами первого хэша файла, чтобы
+    // стоимость отказа не отличалась от настоящей проверки
+    PasswordHash& dummy = snapshot->dummy;
+    if (dummy.n == 0) {
+        dummy.n = 16384;
+        dummy.r = 8;
+        dummy.p = 1;
+        dummy.salt.resize(SALT_SIZE);
+        dummy.hash.resize(DERIVED_SIZE);
+    }
+    if (!Crypto::random_bytes(reinterpret_cast<uint8_t*>(&dummy.salt[0]), dummy.salt.size())) {
+        std::fill(dummy.salt.begin(), dummy.salt.end(), '\0');
+    }
+
+    size_t users = snapshot->users.size();
+    size_t tokens = snapshot->tokens.size();
+    std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(std::move(snapshot)));
+    enabled_.store(config.is_auth_enabled());
+
+    if (config.is_auth_enabled()) {
+        Logger::info("Пользователи загружены: " + std::to_string(users) + ", токенов " + std::to_string(tokens) +
+                     ", пропущено " + std::to_string(rejected));
+        if (users == 0) {
+            Logger::warning("Аутентификация включена, но пользователей нет: все соединения будут отклонены");
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<const CredentialStore::Snapshot> CredentialStore::current() const {
+    return std::atomic_load(&snapshot_);
+}
+
+bool CredentialStore::verify_password(const std::string& name, const std::string& password,
+                                      const std::string& client) {
+    static MetricValue& failed = Metrics::counter("auth_failed_total");
+    std::shared_ptr<const Snapshot> snapshot = current();
+    auto it = snapshot->users.find(name);
+    bool known = it != snapshot->users.end() && !it->second.passwords.empty();
+
+    std::string key = cache_key(name, password);
+    if (known && cached(key, *snapshot, name)) {
+        ++it->second.counters->cache_hits;
+        ++it->second.counters->logins;
+        return true;
+    }
+
+    // Адрес, исчерпавший лимит неудач, не получает scrypt до конца окна
+    if (throttled(client)) {
+        ++throttled_total_;
+        failed.add();
+        return false;
+    }
+
+    if (!known) {
+        // Тот же scrypt, что и для известного имени: время ответа не
+        // выдает, есть ли такой пользователь
+        std::string derived = derive_bounded(password, snapshot->dummy);
+        Utils::constant_time_equals(derived, snapshot->dummy.hash);
+        if (it == snapshot->users.end()) {
+            ++unknown_total_;
+        } else {
+            ++it->second.counters->failures;
+        }
+        record_failure(client);
+        failed.add();
+        return false;
+    }
+    const User& user = it->second;
+
+    bool matched = false;
+    for (const PasswordHash& hash : user.passwords) {
+        std::string derived = derive_bounded(password, hash);
+        // Проверяются все хэши пользователя, без выхода на первом совпадении
+        if (!derived.empty() && Utils::constant_time_equals(derived, hash.hash)) {
+            matched = true;
+        }
+    }
+    if (!matched) {
+        ++user.counters->failures;
+        record_failure(client);
+        failed.add();
+        return false;
+    }
+    clear_failures(client);
+    remember(key, *snapshot, name);
+    ++user.counters->logins;
+    return true;
+}
+
+std::string CredentialStore::derive_bounded(const std::string& password, const PasswordHash& hash) {
+    static LogSite& site = Logger::site("auth.scrypt");
+    // Память Crypto::scrypt: V (n блоков), B (p блоков) и два рабочих блока
+    size_t bytes = 128 * static_cast<size_t>(hash.r) * (static_cast<size_t>(hash.n) + hash.p + 2);
+    {
+        std::unique_lock<std::mutex> lock(scrypt_mutex_);
+        scrypt_cv_.wait(lock, [this] { return scrypt_running_ < scrypt_slots_; });
+        ++scrypt_running_;
+    }
+    std::string derived;
+    if (memory_.try_reserve(bytes)) {
+        ++scrypt_total_;
+        derived = derive(password, hash.salt, hash.n, hash.r, hash.p);
+        memory_.release(bytes);
+    } else {
+        ++scrypt_refused_total_;
+        Logger::warning(site, "Проверка пароля отклонена: нет памяти для scrypt (" + std::to_string(bytes) +
+                                  " байт)");
+    }
+    {
+        std::lock_guard<std::mutex> lock(scrypt_mutex_);
+        --scrypt_running_;
+    }
+    scrypt_cv_.notify_one();
+    return derived;
+}
+
+bool CredentialStore::throttled(const std::string& client) {
+    int limit = failure_limit_.load(std::memory_order_relaxed);
+    if (client.empty() || limit <= 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(failures_mutex_);
+    auto it = failures_.find(client);
+    if (it == failures_.end()) {
+        return false;
+    }
+    if (it->second.window_end <= std::chrono::steady_clock::now()) {
+        failures_.erase(it);
+        return false;
+    }
+    return it->second.count >= limit;
+}
+
+void CredentialStore::record_failure(const std::string& client) {
+    if (client.empty() || failure_limit_.load(std::memory_order_relaxed) <= 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(failures_mutex_);
+    auto it = failures_.find(client);
+    if (it != failures_.end() && it->second.window_end > now) {
+        ++it->second.count;
+        return;
+    }
+    if (it == failures_.end() && failures_.size() >= MAX_FAILURE_CLIENTS) {
+        for (auto entry = failures_.begin(); entry != failures_.end();) {
+            entry = entry->second.window_end <= now ? failures_.erase(entry) : std::next(entry);
+        }
+        if (failures_.size() >= MAX_FAILURE_CLIENTS) {
+            failures_.erase(failures_.begin());
+        }
+    }
+    ClientFailures& entry = failures_[client];
+    entry.count = 1;
+    entry.window_end = now + std::chrono::seconds(failure_window_seconds_.load(std::memory_order_relaxed));
+}
+
+void CredentialStore::clear_failures(const std::string& client) {
+    if (client.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(failures_mutex_);
+    failures_.erase(client);
+}
+
+bool CredentialStore::verify_token(const std::string& token, std::string& user) {
+    static MetricValue& failed = Metrics::counter("auth_failed_total");
+    std::shared_ptr<const Snapshot> snapshot = current();
+    // Поиск идет по SHA-256 токена: время поиска не говорит ничего о
+    // самом токене
+    auto it = snapshot->tokens.find(token_digest(token));
+    if (it == snapshot->tokens.end()) {
+        failed.add();
+        return false;
+    }
+    user = it->second;
+    auto owner = snapshot->users.find(user);
+    if (owner != snapshot->users.end()) {
+        ++owner->second.counters->logins;
+    }
+    return true;
+}
+
+bool CredentialStore::verify_header(const std::string& value, std::string& user, const std::string& client) {
+    std::string credentials;
+    if (starts_with_scheme(value, "Basic", credentials)) {
+        std::string decoded;
+        size_t colon;
+        if (!Utils::base64_decode(credentials, decoded) || (colon = decoded.find(':')) == std::string::npos) {
+            return false;
+        }
+        user = decoded.substr(0, colon);
+        return verify_password(user, decoded.substr(colon + 1), client);
+    }
+    if (starts_with_scheme(value, "Bearer", credentials)) {
+        return verify_token(credentials, user);
+    }
+    return false;
+}
+
+std::string CredentialStore::cache_key(const std::string& name, const std::string& password) const {
+    std::string data;
+    data.reserve(name.size() + 1 + password.size());
+    data.append(name).append(1, '\0').append(password);
+    uint8_t mac[Crypto::HASH_SIZE];
+    Crypto::hmac_sha256(cache_key_, sizeof(cache_key_), reinterpret_cast<const uint8_t*>(data.data()),
+                        data.size(), mac);
+    return std::string(reinterpret_cast<const char*>(mac), sizeof(mac));
+}
+
+bool CredentialStore::cached(const std::string& key, const Snapshot& snapshot, const std::string& name) {
+    CacheShard& shard = shards_[static_cast<uint8_t>(key[0]) % CACHE_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        return false;
+    }
+    if (it->second.generation != snapshot.generation || it->second.user != name ||
+        it->second.expires <= std::chrono::steady_clock::now()) {
+        shard.entries.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void CredentialStore::remember(const std::string& key, const Snapshot& snapshot, const std::string& name) {
+    int ttl = cache_ttl_seconds_.load(std::memory_order_relaxed);
+    if (ttl <= 0) {
+        return;
+    }
+    CacheShard& shard = shards_[static_cast<uint8_t>(key[0]) % CACHE_SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t capacity = shard_capacity_.load(std::memory_order_relaxed);
+    while (shard.entries.size() >= capacity) {
+        // Ключи - HMAC, так что первая запись таблицы - случайная
+        shard.entries.erase(shard.entries.begin());
+    }
+    CacheEntry& entry = shard.entries[key];
+    entry.user = name;
+    entry.generation = snapshot.generation;
+    entry.expires = std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+}
+
+bool CredentialStore::parse_secret(const std::string& secret, PasswordHash& hash) {
+    std::vector<std::string> parts = Utils::split(secret, '$');
+    if (parts.size() != 6 || parts[0] != "scrypt") {
+        return false;
+    }
+    try {
+        hash.n = std::stoull(parts[1]);
+        unsigned long r = std::stoul(parts[2]);
+        unsigned long p = std::stoul(parts[3]);
+        if (r == 0 || p == 0 || r > 64 || p > 64) {
+            return false;
+        }
+        hash.r = static_cast<uint32_t>(r);
+        hash.p = static_cast<uint32_t>(p);
+    } catch (const std::exception&) {
+        return false;
+    }
+    // Те же ограничения, что у Crypto::scrypt
+    if (hash.n < 2 || (hash.n & (hash.n - 1)) != 0 || hash.n > Crypto::SCRYPT_MAX_MEMORY / (128 * hash.r)) {
+        return false;
+    }
+    if (parts[4].empty() || parts[4].size() % 2 != 0 || parts[5].size() != 2 * DERIVED_SIZE) {
+        return false;
+    }
+    hash.salt.resize(parts[4].size() / 2);
+    hash.hash.resize(DERIVED_SIZE);
+    return Crypto::from_hex(parts[4], reinterpret_cast<uint8_t*>(&hash.salt[0]), hash.salt.size()) &&
+           Crypto::from_hex(parts[5], reinterpret_cast<uint8_t*>(&hash.hash[0]), hash.hash.size());
+}
+
+std::string CredentialStore::hash_password(const std::string& password, uint64_t n, uint32_t r, uint32_t p) {
+    uint8_t salt[SALT_SIZE];
+    if (!Crypto::random_bytes(salt, sizeof(salt))) {
+        return std::string();
+    }
+    std::string derived = derive(password, std::string(reinterpret_cast<const char*>(salt), sizeof(salt)), n, r, p);
+    if (derived.empty()) {
+        return std::string();
+    }
+    return "scrypt$" + std::to_string(n) + "$" + std::to_string(r) + "$" + std::to_string(p) + "$" +
+           Crypto::to_hex(salt, sizeof(salt)) + "$" +
+           Crypto::to_hex(reinterpret_cast<const uint8_t*>(derived.data()), derived.size());
+}
+
+std::string CredentialStore::hash_token(const std::string& token) {
+    return "token$" + token_digest(token);
+}
+
+size_t CredentialStore::users() const {
+    return current()->users.size();
+}
+
+void CredentialStore::render_metrics(std::ostream& out) {
+    std::shared_ptr<const Snapshot> snapshot = current();
+    size_t entries = 0;
+    for (CacheShard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        entries += shard.entries.size();
+    }
+    out << "auth_users " << snapshot->users.size() << "\n";
+    out << "auth_tokens " << snapshot->tokens.size() << "\n";
+    out << "auth_cache_entries " << entries << "\n";
+    size_t clients = 0;
+    {
+        std::lock_guard<std::mutex> lock(failures_mutex_);
+        clients = failures_.size();
+    }
+    out << "auth_scrypt_total " << scrypt_total_.load() << "\n";
+    out << "auth_scrypt_refused_total " << scrypt_refused_total_.load() << "\n";
+    out << "auth_unknown_user_total " << unknown_total_.load() << "\n";
+    out << "auth_throttled_total " << throttled_total_.load() << "\n";
+    out << "auth_failure_clients " << clients << "\n";
+    for (const auto& item : snapshot->users) {
+        const AuthCounters& counters = *item.second.counters;
+        out << "auth_user_logins_total{user=\"" << item.first << "\"} " << counters.logins.load() << "\n";
+        out << "auth_user_failures_total{user=\"" << item.first << "\"} " << counters.failures.load() << "\n";
+        out << "auth_user_cache_hits_total{user=\"" << item.first << "\"} " << counters.cache_hits.load() << "\n";
+    }
+}
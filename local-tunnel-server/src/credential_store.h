@@ -0,0 +1,154 @@
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "crypto.h"
+
+class Config;
+class MemoryBudget;
+
+// Счетчики пользователя; переживают перезагрузку списка пользователей
+struct AuthCounters {
+    std::atomic<uint64_t> logins{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> cache_hits{0};
+};
+
+// Учетные данные клиентов прокси. Пароли хранятся хэшами scrypt с солью,
+// токены (Bearer) - хэшами SHA-256. Пароль, проверенный scrypt, запоминается
+// в шардированном кэше по HMAC пары имя/пароль с ключом процесса: повторный
+// вход стоит одного HMAC вместо scrypt. Неудачные попытки не кэшируются.
+// Перезагрузка атомарно подменяет список; записи кэша прежнего списка не
+// используются.
+//
+// scrypt доступен клиенту до аутентификации, поэтому его стоимость
+// ограничена: одновременно выполняется не больше вычислений, чем ядер, их
+// память резервируется в общем бюджете, а адрес, исчерпавший лимит неудач
+// за окно, до конца окна получает отказ без scrypt.
+class CredentialStore {
+public:
+    static constexpr size_t CACHE_SHARDS = 16;
+    static constexpr size_t MAX_FAILURE_CLIENTS = 65536;
+
+    explicit CredentialStore(MemoryBudget& memory);
+    ~CredentialStore();
+
+    // Пользователи из authentication.users_file или, если файл не задан, -
+    // username/password конфигурации. false - файл не прочитан, действует
+    // прежний список
+    bool load(const Config& config);
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // client - адрес клиента для лимита неудачных попыток; пустой - без
+    // лимита
+    bool verify_password(const std::string& name, const std::string& password,
+                         const std::string& client = std::string());
+    // user - владелец токена
+    bool verify_token(const std::string& token, std::string& user);
+    // Значение Proxy-Authorization: "Basic base64(имя:пароль)" или
+    // "Bearer токен"; user - имя из заголовка, если оно есть
+    bool verify_header(const std::string& value, std::string& user, const std::string& client = std::string());
+
+    // Секрет строки файла пользователей: "scrypt$n$r$p$соль$хэш" и
+    // "token$sha256"
+    static std::string hash_password(const std::string& password, uint64_t n = 16384, uint32_t r = 8,
+                                     uint32_t p = 1);
+    static std::string hash_token(const std::string& token);
+
+    size_t users() const;
+    void render_metrics(std::ostream& out);
+
+private:
+    struct PasswordHash {
+        uint64_t n{0};
+        uint32_t r{0};
+        uint32_t p{0};
+        std::string salt;
+        std::string hash;
+    };
+
+    struct User {
+        std::vector<PasswordHash> passwords;
+        std::shared_ptr<AuthCounters> counters;
+    };
+
+    // Неизменяемый список пользователей; generation отличает записи кэша.
+    // dummy - параметры настоящих хэшей со случайной солью для проверки
+    // неизвестного имени
+    struct Snapshot {
+        uint64_t generation{0};
+        std::unordered_map<std::string, User> users;
+        std::unordered_map<std::string, std::string> tokens;  // SHA-256 токена -> имя
+        PasswordHash dummy;
+    };
+
+    struct CacheEntry {
+        std::string user;
+        uint64_t generation{0};
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct ClientFailures {
+        int count{0};
+        std::chrono::steady_clock::time_point window_end;
+    };
+
+    struct alignas(64) CacheShard {
+        std::mutex mutex;
+        std::unordered_map<std::string, CacheEntry> entries;
+    };
+
+    MemoryBudget& memory_;
+    std::atomic<bool> enabled_{false};
+    std::shared_ptr<const Snapshot> snapshot_;
+    std::mutex load_mutex_;
+    uint64_t generation_{0};
+
+    uint8_t cache_key_[Crypto::HASH_SIZE];
+    std::atomic<int> cache_ttl_seconds_{300};
+    std::atomic<size_t> shard_capacity_{256};
+    CacheShard shards_[CACHE_SHARDS];
+
+    // Семафор вычислений scrypt
+    std::mutex scrypt_mutex_;
+    std::condition_variable scrypt_cv_;
+    unsigned scrypt_running_{0};
+    unsigned scrypt_slots_;
+
+    std::atomic<int> failure_limit_{10};
+    std::atomic<int> failure_window_seconds_{60};
+    std::mutex failures_mutex_;
+    std::unordered_map<std::string, ClientFailures> failures_;
+
+    std::atomic<uint64_t> scrypt_total_{0};
+    std::atomic<uint64_t> scrypt_refused_total_{0};
+    std::atomic<uint64_t> unknown_total_{0};
+    std::atomic<uint64_t> throttled_total_{0};
+
+    std::shared_ptr<const Snapshot> current() const;
+    std::string cache_key(const std::string& name, const std::string& password) const;
+    bool cached(const std::string& key, const Snapshot& snapshot, const std::string& name);
+    void remember(const std::string& key, const Snapshot& snapshot, const std::string& name);
+    static bool parse_secret(const std::string& secret, PasswordHash& hash);
+
+    // scrypt в пределах семафора и бюджета памяти; пустая строка - отказ
+    std::string derive_bounded(const std::string& password, const PasswordHash& hash);
+    bool throttled(const std::string& client);
+    void record_failure(const std::string& client);
+    void clear_failures(const std::string& client);
+
+    CredentialStore(const CredentialStore&) = delete;
+    CredentialStore& operator=(const CredentialStore&) = delete;
+};
+
+#endif // CREDENTIAL_STORE_H
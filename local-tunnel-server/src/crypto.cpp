@@ -0,0 +1,511 @@
+#include "crypto.h"
+#include "uint128.h"
+#include <sys/random.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// --- SHA-256 (FIPS 180-4) ---
+
+const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+class Sha256 {
+public:
+    Sha256() {
+        static const uint32_t initial[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        std::memcpy(state_, initial, sizeof(state_));
+    }
+
+    void update(const uint8_t* data, size_t size) {
+        total_ += size;
+        if (used_ > 0) {
+            size_t part = std::min(size, sizeof(block_) - used_);
+            std::memcpy(block_ + used_, data, part);
+            used_ += part;
+            data += part;
+            size -= part;
+            if (used_ < sizeof(block_)) {
+                return;
+            }
+            compress(block_);
+            used_ = 0;
+        }
+        for (; size >= sizeof(block_); data += sizeof(block_), size -= sizeof(block_)) {
+            compress(data);
+        }
+        std::memcpy(block_, data, size);
+        used_ = size;
+    }
+
+    void finish(uint8_t out[Crypto::HASH_SIZE]) {
+        uint64_t bits = total_ * 8;
+        uint8_t padding[72] = {0x80};
+        size_t pad = (used_ < 56 ? 56 : 120) - used_;
+        for (int i = 0; i < 8; ++i) {
+            padding[pad + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+        }
+        update(padding, pad + 8);
+        for (int i = 0; i < 8; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                out[4 * i + j] = static_cast<uint8_t>(state_[i] >> (24 - 8 * j));
+            }
+        }
+    }
+
+private:
+    uint32_t state_[8];
+    uint8_t block_[64];
+    size_t used_{0};
+    uint64_t total_{0};
+
+    void compress(const uint8_t* block) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = static_cast<uint32_t>(block[4 * i]) << 24 | static_cast<uint32_t>(block[4 * i + 1]) << 16 |
+                   static_cast<uint32_t>(block[4 * i + 2]) << 8 | block[4 * i + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+        uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state_[0] += a;
+        state_[1] += b;
+        state_[2] += c;
+        state_[3] += d;
+        state_[4] += e;
+        state_[5] += f;
+        state_[6] += g;
+        state_[7] += h;
+    }
+};
+
+// --- X25519: поле по модулю 2^255 - 19, пять 51-битных частей ---
+
+typedef uint64_t Field[5];
+
+constexpr uint64_t MASK51 = (1ULL << 51) - 1;
+
+inline uint64_t load64(const uint8_t* in) {
+    uint64_t value;
+    std::memcpy(&value, in, sizeof(value));
+    return value;  // Только little-endian, как и весь сервер
+}
+
+void field_from_bytes(Field h, const uint8_t in[32]) {
+    h[0] = load64(in) & MASK51;
+    h[1] = (load64(in + 6) >> 3) & MASK51;
+    h[2] = (load64(in + 12) >> 6) & MASK51;
+    h[3] = (load64(in + 19) >> 1) & MASK51;
+    h[4] = (load64(in + 24) >> 12) & MASK51;
+}
+
+void field_carry(Field h) {
+    uint64_t carry;
+    carry = h[0] >> 51; h[0] &= MASK51; h[1] += carry;
+    carry = h[1] >> 51; h[1] &= MASK51; h[2] += carry;
+    carry = h[2] >> 51; h[2] &= MASK51; h[3] += carry;
+    carry = h[3] >> 51; h[3] &= MASK51; h[4] += carry;
+    carry = h[4] >> 51; h[4] &= MASK51; h[0] += carry * 19;
+    carry = h[0] >> 51; h[0] &= MASK51; h[1] += carry;
+}
+
+void field_to_bytes(uint8_t out[32], const Field f) {
+    Field h = {f[0], f[1], f[2], f[3], f[4]};
+    field_carry(h);
+    field_carry(h);
+
+    // Вычитание p, если h >= p: q = 1 ровно тогда, когда h + 19 >= 2^255
+    uint64_t q = (h[0] + 19) >> 51;
+    q = (h[1] + q) >> 51;
+    q = (h[2] + q) >> 51;
+    q = (h[3] + q) >> 51;
+    q = (h[4] + q) >> 51;
+    h[0] += 19 * q;
+    uint64_t carry;
+    carry = h[0] >> 51; h[0] &= MASK51; h[1] += carry;
+    carry = h[1] >> 51; h[1] &= MASK51; h[2] += carry;
+    carry = h[2] >> 51; h[2] &= MASK51; h[3] += carry;
+    carry = h[3] >> 51; h[3] &= MASK51; h[4] += carry;
+    h[4] &= MASK51;
+
+    uint64_t words[4] = {
+        h[0] | (h[1] << 51),
+        (h[1] >> 13) | (h[2] << 38),
+        (h[2] >> 26) | (h[3] << 25),
+        (h[3] >> 39) | (h[4] << 12)
+    };
+    std::memcpy(out, words, sizeof(words));
+}
+
+void field_add(Field h, const Field f, const Field g) {
+    for (int i = 0; i < 5; ++i) {
+        h[i] = f[i] + g[i];
+    }
+    field_carry(h);
+}
+
+void field_sub(Field h, const Field f, const Field g) {
+    // + 2p, чтобы части не ушли в минус
+    h[0] = f[0] + 0xfffffffffffdaULL - g[0];
+    for (int i = 1; i < 5; ++i) {
+        h[i] = f[i] + 0xffffffffffffeULL - g[i];
+    }
+    field_carry(h);
+}
+
+void field_mul(Field h, const Field f, const Field g) {
+    uint64_t g1_19 = g[1] * 19, g2_19 = g[2] * 19, g3_19 = g[3] * 19, g4_19 = g[4] * 19;
+    uint128_t r0 = (uint128_t)f[0] * g[0] + (uint128_t)f[1] * g4_19 + (uint128_t)f[2] * g3_19 +
+                   (uint128_t)f[3] * g2_19 + (uint128_t)f[4] * g1_19;
+    uint128_t r1 = (uint128_t)f[0] * g[1] + (uint128_t)f[1] * g[0] + (uint128_t)f[2] * g4_19 +
+                   (uint128_t)f[3] * g3_19 + (uint128_t)f[4] * g2_19;
+    uint128_t r2 = (uint128_t)f[0] * g[2] + (uint128_t)f[1] * g[1] + (uint128_t)f[2] * g[0] +
+                   (uint128_t)f[3] * g4_19 + (uint128_t)f[4] * g3_19;
+    uint128_t r3 = (uint128_t)f[0] * g[3] + (uint128_t)f[1] * g[2] + (uint128_t)f[2] * g[1] +
+                   (uint128_t)f[3] * g[0] + (uint128_t)f[4] * g4_19;
+    uint128_t r4 = (uint128_t)f[0] * g[4] + (uint128_t)f[1] * g[3] + (uint128_t)f[2] * g[2] +
+                   (uint128_t)f[3] * g[1] + (uint128_t)f[4] * g[0];
+
+    r1 += static_cast<uint64_t>(r0 >> 51);
+    r2 += static_cast<uint64_t>(r1 >> 51);
+    r3 += static_cast<uint64_t>(r2 >> 51);
+    r4 += static_cast<uint64_t>(r3 >> 51);
+    h[0] = (static_cast<uint64_t>(r0) & MASK51) + static_cast<uint64_t>(r4 >> 51) * 19;
+    h[1] = static_cast<uint64_t>(r1) & MASK51;
+    h[2] = static_cast<uint64_t>(r2) & MASK51;
+    h[3] = static_cast<uint64_t>(r3) & MASK51;
+    h[4] = static_cast<uint64_t>(r4) & MASK51;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+void field_mul_small(Field h, const Field f, uint64_t n) {
+    uint128_t carry = 0;
+    for (int i = 0; i < 5; ++i) {
+        uint128_t value = (uint128_t)f[i] * n + carry;
+        h[i] = static_cast<uint64_t>(value) & MASK51;
+        carry = value >> 51;
+    }
+    h[0] += static_cast<uint64_t>(carry) * 19;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+// z^(p - 2) = z^-1; p - 2 = 2^255 - 21: все биты единичные, кроме 2 и 4
+void field_invert(Field out, const Field z) {
+    Field result = {1, 0, 0, 0, 0};
+    for (int bit = 254; bit >= 0; --bit) {
+        field_mul(result, result, result);
+        if (bit != 2 && bit != 4) {
+            field_mul(result, result, z);
+        }
+    }
+    std::memcpy(out, result, sizeof(Field));
+}
+
+void field_swap(Field f, Field g, uint64_t swap) {
+    uint64_t mask = 0 - swap;
+    for (int i = 0; i < 5; ++i) {
+        uint64_t x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+// Лестница Монтгомери (RFC 7748, раздел 5) за постоянное время
+void scalar_mult(uint8_t out[32], const uint8_t scalar[32], const uint8_t point[32]) {
+    uint8_t k[32];
+    std::memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    Field x1, x2 = {1, 0, 0, 0, 0}, z2 = {0, 0, 0, 0, 0}, x3, z3 = {1, 0, 0, 0, 0};
+    field_from_bytes(x1, point);
+    std::memcpy(x3, x1, sizeof(Field));
+
+    uint64_t swap = 0;
+    for (int t = 254; t >= 0; --t) {
+        uint64_t bit = (k[t / 8] >> (t % 8)) & 1;
+        swap ^= bit;
+        field_swap(x2, x3, swap);
+        field_swap(z2, z3, swap);
+        swap = bit;
+
+        Field a, aa, b, bb, e, c, d, da, cb, t0;
+        field_add(a, x2, z2);
+        field_mul(aa, a, a);
+        field_sub(b, x2, z2);
+        field_mul(bb, b, b);
+        field_sub(e, aa, bb);
+        field_add(c, x3, z3);
+        field_sub(d, x3, z3);
+        field_mul(da, d, a);
+        field_mul(cb, c, b);
+
+        field_add(t0, da, cb);
+        field_mul(x3, t0, t0);
+        field_sub(t0, da, cb);
+        field_mul(t0, t0, t0);
+        field_mul(z3, x1, t0);
+
+        field_mul(x2, aa, bb);
+        field_mul_small(t0, e, 121665);
+        field_add(t0, aa, t0);
+        field_mul(z2, e, t0);
+    }
+    field_swap(x2, x3, swap);
+    field_swap(z2, z3, swap);
+
+    Field inverse;
+    field_invert(inverse, z2);
+    field_mul(x2, x2, inverse);
+    field_to_bytes(out, x2);
+    std::memset(k, 0, sizeof(k));
+}
+
+// --- scrypt (RFC 7914): Salsa20/8, BlockMix и ROMix над словами ---
+
+inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+void salsa20_8(uint32_t b[16]) {
+    uint32_t x[16];
+    std::memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= rotl(x[0] + x[12], 7);   x[8] ^= rotl(x[4] + x[0], 9);
+        x[12] ^= rotl(x[8] + x[4], 13);  x[0] ^= rotl(x[12] + x[8], 18);
+        x[9] ^= rotl(x[5] + x[1], 7);    x[13] ^= rotl(x[9] + x[5], 9);
+        x[1] ^= rotl(x[13] + x[9], 13);  x[5] ^= rotl(x[1] + x[13], 18);
+        x[14] ^= rotl(x[10] + x[6], 7);  x[2] ^= rotl(x[14] + x[10], 9);
+        x[6] ^= rotl(x[2] + x[14], 13);  x[10] ^= rotl(x[6] + x[2], 18);
+        x[3] ^= rotl(x[15] + x[11], 7);  x[7] ^= rotl(x[3] + x[15], 9);
+        x[11] ^= rotl(x[7] + x[3], 13);  x[15] ^= rotl(x[11] + x[7], 18);
+        x[1] ^= rotl(x[0] + x[3], 7);    x[2] ^= rotl(x[1] + x[0], 9);
+        x[3] ^= rotl(x[2] + x[1], 13);   x[0] ^= rotl(x[3] + x[2], 18);
+        x[6] ^= rotl(x[5] + x[4], 7);    x[7] ^= rotl(x[6] + x[5], 9);
+        x[4] ^= rotl(x[7] + x[6], 13);   x[5] ^= rotl(x[4] + x[7], 18);
+        x[11] ^= rotl(x[10] + x[9], 7);  x[8] ^= rotl(x[11] + x[10], 9);
+        x[9] ^= rotl(x[8] + x[11], 13);  x[10] ^= rotl(x[9] + x[8], 18);
+        x[12] ^= rotl(x[15] + x[14], 7); x[13] ^= rotl(x[12] + x[15], 9);
+        x[14] ^= rotl(x[13] + x[12], 13); x[15] ^= rotl(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; ++i) {
+        b[i] += x[i];
+    }
+}
+
+// 2r блоков по 16 слов: четные блоки результата - в первую половину out,
+// нечетные - во вторую
+void block_mix(const uint32_t* in, uint32_t* out, size_t r) {
+    uint32_t x[16];
+    std::memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+    for (size_t i = 0; i < 2 * r; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            x[j] ^= in[i * 16 + j];
+        }
+        salsa20_8(x);
+        std::memcpy(out + ((i / 2) + (i & 1) * r) * 16, x, sizeof(x));
+    }
+}
+
+// b - 128 * r байт; v - n блоков, x и y - по блоку
+void ro_mix(uint8_t* b, size_t r, uint64_t n, uint32_t* v, uint32_t* x, uint32_t* y) {
+    size_t words = 32 * r;
+    std::memcpy(x, b, words * 4);  // Только little-endian, как и весь сервер
+    for (uint64_t i = 0; i < n; ++i) {
+        std::memcpy(v + i * words, x, words * 4);
+        block_mix(x, y, r);
+        std::swap(x, y);
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+        for (size_t k = 0; k < words; ++k) {
+            x[k] ^= v[j * words + k];
+        }
+        block_mix(x, y, r);
+        std::swap(x, y);
+    }
+    std::memcpy(b, x, words * 4);
+}
+
+}  // namespace
+
+namespace Crypto {
+
+bool random_bytes(uint8_t* out, size_t size) {
+    while (size > 0) {
+        ssize_t received = getrandom(out, size, 0);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        out += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+void sha256(const uint8_t* data, size_t size, uint8_t out[HASH_SIZE]) {
+    Sha256 hash;
+    hash.update(data, size);
+    hash.finish(out);
+}
+
+void hmac_sha256(const uint8_t* key, size_t key_size, const uint8_t* data, size_t size,
+                 uint8_t out[HASH_SIZE]) {
+    uint8_t block[64] = {};
+    if (key_size > sizeof(block)) {
+        sha256(key, key_size, block);
+    } else {
+        std::memcpy(block, key, key_size);
+    }
+
+    uint8_t pad[64];
+    for (size_t i = 0; i < sizeof(pad); ++i) {
+        pad[i] = block[i] ^ 0x36;
+    }
+    uint8_t inner[HASH_SIZE];
+    Sha256 inner_hash;
+    inner_hash.update(pad, sizeof(pad));
+    inner_hash.update(data, size);
+    inner_hash.finish(inner);
+
+    for (size_t i = 0; i < sizeof(pad); ++i) {
+        pad[i] = block[i] ^ 0x5c;
+    }
+    Sha256 outer_hash;
+    outer_hash.update(pad, sizeof(pad));
+    outer_hash.update(inner, sizeof(inner));
+    outer_hash.finish(out);
+}
+
+void pbkdf2_sha256(const uint8_t* password, size_t password_size, const uint8_t* salt, size_t salt_size,
+                   uint32_t iterations, uint8_t* out, size_t out_size) {
+    std::vector<uint8_t> block(salt, salt + salt_size);
+    block.resize(salt_size + 4);
+    for (uint32_t index = 1; out_size > 0; ++index) {
+        block[salt_size] = static_cast<uint8_t>(index >> 24);
+        block[salt_size + 1] = static_cast<uint8_t>(index >> 16);
+        block[salt_size + 2] = static_cast<uint8_t>(index >> 8);
+        block[salt_size + 3] = static_cast<uint8_t>(index);
+        uint8_t u[HASH_SIZE];
+        uint8_t t[HASH_SIZE];
+        hmac_sha256(password, password_size, block.data(), block.size(), u);
+        std::memcpy(t, u, sizeof(t));
+        for (uint32_t i = 1; i < iterations; ++i) {
+            hmac_sha256(password, password_size, u, sizeof(u), u);
+            for (size_t k = 0; k < sizeof(t); ++k) {
+                t[k] ^= u[k];
+            }
+        }
+        size_t length = std::min(out_size, sizeof(t));
+        std::memcpy(out, t, length);
+        out += length;
+        out_size -= length;
+    }
+}
+
+bool scrypt(const uint8_t* password, size_t password_size, const uint8_t* salt, size_t salt_size,
+            uint64_t n, uint32_t r, uint32_t p, uint8_t* out, size_t out_size) {
+    if (n < 2 || (n & (n - 1)) != 0 || r == 0 || p == 0 ||
+        static_cast<uint64_t>(r) * p >= (1u << 30) || n > SCRYPT_MAX_MEMORY / (128 * r)) {
+        return false;
+    }
+    size_t block_size = 128 * static_cast<size_t>(r);
+    std::vector<uint8_t> b(block_size * p);
+    pbkdf2_sha256(password, password_size, salt, salt_size, 1, b.data(), b.size());
+
+    std::vector<uint32_t> v(static_cast<size_t>(n) * 32 * r);
+    std::vector<uint32_t> x(32 * r);
+    std::vector<uint32_t> y(32 * r);
+    for (uint32_t i = 0; i < p; ++i) {
+        ro_mix(b.data() + i * block_size, r, n, v.data(), x.data(), y.data());
+    }
+    pbkdf2_sha256(password, password_size, b.data(), b.size(), 1, out, out_size);
+    return true;
+}
+
+bool x25519(uint8_t out[KEY_SIZE], const uint8_t scalar[KEY_SIZE], const uint8_t point[KEY_SIZE]) {
+    scalar_mult(out, scalar, point);
+    uint8_t any = 0;
+    for (size_t i = 0; i < KEY_SIZE; ++i) {
+        any |= out[i];
+    }
+    return any != 0;
+}
+
+void x25519_base(uint8_t out[KEY_SIZE], const uint8_t scalar[KEY_SIZE]) {
+    static const uint8_t base[KEY_SIZE] = {9};
+    scalar_mult(out, scalar, base);
+}
+
+std::string to_hex(const uint8_t* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(size * 2, '0');
+    for (size_t i = 0; i < size; ++i) {
+        text[2 * i] = digits[data[i] >> 4];
+        text[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+    return text;
+}
+
+bool from_hex(const std::string& text, uint8_t* out, size_t size) {
+    if (text.size() != size * 2) {
+        return false;
+    }
+    auto digit = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < size; ++i) {
+        int high = digit(text[2 * i]);
+        int low = digit(text[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return true;
+}
+
+}  // namespace Crypto
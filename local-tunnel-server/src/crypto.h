@@ -0,0 +1,42 @@
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Примитивы для согласования ключей шифрованных туннелей: случайные байты
+// из ядра, SHA-256 и HMAC для вывода ключей и обмен ключами X25519
+// (RFC 7748); scrypt (RFC 7914) для хэшей паролей. Ключи и хэши - массивы
+// байт фиксированной длины.
+namespace Crypto {
+    constexpr size_t KEY_SIZE = 32;
+    constexpr size_t HASH_SIZE = 32;
+
+    // false - ядро не выдало случайные байты
+    bool random_bytes(uint8_t* out, size_t size);
+
+    void sha256(const uint8_t* data, size_t size, uint8_t out[HASH_SIZE]);
+    void hmac_sha256(const uint8_t* key, size_t key_size, const uint8_t* data, size_t size,
+                     uint8_t out[HASH_SIZE]);
+
+    void pbkdf2_sha256(const uint8_t* password, size_t password_size, const uint8_t* salt, size_t salt_size,
+                       uint32_t iterations, uint8_t* out, size_t out_size);
+    // Память - 128 * r * n байт. false - n не степень двойки больше 1,
+    // r * p >= 2^30 или память больше SCRYPT_MAX_MEMORY
+    constexpr size_t SCRYPT_MAX_MEMORY = 256u << 20;
+    bool scrypt(const uint8_t* password, size_t password_size, const uint8_t* salt, size_t salt_size,
+                uint64_t n, uint32_t r, uint32_t p, uint8_t* out, size_t out_size);
+
+    // Общий секрет scalar * point. false - результат нулевой (точка малого
+    // порядка), такой секрет использовать нельзя
+    bool x25519(uint8_t out[KEY_SIZE], const uint8_t scalar[KEY_SIZE], const uint8_t point[KEY_SIZE]);
+    // Открытый ключ по закрытому
+    void x25519_base(uint8_t out[KEY_SIZE], const uint8_t scalar[KEY_SIZE]);
+
+    std::string to_hex(const uint8_t* data, size_t size);
+    // false - длина не size * 2 или не шестнадцатеричные символы
+    bool from_hex(const std::string& text, uint8_t* out, size_t size);
+}
+
+#endif // CRYPTO_H
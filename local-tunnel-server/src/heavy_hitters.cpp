@@ -0,0 +1,358 @@
+#include "heavy_hitters.h"
+#include "config.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+std::atomic<bool> HeavyHitters::enabled_{false};
+std::mutex HeavyHitters::shards_mutex_;
+std::vector<std::unique_ptr<HeavyHitters::Shard>> HeavyHitters::shards_;
+std::vector<HeavyHitters::Shard*> HeavyHitters::free_shards_;
+std::mutex HeavyHitters::tables_mutex_;
+HeavyHitters::Table HeavyHitters::tables_[HeavyHitters::DIMENSIONS][2];
+size_t HeavyHitters::top_k_{0};
+size_t HeavyHitters::width_{0};
+size_t HeavyHitters::depth_{0};
+int HeavyHitters::decay_seconds_{60};
+HeavyHitters::Clock::time_point HeavyHitters::last_decay_{};
+
+namespace {
+
+uint64_t mix(uint64_t value) {
+    // Финализатор splitmix64: std::hash строк может плохо перемешивать младшие биты
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+uint64_t hash_name(const std::string& name) {
+    return mix(std::hash<std::string>{}(name));
+}
+
+std::string escape_label(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+size_t round_up_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+const char* measure_name(HitterMeasure measure) {
+    return measure == HitterMeasure::BYTES ? "bytes" : "connections";
+}
+
+}  // namespace
+
+HeavyHitters::Key HeavyHitters::make_key(const std::string& target_host, int target_port,
+                                         const std::string& client_ip) {
+    Key key;
+    key.names[static_cast<size_t>(HitterDimension::TARGET_HOST)] = target_host;
+    key.names[static_cast<size_t>(HitterDimension::TARGET_PORT)] = std::to_string(target_port);
+    key.names[static_cast<size_t>(HitterDimension::CLIENT_IP)] = client_ip;
+    for (size_t d = 0; d < DIMENSIONS; ++d) {
+        key.hashes[d] = hash_name(key.names[d]);
+    }
+    return key;
+}
+
+void HeavyHitters::configure(const Config& config) {
+    size_t width = round_up_power_of_two(static_cast<size_t>(std::max(64, config.get_heavy_hitters_width())));
+    size_t depth = static_cast<size_t>(std::min(16, std::max(1, config.get_heavy_hitters_depth())));
+    size_t top_k = static_cast<size_t>(std::max(1, config.get_heavy_hitters_top_k()));
+
+    {
+        std::lock_guard<std::mutex> lock(tables_mutex_);
+        // Новые размеры эскиза несовместимы со старыми счетчиками
+        if (width != width_ || depth != depth_) {
+            for (auto& dimension : tables_) {
+                for (auto& table : dimension) {
+                    table.sketch.reset(width, depth);
+                    table.top.clear();
+                }
+            }
+            width_ = width;
+            depth_ = depth;
+            last_decay_ = Clock::now();
+        }
+        top_k_ = top_k;
+        for (auto& dimension : tables_) {
+            for (auto& table : dimension) {
+                if (table.top.size() > top_k_) {
+                    std::sort(table.top.begin(), table.top.end(), [](const Candidate& a, const Candidate& b) {
+                        return a.estimate > b.estimate;
+                    });
+                    table.top.resize(top_k_);
+                }
+            }
+        }
+        decay_seconds_ = config.get_heavy_hitters_decay_seconds();
+    }
+
+    enabled_.store(config.is_heavy_hitters_enabled());
+    Metrics::register_provider("heavy_hitters", [](std::ostream& out) {
+        render(out);
+    });
+}
+
+const char* HeavyHitters::dimension_name(HitterDimension dimension) {
+    switch (dimension) {
+        case HitterDimension::TARGET_HOST: return "target_host";
+        case HitterDimension::TARGET_PORT: return "target_port";
+        case HitterDimension::CLIENT_IP: return "client_ip";
+    }
+    return "unknown";
+}
+
+void HeavyHitters::Sketch::reset(size_t width, size_t depth) {
+    cells_.assign(width * depth, 0);
+    width_ = width;
+    depth_ = depth;
+    total_ = 0;
+}
+
+size_t HeavyHitters::Sketch::index(uint64_t hash, size_t row) const {
+    // Двойное хэширование: строка i использует h1 + i * h2
+    uint64_t h2 = mix(hash ^ 0x9e3779b97f4a7c15ULL) | 1;
+    return row * width_ + static_cast<size_t>((hash + row * h2) & (width_ - 1));
+}
+
+uint64_t HeavyHitters::Sketch::add(uint64_t hash, uint64_t delta) {
+    uint64_t estimate = UINT64_MAX;
+    for (size_t row = 0; row < depth_; ++row) {
+        uint64_t& cell = cells_[index(hash, row)];
+        cell += delta;
+        estimate = std::min(estimate, cell);
+    }
+    total_ += delta;
+    return depth_ > 0 ? estimate : 0;
+}
+
+uint64_t HeavyHitters::Sketch::estimate(uint64_t hash) const {
+    uint64_t estimate = UINT64_MAX;
+    for (size_t row = 0; row < depth_; ++row) {
+        estimate = std::min(estimate, cells_[index(hash, row)]);
+    }
+    return depth_ > 0 ? estimate : 0;
+}
+
+void HeavyHitters::Sketch::decay() {
+    for (auto& cell : cells_) {
+        cell >>= 1;
+    }
+    total_ >>= 1;
+}
+
+HeavyHitters::Lease::~Lease() {
+    if (shard) {
+        std::lock_guard<std::mutex> lock(shards_mutex_);
+        free_shards_.push_back(shard);
+    }
+}
+
+HeavyHitters::Shard* HeavyHitters::thread_shard() {
+    thread_local Lease lease;
+    if (!lease.shard) {
+        std::lock_guard<std::mutex> lock(shards_mutex_);
+        if (!free_shards_.empty()) {
+            lease.shard = free_shards_.back();
+            free_shards_.pop_back();
+        } else {
+            shards_.push_back(std::make_unique<Shard>());
+            lease.shard = shards_.back().get();
+        }
+    }
+    return lease.shard;
+}
+
+void HeavyHitters::take(Shard& shard, std::vector<Pending> (&out)[DIMENSIONS]) {
+    // Вызывается под блокировкой буфера
+    for (size_t d = 0; d < DIMENSIONS; ++d) {
+        for (size_t i = 0; i < shard.used[d]; ++i) {
+            out[d].push_back(std::move(shard.pending[d][i]));
+            shard.pending[d][i] = Pending{};
+        }
+        shard.used[d] = 0;
+    }
+}
+
+void HeavyHitters::add(const Key& key, uint64_t connections, uint64_t bytes) {
+    if (!enabled() || !key.valid()) {
+        return;
+    }
+
+    Shard* shard = thread_shard();
+    std::vector<Pending> flushed[DIMENSIONS];
+    bool flush = false;
+    {
+        // Блокировка буфера своего потока почти всегда свободна
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (size_t d = 0; d < DIMENSIONS; ++d) {
+            Pending* slot = nullptr;
+            for (size_t i = 0; i < shard->used[d]; ++i) {
+                if (shard->pending[d][i].hash == key.hashes[d]) {
+                    slot = &shard->pending[d][i];
+                    break;
+                }
+            }
+            if (!slot) {
+                if (shard->used[d] == SHARD_SLOTS) {
+                    take(*shard, flushed);
+                    flush = true;
+                }
+                slot = &shard->pending[d][shard->used[d]++];
+                slot->hash = key.hashes[d];
+                slot->name = key.names[d];
+            }
+            slot->connections += connections;
+            slot->bytes += bytes;
+        }
+    }
+
+    if (flush) {
+        std::lock_guard<std::mutex> lock(tables_mutex_);
+        apply(flushed);
+    }
+}
+
+void HeavyHitters::offer(Table& table, uint64_t hash, const std::string& name, uint64_t estimate) {
+    for (auto& candidate : table.top) {
+        if (candidate.hash == hash) {
+            candidate.estimate = estimate;
+            return;
+        }
+    }
+    if (table.top.size() < top_k_) {
+        table.top.push_back(Candidate{hash, name, estimate});
+        return;
+    }
+
+    // Вытесняется кандидат с наименьшей оценкой, если новое значение его обогнало
+    auto weakest = std::min_element(table.top.begin(), table.top.end(),
+                                    [](const Candidate& a, const Candidate& b) {
+                                        return a.estimate < b.estimate;
+                                    });
+    if (estimate > weakest->estimate) {
+        *weakest = Candidate{hash, name, estimate};
+    }
+}
+
+void HeavyHitters::apply(std::vector<Pending> (&batch)[DIMENSIONS]) {
+    // Вызывается под tables_mutex_
+    for (size_t d = 0; d < DIMENSIONS; ++d) {
+        Table& by_connections = tables_[d][static_cast<size_t>(HitterMeasure::CONNECTIONS)];
+        Table& by_bytes = tables_[d][static_cast<size_t>(HitterMeasure::BYTES)];
+        for (const auto& pending : batch[d]) {
+            if (pending.connections > 0) {
+                offer(by_connections, pending.hash, pending.name,
+                      by_connections.sketch.add(pending.hash, pending.connections));
+            }
+            if (pending.bytes > 0) {
+                offer(by_bytes, pending.hash, pending.name,
+                      by_bytes.sketch.add(pending.hash, pending.bytes));
+            }
+        }
+    }
+}
+
+void HeavyHitters::decay_locked() {
+    for (auto& dimension : tables_) {
+        for (auto& table : dimension) {
+            table.sketch.decay();
+            for (auto& candidate : table.top) {
+                candidate.estimate >>= 1;
+            }
+            table.top.erase(std::remove_if(table.top.begin(), table.top.end(),
+                                           [](const Candidate& candidate) {
+                                               return candidate.estimate == 0;
+                                           }),
+                            table.top.end());
+        }
+    }
+}
+
+void HeavyHitters::merge() {
+    std::vector<Pending> batch[DIMENSIONS];
+    {
+        // Буферы не удаляются, блокировка защищает только список
+        std::lock_guard<std::mutex> lock(shards_mutex_);
+        for (const auto& shard : shards_) {
+            std::lock_guard<std::mutex> shard_lock(shard->mutex);
+            take(*shard, batch);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(tables_mutex_);
+    apply(batch);
+
+    auto now = Clock::now();
+    if (decay_seconds_ > 0 && now - last_decay_ >= std::chrono::seconds(decay_seconds_)) {
+        decay_locked();
+        last_decay_ = now;
+    }
+}
+
+std::vector<HeavyHitters::Entry> HeavyHitters::top(HitterDimension dimension, HitterMeasure measure) {
+    std::vector<Entry> entries;
+    size_t d = static_cast<size_t>(dimension);
+
+    std::lock_guard<std::mutex> lock(tables_mutex_);
+    const Table& by_connections = tables_[d][static_cast<size_t>(HitterMeasure::CONNECTIONS)];
+    const Table& by_bytes = tables_[d][static_cast<size_t>(HitterMeasure::BYTES)];
+    for (const auto& candidate : tables_[d][static_cast<size_t>(measure)].top) {
+        entries.push_back(Entry{candidate.name,
+                                by_connections.sketch.estimate(candidate.hash),
+                                by_bytes.sketch.estimate(candidate.hash)});
+    }
+    std::sort(entries.begin(), entries.end(), [measure](const Entry& a, const Entry& b) {
+        return measure == HitterMeasure::BYTES ? a.bytes > b.bytes : a.connections > b.connections;
+    });
+    return entries;
+}
+
+void HeavyHitters::render(std::ostream& out) {
+    for (size_t d = 0; d < DIMENSIONS; ++d) {
+        HitterDimension dimension = static_cast<HitterDimension>(d);
+        for (HitterMeasure measure : {HitterMeasure::CONNECTIONS, HitterMeasure::BYTES}) {
+            for (const auto& entry : top(dimension, measure)) {
+                out << "heavy_hitter_" << measure_name(measure)
+                    << "{dimension=\"" << dimension_name(dimension)
+                    << "\",key=\"" << escape_label(entry.name) << "\"} "
+                    << (measure == HitterMeasure::BYTES ? entry.bytes : entry.connections) << "\n";
+            }
+
+            // Оценка count-min завышена не более чем на e * N / width
+            // (с вероятностью 1 - e^-depth)
+            uint64_t bound;
+            {
+                std::lock_guard<std::mutex> lock(tables_mutex_);
+                const Sketch& sketch = tables_[d][static_cast<size_t>(measure)].sketch;
+                bound = sketch.width() > 0
+                    ? static_cast<uint64_t>(std::ceil(std::exp(1.0) * static_cast<double>(sketch.total()) /
+                                                      static_cast<double>(sketch.width())))
+                    : 0;
+            }
+            out << "heavy_hitters_error_bound{dimension=\"" << dimension_name(dimension)
+                << "\",measure=\"" << measure_name(measure) << "\"} " << bound << "\n";
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#ifndef HEAVY_HITTERS_H
+#define HEAVY_HITTERS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+class Config;
+
+// Измерения, по которым ищутся самые нагруженные значения
+enum class HitterDimension : uint8_t {
+    TARGET_HOST = 0,
+    TARGET_PORT = 1,
+    CLIENT_IP = 2
+};
+
+// Мера нагрузки
+enum class HitterMeasure : uint8_t {
+    CONNECTIONS = 0,
+    BYTES = 1
+};
+
+// Потоковый поиск самых нагруженных целей, портов и клиентов (топ-K по
+// соединениям и по байтам). Частоты оцениваются эскизом count-min
+// фиксированного размера, кандидаты в топ хранятся в небольшой таблице
+// на K записей. Обработчики пишут приращения в буфер своего потока без
+// общих блокировок; основной поток раз в секунду сливает буферы в эскизы
+// (merge). Раз в decay_seconds все счетчики делятся пополам, поэтому топ
+// отражает текущую нагрузку, а не накопленную с запуска.
+class HeavyHitters {
+public:
+    static constexpr size_t DIMENSIONS = 3;
+
+    // Значения измерений соединения, хэши считаются один раз на туннель
+    struct Key {
+        std::string names[DIMENSIONS];
+        uint64_t hashes[DIMENSIONS]{};
+
+        bool valid() const { return !names[0].empty(); }
+    };
+
+    struct Entry {
+        std::string name;
+        uint64_t connections;
+        uint64_t bytes;
+    };
+
+    static Key make_key(const std::string& target_host, int target_port, const std::string& client_ip);
+
+    static void configure(const Config& config);
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    static void add_connection(const Key& key) { add(key, 1, 0); }
+    static void add_bytes(const Key& key, uint64_t bytes) { add(key, 0, bytes); }
+
+    // Слияние буферов потоков и затухание (из основного цикла сервера)
+    static void merge();
+
+    // Текущий топ по измерению, по убыванию меры
+    static std::vector<Entry> top(HitterDimension dimension, HitterMeasure measure);
+
+    // Строки метрик heavy_hitter_connections / heavy_hitter_bytes
+    static void render(std::ostream& out);
+
+    static const char* dimension_name(HitterDimension dimension);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Поток обработчика обслуживает один туннель, поэтому буферу хватает
+    // нескольких ключей на измерение; при переполнении он сливается сразу
+    static constexpr size_t SHARD_SLOTS = 4;
+
+    struct Pending {
+        uint64_t hash{0};
+        std::string name;
+        uint64_t connections{0};
+        uint64_t bytes{0};
+    };
+
+    // Буфер приращений одного потока: пишет владелец, забирает merge()
+    struct Shard {
+        std::mutex mutex;
+        Pending pending[DIMENSIONS][SHARD_SLOTS];
+        size_t used[DIMENSIONS]{};
+    };
+
+    // Возвращает буфер в пул при завершении потока (накопленное сольет merge)
+    struct Lease {
+        Shard* shard{nullptr};
+        ~Lease();
+    };
+
+    // Эскиз count-min: depth строк по width счетчиков (width - степень двойки)
+    class Sketch {
+    public:
+        void reset(size_t width, size_t depth);
+        uint64_t add(uint64_t hash, uint64_t delta);  // Возвращает новую оценку
+        uint64_t estimate(uint64_t hash) const;
+        uint64_t total() const { return total_; }
+        size_t width() const { return width_; }
+        void decay();
+
+    private:
+        std::vector<uint64_t> cells_;
+        size_t width_{0};
+        size_t depth_{0};
+        uint64_t total_{0};
+
+        size_t index(uint64_t hash, size_t row) const;
+    };
+
+    struct Candidate {
+        uint64_t hash;
+        std::string name;
+        uint64_t estimate;  // Оценка меры, по которой ведется таблица
+    };
+
+    // Эскиз и кандидаты в топ для одного измерения и одной меры
+    struct Table {
+        Sketch sketch;
+        std::vector<Candidate> top;
+    };
+
+    static std::atomic<bool> enabled_;
+
+    // Пул буферов потоков
+    static std::mutex shards_mutex_;
+    static std::vector<std::unique_ptr<Shard>> shards_;
+    static std::vector<Shard*> free_shards_;
+
+    // Общие эскизы: [измерение][мера]
+    static std::mutex tables_mutex_;
+    static Table tables_[DIMENSIONS][2];
+    static size_t top_k_;
+    static size_t width_;
+    static size_t depth_;
+    static int decay_seconds_;
+    static Clock::time_point last_decay_;
+
+    static void add(const Key& key, uint64_t connections, uint64_t bytes);
+    static Shard* thread_shard();
+    static void take(Shard& shard, std::vector<Pending> (&out)[DIMENSIONS]);
+    static void apply(std::vector<Pending> (&batch)[DIMENSIONS]);
+    static void offer(Table& table, uint64_t hash, const std::string& name, uint64_t estimate);
+    static void decay_locked();
+};
+
+#endif // HEAVY_HITTERS_H
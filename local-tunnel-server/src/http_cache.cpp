@@ -0,0 +1,775 @@
+#include "http_cache.h"
+#include "metrics.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <strings.h>
+
+namespace {
+
+// Статусы, ответы с которыми можно сохранять без явного разрешения
+// (эвристически кэшируемые, RFC 7231 6.1)
+bool storable_status(int status) {
+    switch (status) {
+        case 200: case 203: case 204: case 300: case 301: case 308:
+        case 404: case 405: case 410: case 414: case 501:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Заголовки соединения, которые кэш не хранит и не пересылает
+bool hop_by_hop(const char* name, size_t length) {
+    static const char* const names[] = {
+        "connection", "keep-alive", "proxy-connection", "transfer-encoding", "te",
+        "trailer", "upgrade", "proxy-authenticate", "proxy-authorization", "age"
+    };
+    for (const char* candidate : names) {
+        if (std::strlen(candidate) == length && strncasecmp(name, candidate, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return value;
+}
+
+// Обход строк заголовков: callback(начало имени, длина имени, значение)
+template <typename Callback>
+void for_each_header(const std::string& head, Callback callback) {
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos) {
+        size_t start = pos + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos || end == start) {
+            break;
+        }
+        size_t colon = head.find(':', start);
+        if (colon != std::string::npos && colon < end) {
+            callback(start, colon - start, Utils::trim(head.substr(colon + 1, end - colon - 1)), end);
+        }
+        pos = end;
+    }
+}
+
+int64_t read_seconds(const std::string& value) {
+    if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0]))) {
+        return -1;
+    }
+    // Слишком большие значения ограничиваются (RFC 7234 1.2.1)
+    long long seconds = std::strtoll(value.c_str(), nullptr, 10);
+    return std::min<long long>(seconds, 2147483648LL);
+}
+
+std::string strip_weak(const std::string& etag) {
+    return etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+}
+
+}  // namespace
+
+void SharedFetch::start(std::shared_ptr<const std::string> head, std::string variant,
+                        std::vector<std::string> vary) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    variant_ = std::move(variant);
+    vary_ = std::move(vary);
+    parts_.push_back(std::move(head));
+    ready_.notify_all();
+}
+
+void SharedFetch::append(std::shared_ptr<const std::string> part) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    parts_.push_back(std::move(part));
+    ready_.notify_all();
+}
+
+void SharedFetch::finish(bool complete) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!finished_) {
+        finished_ = true;
+        complete_ = complete;
+        ready_.notify_all();
+    }
+}
+
+SharedFetch::State SharedFetch::wait(size_t index, int timeout_ms, std::shared_ptr<const std::string>& part) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool ready = ready_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                 [&] { return index < parts_.size() || finished_; });
+    // Полученные части отдаются и после завершения загрузки
+    if (index < parts_.size()) {
+        part = parts_[index];
+        return State::DATA;
+    }
+    if (!ready) {
+        return State::TIMEOUT;
+    }
+    return complete_ ? State::DONE : State::FAILED;
+}
+
+bool SharedFetch::matches(const std::string& url, const std::string& request_head) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return HttpCache::variant_key(url, vary_, request_head) == variant_;
+}
+
+int64_t CachedResponse::age_ms(int64_t now_ms) const {
+    return initial_age_ms + std::max<int64_t>(0, now_ms - response_ms);
+}
+
+size_t CachedResponse::size() const {
+    size_t total = sizeof(CachedResponse) + head.capacity() + etag.capacity() + last_modified.capacity();
+    for (const std::string& name : vary) {
+        total += name.capacity();
+    }
+    return total + (body ? body->capacity() : 0);
+}
+
+HttpCache::HttpCache() {
+    Metrics::register_provider("http_cache", [this](std::ostream& out) { render_metrics(out); });
+}
+
+HttpCache::~HttpCache() {
+    Metrics::unregister_provider("http_cache");
+}
+
+void HttpCache::configure(const Config& config) {
+    enabled_.store(config.is_http_cache_enabled());
+    max_bytes_.store(static_cast<size_t>(std::max(1, config.get_http_cache_max_size_mb())) << 20);
+    max_object_size_.store(static_cast<size_t>(std::max(1, config.get_http_cache_max_object_kb())) << 10);
+    collapse_timeout_ms_.store(std::max(0, config.get_http_cache_collapse_timeout_ms()));
+
+    // Уменьшение объема применяется сразу
+    size_t capacity = max_bytes_.load() / SHARDS;
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!enabled_.load()) {
+            while (!shard.items.empty()) {
+                remove(shard, shard.items.begin());
+            }
+            shard.small.clear();
+            shard.main.clear();
+            shard.ghost.clear();
+            shard.ghost_set.clear();
+        } else {
+            evict(shard, capacity);
+        }
+    }
+}
+
+bool HttpCache::cacheable_request(const std::string& method, const std::string& url,
+                                  const std::string& request_head) {
+    if (method != "GET" || url.compare(0, 7, "http://") != 0) {
+        return false;
+    }
+    std::string value;
+    if (header(request_head, "authorization", value) || header(request_head, "range", value)) {
+        return false;
+    }
+    return !(header(request_head, "cache-control", value) && directive(value, "no-store"));
+}
+
+HttpCache::Shard& HttpCache::shard_for(const std::string& url) {
+    return shards_[std::hash<std::string>()(url) % SHARDS];
+}
+
+std::string HttpCache::variant_key(const std::string& url, const std::vector<std::string>& vary,
+                                   const std::string& request_head) {
+    std::string key = url;
+    for (const std::string& name : vary) {
+        std::string value;
+        header(request_head, name, value);
+        key += '\n';
+        key += name;
+        key += ':';
+        key += value;
+    }
+    return key;
+}
+
+bool HttpCache::may_serve(const std::string& url, int64_t now_ms) {
+    if (!enabled()) {
+        return false;
+    }
+    if (collapse_timeout_ms() > 0) {
+        std::lock_guard<std::mutex> lock(fetches_mutex_);
+        if (fetches_.count(url) > 0) {
+            return true;
+        }
+    }
+    Shard& shard = shard_for(url);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto index = shard.urls.find(url);
+    if (index == shard.urls.end() || !index->second.names.empty()) {
+        return false;
+    }
+    auto it = shard.items.find(url);
+    return it != shard.items.end() && it->second.entry->fresh(now_ms);
+}
+
+HttpCache::Result HttpCache::lookup(const std::string& url, const std::string& request_head,
+                                    int64_t now_ms, std::shared_ptr<const CachedResponse>& entry) {
+    entry.reset();
+    if (!enabled()) {
+        return Result::MISS;
+    }
+    {
+        Shard& shard = shard_for(url);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto index = shard.urls.find(url);
+        if (index == shard.urls.end()) {
+            return Result::MISS;
+        }
+        auto it = shard.items.find(variant_key(url, index->second.names, request_head));
+        if (it == shard.items.end()) {
+            return Result::MISS;
+        }
+        it->second.frequency = std::min(it->second.frequency + 1, FREQUENCY_LIMIT);
+        entry = it->second.entry;
+    }
+
+    if (!entry->fresh(now_ms)) {
+        return Result::STALE;
+    }
+
+    // Клиент может потребовать ревалидации или ограничить возраст ответа
+    std::string value;
+    if (header(request_head, "pragma", value) && directive(value, "no-cache")) {
+        return Result::STALE;
+    }
+    if (header(request_head, "cache-control", value)) {
+        std::string max_age;
+        if (directive(value, "no-cache")) {
+            return Result::STALE;
+        }
+        if (directive(value, "max-age", &max_age)) {
+            int64_t seconds = read_seconds(max_age);
+            if (seconds >= 0 && entry->age_ms(now_ms) > seconds * 1000) {
+                return Result::STALE;
+            }
+        }
+    }
+    return Result::FRESH;
+}
+
+std::string HttpCache::strip_hop_by_hop(const std::string& head) {
+    // Также удаляются заголовки, перечисленные в Connection
+    std::string connection;
+    std::vector<std::string> listed;
+    if (header(head, "connection", connection)) {
+        for (const std::string& name : Utils::split(connection, ',')) {
+            listed.push_back(lower(Utils::trim(name)));
+        }
+    }
+
+    size_t first_line = head.find("\r\n");
+    std::string out = head.substr(0, first_line == std::string::npos ? head.size() : first_line + 2);
+    for_each_header(head, [&](size_t start, size_t length, const std::string&, size_t end) {
+        std::string name = lower(head.substr(start, length));
+        if (hop_by_hop(name.data(), name.size()) ||
+            std::find(listed.begin(), listed.end(), name) != listed.end()) {
+            return;
+        }
+        out.append(head, start, end + 2 - start);
+    });
+    return out;
+}
+
+bool HttpCache::describe(CachedResponse& entry, int64_t request_ms, int64_t response_ms) {
+    std::string cache_control;
+    std::string value;
+    header(entry.head, "cache-control", cache_control);
+    if (directive(cache_control, "no-store") || directive(cache_control, "private")) {
+        return false;
+    }
+
+    entry.response_ms = response_ms;
+    entry.no_cache = directive(cache_control, "no-cache");
+    entry.etag.clear();
+    entry.last_modified.clear();
+    header(entry.head, "etag", entry.etag);
+    header(entry.head, "last-modified", entry.last_modified);
+
+    int64_t date_ms = header(entry.head, "date", value) ? parse_http_date(value) : -1;
+    if (date_ms < 0) {
+        date_ms = response_ms;
+    }
+
+    // Возраст в момент получения (RFC 7234 4.2.3)
+    int64_t apparent_age = std::max<int64_t>(0, response_ms - date_ms);
+    int64_t age_value = header(entry.head, "age", value) ? std::max<int64_t>(0, read_seconds(value)) * 1000 : 0;
+    entry.initial_age_ms = std::max(apparent_age, age_value + (response_ms - request_ms));
+
+    // Срок свежести: s-maxage, max-age, Expires, затем эвристика по Last-Modified
+    std::string argument;
+    int64_t seconds = -1;
+    if (directive(cache_control, "s-maxage", &argument) || directive(cache_control, "max-age", &argument)) {
+        seconds = read_seconds(argument);
+    }
+    if (seconds >= 0) {
+        entry.lifetime_ms = seconds * 1000;
+    } else if (header(entry.head, "expires", value)) {
+        // Некорректный Expires означает уже истекший ответ
+        int64_t expires_ms = parse_http_date(value);
+        entry.lifetime_ms = expires_ms < 0 ? 0 : std::max<int64_t>(0, expires_ms - date_ms);
+    } else if (!entry.last_modified.empty() && parse_http_date(entry.last_modified) >= 0) {
+        int64_t modified_ms = parse_http_date(entry.last_modified);
+        entry.lifetime_ms = std::min(HEURISTIC_LIMIT_MS, std::max<int64_t>(0, date_ms - modified_ms) / 10);
+    } else {
+        entry.lifetime_ms = 0;
+    }
+
+    // must-revalidate не меняет поведение: устаревшие ответы всегда ревалидируются
+    return entry.lifetime_ms > 0 || entry.has_validators();
+}
+
+std::shared_ptr<CachedResponse> HttpCache::prepare(const std::string& request_head,
+                                                   const std::string& response_head,
+                                                   int64_t request_ms, int64_t response_ms) const {
+    if (!enabled() || response_head.compare(0, 7, "HTTP/1.") != 0 || response_head.size() < 12) {
+        return nullptr;
+    }
+    int status = std::atoi(response_head.c_str() + 9);
+    if (!storable_status(status)) {
+        return nullptr;
+    }
+
+    // Ответы с cookie и на запросы с учетными данными разделяемый кэш не хранит
+    std::string value;
+    if (header(response_head, "set-cookie", value) || header(request_head, "authorization", value)) {
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<CachedResponse>();
+    entry->status = status;
+    if (header(response_head, "vary", value)) {
+        for (const std::string& name : Utils::split(value, ',')) {
+            std::string trimmed = lower(Utils::trim(name));
+            if (trimmed == "*") {
+                return nullptr;
+            }
+            if (!trimmed.empty()) {
+                entry->vary.push_back(trimmed);
+            }
+        }
+    }
+    entry->head = strip_hop_by_hop(response_head);
+    if (!describe(*entry, request_ms, response_ms)) {
+        return nullptr;
+    }
+    return entry;
+}
+
+std::shared_ptr<CachedResponse> HttpCache::refresh(const CachedResponse& entry, const std::string& response_head,
+                                                   int64_t request_ms, int64_t response_ms) const {
+    // Заголовки из 304 заменяют одноименные сохраненные (RFC 7234 4.3.4)
+    std::string update = strip_hop_by_hop(response_head);
+    std::vector<std::string> replaced;
+    for_each_header(update, [&](size_t start, size_t length, const std::string&, size_t) {
+        std::string name = lower(update.substr(start, length));
+        if (name != "content-length") {
+            replaced.push_back(name);
+        }
+    });
+
+    auto updated = std::make_shared<CachedResponse>(entry);
+    size_t first_line = entry.head.find("\r\n");
+    updated->head = entry.head.substr(0, first_line + 2);
+    for_each_header(entry.head, [&](size_t start, size_t length, const std::string&, size_t end) {
+        std::string name = lower(entry.head.substr(start, length));
+        if (std::find(replaced.begin(), replaced.end(), name) == replaced.end()) {
+            updated->head.append(entry.head, start, end + 2 - start);
+        }
+    });
+    for_each_header(update, [&](size_t start, size_t length, const std::string&, size_t end) {
+        if (length != 14 || strncasecmp(update.data() + start, "content-length", 14) != 0) {
+            updated->head.append(update, start, end + 2 - start);
+        }
+    });
+
+    if (!describe(*updated, request_ms, response_ms)) {
+        return nullptr;
+    }
+    return updated;
+}
+
+void HttpCache::attach_body(CachedResponse& entry, std::string body) {
+    std::string value;
+    if (!header(entry.head, "content-length", value)) {
+        entry.head += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    body.shrink_to_fit();
+    entry.body = std::make_shared<const std::string>(std::move(body));
+}
+
+void HttpCache::store(const std::string& url, const std::string& request_head,
+                      std::shared_ptr<const CachedResponse> entry) {
+    if (!enabled() || !entry || !entry->body) {
+        return;
+    }
+    size_t size = entry->size() + url.size() + ENTRY_OVERHEAD;
+    size_t capacity = max_bytes_.load() / SHARDS;
+    if (size > capacity || entry->body->size() > max_object_size()) {
+        return;
+    }
+
+    std::string key = variant_key(url, entry->vary, request_head);
+    uint64_t key_hash = std::hash<std::string>()(key);
+    Shard& shard = shard_for(url);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto existing = shard.items.find(key);
+    bool frequent = false;
+    if (existing != shard.items.end()) {
+        // Обновленная запись сохраняет место в основной очереди
+        frequent = existing->second.in_main;
+        remove(shard, existing);
+    } else if (shard.ghost_set.erase(key_hash) > 0) {
+        frequent = true;
+    }
+
+    // Варианты со старым набором Vary больше не найти - они удаляются
+    auto index = shard.urls.find(url);
+    if (index != shard.urls.end() && index->second.names != entry->vary) {
+        remove_url(shard, url);
+    }
+    VaryIndex& variants = shard.urls[url];
+    variants.names = entry->vary;
+    variants.keys.push_back(key);
+
+    Item item;
+    item.entry = std::move(entry);
+    item.url = url;
+    item.size = size;
+    item.in_main = frequent;
+    std::list<std::string>& queue = frequent ? shard.main : shard.small;
+    queue.push_front(key);
+    item.position = queue.begin();
+    shard.items.emplace(key, std::move(item));
+    shard.bytes += size;
+    if (!frequent) {
+        shard.small_bytes += size;
+    }
+    stored_.fetch_add(1, std::memory_order_relaxed);
+
+    evict(shard, capacity);
+}
+
+void HttpCache::remove(Shard& shard, std::unordered_map<std::string, Item>::iterator it) {
+    Item& item = it->second;
+    shard.bytes -= item.size;
+    if (item.in_main) {
+        shard.main.erase(item.position);
+    } else {
+        shard.small_bytes -= item.size;
+        shard.small.erase(item.position);
+    }
+    auto index = shard.urls.find(item.url);
+    if (index != shard.urls.end()) {
+        std::vector<std::string>& keys = index->second.keys;
+        keys.erase(std::remove(keys.begin(), keys.end(), it->first), keys.end());
+        if (keys.empty()) {
+            shard.urls.erase(index);
+        }
+    }
+    shard.items.erase(it);
+}
+
+void HttpCache::remove_url(Shard& shard, const std::string& url) {
+    auto index = shard.urls.find(url);
+    if (index == shard.urls.end()) {
+        return;
+    }
+    std::vector<std::string> keys = index->second.keys;
+    for (const std::string& key : keys) {
+        auto it = shard.items.find(key);
+        if (it != shard.items.end()) {
+            remove(shard, it);
+        }
+    }
+    shard.urls.erase(url);
+}
+
+void HttpCache::invalidate(const std::string& url) {
+    if (!enabled()) {
+        return;
+    }
+    Shard& shard = shard_for(url);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    remove_url(shard, url);
+}
+
+void HttpCache::evict(Shard& shard, size_t capacity) {
+    // Малая очередь занимает около 10% объема сегмента
+    size_t small_target = capacity / 10;
+    size_t ghost_limit = std::max<size_t>(64, shard.items.size());
+    while (shard.bytes > capacity && !shard.items.empty()) {
+        if (!shard.small.empty() && (shard.small_bytes > small_target || shard.main.empty())) {
+            auto it = shard.items.find(shard.small.back());
+            Item& item = it->second;
+            if (item.frequency > 0) {
+                // К записи обращались - переход в основную очередь
+                shard.small.pop_back();
+                shard.small_bytes -= item.size;
+                shard.main.push_front(it->first);
+                item.position = shard.main.begin();
+                item.in_main = true;
+                item.frequency = 0;
+                continue;
+            }
+            uint64_t key_hash = std::hash<std::string>()(it->first);
+            if (shard.ghost_set.insert(key_hash).second) {
+                shard.ghost.push_back(key_hash);
+            }
+            while (shard.ghost.size() > ghost_limit) {
+                shard.ghost_set.erase(shard.ghost.front());
+                shard.ghost.pop_front();
+            }
+            remove(shard, it);
+        } else {
+            auto it = shard.items.find(shard.main.back());
+            Item& item = it->second;
+            if (item.frequency > 0) {
+                item.frequency--;
+                shard.main.splice(shard.main.begin(), shard.main, item.position);
+                continue;
+            }
+            remove(shard, it);
+        }
+        evicted_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::shared_ptr<SharedFetch> HttpCache::join(const std::string& url, bool& leader) {
+    leader = false;
+    if (!enabled() || collapse_timeout_ms() <= 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(fetches_mutex_);
+    std::shared_ptr<SharedFetch>& fetch = fetches_[url];
+    if (!fetch) {
+        fetch = std::make_shared<SharedFetch>();
+        leader = true;
+    }
+    return fetch;
+}
+
+void HttpCache::release(const std::string& url, const std::shared_ptr<SharedFetch>& fetch) {
+    std::lock_guard<std::mutex> lock(fetches_mutex_);
+    auto it = fetches_.find(url);
+    if (it != fetches_.end() && it->second == fetch) {
+        fetches_.erase(it);
+    }
+}
+
+void HttpCache::record_hit(size_t bytes, int64_t latency_us) {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    bytes_saved_.fetch_add(bytes, std::memory_order_relaxed);
+    hit_latency_us_.fetch_add(static_cast<uint64_t>(latency_us), std::memory_order_relaxed);
+    int64_t max = hit_latency_max_us_.load(std::memory_order_relaxed);
+    while (latency_us > max && !hit_latency_max_us_.compare_exchange_weak(max, latency_us)) {
+    }
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && latency_us > LATENCY_BOUNDS[bucket]) {
+        ++bucket;
+    }
+    hit_latency_buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void HttpCache::record_miss() {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HttpCache::record_revalidated(size_t bytes) {
+    revalidated_.fetch_add(1, std::memory_order_relaxed);
+    bytes_saved_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void HttpCache::record_collapsed(size_t bytes) {
+    collapsed_.fetch_add(1, std::memory_order_relaxed);
+    bytes_saved_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void HttpCache::record_collapse_fallback(bool timeout) {
+    (timeout ? collapse_timeouts_ : collapse_fallbacks_).fetch_add(1, std::memory_order_relaxed);
+}
+
+void HttpCache::render_metrics(std::ostream& out) {
+    size_t bytes = 0;
+    size_t objects = 0;
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+        objects += shard.items.size();
+    }
+    uint64_t hits = hits_.load();
+    uint64_t misses = misses_.load();
+    out << "http_cache_hits_total " << hits << "\n";
+    out << "http_cache_misses_total " << misses << "\n";
+    out << "http_cache_hit_ratio " << (hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0) << "\n";
+    out << "http_cache_revalidated_total " << revalidated_.load() << "\n";
+    out << "http_cache_stored_total " << stored_.load() << "\n";
+    out << "http_cache_evicted_total " << evicted_.load() << "\n";
+    out << "http_cache_bytes_saved_total " << bytes_saved_.load() << "\n";
+    out << "http_cache_collapsed_total " << collapsed_.load() << "\n";
+    out << "http_cache_collapse_fallbacks_total " << collapse_fallbacks_.load() << "\n";
+    out << "http_cache_collapse_timeouts_total " << collapse_timeouts_.load() << "\n";
+    {
+        std::lock_guard<std::mutex> lock(fetches_mutex_);
+        out << "http_cache_fetches_in_flight " << fetches_.size() << "\n";
+    }
+    out << "http_cache_bytes " << bytes << "\n";
+    out << "http_cache_objects " << objects << "\n";
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        cumulative += hit_latency_buckets_[i].load();
+        out << "http_cache_hit_latency_us_bucket{le=\""
+            << (i < LATENCY_BUCKETS - 1 ? std::to_string(LATENCY_BOUNDS[i]) : "+Inf") << "\"} "
+            << cumulative << "\n";
+    }
+    out << "http_cache_hit_latency_us_sum " << hit_latency_us_.load() << "\n";
+    out << "http_cache_hit_latency_us_count " << hits << "\n";
+    out << "http_cache_hit_latency_us_max " << hit_latency_max_us_.load() << "\n";
+}
+
+bool HttpCache::header(const std::string& head, const std::string& name, std::string& value) {
+    value.clear();
+    bool found = false;
+    for_each_header(head, [&](size_t start, size_t length, const std::string& part, size_t) {
+        if (length == name.size() && strncasecmp(head.data() + start, name.data(), length) == 0) {
+            if (found) {
+                value += ", ";
+            }
+            value += part;
+            found = true;
+        }
+    });
+    return found;
+}
+
+bool HttpCache::directive(const std::string& cache_control, const std::string& name, std::string* argument) {
+    for (const std::string& token : Utils::split(cache_control, ',')) {
+        std::string item = Utils::trim(token);
+        size_t equals = item.find('=');
+        std::string key = Utils::trim(item.substr(0, equals));
+        if (key.size() != name.size() || strncasecmp(key.data(), name.data(), name.size()) != 0) {
+            continue;
+        }
+        if (argument) {
+            *argument = equals == std::string::npos ? "" : Utils::trim(item.substr(equals + 1));
+            if (argument->size() >= 2 && argument->front() == '"' && argument->back() == '"') {
+                *argument = argument->substr(1, argument->size() - 2);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+int64_t HttpCache::parse_http_date(const std::string& value) {
+    // IMF-fixdate, устаревшие RFC 850 и asctime (RFC 7231 7.1.1.1)
+    static const char* const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT", "%A, %d-%b-%y %H:%M:%S GMT", "%a %b %e %H:%M:%S %Y"
+    };
+    for (const char* format : formats) {
+        std::tm tm{};
+        const char* end = strptime(value.c_str(), format, &tm);
+        if (end && *end == '\0') {
+            return static_cast<int64_t>(timegm(&tm)) * 1000;
+        }
+    }
+    return -1;
+}
+
+void HttpCache::rewrite_request(std::string& request_head, const CachedResponse* stale) {
+    std::string head = strip_hop_by_hop(request_head);
+    head += "Connection: close\r\n";
+    if (stale) {
+        if (!stale->etag.empty()) {
+            head += "If-None-Match: " + stale->etag + "\r\n";
+        }
+        if (!stale->last_modified.empty()) {
+            head += "If-Modified-Since: " + stale->last_modified + "\r\n";
+        }
+    }
+    head += "\r\n";
+    request_head.swap(head);
+}
+
+std::string HttpCache::closing_head(const std::string& response_head) {
+    size_t first_line = response_head.find("\r\n");
+    std::string out = response_head.substr(0, first_line + 2);
+    for_each_header(response_head, [&](size_t start, size_t length, const std::string&, size_t end) {
+        const char* name = response_head.data() + start;
+        if ((length == 10 && strncasecmp(name, "connection", 10) == 0) ||
+            (length == 10 && strncasecmp(name, "keep-alive", 10) == 0) ||
+            (length == 16 && strncasecmp(name, "proxy-connection", 16) == 0)) {
+            return;
+        }
+        out.append(response_head, start, end + 2 - start);
+    });
+    out += "Connection: close\r\n\r\n";
+    return out;
+}
+
+bool HttpCache::conditional(const std::string& request_head) {
+    std::string value;
+    return header(request_head, "if-none-match", value) || header(request_head, "if-modified-since", value) ||
+           header(request_head, "if-match", value) || header(request_head, "if-unmodified-since", value);
+}
+
+bool HttpCache::not_modified(const CachedResponse& entry, const std::string& request_head) {
+    // If-None-Match сравнивается слабо и имеет приоритет (RFC 7232 6)
+    std::string value;
+    if (header(request_head, "if-none-match", value)) {
+        if (entry.etag.empty()) {
+            return false;
+        }
+        std::string etag = strip_weak(entry.etag);
+        for (const std::string& candidate : Utils::split(value, ',')) {
+            std::string trimmed = Utils::trim(candidate);
+            if (trimmed == "*" || strip_weak(trimmed) == etag) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (header(request_head, "if-modified-since", value) && !entry.last_modified.empty()) {
+        int64_t since = parse_http_date(value);
+        int64_t modified = parse_http_date(entry.last_modified);
+        return since >= 0 && modified >= 0 && modified <= since;
+    }
+    return false;
+}
+
+std::string HttpCache::response_head(const CachedResponse& entry, int64_t now_ms, bool not_modified) {
+    std::string head;
+    if (not_modified) {
+        // 304 несет только заголовки, описывающие сохраненный ответ
+        static const char* const kept[] = {"cache-control", "content-location", "date", "etag",
+                                           "expires", "last-modified", "vary"};
+        head = "HTTP/1.1 304 Not Modified\r\n";
+        for_each_header(entry.head, [&](size_t start, size_t length, const std::string&, size_t end) {
+            for (const char* name : kept) {
+                if (std::strlen(name) == length && strncasecmp(entry.head.data() + start, name, length) == 0) {
+                    head.append(entry.head, start, end + 2 - start);
+                    break;
+                }
+            }
+        });
+    } else {
+        head = entry.head;
+    }
+    head += "Age: " + std::to_string(entry.age_ms(now_ms) / 1000) + "\r\n";
+    head += "Connection: close\r\n\r\n";
+    return head;
+}
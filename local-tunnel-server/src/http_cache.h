@@ -0,0 +1,233 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "config.h"
+
+// Сохраненный ответ. Неизменяем после сохранения: обработчики отдают его без
+// блокировок, удерживая shared_ptr; ревалидация создает новый объект с тем же
+// телом.
+struct CachedResponse {
+    std::string head;                        // Строка статуса и заголовки без hop-by-hop и Age
+    std::shared_ptr<const std::string> body;
+    int status{0};
+    std::string etag;
+    std::string last_modified;
+    std::vector<std::string> vary;           // Имена заголовков из Vary в нижнем регистре
+    int64_t response_ms{0};                  // Время получения (или ревалидации) ответа
+    int64_t initial_age_ms{0};               // Возраст ответа в момент получения
+    int64_t lifetime_ms{0};                  // Срок свежести
+    bool no_cache{false};                    // Отдается только после ревалидации
+
+    int64_t age_ms(int64_t now_ms) const;
+    bool fresh(int64_t now_ms) const { return !no_cache && age_ms(now_ms) < lifetime_ms; }
+    bool has_validators() const { return !etag.empty() || !last_modified.empty(); }
+    size_t size() const;
+};
+
+// Загрузка ответа цели, к которой присоединяются одновременные запросы того
+// же URL (collapsed forwarding). Ведущий обработчик читает ответ и добавляет
+// его части в цепочку неизменяемых буферов; каждый ожидающий отправляет их
+// своему клиенту со своей скоростью, не задерживая ведущего и других.
+class SharedFetch {
+public:
+    enum class State { DATA, DONE, FAILED, TIMEOUT };
+
+    // Ведущий: заголовки ответа клиенту и ключ варианта ответа (Vary)
+    void start(std::shared_ptr<const std::string> head, std::string variant, std::vector<std::string> vary);
+    void append(std::shared_ptr<const std::string> part);
+    // complete == false до start - ожидающие выполняют запрос сами,
+    // после start - ответ обрывается
+    void finish(bool complete);
+
+    // Ожидающий: часть ответа с номером index (0 - заголовки)
+    State wait(size_t index, int timeout_ms, std::shared_ptr<const std::string>& part);
+    // Подходит ли ответ запросу с учетом Vary (после получения заголовков)
+    bool matches(const std::string& url, const std::string& request_head);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::vector<std::shared_ptr<const std::string>> parts_;
+    std::string variant_;
+    std::vector<std::string> vary_;
+    bool finished_{false};
+    bool complete_{false};
+};
+
+// Кэш ответов на обычные HTTP запросы через прокси (RFC 7234, разделяемый
+// кэш). Ключ - URL запроса GET, варианты одного URL различаются значениями
+// заголовков запроса из Vary. Кэш разбит на сегменты по хэшу URL; в каждом
+// сегменте объем ограничен и вытеснение идет по S3-FIFO: новые записи
+// попадают в малую очередь и переходят в основную, только если к ним
+// обращались, ключи вытесненных из малой очереди помнятся в очереди-призраке.
+// Попадание лишь увеличивает счетчик обращений записи.
+class HttpCache {
+public:
+    enum class Result { MISS, FRESH, STALE };
+
+    HttpCache();
+    ~HttpCache();
+
+    void configure(const Config& config);
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    size_t max_object_size() const { return max_object_size_.load(std::memory_order_relaxed); }
+
+    // Может ли запрос обслуживаться кэшем: GET к http:// URL без no-store,
+    // Authorization и Range. request_head - строка запроса и заголовки
+    static bool cacheable_request(const std::string& method, const std::string& url,
+                                  const std::string& request_head);
+
+    // Есть ли свежий ответ для URL без Vary или загрузка, к которой можно
+    // присоединиться, - проверка до чтения заголовков
+    bool may_serve(const std::string& url, int64_t now_ms);
+
+    // Поиск ответа с учетом Vary и директив запроса (no-cache, max-age).
+    // STALE - найденный ответ нужно ревалидировать
+    Result lookup(const std::string& url, const std::string& request_head, int64_t now_ms,
+                  std::shared_ptr<const CachedResponse>& entry);
+
+    // Запись по заголовкам ответа (тело добавляется позже);
+    // nullptr - ответ сохранять нельзя
+    std::shared_ptr<CachedResponse> prepare(const std::string& request_head,
+                                            const std::string& response_head,
+                                            int64_t request_ms, int64_t response_ms) const;
+
+    // Копия записи с заголовками из ответа 304; nullptr - ответ 304 запрещает
+    // сохранение
+    std::shared_ptr<CachedResponse> refresh(const CachedResponse& entry, const std::string& response_head,
+                                            int64_t request_ms, int64_t response_ms) const;
+
+    // Тело ответа; без Content-Length в заголовках он добавляется
+    static void attach_body(CachedResponse& entry, std::string body);
+
+    void store(const std::string& url, const std::string& request_head,
+               std::shared_ptr<const CachedResponse> entry);
+
+    // Удаление всех вариантов URL после небезопасного запроса (RFC 7234 4.4)
+    void invalidate(const std::string& url);
+
+    // Загрузка URL, выполняемая другим обработчиком, или новая (leader ==
+    // true). nullptr - объединение запросов отключено
+    std::shared_ptr<SharedFetch> join(const std::string& url, bool& leader);
+    // Новые запросы больше не присоединяются к загрузке
+    void release(const std::string& url, const std::shared_ptr<SharedFetch>& fetch);
+    int collapse_timeout_ms() const { return collapse_timeout_ms_.load(std::memory_order_relaxed); }
+
+    // Ключ варианта ответа: URL и значения заголовков запроса из Vary
+    static std::string variant_key(const std::string& url, const std::vector<std::string>& vary,
+                                   const std::string& request_head);
+
+    // Учет обслуживания запросов
+    void record_hit(size_t bytes, int64_t latency_us);
+    void record_miss();
+    void record_revalidated(size_t bytes);
+    void record_collapsed(size_t bytes);
+    void record_collapse_fallback(bool timeout);
+    void render_metrics(std::ostream& out);
+
+    // Разбор сообщений HTTP. head - стартовая строка и заголовки, каждый
+    // с \r\n; одноименные заголовки объединяются через запятую
+    static bool header(const std::string& head, const std::string& name, std::string& value);
+    static bool directive(const std::string& cache_control, const std::string& name,
+                          std::string* argument = nullptr);
+    static int64_t parse_http_date(const std::string& value);  // unix ms или -1
+
+    // Запрос к цели: соединение закрывается после ответа, для ревалидации
+    // добавляются If-None-Match и If-Modified-Since
+    static void rewrite_request(std::string& request_head, const CachedResponse* stale);
+    // Заголовки ответа цели для клиента: соединение закрывается после ответа
+    static std::string closing_head(const std::string& response_head);
+    // Есть ли в запросе собственные условия клиента
+    static bool conditional(const std::string& request_head);
+    // Выполнены ли условия клиента для сохраненного ответа (ответ 304)
+    static bool not_modified(const CachedResponse& entry, const std::string& request_head);
+    // Заголовки ответа клиенту: с Age и Connection: close, для 304 - без тела
+    static std::string response_head(const CachedResponse& entry, int64_t now_ms, bool not_modified);
+
+private:
+    static constexpr size_t SHARDS = 16;
+    static constexpr int FREQUENCY_LIMIT = 3;
+    // Эвристический срок свежести - 10% от возраста Last-Modified, не больше суток
+    static constexpr int64_t HEURISTIC_LIMIT_MS = 24 * 3600 * 1000LL;
+    // Оценка накладных расходов записи помимо заголовков и тела
+    static constexpr size_t ENTRY_OVERHEAD = 256;
+
+    struct Item {
+        std::shared_ptr<const CachedResponse> entry;
+        std::string url;
+        size_t size{0};
+        int frequency{0};
+        bool in_main{false};
+        std::list<std::string>::iterator position;
+    };
+
+    // Имена заголовков Vary сохраненного ответа для URL и ключи его вариантов
+    struct VaryIndex {
+        std::vector<std::string> names;
+        std::vector<std::string> keys;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Item> items;        // По ключу варианта
+        std::unordered_map<std::string, VaryIndex> urls;
+        std::list<std::string> small;                        // Новые записи в начале
+        std::list<std::string> main;
+        std::deque<uint64_t> ghost;                          // Хэши ключей, вытесненных из small
+        std::unordered_set<uint64_t> ghost_set;
+        size_t bytes{0};
+        size_t small_bytes{0};
+    };
+
+    Shard shards_[SHARDS];
+
+    std::atomic<bool> enabled_{true};
+    std::atomic<size_t> max_bytes_{64u << 20};
+    std::atomic<size_t> max_object_size_{1u << 20};
+    std::atomic<int> collapse_timeout_ms_{10000};
+
+    // Выполняющиеся загрузки по URL
+    std::mutex fetches_mutex_;
+    std::unordered_map<std::string, std::shared_ptr<SharedFetch>> fetches_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> revalidated_{0};
+    std::atomic<uint64_t> stored_{0};
+    std::atomic<uint64_t> evicted_{0};
+    std::atomic<uint64_t> bytes_saved_{0};
+    std::atomic<uint64_t> collapsed_{0};
+    std::atomic<uint64_t> collapse_fallbacks_{0};
+    std::atomic<uint64_t> collapse_timeouts_{0};
+    std::atomic<uint64_t> hit_latency_us_{0};
+    std::atomic<int64_t> hit_latency_max_us_{0};
+
+    // Гистограмма задержки попаданий в микросекундах
+    static constexpr int64_t LATENCY_BOUNDS[] = {50, 100, 250, 500, 1000, 2500, 10000};
+    static constexpr size_t LATENCY_BUCKETS = sizeof(LATENCY_BOUNDS) / sizeof(LATENCY_BOUNDS[0]) + 1;
+    std::atomic<uint64_t> hit_latency_buckets_[LATENCY_BUCKETS]{};
+
+    Shard& shard_for(const std::string& url);
+    void evict(Shard& shard, size_t capacity);
+    void remove(Shard& shard, std::unordered_map<std::string, Item>::iterator it);
+    void remove_url(Shard& shard, const std::string& url);
+    static bool describe(CachedResponse& entry, int64_t request_ms, int64_t response_ms);
+    static std::string strip_hop_by_hop(const std::string& head);
+
+    HttpCache(const HttpCache&) = delete;
+    HttpCache& operator=(const HttpCache&) = delete;
+};
+
+#endif // HTTP_CACHE_H
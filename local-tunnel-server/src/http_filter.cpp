@@ -0,0 +1,322 @@
+#include "http_filter.h"
+#include "config.h"
+#include "logger.h"
+#include <strings.h>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+bool same_name(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+std::string_view trim(std::string_view text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string_view::npos) {
+        return std::string_view();
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+std::string make_line(std::string_view name, std::string_view value) {
+    std::string line;
+    line.reserve(name.size() + value.size() + 4);
+    line.append(name).append(": ").append(value).append("\r\n");
+    return line;
+}
+
+// Имя и значение строки, собранной make_line
+std::string_view line_name(const std::string& line) {
+    return std::string_view(line).substr(0, line.find(':'));
+}
+
+std::string_view line_value(const std::string& line) {
+    size_t colon = line.find(':');
+    return std::string_view(line).substr(colon + 2, line.size() - colon - 4);
+}
+
+// "*" - любая цель, "*.example.com" - домен и его поддомены, иначе точное имя
+bool host_matches(const std::string& pattern, const std::string& host) {
+    if (pattern == "*") {
+        return true;
+    }
+    if (pattern.size() > 2 && pattern[0] == '*' && pattern[1] == '.') {
+        size_t suffix = pattern.size() - 1;  // ".example.com"
+        if (host.size() == suffix - 1) {
+            return strcasecmp(host.c_str(), pattern.c_str() + 2) == 0;
+        }
+        return host.size() > suffix &&
+               strcasecmp(host.c_str() + host.size() - suffix, pattern.c_str() + 1) == 0;
+    }
+    return strcasecmp(pattern.c_str(), host.c_str()) == 0;
+}
+
+class StripFilter : public HttpFilter {
+public:
+    explicit StripFilter(std::vector<std::string> names) : names_(std::move(names)) {}
+
+    void apply(const HttpFilterContext&, HttpHeaders& headers) const override {
+        for (const std::string& name : names_) {
+            headers.remove(name);
+        }
+    }
+
+private:
+    std::vector<std::string> names_;
+};
+
+// Host по цели из абсолютного URL запроса
+class HostFilter : public HttpFilter {
+public:
+    void apply(const HttpFilterContext& context, HttpHeaders& headers) const override {
+        headers.set("Host", context.target_host);
+    }
+};
+
+// Отдельная строка Via равнозначна добавлению к списку существующей
+class ViaFilter : public HttpFilter {
+public:
+    explicit ViaFilter(std::string value) : value_(std::move(value)) {}
+
+    void apply(const HttpFilterContext&, HttpHeaders& headers) const override {
+        headers.add("Via", value_);
+    }
+
+private:
+    std::string value_;
+};
+
+class ForwardedForFilter : public HttpFilter {
+public:
+    void apply(const HttpFilterContext& context, HttpHeaders& headers) const override {
+        std::string_view existing;
+        if (headers.find("X-Forwarded-For", existing)) {
+            std::string value(existing);
+            value += ", ";
+            value += context.client_ip;
+            headers.set("X-Forwarded-For", value);
+        } else {
+            headers.add("X-Forwarded-For", context.client_ip);
+        }
+    }
+};
+
+class InjectFilter : public HttpFilter {
+public:
+    InjectFilter(std::string pattern, std::string name, std::string value)
+        : pattern_(std::move(pattern)), name_(std::move(name)), value_(std::move(value)) {}
+
+    void apply(const HttpFilterContext& context, HttpHeaders& headers) const override {
+        if (host_matches(pattern_, context.target_host)) {
+            headers.set(name_, value_);
+        }
+    }
+
+private:
+    std::string pattern_;
+    std::string name_;
+    std::string value_;
+};
+
+// "шаблон_цели Имя: значение"
+bool parse_inject(const std::string& rule, std::string& pattern, std::string& name, std::string& value) {
+    std::string_view text = trim(rule);
+    size_t space = text.find_first_of(" \t");
+    if (space == std::string_view::npos) {
+        return false;
+    }
+    std::string_view header = trim(text.substr(space));
+    size_t colon = header.find(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    pattern = std::string(text.substr(0, space));
+    name = std::string(trim(header.substr(0, colon)));
+    value = std::string(trim(header.substr(colon + 1)));
+    return !name.empty() && name.find_first_of(" \t") == std::string::npos;
+}
+
+}  // namespace
+
+void HttpHeaders::parse(std::string_view block) {
+    clear();
+    size_t position = 0;
+    while (position < block.size()) {
+        size_t eol = block.find('\n', position);
+        size_t end = eol == std::string_view::npos ? block.size() : eol + 1;
+        Field field;
+        field.line = block.substr(position, end - position);
+        size_t colon = field.line.find(':');
+        if (colon != std::string_view::npos) {
+            field.name = field.line.substr(0, colon);
+            field.value = trim(field.line.substr(colon + 1));
+        }
+        fields_.push_back(field);
+        position = end;
+    }
+}
+
+void HttpHeaders::clear() {
+    fields_.clear();
+    added_.clear();
+    appended_.clear();
+}
+
+bool HttpHeaders::find(std::string_view name, std::string_view& value) const {
+    for (const Field& field : fields_) {
+        if (!field.removed && same_name(field.name, name)) {
+            value = field.replacement < 0 ? field.value : line_value(added_[field.replacement]);
+            return true;
+        }
+    }
+    for (int index : appended_) {
+        if (same_name(line_name(added_[index]), name)) {
+            value = line_value(added_[index]);
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpHeaders::set(std::string_view name, std::string_view value) {
+    bool done = false;
+    for (Field& field : fields_) {
+        if (field.removed || !same_name(field.name, name)) {
+            continue;
+        }
+        if (done) {
+            field.removed = true;
+            continue;
+        }
+        // Имя остается в написании клиента
+        std::string line = make_line(field.name, value);
+        if (field.replacement < 0) {
+            field.replacement = static_cast<int>(added_.size());
+            added_.push_back(std::move(line));
+        } else {
+            added_[field.replacement] = std::move(line);
+        }
+        done = true;
+    }
+    for (auto it = appended_.begin(); it != appended_.end();) {
+        if (!same_name(line_name(added_[*it]), name)) {
+            ++it;
+        } else if (done) {
+            it = appended_.erase(it);
+        } else {
+            added_[*it] = make_line(name, value);
+            done = true;
+            ++it;
+        }
+    }
+    if (!done) {
+        add(name, value);
+    }
+}
+
+void HttpHeaders::add(std::string_view name, std::string_view value) {
+    appended_.push_back(static_cast<int>(added_.size()));
+    added_.push_back(make_line(name, value));
+}
+
+void HttpHeaders::remove(std::string_view name) {
+    for (Field& field : fields_) {
+        if (same_name(field.name, name)) {
+            field.removed = true;
+        }
+    }
+    appended_.erase(std::remove_if(appended_.begin(), appended_.end(), [&](int index) {
+        return same_name(line_name(added_[index]), name);
+    }), appended_.end());
+}
+
+void HttpHeaders::gather(std::vector<iovec>& out) const {
+    auto push = [&out](const char* data, size_t size) {
+        // Строки, лежащие в буфере подряд, объединяются
+        if (!out.empty() && static_cast<const char*>(out.back().iov_base) + out.back().iov_len == data) {
+            out.back().iov_len += size;
+            return;
+        }
+        iovec part;
+        part.iov_base = const_cast<char*>(data);
+        part.iov_len = size;
+        out.push_back(part);
+    };
+    for (const Field& field : fields_) {
+        if (field.removed) {
+            continue;
+        }
+        if (field.replacement < 0) {
+            push(field.line.data(), field.line.size());
+        } else {
+            push(added_[field.replacement].data(), added_[field.replacement].size());
+        }
+    }
+    for (int index : appended_) {
+        push(added_[index].data(), added_[index].size());
+    }
+}
+
+void HttpHeaders::append_to(std::string& out) const {
+    std::vector<iovec> parts;
+    gather(parts);
+    for (const iovec& part : parts) {
+        out.append(static_cast<const char*>(part.iov_base), part.iov_len);
+    }
+}
+
+HttpFilterChain::HttpFilterChain(const Settings& settings) {
+    if (!settings.strip.empty()) {
+        filters_.push_back(std::make_unique<StripFilter>(settings.strip));
+    }
+    if (settings.rewrite_host) {
+        filters_.push_back(std::make_unique<HostFilter>());
+    }
+    if (!settings.via.empty()) {
+        filters_.push_back(std::make_unique<ViaFilter>(settings.via));
+    }
+    if (settings.forwarded_for) {
+        filters_.push_back(std::make_unique<ForwardedForFilter>());
+    }
+    for (const std::string& rule : settings.inject) {
+        std::string pattern;
+        std::string name;
+        std::string value;
+        if (!parse_inject(rule, pattern, name, value)) {
+            Logger::warning("Пропущено правило заголовка (inject): " + rule);
+            continue;
+        }
+        filters_.push_back(std::make_unique<InjectFilter>(std::move(pattern), std::move(name), std::move(value)));
+    }
+}
+
+void HttpFilterChain::apply(const HttpFilterContext& context, HttpHeaders& headers) const {
+    for (const auto& filter : filters_) {
+        filter->apply(context, headers);
+    }
+}
+
+HttpFilterChain::Settings HttpFilterChain::settings_from(const Config& config) {
+    Settings settings;
+    settings.rewrite_host = config.is_http_rewrite_host();
+    settings.via = config.get_http_via();
+    settings.forwarded_for = config.is_http_forwarded_for();
+    settings.strip = config.get_http_strip_headers();
+    settings.inject = config.get_http_inject_headers();
+    return settings;
+}
+
+HttpFilters::HttpFilters() : chain_(std::make_shared<HttpFilterChain>(HttpFilterChain::Settings())) {
+}
+
+void HttpFilters::configure(const Config& config) {
+    std::lock_guard<std::mutex> lock(configure_mutex_);
+    auto chain = std::make_shared<const HttpFilterChain>(HttpFilterChain::settings_from(config));
+    std::atomic_store(&chain_, chain);
+}
+
+std::shared_ptr<const HttpFilterChain> HttpFilters::current() const {
+    return std::atomic_load(&chain_);
+}
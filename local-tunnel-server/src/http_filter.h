@@ -0,0 +1,104 @@
+#ifndef HTTP_FILTER_H
+#define HTTP_FILTER_H
+
+#include <sys/uio.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Config;
+
+// Заголовки запроса обычного HTTP прокси. Поля - участки буфера приема,
+// правки - пометки удаления и замены и добавленные строки. Неизмененные
+// строки не копируются: gather() отдает их участками буфера для writev.
+// Буфер не должен меняться, пока заголовки используются.
+class HttpHeaders {
+public:
+    // Строки заголовков без пустой строки в конце. Строки без ':'
+    // пересылаются как есть
+    void parse(std::string_view block);
+    void clear();
+
+    bool empty() const { return fields_.empty() && added_.empty(); }
+
+    // Значение первого заголовка с именем name (без учета регистра)
+    bool find(std::string_view name, std::string_view& value) const;
+
+    // Замена первого заголовка name (остальные удаляются) или добавление в
+    // конец, если его нет
+    void set(std::string_view name, std::string_view value);
+    void add(std::string_view name, std::string_view value);
+    void remove(std::string_view name);
+
+    // Участки для writev: неизмененные строки подряд - одним участком
+    void gather(std::vector<iovec>& out) const;
+    // Заголовки с правками текстом (нужен кэшу)
+    void append_to(std::string& out) const;
+
+private:
+    struct Field {
+        std::string_view line;   // С концом строки
+        std::string_view name;
+        std::string_view value;  // Без пробелов вокруг
+        bool removed{false};
+        int replacement{-1};     // Индекс строки в added_
+    };
+
+    std::vector<Field> fields_;
+    std::vector<std::string> added_;
+    std::vector<int> appended_;  // Строки added_, идущие после полей
+};
+
+// Данные соединения, от которых зависят фильтры
+struct HttpFilterContext {
+    const std::string& target_host;
+    const std::string& client_ip;
+};
+
+class HttpFilter {
+public:
+    virtual ~HttpFilter() = default;
+    virtual void apply(const HttpFilterContext& context, HttpHeaders& headers) const = 0;
+};
+
+// Цепочка фильтров заголовков: удаление, замена Host, Via, X-Forwarded-For
+// и заголовки для отдельных целей, в этом порядке
+class HttpFilterChain {
+public:
+    struct Settings {
+        bool rewrite_host{true};
+        std::string via;                  // Пусто - без Via
+        bool forwarded_for{false};
+        std::vector<std::string> strip;
+        std::vector<std::string> inject;  // "шаблон_цели Имя: значение"
+    };
+
+    // Неверные правила inject пропускаются с предупреждением
+    explicit HttpFilterChain(const Settings& settings);
+
+    void apply(const HttpFilterContext& context, HttpHeaders& headers) const;
+    size_t size() const { return filters_.size(); }
+
+    static Settings settings_from(const Config& config);
+
+private:
+    std::vector<std::unique_ptr<HttpFilter>> filters_;
+};
+
+// Актуальная цепочка: обработчик берет снимок через current(), перезагрузка
+// конфигурации собирает новую цепочку и атомарно подменяет указатель
+class HttpFilters {
+public:
+    HttpFilters();
+
+    void configure(const Config& config);
+    std::shared_ptr<const HttpFilterChain> current() const;
+
+private:
+    std::shared_ptr<const HttpFilterChain> chain_;
+    std::mutex configure_mutex_;
+};
+
+#endif // HTTP_FILTER_H
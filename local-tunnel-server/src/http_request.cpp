@@ -0,0 +1,104 @@
+#include "http_request.h"
+
+namespace HttpRequest {
+
+namespace {
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+// Следующее слово строки (слова разделены пробельными символами)
+bool next_word(const std::string& line, size_t& pos, std::string& word) {
+    while (pos < line.size() && is_space(line[pos])) {
+        ++pos;
+    }
+    size_t start = pos;
+    while (pos < line.size() && !is_space(line[pos])) {
+        ++pos;
+    }
+    word.assign(line, start, pos - start);
+    return pos > start;
+}
+
+bool split_words(const std::string& line, RequestLine& request) {
+    size_t pos = 0;
+    return next_word(line, pos, request.method) && next_word(line, pos, request.target) &&
+           next_word(line, pos, request.version);
+}
+
+// Порт - десятичные цифры в начале строки после двоеточия
+bool parse_port(const std::string& text, size_t start, size_t end, int& port) {
+    int value = 0;
+    size_t digits = 0;
+    for (size_t i = start; i < end && text[i] >= '0' && text[i] <= '9'; ++i, ++digits) {
+        value = value * 10 + (text[i] - '0');
+        if (value > 65535) {
+            return false;
+        }
+    }
+    if (digits == 0 || value == 0) {
+        return false;
+    }
+    port = value;
+    return true;
+}
+
+}  // namespace
+
+Error parse_connect(const std::string& line, RequestLine& request) {
+    if (!split_words(line, request)) {
+        return Error::FORMAT;
+    }
+    if (request.method != "CONNECT") {
+        return Error::METHOD;
+    }
+    size_t colon = request.target.find(':');
+    if (colon == std::string::npos) {
+        return Error::NO_PORT;
+    }
+    request.host.assign(request.target, 0, colon);
+    request.path.clear();
+    request.https = false;
+    return parse_port(request.target, colon + 1, request.target.size(), request.port) ? Error::NONE : Error::BAD_PORT;
+}
+
+Error parse_absolute(const std::string& line, RequestLine& request) {
+    if (!split_words(line, request)) {
+        return Error::FORMAT;
+    }
+
+    size_t authority;
+    if (request.target.compare(0, 8, "https://") == 0) {
+        authority = 8;
+        request.https = true;
+        request.port = 443;
+    } else if (request.target.compare(0, 7, "http://") == 0) {
+        authority = 7;
+        request.https = false;
+        request.port = 80;
+    } else {
+        return Error::SCHEME;
+    }
+
+    size_t slash = request.target.find('/', authority);
+    size_t authority_end = slash == std::string::npos ? request.target.size() : slash;
+    if (slash == std::string::npos) {
+        request.path = "/";
+    } else {
+        request.path.assign(request.target, slash, std::string::npos);
+    }
+
+    size_t colon = request.target.find(':', authority);
+    if (colon != std::string::npos && colon < authority_end) {
+        request.host.assign(request.target, authority, colon - authority);
+        if (!parse_port(request.target, colon + 1, authority_end, request.port)) {
+            return Error::BAD_PORT;
+        }
+    } else {
+        request.host.assign(request.target, authority, authority_end - authority);
+    }
+    return Error::NONE;
+}
+
+}  // namespace HttpRequest
@@ -0,0 +1,36 @@
+#ifndef HTTP_REQUEST_H
+#define HTTP_REQUEST_H
+
+#include <string>
+
+// Разбор стартовой строки запросов HTTP прокси: CONNECT host:port и
+// обычных запросов с абсолютным URL. Функции не пишут в журнал - сообщение
+// об ошибке формирует обработчик по коду ошибки и уже разобранным полям.
+namespace HttpRequest {
+    enum class Error {
+        NONE,
+        FORMAT,      // Меньше трех слов в строке
+        METHOD,      // Ожидался CONNECT
+        NO_PORT,     // В CONNECT нет порта
+        BAD_PORT,    // Порт не число или вне 1..65535
+        SCHEME       // URL не http:// и не https://
+    };
+
+    struct RequestLine {
+        std::string method;
+        std::string target;   // Как в запросе: host:port или абсолютный URL
+        std::string version;
+        std::string path;     // Для абсолютного URL - путь с запросом, иначе пусто
+        std::string host;
+        int port{0};
+        bool https{false};
+    };
+
+    // "CONNECT example.com:443 HTTP/1.1"
+    Error parse_connect(const std::string& line, RequestLine& request);
+
+    // "GET http://example.com[:port]/path HTTP/1.1"; порт по умолчанию - по схеме
+    Error parse_absolute(const std::string& line, RequestLine& request);
+}
+
+#endif // HTTP_REQUEST_H
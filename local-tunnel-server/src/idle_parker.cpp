@@ -0,0 +1,176 @@
+#include "idle_parker.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+IdleParker::IdleParker() {
+    Metrics::register_provider("idle_parker", [this](std::ostream& out) {
+        render_metrics(out);
+    });
+}
+
+IdleParker::~IdleParker() {
+    stop();
+    Metrics::unregister_provider("idle_parker");
+}
+
+bool IdleParker::start() {
+    if (running_.load()) {
+        return true;
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        Logger::error("Не удалось создать epoll для простаивающих туннелей: " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;  // Идентификатор 0 - пробуждение при остановке
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+    running_.store(true);
+    thread_ = std::make_unique<std::thread>(&IdleParker::loop, this);
+    return true;
+}
+
+void IdleParker::stop() {
+    if (running_.exchange(false) && wake_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd_, &one, sizeof(one));
+        (void)written;
+    }
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+
+    // Запаркованные соединения закрывают их обработчики
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+    if (wake_fd_ >= 0) {
+        close(wake_fd_);
+        wake_fd_ = -1;
+    }
+}
+
+bool IdleParker::park(int client_socket, int target_socket, std::atomic<uint64_t>& parked_id,
+                      ResumeFunction resume) {
+    if (!running_.load()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t id = next_id_++;
+    entries_.emplace(id, Entry{client_socket, target_socket, std::move(resume)});
+    parked_id.store(id);
+
+    // Событие может прийти сразу после регистрации, но поток стоянки
+    // обработает его только после снятия блокировки
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+        entries_.erase(id);
+        parked_id.store(0);
+        return false;
+    }
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, target_socket, &event) < 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client_socket, nullptr);
+        entries_.erase(id);
+        parked_id.store(0);
+        return false;
+    }
+
+    parked_total_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void IdleParker::unregister(const Entry& entry) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry.client_socket, nullptr);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, entry.target_socket, nullptr);
+}
+
+void IdleParker::forget(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end()) {
+        return;
+    }
+    if (epoll_fd_ >= 0) {
+        unregister(it->second);
+    }
+    entries_.erase(it);
+}
+
+size_t IdleParker::parked() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void IdleParker::loop() {
+    std::vector<epoll_event> events(256);
+    std::vector<ResumeFunction> ready;
+    uint64_t trimmed_at = 0;
+
+    while (running_.load()) {
+        // После волны парковок освобожденные стеки и буферы потоков остаются
+        // в кэшах malloc - возвращаем их системе
+        uint64_t parked_total = parked_total_.load(std::memory_order_relaxed);
+        if (parked_total - trimmed_at >= TRIM_AFTER_PARKS) {
+            trimmed_at = parked_total;
+            malloc_trim(0);
+        }
+
+        int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), 1000);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::error("Ошибка epoll_wait: " + std::string(strerror(errno)));
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int i = 0; i < count; ++i) {
+                uint64_t id = events[i].data.u64;
+                auto it = (id == 0) ? entries_.end() : entries_.find(id);
+                if (it == entries_.end()) {
+                    continue;  // Второй сокет того же туннеля или пробуждение
+                }
+                unregister(it->second);
+                ready.push_back(std::move(it->second.resume));
+                entries_.erase(it);
+            }
+        }
+
+        // Возобновление вне блокировки: оно запускает поток обработчика
+        for (auto& resume : ready) {
+            resumed_total_.fetch_add(1, std::memory_order_relaxed);
+            resume();
+        }
+        ready.clear();
+    }
+}
+
+void IdleParker::render_metrics(std::ostream& out) {
+    out << "tunnels_parked " << parked() << "\n"
+        << "tunnels_parked_total " << parked_total_.load() << "\n"
+        << "tunnels_resumed_total " << resumed_total_.load() << "\n";
+}
@@ -0,0 +1,66 @@
+#ifndef IDLE_PARKER_H
+#define IDLE_PARKER_H
+
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <ostream>
+#include <cstdint>
+
+// "Парковка" простаивающих туннелей. Поток обработчика простаивающего
+// туннеля завершается, а оба его сокета ожидают данных в общем epoll.
+// При первых данных с любой стороны вызывается функция возобновления,
+// которая снова запускает поток передачи. На один запаркованный туннель
+// приходится только запись в таблице и регистрация сокетов в epoll.
+class IdleParker {
+public:
+    using ResumeFunction = std::function<void()>;
+
+    IdleParker();
+    ~IdleParker();
+
+    bool start();
+    void stop();
+    bool is_running() const { return running_.load(); }
+
+    // false - парковка невозможна. Идентификатор стоянки записывается в
+    // parked_id под блокировкой до регистрации сокетов в epoll, поэтому
+    // возобновление всегда застает его опубликованным
+    bool park(int client_socket, int target_socket, std::atomic<uint64_t>& parked_id,
+              ResumeFunction resume);
+
+    // Снятие с парковки без возобновления (соединение закрывается)
+    void forget(uint64_t id);
+
+    size_t parked() const;
+
+    void render_metrics(std::ostream& out);
+
+private:
+    struct Entry {
+        int client_socket;
+        int target_socket;
+        ResumeFunction resume;
+    };
+
+    static constexpr uint64_t TRIM_AFTER_PARKS = 256;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    uint64_t next_id_{1};
+    int epoll_fd_{-1};
+    int wake_fd_{-1};
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    std::atomic<uint64_t> parked_total_{0};
+    std::atomic<uint64_t> resumed_total_{0};
+
+    void loop();
+    void unregister(const Entry& entry);
+};
+
+#endif // IDLE_PARKER_H
@@ -1,12 +1,20 @@
 #include "logger.h"
+#include "metrics.h"
+#include <algorithm>
+#include <vector>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
 
-LogLevel Logger::current_level_ = LogLevel::INFO;
+std::atomic<LogLevel> Logger::current_level_{LogLevel::INFO};
 std::string Logger::log_file_;
 std::ofstream Logger::file_stream_;
 std::mutex Logger::log_mutex_;
+std::mutex Logger::sites_mutex_;
+std::map<std::string, std::unique_ptr<LogSite>> Logger::sites_;
+std::atomic<double> Logger::rate_per_second_{20};
+std::atomic<double> Logger::rate_burst_{50};
+std::atomic<int> Logger::debug_sample_one_in_{1};
 
 void Logger::init(const std::string& level, const std::string& file, 
                  const std::string& format) {
@@ -45,22 +53,141 @@ void Logger::debug(const std::string& message) {
     log(LogLevel::DEBUG, message);
 }
 
+void Logger::info(LogSite& site, const std::string& message) {
+    log(site, LogLevel::INFO, message);
+}
+
+void Logger::warning(LogSite& site, const std::string& message) {
+    log(site, LogLevel::WARNING, message);
+}
+
+void Logger::error(LogSite& site, const std::string& message) {
+    log(site, LogLevel::ERROR, message);
+}
+
+void Logger::debug(LogSite& site, const std::string& message) {
+    log(site, LogLevel::DEBUG, message);
+}
+
+LogSite& Logger::site(const std::string& name) {
+    std::lock_guard<std::mutex> lock(sites_mutex_);
+    auto& slot = sites_[name];
+    if (!slot) {
+        slot = std::make_unique<LogSite>(name);
+    }
+    return *slot;
+}
+
+void Logger::set_rate_limit(int per_second, int burst) {
+    rate_per_second_.store(std::max(0, per_second));
+    rate_burst_.store(std::max({1, burst, per_second}));
+}
+
+void Logger::set_debug_sampling(int one_in) {
+    debug_sample_one_in_.store(std::max(0, one_in));
+}
+
+bool Logger::debug_sampled(uint64_t connection_id) {
+    int one_in = debug_sample_one_in_.load(std::memory_order_relaxed);
+    return one_in > 0 && connection_id % static_cast<uint64_t>(one_in) == 0;
+}
+
+bool LogSite::acquire(LogLevel level, double rate, double burst, uint64_t& suppressed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    
+    if (rate <= 0) {
+        tokens_ = burst;
+    } else if (tokens_ < 0) {
+        tokens_ = burst;
+    } else {
+        double elapsed = std::chrono::duration<double>(now - refilled_).count();
+        tokens_ = std::min(burst, tokens_ + elapsed * rate);
+    }
+    refilled_ = now;
+    
+    if (tokens_ >= 1) {
+        tokens_ -= 1;
+        suppressed = suppressed_;
+        suppressed_ = 0;
+        return true;
+    }
+    if (suppressed_ == 0) {
+        first_suppressed_ = now;
+    }
+    ++suppressed_;
+    level_ = level;
+    return false;
+}
+
+void Logger::log(LogSite& site, LogLevel level, const std::string& message) {
+    static MetricValue& suppressed_total = Metrics::counter("log_suppressed_total");
+    
+    if (!is_enabled(level)) {
+        return;
+    }
+    
+    uint64_t suppressed = 0;
+    if (!site.acquire(level, rate_per_second_.load(std::memory_order_relaxed),
+                      rate_burst_.load(std::memory_order_relaxed), suppressed)) {
+        suppressed_total.add();
+        return;
+    }
+    if (suppressed > 0) {
+        log(level, message + " (подавлено " + std::to_string(suppressed) + " похожих сообщений)");
+    } else {
+        log(level, message);
+    }
+}
+
+void Logger::report_suppressed() {
+    struct Summary {
+        LogLevel level;
+        std::string text;
+    };
+    std::vector<Summary> summaries;
+    auto now = LogSite::Clock::now();
+    
+    {
+        std::lock_guard<std::mutex> lock(sites_mutex_);
+        for (auto& entry : sites_) {
+            LogSite& site = *entry.second;
+            std::lock_guard<std::mutex> site_lock(site.mutex_);
+            // Сводка не чаще раза в секунду на место вызова
+            if (site.suppressed_ == 0 || now - site.first_suppressed_ < std::chrono::seconds(1)) {
+                continue;
+            }
+            double seconds = std::chrono::duration<double>(now - site.first_suppressed_).count();
+            summaries.push_back(Summary{
+                site.level_,
+                "[" + site.name_ + "] подавлено " + std::to_string(site.suppressed_) +
+                " похожих сообщений за " + std::to_string(static_cast<int>(seconds + 0.5)) + " с"});
+            site.suppressed_ = 0;
+        }
+    }
+    
+    for (const auto& summary : summaries) {
+        log(summary.level, summary.text);
+    }
+}
+
 void Logger::set_level(const std::string& level) {
     std::lock_guard<std::mutex> lock(log_mutex_);
     current_level_ = string_to_level(level);
 }
 
 void Logger::log(LogLevel level, const std::string& message) {
-    if (level < current_level_) {
+    if (level < current_level_.load(std::memory_order_relaxed)) {
         return;
     }
     
-    std::lock_guard<std::mutex> lock(log_mutex_);
-    
+    // Строка формируется до блокировки - под ней только вывод
     std::string timestamp = get_timestamp();
     std::string level_str = level_to_string(level);
     std::string log_line = timestamp + " [" + level_str + "] " + message;
     
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    
     // Вывод в консоль
     if (level >= LogLevel::ERROR) {
         std::cerr << log_line << std::endl;
@@ -104,7 +231,11 @@ std::string Logger::get_timestamp() {
     auto now = std::chrono::system_clock::now();
     auto time_t = std::chrono::system_clock::to_time_t(now);
     
+    // localtime_r: localtime использует общий статический буфер
+    std::tm local{};
+    localtime_r(&time_t, &local);
+    
     std::stringstream ss;
-    ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
+    ss << std::put_time(&local, "%Y-%m-%d %H:%M:%S");
     return ss.str();
 }
\ No newline at end of file
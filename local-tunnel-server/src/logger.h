@@ -5,6 +5,11 @@
 #include <fstream>
 #include <mutex>
 #include <iostream>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstdint>
 
 enum class LogLevel {
     TRACE = 0,
@@ -16,6 +21,36 @@ enum class LogLevel {
     OFF = 6
 };
 
+class Logger;
+
+// Место вызова с ограничением частоты сообщений (ведро токенов). Сообщения
+// сверх бюджета не выводятся, а подсчитываются; их число сообщается при
+// следующем выведенном сообщении или сводкой Logger::report_suppressed().
+// Адрес стабилен, поэтому место вызова кэширует ссылку:
+//     static LogSite& site = Logger::site("proxy.header_timeout");
+//     Logger::error(site, "...");
+class LogSite {
+public:
+    explicit LogSite(const std::string& name) : name_(name) {}
+
+    const std::string& name() const { return name_; }
+
+private:
+    friend class Logger;
+    using Clock = std::chrono::steady_clock;
+
+    std::string name_;
+    std::mutex mutex_;
+    double tokens_{-1};  // -1 - ведро еще не заполнялось
+    Clock::time_point refilled_{};
+    uint64_t suppressed_{0};
+    Clock::time_point first_suppressed_{};
+    LogLevel level_{LogLevel::INFO};
+
+    // false - сообщение подавлено; suppressed - сколько подавлено до него
+    bool acquire(LogLevel level, double rate, double burst, uint64_t& suppressed);
+};
+
 class Logger {
 public:
     static void init(const std::string& level = "INFO", 
@@ -27,17 +62,43 @@ public:
     static void error(const std::string& message);
     static void debug(const std::string& message);
     
+    // Сообщения с ограничением частоты по месту вызова
+    static void info(LogSite& site, const std::string& message);
+    static void warning(LogSite& site, const std::string& message);
+    static void error(LogSite& site, const std::string& message);
+    static void debug(LogSite& site, const std::string& message);
+    
     static void set_level(const std::string& level);
+    static bool is_enabled(LogLevel level) { return level >= current_level_.load(std::memory_order_relaxed); }
+    
+    // Реестр мест вызова и бюджет каждого (0 сообщений в секунду - без ограничения)
+    static LogSite& site(const std::string& name);
+    static void set_rate_limit(int per_second, int burst);
+    
+    // Сводка "подавлено N похожих сообщений" по местам с подавленными сообщениями
+    static void report_suppressed();
+    
+    // Детерминированная выборка отладочных сообщений соединений:
+    // выводятся сообщения каждого N-го соединения
+    static void set_debug_sampling(int one_in);
+    static bool debug_sampled(uint64_t connection_id);
 
 private:
-    static LogLevel current_level_;
+    static std::atomic<LogLevel> current_level_;  // Читается без блокировки
     static std::string log_file_;
     static std::ofstream file_stream_;
     static std::mutex log_mutex_;
     
+    static std::mutex sites_mutex_;
+    static std::map<std::string, std::unique_ptr<LogSite>> sites_;
+    static std::atomic<double> rate_per_second_;
+    static std::atomic<double> rate_burst_;
+    static std::atomic<int> debug_sample_one_in_;
+    
     static LogLevel string_to_level(const std::string& level);
     static std::string level_to_string(LogLevel level);
     static void log(LogLevel level, const std::string& message);
+    static void log(LogSite& site, LogLevel level, const std::string& message);
     static std::string get_timestamp();
 };
 
@@ -0,0 +1,219 @@
+#include "lz4.h"
+#include <cstring>
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;      // Последние байты блока - всегда литералы
+constexpr size_t MATCH_FIND_LIMIT = 12;  // Совпадение начинается не ближе к концу блока
+constexpr size_t MAX_DISTANCE = 65535;
+constexpr int MAX_HASH_LOG = 12;
+constexpr unsigned SKIP_TRIGGER = 6;     // Промахов подряд до увеличения шага поиска
+
+inline uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash(uint32_t sequence, int hash_log) {
+    return (sequence * 2654435761u) >> (32 - hash_log);
+}
+
+// Длина общего начала a и b, не дальше limit (b лежит раньше a)
+inline size_t common_length(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+    const uint8_t* start = a;
+    while (a + sizeof(uint64_t) <= limit) {
+        uint64_t difference = read64(a) ^ read64(b);
+        if (difference != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return static_cast<size_t>(a - start) + (__builtin_ctzll(difference) >> 3);
+#else
+            return static_cast<size_t>(a - start) + (__builtin_clzll(difference) >> 3);
+#endif
+        }
+        a += sizeof(uint64_t);
+        b += sizeof(uint64_t);
+    }
+    while (a < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return static_cast<size_t>(a - start);
+}
+
+// Длина сверх 15 - байтами по 255 и остатком
+inline uint8_t* write_length(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+// Последовательность: литералы и совпадение (match_length 0 - последняя
+// последовательность блока). nullptr - не хватает места
+uint8_t* write_sequence(uint8_t* op, uint8_t* op_end, const uint8_t* literals, size_t literal_length,
+                        size_t offset, size_t match_length) {
+    size_t worst = 1 + literal_length / 255 + 1 + literal_length + (match_length ? 3 + match_length / 255 : 0);
+    if (worst > static_cast<size_t>(op_end - op)) {
+        return nullptr;
+    }
+    uint8_t* token = op++;
+    *token = static_cast<uint8_t>(literal_length >= 15 ? 0xF0 : literal_length << 4);
+    if (literal_length >= 15) {
+        op = write_length(op, literal_length - 15);
+    }
+    if (literal_length > 0) {
+        std::memcpy(op, literals, literal_length);
+        op += literal_length;
+    }
+
+    if (match_length > 0) {
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+        size_t extra = match_length - MIN_MATCH;
+        *token |= static_cast<uint8_t>(extra >= 15 ? 15 : extra);
+        if (extra >= 15) {
+            op = write_length(op, extra - 15);
+        }
+    }
+    return op;
+}
+
+bool read_length(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+}  // namespace
+
+namespace Lz4 {
+
+size_t compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity) {
+    if (size > MAX_INPUT) {
+        return 0;
+    }
+    uint8_t* op = output;
+    uint8_t* const op_end = output + capacity;
+    const uint8_t* anchor = input;
+    const uint8_t* const end = input + size;
+
+    if (size > MATCH_FIND_LIMIT) {
+        // Таблица поменьше для коротких блоков: ее обнуление не должно
+        // стоить дороже самого сжатия
+        int hash_log = size > 8192 ? MAX_HASH_LOG : (size > 1024 ? 10 : 8);
+        uint16_t table[1 << MAX_HASH_LOG];
+        std::memset(table, 0, sizeof(uint16_t) << hash_log);
+
+        const uint8_t* const match_limit = end - LAST_LITERALS;
+        const uint8_t* const search_limit = end - MATCH_FIND_LIMIT;
+        const uint8_t* ip = input + 1;
+        unsigned attempts = 1u << SKIP_TRIGGER;
+        while (ip <= search_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t slot = hash(sequence, hash_log);
+            const uint8_t* candidate = input + table[slot];
+            table[slot] = static_cast<uint16_t>(ip - input);
+            if (candidate >= ip || static_cast<size_t>(ip - candidate) > MAX_DISTANCE ||
+                read32(candidate) != sequence) {
+                // Чем дольше нет совпадений, тем длиннее шаг
+                ip += attempts++ >> SKIP_TRIGGER;
+                continue;
+            }
+            attempts = 1u << SKIP_TRIGGER;
+
+            while (ip > anchor && candidate > input && ip[-1] == candidate[-1]) {
+                --ip;
+                --candidate;
+            }
+            size_t length = MIN_MATCH + common_length(ip + MIN_MATCH, candidate + MIN_MATCH, match_limit);
+            op = write_sequence(op, op_end, anchor, static_cast<size_t>(ip - anchor),
+                                static_cast<size_t>(ip - candidate), length);
+            if (op == nullptr) {
+                return 0;
+            }
+            ip += length;
+            anchor = ip;
+            if (ip <= search_limit) {
+                table[hash(read32(ip - 2), hash_log)] = static_cast<uint16_t>(ip - 2 - input);
+            }
+        }
+    }
+
+    op = write_sequence(op, op_end, anchor, static_cast<size_t>(end - anchor), 0, 0);
+    return op == nullptr ? 0 : static_cast<size_t>(op - output);
+}
+
+bool decompress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity, size_t& produced) {
+    const uint8_t* ip = input;
+    const uint8_t* const end = input + size;
+    uint8_t* op = output;
+    uint8_t* const op_end = output + capacity;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(ip, end, literal_length)) {
+            return false;
+        }
+        if (literal_length > static_cast<size_t>(end - ip) || literal_length > static_cast<size_t>(op_end - op)) {
+            return false;
+        }
+        std::memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == end) {
+            break;  // Последняя последовательность - только литералы
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = static_cast<size_t>(ip[0]) | static_cast<size_t>(ip[1]) << 8;
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - output)) {
+            return false;
+        }
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(ip, end, match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (match_length > static_cast<size_t>(op_end - op)) {
+            return false;
+        }
+
+        if (offset == 1) {
+            std::memset(op, op[-1], match_length);
+            op += match_length;
+            continue;
+        }
+        // Совпадение может перекрывать записываемое: копируется кусками не
+        // длиннее смещения, повторяя период
+        while (match_length > 0) {
+            size_t chunk = match_length < offset ? match_length : offset;
+            std::memcpy(op, op - offset, chunk);
+            op += chunk;
+            match_length -= chunk;
+        }
+    }
+    produced = static_cast<size_t>(op - output);
+    return true;
+}
+
+}  // namespace Lz4
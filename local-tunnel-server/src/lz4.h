@@ -0,0 +1,26 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Сжатие блоков в формате LZ4 (LZ4 Block Format): жадный поиск совпадений
+// по хэш-таблице четырехбайтовых последовательностей, как у LZ4 с
+// ускорением 1. На несжимаемых данных шаг поиска растет, поэтому время на
+// байт почти не зависит от того, удалось ли что-то сжать.
+namespace Lz4 {
+    // Наибольший вход одного блока: смещения в хэш-таблице 16-битные
+    constexpr size_t MAX_INPUT = 64 * 1024;
+
+    // Размер сжатого блока в худшем случае
+    constexpr size_t bound(size_t size) { return size + size / 255 + 16; }
+
+    // Сжатие size байт (не больше MAX_INPUT). 0 - результат не помещается в
+    // capacity байт, например данные несжимаемы и capacity меньше size
+    size_t compress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity);
+
+    // Распаковка блока; false - блок поврежден или не помещается в capacity
+    bool decompress(const uint8_t* input, size_t size, uint8_t* output, size_t capacity, size_t& produced);
+}
+
+#endif // LZ4_H
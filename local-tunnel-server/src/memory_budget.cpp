@@ -0,0 +1,178 @@
+#include "memory_budget.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstring>
+
+MemoryBudget::MemoryBudget() {
+    Metrics::register_provider("memory", [this](std::ostream& out) {
+        render_metrics(out);
+    });
+}
+
+MemoryBudget::~MemoryBudget() {
+    Metrics::unregister_provider("memory");
+}
+
+void MemoryBudget::configure(const Config& config) {
+    size_t total = static_cast<size_t>(std::max(1, config.get_memory_total_mb())) << 20;
+    int pressure = std::min(100, std::max(1, config.get_memory_pressure_percent()));
+    total_limit_.store(total);
+    pressure_limit_.store(total / 100 * static_cast<size_t>(pressure));
+
+    connection_limit_.store(static_cast<size_t>(std::max(1, config.get_memory_connection_kb())) << 10);
+    connection_overhead_.store(static_cast<size_t>(std::max(0, config.get_memory_connection_overhead_kb())) << 10);
+
+    // Минимальный размер буфера - прежний server.buffer_size
+    size_t min_buffer = static_cast<size_t>(std::max(512, config.get_buffer_size()));
+    size_t max_buffer = static_cast<size_t>(std::max(1, config.get_memory_max_buffer_kb())) << 10;
+    min_buffer_.store(min_buffer);
+    max_buffer_.store(std::max(min_buffer, max_buffer));
+    idle_release_ms_.store(std::max(0, config.get_memory_idle_release_seconds()) * 1000);
+}
+
+bool MemoryBudget::try_reserve(size_t bytes) {
+    size_t limit = total_limit_.load(std::memory_order_relaxed);
+    size_t current = current_.load(std::memory_order_relaxed);
+    do {
+        if (current + bytes > limit) {
+            return false;
+        }
+    } while (!current_.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+
+    size_t now = current + bytes;
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+    }
+    return true;
+}
+
+void MemoryBudget::charge(size_t bytes) {
+    size_t now = current_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+    }
+}
+
+void MemoryBudget::release(size_t bytes) {
+    current_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool MemoryBudget::admit_connection(size_t bytes) {
+    if (current() + bytes > pressure_limit_.load(std::memory_order_relaxed) || !try_reserve(bytes)) {
+        refused_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool MemoryBudget::under_pressure() const {
+    return current() >= pressure_limit_.load(std::memory_order_relaxed);
+}
+
+void MemoryBudget::render_metrics(std::ostream& out) {
+    out << "memory_accounted_bytes " << current() << "\n"
+        << "memory_accounted_peak_bytes " << peak() << "\n"
+        << "memory_budget_bytes " << limit() << "\n"
+        << "memory_refused_connections_total " << refused_.load() << "\n";
+}
+
+ConnectionQuota::ConnectionQuota(MemoryBudget& budget, size_t reserved)
+    : budget_(budget), used_(reserved) {
+}
+
+ConnectionQuota::~ConnectionQuota() {
+    release_all();
+}
+
+bool ConnectionQuota::reserve(size_t bytes) {
+    if (used_ + bytes > budget_.connection_limit() || !budget_.try_reserve(bytes)) {
+        return false;
+    }
+    used_ += bytes;
+    return true;
+}
+
+void ConnectionQuota::charge(size_t bytes) {
+    budget_.charge(bytes);
+    used_ += bytes;
+}
+
+void ConnectionQuota::release(size_t bytes) {
+    bytes = std::min(bytes, used_);
+    used_ -= bytes;
+    budget_.release(bytes);
+}
+
+void ConnectionQuota::release_all() {
+    release(used_);
+}
+
+AdaptiveBuffer::AdaptiveBuffer(ConnectionQuota& quota) : quota_(quota) {
+}
+
+AdaptiveBuffer::~AdaptiveBuffer() {
+    release();
+}
+
+bool AdaptiveBuffer::resize(size_t new_size, size_t keep) {
+    if (new_size > size_ && !quota_.reserve(new_size - size_)) {
+        return false;
+    }
+    std::unique_ptr<char[]> data(new char[new_size]);
+    if (keep > 0) {
+        std::memcpy(data.get(), data_.get(), keep);
+    }
+    data_.swap(data);
+    data.reset();
+    if (new_size < size_) {
+        quota_.release(size_ - new_size);
+    }
+    size_ = new_size;
+    return true;
+}
+
+bool AdaptiveBuffer::ensure() {
+    if (size_ > 0) {
+        return true;
+    }
+    full_reads_ = 0;
+    small_reads_ = 0;
+    return resize(quota_.budget().min_buffer());
+}
+
+void AdaptiveBuffer::on_read(size_t bytes, size_t keep) {
+    MemoryBudget& budget = quota_.budget();
+
+    if (bytes >= size_) {
+        small_reads_ = 0;
+        // Поток упирается в размер буфера - увеличиваем, если есть память
+        if (++full_reads_ >= GROW_AFTER && size_ < budget.max_buffer() && !budget.under_pressure()) {
+            resize(std::min(size_ * 2, budget.max_buffer()), keep);
+            full_reads_ = 0;
+        }
+        return;
+    }
+
+    full_reads_ = 0;
+    if (bytes < size_ / 4 && size_ > budget.min_buffer()) {
+        if (++small_reads_ >= SHRINK_AFTER) {
+            resize(std::max({size_ / 2, budget.min_buffer(), keep}), keep);
+            small_reads_ = 0;
+        }
+    } else {
+        small_reads_ = 0;
+    }
+}
+
+bool AdaptiveBuffer::grow(size_t bytes, size_t keep) {
+    return bytes <= size_ || resize(bytes, keep);
+}
+
+void AdaptiveBuffer::release() {
+    if (size_ == 0) {
+        return;
+    }
+    data_.reset();
+    quota_.release(size_);
+    size_ = 0;
+}
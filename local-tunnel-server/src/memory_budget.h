@@ -0,0 +1,127 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+#include "config.h"
+
+// Учет памяти сервера. Обработчики резервируют байты перед выделением
+// буферов; при исчерпании бюджета новые туннели не принимаются, а буферы
+// существующих перестают расти, вместо того чтобы процесс убил OOM killer.
+class MemoryBudget {
+public:
+    MemoryBudget();
+    ~MemoryBudget();
+
+    void configure(const Config& config);
+
+    // Резервирование в пределах общего бюджета
+    bool try_reserve(size_t bytes);
+    void release(size_t bytes);
+    
+    // Учет без проверки лимита (память, без которой нельзя продолжить работу)
+    void charge(size_t bytes);
+
+    // Допуск нового соединения: резервирует bytes накладных расходов,
+    // если занято меньше порога давления
+    bool admit_connection(size_t bytes);
+
+    bool under_pressure() const;
+
+    size_t current() const { return current_.load(std::memory_order_relaxed); }
+    size_t peak() const { return peak_.load(std::memory_order_relaxed); }
+    size_t limit() const { return total_limit_.load(std::memory_order_relaxed); }
+
+    // Настройки для соединений
+    size_t connection_limit() const { return connection_limit_.load(std::memory_order_relaxed); }
+    size_t connection_overhead() const { return connection_overhead_.load(std::memory_order_relaxed); }
+    size_t min_buffer() const { return min_buffer_.load(std::memory_order_relaxed); }
+    size_t max_buffer() const { return max_buffer_.load(std::memory_order_relaxed); }
+    int idle_release_ms() const { return idle_release_ms_.load(std::memory_order_relaxed); }
+
+    void render_metrics(std::ostream& out);
+
+private:
+    std::atomic<size_t> current_{0};
+    std::atomic<size_t> peak_{0};
+    std::atomic<uint64_t> refused_{0};
+
+    std::atomic<size_t> total_limit_{512u << 20};
+    std::atomic<size_t> pressure_limit_{(512u << 20) / 10 * 9};
+    std::atomic<size_t> connection_limit_{1u << 20};
+    std::atomic<size_t> connection_overhead_{64u << 10};
+    std::atomic<size_t> min_buffer_{4096};
+    std::atomic<size_t> max_buffer_{256u << 10};
+    std::atomic<int> idle_release_ms_{5000};
+};
+
+// Память одного соединения: ограничена квотой соединения и общим бюджетом.
+// Все зарезервированное возвращается в бюджет при уничтожении.
+class ConnectionQuota {
+public:
+    // reserved - уже зарезервированные при допуске накладные расходы
+    ConnectionQuota(MemoryBudget& budget, size_t reserved);
+    ~ConnectionQuota();
+
+    bool reserve(size_t bytes);
+    void charge(size_t bytes);
+    void release(size_t bytes);
+    void release_all();
+
+    size_t used() const { return used_; }
+    MemoryBudget& budget() { return budget_; }
+
+private:
+    MemoryBudget& budget_;
+    size_t used_;
+
+    ConnectionQuota(const ConnectionQuota&) = delete;
+    ConnectionQuota& operator=(const ConnectionQuota&) = delete;
+};
+
+// Буфер передачи данных, размер которого подстраивается под поток:
+// пока туннель простаивает, память не выделена; при чтениях, заполняющих
+// буфер целиком, размер удваивается до max_buffer, при мелких - уменьшается.
+class AdaptiveBuffer {
+public:
+    explicit AdaptiveBuffer(ConnectionQuota& quota);
+    ~AdaptiveBuffer();
+
+    // Выделение минимального буфера, если он был отдан; false - нет памяти
+    bool ensure();
+
+    char* data() { return data_.get(); }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Учет результата чтения для выбора размера следующего. keep - байты в
+    // начале буфера, которые сохраняются при смене размера
+    void on_read(size_t bytes, size_t keep = 0);
+
+    // Увеличение до bytes с сохранением первых keep байт (неполная запись
+    // шифрованного туннеля); может превысить max_buffer, но не квоту
+    bool grow(size_t bytes, size_t keep);
+
+    // Возврат памяти в бюджет (туннель простаивает)
+    void release();
+
+private:
+    static constexpr int GROW_AFTER = 2;     // Полных чтений подряд до роста
+    static constexpr int SHRINK_AFTER = 16;  // Мелких чтений подряд до уменьшения
+
+    ConnectionQuota& quota_;
+    std::unique_ptr<char[]> data_;
+    size_t size_{0};
+    int full_reads_{0};
+    int small_reads_{0};
+
+    bool resize(size_t new_size, size_t keep = 0);
+
+    AdaptiveBuffer(const AdaptiveBuffer&) = delete;
+    AdaptiveBuffer& operator=(const AdaptiveBuffer&) = delete;
+};
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,70 @@
+#include "metrics.h"
+#include <cstdio>
+#include <fstream>
+
+std::mutex Metrics::mutex_;
+std::map<std::string, std::unique_ptr<MetricValue>> Metrics::values_;
+std::map<std::string, Metrics::Provider> Metrics::providers_;
+
+MetricValue& Metrics::counter(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& slot = values_[name];
+    if (!slot) {
+        slot = std::make_unique<MetricValue>();
+    }
+    return *slot;
+}
+
+void Metrics::register_provider(const std::string& name, Provider provider) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    providers_[name] = std::move(provider);
+}
+
+void Metrics::unregister_provider(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    providers_.erase(name);
+}
+
+std::string Metrics::render() {
+    std::ostringstream out;
+    std::map<std::string, Provider> providers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& entry : values_) {
+            out << entry.first << " " << entry.second->get() << "\n";
+        }
+        providers = providers_;
+    }
+
+    // Поставщики вызываются без блокировки реестра - они могут сами
+    // обращаться к Metrics::counter
+    for (const auto& entry : providers) {
+        entry.second(out);
+    }
+    return out.str();
+}
+
+std::vector<std::pair<std::string, int64_t>> Metrics::snapshot() {
+    std::vector<std::pair<std::string, int64_t>> values;
+    std::lock_guard<std::mutex> lock(mutex_);
+    values.reserve(values_.size());
+    for (const auto& entry : values_) {
+        values.emplace_back(entry.first, entry.second->get());
+    }
+    return values;
+}
+
+bool Metrics::write_file(const std::string& path) {
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << render();
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
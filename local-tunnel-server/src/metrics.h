@@ -0,0 +1,94 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <sstream>
+#include <cstdint>
+
+// Счетчик или измеритель. Адрес стабилен все время работы процесса,
+// поэтому горячий путь кэширует ссылку и обновляет значение без блокировок.
+// Значение разбито на ячейки в отдельных строках кэша: потоки разных
+// процессоров увеличивают разные ячейки и не перебрасывают друг другу
+// одну строку. Чтение суммирует ячейки.
+class MetricValue {
+public:
+    void add(int64_t delta = 1) { cells_[cell_index()].value.fetch_add(delta, std::memory_order_relaxed); }
+    void sub(int64_t delta = 1) { cells_[cell_index()].value.fetch_sub(delta, std::memory_order_relaxed); }
+
+    int64_t get() const {
+        int64_t sum = 0;
+        for (const auto& cell : cells_) {
+            sum += cell.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    // Установка и максимум - для измерителей с одним писателем,
+    // значение хранится в первой ячейке
+    void set(int64_t value) {
+        cells_[0].value.store(value, std::memory_order_relaxed);
+        for (size_t i = 1; i < CELLS; ++i) {
+            cells_[i].value.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Обновление максимума (для пиковых значений)
+    void update_max(int64_t value) {
+        std::atomic<int64_t>& slot = cells_[0].value;
+        int64_t current = slot.load(std::memory_order_relaxed);
+        while (value > current &&
+               !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+private:
+    static constexpr size_t CELLS = 16;
+
+    struct alignas(64) Cell {
+        std::atomic<int64_t> value{0};
+    };
+
+    // Поток закрепляет за собой ячейку при первом обращении
+    static size_t cell_index() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % CELLS;
+        return index;
+    }
+
+    Cell cells_[CELLS];
+};
+
+// Реестр метрик сервера в текстовом формате "имя{метки} значение".
+// Подсистемы с динамическим набором значений (вышестоящие прокси и т.п.)
+// регистрируют поставщиков, которые дописывают свои строки при выгрузке.
+class Metrics {
+public:
+    using Provider = std::function<void(std::ostream&)>;
+
+    static MetricValue& counter(const std::string& name);
+    static MetricValue& gauge(const std::string& name) { return counter(name); }
+
+    static void register_provider(const std::string& name, Provider provider);
+    static void unregister_provider(const std::string& name);
+
+    static std::string render();
+
+    // Значения зарегистрированных счетчиков без строк поставщиков
+    static std::vector<std::pair<std::string, int64_t>> snapshot();
+
+    // Атомарная запись снимка в файл (через временный файл и rename)
+    static bool write_file(const std::string& path);
+
+private:
+    static std::mutex mutex_;
+    static std::map<std::string, std::unique_ptr<MetricValue>> values_;
+    static std::map<std::string, Provider> providers_;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,473 @@
+#include "pcap_tap.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+// Блоки pcapng и флаги TCP
+constexpr uint32_t SECTION_HEADER = 0x0A0D0D0A;
+constexpr uint32_t BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+constexpr uint32_t INTERFACE_DESCRIPTION = 1;
+constexpr uint32_t ENHANCED_PACKET = 6;
+constexpr uint16_t LINKTYPE_RAW = 101;  // Пакет начинается с заголовка IP
+constexpr uint16_t OPTION_COMMENT = 1;
+
+constexpr uint8_t TCP_FIN = 0x01;
+constexpr uint8_t TCP_SYN = 0x02;
+constexpr uint8_t TCP_PSH = 0x08;
+constexpr uint8_t TCP_ACK = 0x10;
+
+// Блоки pcapng пишутся в порядке байт процессора - его указывает
+// BYTE_ORDER_MAGIC заголовка секции
+template <typename T>
+void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void put_be16(char* p, uint16_t value) {
+    p[0] = static_cast<char>(value >> 8);
+    p[1] = static_cast<char>(value);
+}
+
+void put_be32(char* p, uint32_t value) {
+    put_be16(p, static_cast<uint16_t>(value >> 16));
+    put_be16(p + 2, static_cast<uint16_t>(value));
+}
+
+void pad(std::string& out) {
+    out.append((4 - out.size() % 4) % 4, '\0');
+}
+
+int64_t unix_time_us() {
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+// Адрес IPv6 конечной точки: IPv4 - в виде ::ffff:a.b.c.d
+void address_v6(const sockaddr_storage& address, uint8_t out[16]) {
+    std::memset(out, 0, 16);
+    if (address.ss_family == AF_INET6) {
+        std::memcpy(out, &reinterpret_cast<const sockaddr_in6&>(address).sin6_addr, 16);
+    } else if (address.ss_family == AF_INET) {
+        out[10] = out[11] = 0xff;
+        std::memcpy(out + 12, &reinterpret_cast<const sockaddr_in&>(address).sin_addr, 4);
+    }
+}
+
+uint16_t port_of(const sockaddr_storage& address) {
+    if (address.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<const sockaddr_in6&>(address).sin6_port);
+    }
+    if (address.ss_family == AF_INET) {
+        return ntohs(reinterpret_cast<const sockaddr_in&>(address).sin_port);
+    }
+    return 0;
+}
+
+uint16_t ip_checksum(const char* header, size_t size) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < size; i += 2) {
+        sum += static_cast<uint32_t>(static_cast<uint8_t>(header[i])) << 8 | static_cast<uint8_t>(header[i + 1]);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+// Пакет IP с TCP сегментом в блоке Enhanced Packet. Контрольная сумма TCP
+// не вычисляется (Wireshark по умолчанию ее не проверяет)
+void append_packet(std::string& out, const sockaddr_storage& source, const sockaddr_storage& destination,
+                   uint32_t sequence, uint32_t acknowledgment, uint8_t flags, const char* payload, size_t length,
+                   int64_t time_us, const std::string& comment) {
+    char packet[60];
+    size_t ip_size;
+    if (source.ss_family == AF_INET && destination.ss_family == AF_INET) {
+        ip_size = 20;
+        std::memset(packet, 0, ip_size);
+        packet[0] = 0x45;
+        put_be16(packet + 2, static_cast<uint16_t>(ip_size + 20 + length));
+        put_be16(packet + 6, 0x4000);  // Не фрагментировать
+        packet[8] = 64;
+        packet[9] = IPPROTO_TCP;
+        std::memcpy(packet + 12, &reinterpret_cast<const sockaddr_in&>(source).sin_addr, 4);
+        std::memcpy(packet + 16, &reinterpret_cast<const sockaddr_in&>(destination).sin_addr, 4);
+        put_be16(packet + 10, ip_checksum(packet, ip_size));
+    } else {
+        ip_size = 40;
+        std::memset(packet, 0, ip_size);
+        packet[0] = 0x60;
+        put_be16(packet + 4, static_cast<uint16_t>(20 + length));
+        packet[6] = IPPROTO_TCP;
+        packet[7] = 64;
+        address_v6(source, reinterpret_cast<uint8_t*>(packet + 8));
+        address_v6(destination, reinterpret_cast<uint8_t*>(packet + 24));
+    }
+    char* tcp = packet + ip_size;
+    std::memset(tcp, 0, 20);
+    put_be16(tcp, port_of(source));
+    put_be16(tcp + 2, port_of(destination));
+    put_be32(tcp + 4, sequence);
+    put_be32(tcp + 8, acknowledgment);
+    tcp[12] = 5 << 4;
+    tcp[13] = static_cast<char>(flags);
+    put_be16(tcp + 14, 0xffff);
+
+    uint32_t captured = static_cast<uint32_t>(ip_size + 20 + length);
+    uint32_t options = comment.empty() ? 0 : static_cast<uint32_t>(4 + (comment.size() + 3) / 4 * 4 + 4);
+    uint32_t total = 28 + (captured + 3) / 4 * 4 + options + 4;
+    put(out, ENHANCED_PACKET);
+    put(out, total);
+    put(out, uint32_t{0});  // Интерфейс
+    put(out, static_cast<uint32_t>(static_cast<uint64_t>(time_us) >> 32));
+    put(out, static_cast<uint32_t>(time_us));
+    put(out, captured);
+    put(out, captured);
+    out.append(packet, ip_size + 20);
+    out.append(payload, length);
+    pad(out);
+    if (!comment.empty()) {
+        put(out, OPTION_COMMENT);
+        put(out, static_cast<uint16_t>(comment.size()));
+        out += comment;
+        pad(out);
+        put(out, uint32_t{0});  // opt_endofopt
+    }
+    put(out, total);
+}
+
+}  // namespace
+
+TapStream::TapStream(PcapTap& tap, uint64_t tunnel, const sockaddr_storage& client,
+                     const sockaddr_storage& target, const std::string& label)
+    : tap_(tap), tunnel_(tunnel), client_(client), target_(target), label_(label) {
+}
+
+void TapStream::record(bool from_client, const char* data, size_t size) {
+    static MetricValue& dropped = Metrics::counter("tap_dropped_bytes_total");
+    int64_t now = unix_time_us();
+    uint64_t& gap = dropped_[from_client ? 0 : 1];
+    while (size > 0) {
+        size_t length = std::min(size, TapSegment::MAX_PAYLOAD);
+        TapSegment* segment = queue_.claim();
+        if (segment == nullptr) {
+            // Поток записи не успевает - остаток отбрасывается
+            gap += size;
+            dropped.add(static_cast<int64_t>(size));
+            return;
+        }
+        segment->time_us = now;
+        segment->gap = static_cast<uint32_t>(gap);
+        segment->length = static_cast<uint16_t>(length);
+        segment->from_client = from_client;
+        std::memcpy(segment->data, data, length);
+        queue_.publish();
+        gap = 0;
+        data += length;
+        size -= length;
+        if (++unsignaled_ == SEGMENTS / 4) {
+            unsignaled_ = 0;
+            tap_.wake();
+        }
+    }
+}
+
+PcapTap::PcapTap() {
+}
+
+PcapTap::~PcapTap() {
+    stop();
+}
+
+void PcapTap::configure(const Config& config) {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    std::string path = config.get_tap_file();
+    if (path != path_) {
+        reopen_requested_ = true;
+    }
+    bool enabled = config.is_tap_enabled() && !path.empty();
+    bool changed = enabled != enabled_ || config.get_tap_client() != client_ ||
+                   config.get_tap_target_host() != target_host_ || config.get_tap_target_port() != target_port_;
+    path_ = path;
+    enabled_ = enabled;
+    client_ = config.get_tap_client();
+    target_host_ = config.get_tap_target_host();
+    target_port_ = config.get_tap_target_port();
+    max_size_ = static_cast<uint64_t>(std::max(0, config.get_tap_max_size_mb())) * 1024 * 1024;
+    if (changed) {
+        generation_.fetch_add(1, std::memory_order_relaxed);
+        if (enabled_) {
+            Logger::info("Отвод туннелей в " + path_ + ": клиент " + (client_.empty() ? "*" : client_) +
+                         ", цель " + (target_host_.empty() ? "*" : target_host_) + ":" +
+                         (target_port_ == 0 ? "*" : std::to_string(target_port_)));
+        }
+    }
+}
+
+bool PcapTap::start() {
+    std::lock_guard<std::mutex> lock(streams_mutex_);
+    if (running_) {
+        return true;
+    }
+    running_ = true;
+    thread_ = std::make_unique<std::thread>(&PcapTap::loop, this);
+    return true;
+}
+
+void PcapTap::stop() {
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        running_ = false;
+    }
+    streams_cv_.notify_all();
+    if (thread_ && thread_->joinable()) {
+        thread_->join();  // Поток дописывает забранные сегменты перед выходом
+    }
+    thread_.reset();
+}
+
+bool PcapTap::matches(const std::string& client_ip, const std::string& host, int port) const {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    return enabled_ && (client_.empty() || client_ == client_ip) &&
+           (target_host_.empty() || strcasecmp(target_host_.c_str(), host.c_str()) == 0) &&
+           (target_port_ == 0 || target_port_ == port);
+}
+
+std::shared_ptr<TapStream> PcapTap::attach(uint64_t tunnel, int client_socket, int target_socket,
+                                           const std::string& host, int port) {
+    sockaddr_storage client{};
+    sockaddr_storage target{};
+    socklen_t length = sizeof(client);
+    getpeername(client_socket, reinterpret_cast<sockaddr*>(&client), &length);
+    length = sizeof(target);
+    getpeername(target_socket, reinterpret_cast<sockaddr*>(&target), &length);
+
+    auto stream = std::make_shared<TapStream>(*this, tunnel, client, target,
+                                              "tunnel " + std::to_string(tunnel) + " -> " + host + ":" +
+                                              std::to_string(port));
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        if (!running_) {
+            return nullptr;
+        }
+        streams_.push_back(stream);
+    }
+    static MetricValue& tapped = Metrics::counter("tap_tunnels_total");
+    tapped.add();
+    streams_cv_.notify_all();
+    return stream;
+}
+
+std::string PcapTap::file_header() {
+    std::string out;
+    put(out, SECTION_HEADER);
+    put(out, uint32_t{28});
+    put(out, BYTE_ORDER_MAGIC);
+    put(out, uint16_t{1});
+    put(out, uint16_t{0});
+    put(out, int64_t{-1});  // Длина секции не известна
+    put(out, uint32_t{28});
+
+    put(out, INTERFACE_DESCRIPTION);
+    put(out, uint32_t{20});
+    put(out, LINKTYPE_RAW);
+    put(out, uint16_t{0});
+    put(out, uint32_t{0});  // Без ограничения длины пакета
+    put(out, uint32_t{20});
+    return out;
+}
+
+bool PcapTap::drain(TapStream& stream, std::string& out) {
+    static MetricValue& packets = Metrics::counter("tap_packets_total");
+    static MetricValue& bytes = Metrics::counter("tap_bytes_total");
+
+    // Признак закрытия читается до сегментов: все, что обработчик положил до
+    // закрытия, будет забрано в этом же проходе
+    bool closed = stream.closed_.load(std::memory_order_acquire);
+    const sockaddr_storage& client = stream.client_;
+    const sockaddr_storage& target = stream.target_;
+    uint32_t* sequence = stream.sequence_;
+
+    TapSegment* segment = stream.queue_.front();
+    if (!stream.opened_ && (segment != nullptr || closed)) {
+        // Рукопожатие с начальными номерами по идентификатору туннеля
+        int64_t time = segment != nullptr ? segment->time_us : unix_time_us();
+        sequence[0] = static_cast<uint32_t>(stream.tunnel_ * 2654435761u);
+        sequence[1] = ~sequence[0];
+        append_packet(out, client, target, sequence[0]++, 0, TCP_SYN, nullptr, 0, time, stream.label_);
+        append_packet(out, target, client, sequence[1]++, sequence[0], TCP_SYN | TCP_ACK, nullptr, 0, time, "");
+        append_packet(out, client, target, sequence[0], sequence[1], TCP_ACK, nullptr, 0, time, "");
+        stream.opened_ = true;
+    }
+    for (; segment != nullptr; segment = stream.queue_.front()) {
+        int from = segment->from_client ? 0 : 1;
+        sequence[from] += segment->gap;
+        append_packet(out, from == 0 ? client : target, from == 0 ? target : client, sequence[from],
+                      sequence[1 - from], TCP_PSH | TCP_ACK, segment->data, segment->length, segment->time_us, "");
+        sequence[from] += segment->length;
+        packets.add();
+        bytes.add(segment->length);
+        stream.queue_.release();
+    }
+    if (closed) {
+        int64_t time = unix_time_us();
+        append_packet(out, client, target, sequence[0]++, sequence[1], TCP_FIN | TCP_ACK, nullptr, 0, time, "");
+        append_packet(out, target, client, sequence[1]++, sequence[0], TCP_FIN | TCP_ACK, nullptr, 0, time, "");
+        append_packet(out, client, target, sequence[0], sequence[1], TCP_ACK, nullptr, 0, time, "");
+    }
+    return !closed;
+}
+
+void PcapTap::wake() {
+    wake_requested_.store(true, std::memory_order_relaxed);
+    streams_cv_.notify_one();
+}
+
+void PcapTap::loop() {
+    std::vector<std::shared_ptr<TapStream>> streams;
+    std::string batch;
+    while (true) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(streams_mutex_);
+            // Без отводов поток ждет подключения первого
+            bool idle = streams_.empty();
+            streams_cv_.wait_for(lock, std::chrono::milliseconds(idle ? 1000 : DRAIN_MS), [this, idle] {
+                return !running_ || (idle && !streams_.empty()) || wake_requested_.exchange(false);
+            });
+            stopping = !running_;
+            streams = streams_;
+        }
+
+        std::vector<TapStream*> finished;
+        for (const auto& stream : streams) {
+            if (!drain(*stream, batch)) {
+                finished.push_back(stream.get());
+            }
+        }
+        if (!finished.empty()) {
+            std::lock_guard<std::mutex> lock(streams_mutex_);
+            streams_.erase(std::remove_if(streams_.begin(), streams_.end(), [&finished](const auto& stream) {
+                return std::find(finished.begin(), finished.end(), stream.get()) != finished.end();
+            }), streams_.end());
+        }
+        streams.clear();
+        flush(batch);
+        batch.clear();
+        if (stopping) {
+            break;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(streams_mutex_);
+        streams_.clear();
+    }
+    close_file();
+}
+
+void PcapTap::flush(const std::string& batch) {
+    static MetricValue& errors = Metrics::counter("tap_write_errors_total");
+    static MetricValue& dropped = Metrics::counter("tap_dropped_bytes_total");
+
+    bool reopen;
+    uint64_t max_size;
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex_);
+        reopen = reopen_requested_;
+        reopen_requested_ = false;
+        max_size = max_size_;
+    }
+    if (reopen) {
+        close_file();
+        full_ = false;
+    }
+    if (batch.empty()) {
+        return;
+    }
+    if (fd_ < 0 && !open_file()) {
+        errors.add();
+        return;
+    }
+    if (full_ || (max_size > 0 && file_size_ + batch.size() > max_size)) {
+        if (!full_) {
+            Logger::warning("Файл отвода достиг max_size_mb, запись остановлена");
+            full_ = true;
+        }
+        dropped.add(static_cast<int64_t>(batch.size()));
+        return;
+    }
+
+    size_t written_total = 0;
+    while (written_total < batch.size()) {
+        ssize_t written = ::write(fd_, batch.data() + written_total, batch.size() - written_total);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errors.add();
+            Logger::error("Ошибка записи файла отвода: " + std::string(strerror(errno)));
+            close_file();
+            return;
+        }
+        written_total += static_cast<size_t>(written);
+    }
+    file_size_ += written_total;
+}
+
+bool PcapTap::open_file() {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex_);
+        path = path_;
+    }
+    if (path.empty()) {
+        return false;
+    }
+
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        Logger::error("Не удалось открыть файл отвода " + path + ": " + strerror(errno));
+        return false;
+    }
+    struct stat info{};
+    fstat(fd_, &info);
+    file_size_ = static_cast<uint64_t>(info.st_size);
+
+    // Дописывается только файл pcapng: каждое открытие начинает новую секцию
+    if (file_size_ > 0) {
+        uint32_t type = 0;
+        if (pread(fd_, &type, sizeof(type), 0) != static_cast<ssize_t>(sizeof(type)) || type != SECTION_HEADER) {
+            Logger::error("Файл " + path + " не является файлом pcapng");
+            close_file();
+            return false;
+        }
+    }
+    std::string header = file_header();
+    if (::write(fd_, header.data(), header.size()) != static_cast<ssize_t>(header.size())) {
+        Logger::error("Ошибка записи файла отвода: " + std::string(strerror(errno)));
+        close_file();
+        return false;
+    }
+    file_size_ += header.size();
+    return true;
+}
+
+void PcapTap::close_file() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    file_size_ = 0;
+}
@@ -0,0 +1,165 @@
+#ifndef PCAP_TAP_H
+#define PCAP_TAP_H
+
+#include <sys/socket.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "spsc_queue.h"
+
+class Config;
+
+// Часть данных одного направления - один синтезированный TCP сегмент
+struct TapSegment {
+    static constexpr size_t MAX_PAYLOAD = 1448;
+
+    int64_t time_us{0};    // Время Unix
+    uint32_t gap{0};       // Байты направления, отброшенные перед сегментом
+    uint16_t length{0};
+    bool from_client{false};
+    char data[MAX_PAYLOAD];
+};
+
+class PcapTap;
+
+// Отвод одного туннеля: обработчик кладет сегменты в кольцо без блокировок,
+// поток записи отвода их забирает и будится раньше срока, когда обработчик
+// положил четверть кольца. Пишет всегда один поток обработчика -
+// после парковки туннель продолжает новый поток, но не одновременно со
+// старым. При заполненном кольце байты отбрасываются и учитываются в
+// следующем сегменте: в файле остается разрыв номеров последовательности.
+class TapStream {
+public:
+    static constexpr size_t SEGMENTS = 512;
+
+    TapStream(PcapTap& tap, uint64_t tunnel, const sockaddr_storage& client, const sockaddr_storage& target,
+              const std::string& label);
+
+    // Открытый текст, которым туннель обменялся с целью
+    void record(bool from_client, const char* data, size_t size);
+    // Туннель закрыт или больше не подходит под фильтр
+    void close() { closed_.store(true, std::memory_order_release); }
+
+private:
+    friend class PcapTap;
+
+    SpscQueue<TapSegment, SEGMENTS> queue_;
+    std::atomic<bool> closed_{false};
+    uint64_t dropped_[2]{0, 0};  // Обработчик: отброшенное по направлениям
+    size_t unsignaled_{0};       // Обработчик: сегменты после побудки записи
+
+    PcapTap& tap_;
+
+    const uint64_t tunnel_;
+    const sockaddr_storage client_;
+    const sockaddr_storage target_;
+    const std::string label_;
+
+    // Поток записи: рукопожатие записано, номера последовательности
+    // клиента и цели
+    bool opened_{false};
+    uint32_t sequence_[2]{0, 0};
+};
+
+// Операции сокетов туннеля, копирующие в отвод открытый текст обмена с
+// целью: принятое от цели до шифрования и сжатия, отправленное ей - после
+template <typename SocketOps>
+struct TapSocketOps {
+    SocketOps& ops;
+    TapStream& stream;
+    int target;
+
+    ssize_t recv(int socket, char* data, size_t size) {
+        ssize_t received = ops.recv(socket, data, size);
+        if (socket == target && received > 0) {
+            stream.record(false, data, static_cast<size_t>(received));
+        }
+        return received;
+    }
+
+    bool send(int socket, const char* data, size_t size) {
+        bool sent = ops.send(socket, data, size);
+        if (socket == target && sent) {
+            stream.record(true, data, size);
+        }
+        return sent;
+    }
+};
+
+// Отвод туннелей в pcapng: полезная нагрузка туннелей, подходящих под
+// фильтр (адрес клиента, имя и порт цели), с синтезированными заголовками
+// IP и TCP. Шифрованный и сжатый туннель попадает в файл открытым текстом.
+// Отвод включается и меняет фильтр при перезагрузке конфигурации, в том
+// числе для уже установленных туннелей: обработчик сверяет номер настроек
+// generation() при каждой пересылке. Выключенный отвод стоит одного
+// чтения атомарной переменной.
+class PcapTap {
+public:
+    PcapTap();
+    ~PcapTap();
+
+    void configure(const Config& config);
+    bool start();
+    void stop();
+
+    // Меняется при каждом изменении настроек отвода
+    uint64_t generation() const { return generation_.load(std::memory_order_relaxed); }
+
+    bool matches(const std::string& client_ip, const std::string& host, int port) const;
+    std::shared_ptr<TapStream> attach(uint64_t tunnel, int client_socket, int target_socket,
+                                      const std::string& host, int port);
+
+    // Пакеты pcapng (для проверки формата и микробенчмарков)
+    static std::string file_header();
+    // Забирает сегменты отвода и дописывает пакеты в out. false - отвод
+    // закрыт и больше ничего не пришлет
+    static bool drain(TapStream& stream, std::string& out);
+
+private:
+    std::atomic<uint64_t> generation_{0};
+
+    mutable std::mutex settings_mutex_;
+    bool enabled_{false};
+    std::string path_;
+    std::string client_;
+    std::string target_host_;
+    int target_port_{0};
+    uint64_t max_size_{0};
+    bool reopen_requested_{false};
+
+    std::atomic<bool> wake_requested_{false};
+
+    std::mutex streams_mutex_;
+    std::condition_variable streams_cv_;
+    std::vector<std::shared_ptr<TapStream>> streams_;
+    bool running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    // Состояние потока записи
+    int fd_{-1};
+    uint64_t file_size_{0};
+    bool full_{false};
+
+    static constexpr int DRAIN_MS = 10;
+
+    friend class TapStream;
+
+    // Побудка потока записи без ожидания мьютекса; потерянная побудка
+    // означает лишь обычный интервал DRAIN_MS
+    void wake();
+    void loop();
+    void flush(const std::string& batch);
+    bool open_file();
+    void close_file();
+
+    PcapTap(const PcapTap&) = delete;
+    PcapTap& operator=(const PcapTap&) = delete;
+};
+
+#endif // PCAP_TAP_H
@@ -1,25 +1,89 @@
 #include "proxy_handler.h"
+#include "stats_segment.h"
 #include "logger.h"
 #include "utils.h"
+#include "metrics.h"
+#include "socks5.h"
+#include "http_request.h"
+#include "relay_step.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <cstring>
+#include <strings.h>
 #include <cstdint>
 #include <netdb.h>
-#include <sstream>
 #include <vector>
 #include <cerrno>
 #include <netdb.h>
 #include <chrono>
 #include <thread>
+#include <algorithm>
+#include <cctype>
+
+namespace {
+    std::atomic<uint64_t> next_connection_id{1};
+    
+    // Отправленное, но не доставленное клиенту сессии лежит в буфере сокета
+    // и должно поместиться в буфер повтора; ядро удваивает заданный размер
+    void limit_send_buffer(int socket, size_t replay_size) {
+        int send_buffer = static_cast<int>(replay_size / 4);
+        setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+    }
+    
+    // Запрос бинарного протокола: длина имени (4 байта, сетевой порядок;
+    // старший бит - после порта идут учетные данные), имя, порт (2 байта),
+    // затем байт длины и имя пользователя, байт длины и пароль.
+    // 0 - запрос еще не пришел целиком, -1 - некорректный запрос
+    constexpr uint32_t BINARY_CREDENTIALS_FLAG = 0x80000000u;
+    
+    // Байт ответа бинарного протокола
+    constexpr char BINARY_STATUS_ERROR = 0;
+    constexpr char BINARY_STATUS_OK = 1;
+    constexpr char BINARY_STATUS_AUTH_FAILED = 2;
+    
+    ssize_t parse_binary_request(const uint8_t* data, size_t size, std::string& host, int& port,
+                                 bool& has_credentials, std::string& username, std::string& password) {
+        if (size < 4) {
+            return 0;
+        }
+        uint32_t length = (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+                          (static_cast<uint32_t>(data[2]) << 8) | data[3];
+        has_credentials = (length & BINARY_CREDENTIALS_FLAG) != 0;
+        length &= ~BINARY_CREDENTIALS_FLAG;
+        if (length == 0 || length > 255) {
+            return -1;
+        }
+        size_t position = 4 + length + 2;
+        if (size < position) {
+            return 0;
+        }
+        host.assign(reinterpret_cast<const char*>(data) + 4, length);
+        port = (data[4 + length] << 8) | data[4 + length + 1];
+        if (has_credentials) {
+            for (std::string* field : {&username, &password}) {
+                if (size < position + 1 || size < position + 1 + data[position]) {
+                    return 0;
+                }
+                field->assign(reinterpret_cast<const char*>(data) + position + 1, data[position]);
+                position += 1 + data[position];
+            }
+        }
+        return static_cast<ssize_t>(position);
+    }
+}
 
 ProxyHandler::ProxyHandler(int client_socket, const std::string& client_ip,
-                          int client_port, const Config& config)
-    : client_socket_(client_socket), client_ip_(client_ip),
-      client_port_(client_port), config_(config) {
+                          int client_port, ServerContext& context, size_t reserved_memory)
+    : id_(next_connection_id.fetch_add(1, std::memory_order_relaxed)),
+      quota_(context.memory, reserved_memory),
+      client_socket_(client_socket), client_ip_(client_ip),
+      client_port_(client_port), context_(context), config_snapshot_(context.config.current()), config_(*config_snapshot_),
+      traced_(Tracer::sampled(id_)), accepted_at_(std::chrono::steady_clock::now()),
+      debug_sampled_(Logger::debug_sampled(id_)),
+      accepted_unix_ms_(Utils::unix_time_ms()) {
     
     // Настройка таймаута для клиентского сокета
     struct timeval timeout;
@@ -28,6 +92,8 @@ ProxyHandler::ProxyHandler(int client_socket, const std::string& client_ip,
     
     setsockopt(client_socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     setsockopt(client_socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    capturing_ = context_.capture.enabled();
 }
 
 ProxyHandler::~ProxyHandler() noexcept {
@@ -45,14 +111,36 @@ bool ProxyHandler::start() {
 
     running_.store(true);
     
-    // Запуск основного потока обработчика
-    handler_thread_ = std::make_unique<std::thread>(&ProxyHandler::handle, this);
+    // Запуск основного потока обработчика. Поток держит сильную ссылку:
+    // после парковки и возобновления обработчик может быть удален из
+    // списка клиентов раньше, чем завершится его поток
+    std::shared_ptr<ProxyHandler> self = shared_from_this();
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    handler_thread_ = std::make_unique<std::thread>([self]() { self->handle(); });
     
     return true;
 }
 
 void ProxyHandler::stop() {
     running_.store(false);
+    
+    // Запаркованный туннель снимается со стоянки до закрытия сокетов.
+    // Его поток уже завершен, поэтому запись журнала делается здесь.
+    // Под блокировкой park() либо уже зарегистрировал туннель, либо
+    // увидит running_ == false; resume() либо уже забрал идентификатор,
+    // либо найдет его обнуленным
+    uint64_t park_id;
+    std::unique_ptr<std::thread> thread;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        park_id = park_id_.exchange(0);
+        thread = std::move(handler_thread_);
+    }
+    if (park_id != 0) {
+        context_.parker.forget(park_id);
+        close_reason_ = CloseReason::SHUTDOWN;
+        log_access();
+    }
 
     // Простое закрытие сокетов
     if (client_socket_ >= 0) {
@@ -65,42 +153,514 @@ void ProxyHandler::stop() {
         target_socket_ = -1;
     }
 
-    // Ожидание завершения основного потока
-    if (handler_thread_ && handler_thread_->joinable()) {
-        handler_thread_->join();
+    // Ожидание завершения основного потока. Последняя ссылка может
+    // освободиться в самом потоке обработчика - тогда он отсоединяется
+    if (thread && thread->joinable()) {
+        if (thread->get_id() == std::this_thread::get_id()) {
+            thread->detach();
+        } else {
+            thread->join();
+        }
     }
 }
 
 void ProxyHandler::handle() {
+    trace(TracePhase::ACCEPT, accepted_at_);
+    bool established = setup_tunnel();
+    
+    // Память заголовков возвращается сразу, не дожидаясь удаления обработчика
+    http_headers_.clear();
+    std::string().swap(client_buffer_);
+    std::string().swap(original_http_request_);
+    account_header_memory();
+    pending_connect_.reset();
+    
+    if (established && start_data_transfer() && park()) {
+        return;  // Поток завершается, туннель ждет данных на стоянке
+    }
+    detach_session();
+    finish();
+}
+
+void ProxyHandler::resume_transfer() {
+    if (start_data_transfer() && park()) {
+        return;
+    }
+    detach_session();
+    finish();
+}
+
+void ProxyHandler::finish() {
+    auto closing = std::chrono::steady_clock::now();
+    end_fetch(false);  // Ожидающие загрузку, которая не началась, запрашивают сами
+    report_compression();
+    if (tap_) {
+        tap_->close();
+        tap_.reset();
+    }
+    quota_.release_all();
+    log_access();
+    trace(TracePhase::CLOSE, closing);
+    trace(TracePhase::TUNNEL, accepted_at_);
+    
+    // Обработчик завершен при любом исходе - его можно удалить из списка клиентов
+    running_.store(false);
+}
+
+bool ProxyHandler::park() {
+    if (!running_.load() || !context_.parker.is_running()) {
+        return false;
+    }
+    
+    debug("Туннель " + client_ip_ + ":" + std::to_string(client_port_) + " паркуется");
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (!running_.load()) {
+        return false;  // stop() уже забрал поток
+    }
+    
+    // На стоянке учитывается только компактное состояние обработчика и
+    // буфер повтора сессии
+    policy_.reset();
+    size_t parked_size = sizeof(ProxyHandler) + PARKED_OVERHEAD + (session_ ? session_->replay.capacity() : 0);
+    if (quota_.used() > parked_size) {
+        quota_.release(quota_.used() - parked_size);
+    }
+    
+    // Стоянка держит слабую ссылку: удаленный обработчик не возобновляется
+    std::weak_ptr<ProxyHandler> self = shared_from_this();
+    if (!context_.parker.park(client_socket_, target_socket_, park_id_, [self]() {
+            if (auto handler = self.lock()) {
+                handler->resume();
+            }
+        })) {
+        quota_.charge(quota_.budget().connection_overhead());
+        return false;  // Поток продолжает работу и закрывает туннель сам
+    }
+    
+    // Поток отсоединяется только после регистрации: возобновление ждет
+    // блокировку и запустит новый поток, а стек завершенного, но не
+    // присоединенного потока остался бы в памяти
+    if (handler_thread_ && handler_thread_->joinable() &&
+        handler_thread_->get_id() == std::this_thread::get_id()) {
+        handler_thread_->detach();
+    }
+    return true;
+}
+
+void ProxyHandler::resume() {
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (park_id_.exchange(0) == 0) {
+        return;  // Туннель уже снят со стоянки в stop()
+    }
+    if (!running_.load()) {
+        // stop() начался, но идентификатор забран здесь - журнал за нами
+        close_reason_ = CloseReason::SHUTDOWN;
+        log_access();
+        return;
+    }
+    
+    // Снова нужен поток со стеком - его память учитывается без проверки
+    // давления, чтобы не рвать уже установленные туннели
+    quota_.charge(quota_.budget().connection_overhead());
+    
+    try {
+        std::shared_ptr<ProxyHandler> self = shared_from_this();
+        handler_thread_ = std::make_unique<std::thread>([self]() { self->resume_transfer(); });
+    } catch (const std::exception& e) {
+        static LogSite& site = Logger::site("proxy.resume_failed");
+        Logger::error(site, "Не удалось возобновить туннель " + client_ip_ + ":" +
+                           std::to_string(client_port_) + ": " + std::string(e.what()));
+        finish();
+    }
+}
+
+void ProxyHandler::log_access() {
+    if (access_logged_.exchange(true)) {
+        return;
+    }
+    capture_tunnel();
+    if (!context_.access_log.enabled()) {
+        return;
+    }
+    
+    AccessRecord record;
+    record.connection_id = id_;
+    record.start_unix_ms = accepted_unix_ms_;
+    record.duration_ms = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - accepted_at_).count());
+    record.resolve_us = static_cast<uint32_t>(std::max<int64_t>(0, resolve_us_));
+    record.connect_us = static_cast<uint32_t>(std::max<int64_t>(0, connect_us_));
+    record.bytes_from_client = bytes_from_client_;
+    record.bytes_from_target = bytes_from_target_;
+    record.client_ip = client_ip_;
+    record.client_port = static_cast<uint16_t>(client_port_);
+    record.target_host = target_host_;
+    record.target_port = static_cast<uint16_t>(target_port_);
+    record.protocol = protocol_;
+    record.reason = close_reason_;
+    context_.access_log.write(record);
+}
+
+void ProxyHandler::report_compression() {
+    if (!compression_) {
+        return;
+    }
+    const StreamCompression::Stats& stats = compression_->stats();
+    static MetricValue& plain = Metrics::counter("compression_plain_bytes_total");
+    static MetricValue& wire = Metrics::counter("compression_wire_bytes_total");
+    static MetricValue& cpu = Metrics::counter("compression_cpu_us_total");
+    static MetricValue& disabled = Metrics::counter("compression_disabled_total");
+    plain.add(static_cast<int64_t>(stats.sent_plain + stats.received_plain));
+    wire.add(static_cast<int64_t>(stats.sent_wire + stats.received_wire));
+    cpu.add(static_cast<int64_t>(stats.cpu_ns / 1000));
+    
+    // Доля - размер кадров относительно открытого текста
+    auto ratio = [](uint64_t plain_bytes, uint64_t wire_bytes) {
+        std::string text = std::to_string(plain_bytes) + " -> " + std::to_string(wire_bytes) + " байт";
+        if (plain_bytes > 0) {
+            text += " (" + std::to_string(wire_bytes * 100 / plain_bytes) + "%)";
+        }
+        return text;
+    };
+    std::string message = "Сжатие туннеля " + client_ip_ + ":" + std::to_string(client_port_) + " -> " +
+                          target_host_ + ":" + std::to_string(target_port_) + ": к клиенту " +
+                          ratio(stats.sent_plain, stats.sent_wire) + ", от клиента " +
+                          ratio(stats.received_plain, stats.received_wire) + ", процессор " +
+                          std::to_string(stats.cpu_ns / 1000) + " мкс";
+    if (stats.disabled_after > 0) {
+        disabled.add();
+        message += ", выключено после " + std::to_string(stats.disabled_after) + " байт";
+    }
+    Logger::info(message);
+}
+
+void ProxyHandler::capture_bytes(bool from_client, size_t bytes) {
+    if (!capturing_) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (capture_base_ == std::chrono::steady_clock::time_point{}) {
+        capture_base_ = now;  // Ответ из кэша - туннель не устанавливался
+    }
+    auto offset = std::chrono::duration_cast<std::chrono::milliseconds>(now - capture_base_).count();
+    TrafficCapture::add_event(capture_events_, static_cast<uint32_t>(offset), from_client, bytes,
+                              context_.capture.slot_ms(), context_.capture.max_events());
+}
+
+void ProxyHandler::capture_tunnel() {
+    if (!capturing_ || protocol_ == AccessProtocol::UNKNOWN || !context_.capture.enabled()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    CaptureRecord record;
+    record.start_unix_ms = accepted_unix_ms_;
+    if (capture_base_ != std::chrono::steady_clock::time_point{}) {
+        record.setup_us = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(capture_base_ - accepted_at_).count());
+    }
+    record.duration_ms = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(now - accepted_at_).count());
+    record.bytes_from_client = bytes_from_client_;
+    record.bytes_from_target = bytes_from_target_;
+    record.protocol = protocol_;
+    record.reason = close_reason_;
+    record.target_port = static_cast<uint16_t>(target_port_);
+    record.line = context_.capture.handshake_line(protocol_, http_method_, http_url_, target_host_, target_port_);
+    record.events = std::move(capture_events_);
+    context_.capture.write(record);
+}
+
+bool ProxyHandler::snapshot(StatsTunnel& row) const {
+    if (!established_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    row.id = id_;
+    row.age_ms = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - accepted_at_).count());
+    row.bytes_from_client = bytes_from_client_.load(std::memory_order_relaxed);
+    row.bytes_from_target = bytes_from_target_.load(std::memory_order_relaxed);
+    row.handshake_us = static_cast<uint32_t>(std::min<int64_t>(resolve_us_ + connect_us_, UINT32_MAX));
+    row.client_port = static_cast<uint16_t>(client_port_);
+    row.target_port = static_cast<uint16_t>(target_port_);
+    row.protocol = static_cast<uint8_t>(protocol_);
+    row.parked = park_id_.load(std::memory_order_relaxed) != 0;
+    std::snprintf(row.client_ip, sizeof(row.client_ip), "%s", client_ip_.c_str());
+    std::snprintf(row.target_host, sizeof(row.target_host), "%s", target_host_.c_str());
+    return true;
+}
+
+void ProxyHandler::debug(const std::string& message) {
+    if (debug_sampled_) {
+        Logger::debug(message);
+    }
+}
+
+void ProxyHandler::trace(TracePhase phase, std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::time_point end) {
+    if (traced_) {
+        Tracer::record(id_, phase, start, end);
+    }
+}
+
+bool ProxyHandler::setup_tunnel() {
     std::string target_host;
     int target_port;
+    auto parse_started = std::chrono::steady_clock::now();
     
+    // Разбирается только строка запроса - заголовки дочитываются позже,
+    // параллельно с подключением к цели
     if (!get_target_info(target_host, target_port)) {
-        Logger::error("Не удалось получить информацию о целевом сервере от " + 
-                     client_ip_ + ":" + std::to_string(client_port_));
-        return;
+        static LogSite& site = Logger::site("proxy.bad_request");
+        Logger::error(site, "Не удалось получить информацию о целевом сервере от " + 
+                           client_ip_ + ":" + std::to_string(client_port_));
+        return false;
+    }
+    target_host_ = target_host;
+    target_port_ = target_port;
+    if (protocol_ == AccessProtocol::SOCKS5_UDP) {
+        return open_udp_association(target_port);
+    }
+    if (!authenticate_http(target_host)) {
+        return false;
+    }
+    if (HeavyHitters::enabled()) {
+        hitter_key_ = HeavyHitters::make_key(target_host, target_port, client_ip_);
+        HeavyHitters::add_connection(hitter_key_);
+    }
+
+    // Проверка политики доступа до подключения к цели
+    policy_ = context_.policy.current();
+    decision_ = policy_->evaluate(target_host);
+    // Действие по умолчанию для имени, не попавшего под доменные правила,
+    // откладывается до разрешения: CIDR правила могут его переопределить
+    route_by_address_ = !decision_.matched && policy_->has_prefix_rules();
+    if (decision_.action == PolicyAction::DENY && !route_by_address_) {
+        static MetricValue& denied = Metrics::counter("policy_denied_total");
+        denied.add();
+        static LogSite& site = Logger::site("proxy.policy_denied");
+        Logger::warning(site, "Доступ к " + target_host + ":" + std::to_string(target_port) +
+                             " запрещен политикой" +
+                             (decision_.matched ? " (" + policy_->rule(decision_.rule_index).text + ")" : ""));
+        close_reason_ = CloseReason::DENIED;
+        send_denied_response();
+        return false;
+    }
+    
+    // Возобновляемая сессия уже держит сокет цели. Если заголовок сессии
+    // пришел вместе со строкой запроса, заголовки читаются до подключения
+    if (resume_may_follow() && !read_request_headers(target_host)) {
+        return false;
+    }
+    if (resuming()) {
+        return resume_session(target_host, target_port);
     }
 
-    if (!connect_to_target(target_host, target_port)) {
-        Logger::error("Не удалось подключиться к " + target_host + 
-                     ":" + std::to_string(target_port));
+    // allow и bypass - прямое подключение, upstream - через вышестоящий прокси
+    bool connected;
+    if (decision_.action == PolicyAction::UPSTREAM && !route_by_address_) {
+        if (!read_request_headers(target_host)) {
+            return false;
+        }
+        trace(TracePhase::PARSE, parse_started);
+        if (resuming()) {
+            return resume_session(target_host, target_port);
+        }
+        if (try_cache()) {
+            return false;
+        }
+        auto connect_started = std::chrono::steady_clock::now();
+        connected = connect_via_upstream(target_host, target_port);
+        connect_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - connect_started).count();
+        trace(TracePhase::CONNECT, connect_started);
+    } else {
+        // Разомкнутый автомат - мгновенный отказ без попытки подключения
+        CircuitBreakerRegistry::Permit permit = context_.breakers.acquire(target_host, target_port);
+        if (permit == CircuitBreakerRegistry::Permit::REJECTED) {
+            static MetricValue& rejected = Metrics::counter("tunnels_rejected_by_breaker_total");
+            rejected.add();
+            static LogSite& site = Logger::site("proxy.breaker_rejected");
+            Logger::warning(site, "Цель " + target_host + ":" + std::to_string(target_port) +
+                                 " временно отключена автоматом, подключение не выполняется");
+            close_reason_ = CloseReason::REJECTED;
+            send_connection_response(false);
+            return false;
+        }
+        
+        // DNS и TCP рукопожатие с целью идут, пока клиент досылает заголовки.
+        // Для URL со свежим ответом в кэше подключение, скорее всего, не нужно,
+        // а при аутентификации заголовки уже прочитаны.
+        bool pipelined = config_.is_handshake_pipelining() && !cache_may_hit() &&
+                         headers_done_ == std::chrono::steady_clock::time_point{};
+        if (pipelined) {
+            begin_connect(target_host, target_port);
+        }
+        if (!read_request_headers(target_host)) {
+            // Начатое подключение закроется вместе с pending_connect_
+            context_.breakers.record(target_host, target_port, permit,
+                                     CircuitBreakerRegistry::Outcome::IGNORED, 0);
+            return false;
+        }
+        trace(TracePhase::PARSE, parse_started);
+        if (resuming()) {
+            // Заголовок сессии пришел после начала подключения
+            context_.breakers.record(target_host, target_port, permit,
+                                     CircuitBreakerRegistry::Outcome::IGNORED, 0);
+            pending_connect_.reset();
+            return resume_session(target_host, target_port);
+        }
+        if (try_cache()) {
+            context_.breakers.record(target_host, target_port, permit,
+                                     CircuitBreakerRegistry::Outcome::IGNORED, 0);
+            return false;
+        }
+        if (!pipelined) {
+            begin_connect(target_host, target_port);
+        }
+        
+        connected = connect_to_target(target_host, target_port);
+        resolve_us_ = pending_connect_->resolve_us();
+        connect_us_ = pending_connect_->connect_us();
+        int64_t latency_ms = (resolve_us_ + connect_us_) / 1000;
+        
+        // При параллельном подключении эти этапы перекрываются с PARSE
+        auto resolved_at = pending_connect_->started() +
+                           std::chrono::microseconds(pending_connect_->resolve_us());
+        trace(TracePhase::RESOLVE, pending_connect_->started(), resolved_at);
+        trace(TracePhase::CONNECT, resolved_at,
+              resolved_at + std::chrono::microseconds(pending_connect_->connect_us()));
+        
+        CircuitBreakerRegistry::Outcome outcome = denied_by_policy_
+            ? CircuitBreakerRegistry::Outcome::IGNORED
+            : (connected ? CircuitBreakerRegistry::Outcome::SUCCESS
+                         : CircuitBreakerRegistry::Outcome::FAILURE);
+        context_.breakers.record(target_host, target_port, permit, outcome, latency_ms);
+        
+        if (connected && pipelined) {
+            report_handshake_overlap(target_host, target_port);
+        }
+        
+        // Адрес цели направлен CIDR правилом (или действием по умолчанию)
+        // на вышестоящий прокси
+        if (!connected && denied_by_policy_ && address_route_ &&
+            address_route_->action == PolicyAction::UPSTREAM) {
+            denied_by_policy_ = false;
+            decision_ = *address_route_;
+            auto upstream_started = std::chrono::steady_clock::now();
+            connected = connect_via_upstream(target_host, target_port);
+            connect_us_ = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - upstream_started).count();
+        }
+    }
+    if (!connected && denied_by_policy_) {
+        close_reason_ = CloseReason::DENIED;
+        send_denied_response();
+        return false;
+    }
+    if (!connected) {
+        close_reason_ = CloseReason::CONNECT_FAILED;
+        static MetricValue& failed = Metrics::counter("tunnels_failed_total");
+        failed.add();
+        static LogSite& site = Logger::site("proxy.tunnel_failed");
+        Logger::error(site, "Не удалось подключиться к " + target_host + 
+                           ":" + std::to_string(target_port));
         send_connection_response(false);
-        return;
+        return false;
     }
+    
+    static MetricValue& established = Metrics::counter("tunnels_established_total");
+    established.add();
+    established_.store(true, std::memory_order_release);
+    capture_base_ = std::chrono::steady_clock::now();
+    update_tap();
 
     Logger::info("Установлен прокси туннель: " + client_ip_ + 
                 ":" + std::to_string(client_port_) + 
                 " -> " + target_host + ":" + std::to_string(target_port));
 
+    // Дальше соединение закрывается одной из сторон или по ошибке передачи
+    close_reason_ = CloseReason::CLIENT_CLOSED;
+    auto response_started = std::chrono::steady_clock::now();
     send_connection_response(true);
 
-    if (!is_http_connect_) {
+    if (protocol_ == AccessProtocol::HTTP) {
+        cache_request_ms_ = static_cast<int64_t>(Utils::unix_time_ms());
         forward_http_request();
     }
 
-    start_data_transfer();
+    bool forwarded = forward_early_data();
+    established_at_ = std::chrono::steady_clock::now();
+    trace(TracePhase::RESPONSE, response_started, established_at_);
+    return forwarded;
+}
+
+bool ProxyHandler::read_client_line(std::string& line, int timeout_ms) {
+    while (true) {
+        size_t eol = client_buffer_.find('\n', client_buffer_offset_);
+        if (eol != std::string::npos) {
+            size_t end = (eol > client_buffer_offset_ && client_buffer_[eol - 1] == '\r') ? eol - 1 : eol;
+            line.assign(client_buffer_, client_buffer_offset_, end - client_buffer_offset_);
+            client_buffer_offset_ = eol + 1;
+            return true;
+        }
+        if (!receive_client_data(timeout_ms)) {
+            return false;
+        }
+    }
+}
+
+bool ProxyHandler::receive_client_data(int timeout_ms) {
+    const size_t max_header_size = static_cast<size_t>(std::max(1024, config_.get_max_header_size()));
+    if (client_buffer_.size() >= max_header_size) {
+        static LogSite& site = Logger::site("proxy.header_too_long");
+        Logger::error(site, "Слишком длинный заголовок запроса");
+        return false;
+    }
     
-    running_.store(false);
+    pollfd pfd{};
+    pfd.fd = client_socket_;
+    pfd.events = POLLIN;
+    
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0) {
+        static LogSite& site = Logger::site("proxy.header_timeout");
+        Logger::error(site, "Таймаут или ошибка при чтении заголовка");
+        return false;
+    }
+    
+    // Читаем блоком: вместе с заголовками могут прийти и первые данные клиента
+    char buffer[4096];
+    size_t room = std::min(sizeof(buffer), max_header_size - client_buffer_.size());
+    ssize_t received = recv(client_socket_, buffer, room, 0);
+    if (received <= 0) {
+        if (received == 0) {
+            debug("Соединение закрыто клиентом при чтении заголовка");
+        } else {
+            static LogSite& site = Logger::site("proxy.header_read_error");
+            Logger::error(site, "Ошибка чтения данных: " + std::string(strerror(errno)));
+        }
+        return false;
+    }
+    client_buffer_.append(buffer, received);
+    return account_header_memory();
+}
+
+bool ProxyHandler::account_header_memory() {
+    // Буферы заголовков учитываются по фактической емкости строк
+    size_t used = client_buffer_.capacity() + original_http_request_.capacity() + cache_request_.capacity();
+    if (used > header_memory_) {
+        if (!quota_.reserve(used - header_memory_)) {
+            static LogSite& site = Logger::site("proxy.header_quota");
+            Logger::warning(site, "Превышена квота памяти соединения при чтении заголовков от " +
+                                 client_ip_ + ":" + std::to_string(client_port_));
+            close_reason_ = CloseReason::NO_MEMORY;
+            return false;
+        }
+    } else {
+        quota_.release(header_memory_ - used);
+    }
+    header_memory_ = used;
+    return true;
 }
 
 bool ProxyHandler::get_target_info(std::string& target_host, int& target_port) {
@@ -111,64 +671,48 @@ bool ProxyHandler::get_target_info(std::string& target_host, int& target_port) {
             return false;
         }
 
-        // Читаем первую строку для определения протокола
+        // SOCKS5 узнается по первому байту и разбирается без чтения строк
+        if (client_buffer_offset_ >= client_buffer_.size() && !receive_client_data(5000)) {
+            return false;
+        }
+        uint8_t first = static_cast<uint8_t>(client_buffer_[client_buffer_offset_]);
+        if (first == Socks5::VERSION) {
+            protocol_ = AccessProtocol::SOCKS5;
+            return parse_socks5(target_host, target_port);
+        }
+        // Бинарный протокол: старший байт длины имени - 0 или флаг учетных данных
+        if (first == 0x00 || first == 0x80) {
+            protocol_ = AccessProtocol::BINARY;
+            return parse_binary(target_host, target_port);
+        }
+
+        // Читаем первую строку для определения протокола (5 секунд на строку)
         std::string first_line;
-        char buffer[1024];
-        int pos = 0;
-        
-        // Читаем символ за символом до \r\n с таймаутом
-        while (pos < sizeof(buffer) - 1) {
-            fd_set read_fds;
-            FD_ZERO(&read_fds);
-            FD_SET(client_socket_, &read_fds);
-            
-            struct timeval timeout;
-            timeout.tv_sec = 5;  // 5 секунд на чтение заголовка
-            timeout.tv_usec = 0;
-            
-            int ready = select(client_socket_ + 1, &read_fds, nullptr, nullptr, &timeout);
-            if (ready <= 0) {
-                Logger::error("Таймаут или ошибка при чтении заголовка");
-                return false;
-            }
-            
-            ssize_t received = recv(client_socket_, &buffer[pos], 1, 0);
-            if (received <= 0) {
-                if (received == 0) {
-                    Logger::info("Соединение закрыто клиентом при чтении заголовка");
-                } else {
-                    Logger::error("Ошибка чтения данных: " + std::string(strerror(errno)));
-                }
-                return false;
-            }
-            
-            if (buffer[pos] == '\n') {
-                if (pos > 0 && buffer[pos-1] == '\r') {
-                    buffer[pos-1] = '\0'; // Убираем \r\n
-                    first_line = std::string(buffer);
-                    break;
-                }
-            }
-            pos++;
+        if (!read_client_line(first_line, 5000)) {
+            return false;
         }
         
         if (first_line.empty()) {
-            Logger::warning("Получена пустая первая строка");
+            static LogSite& site = Logger::site("proxy.empty_request");
+            Logger::warning(site, "Получена пустая первая строка");
             return false;
         }
         
-        Logger::info("Получена первая строка: " + first_line);
+        debug("Получена первая строка: " + first_line);
         
         // Проверяем тип HTTP запроса
         if (first_line.find("CONNECT ") == 0) {
+            protocol_ = AccessProtocol::CONNECT;
             return parse_http_connect(first_line, target_host, target_port);
         } else if (first_line.find("GET ") == 0 || first_line.find("POST ") == 0 || 
                   first_line.find("PUT ") == 0 || first_line.find("DELETE ") == 0) {
+            protocol_ = AccessProtocol::HTTP;
             return parse_http_request(first_line, target_host, target_port);
         } else {
-            // Предполагаем, что это наш бинарный протокол
-            // Но первые байты уже прочитаны как строка, поэтому нужно их обработать
-            return parse_binary_protocol_from_buffer(buffer, pos + 1, target_host, target_port);
+            static LogSite& site = Logger::site("proxy.unknown_protocol");
+            Logger::warning(site, "Получен неизвестный протокол от " + client_ip_ + ":" +
+                                 std::to_string(client_port_));
+            return false;
         }
 
     } catch (const std::exception& e) {
@@ -181,481 +725,1373 @@ bool ProxyHandler::get_target_info(std::string& target_host, int& target_port) {
     }
 }
 
-ssize_t ProxyHandler::recv_exact(int socket, void* buffer, size_t size) {
-    size_t total_received = 0;
-    char* buf = static_cast<char*>(buffer);
-
-    while (total_received < size && running_.load()) {
-        ssize_t received = recv(socket, buf + total_received, size - total_received, 0);
-        
-        if (received <= 0) {
-            if (received == 0) {
-                Logger::info("Соединение закрыто клиентом");
-            } else {
-                Logger::error("Ошибка при получении данных: " + std::string(strerror(errno)));
-            }
-            return received;
-        }
-        
-        total_received += received;
+bool ProxyHandler::parse_socks5(std::string& target_host, int& target_port) {
+    std::vector<uint8_t> methods;
+    if (!read_socks_message([&](const uint8_t* data, size_t size) {
+            return Socks5::parse_greeting(data, size, methods);
+        })) {
+        return false;
     }
-
-    return total_received;
-}
-
-bool ProxyHandler::connect_to_target(const std::string& host, int port) {
-    Logger::info("Подключение к " + host + ":" + std::to_string(port));
     
-    // Создание сокета для целевого сервера
-    target_socket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (target_socket_ < 0) {
-        Logger::error("Не удалось создать сокет для целевого сервера: " + std::string(strerror(errno)));
+    // Метод выбирает сервер: при включенной аутентификации - только по паролю
+    bool authenticate = context_.credentials.enabled();
+    uint8_t method = authenticate ? Socks5::USERNAME_PASSWORD : Socks5::NO_AUTH;
+    if (std::find(methods.begin(), methods.end(), method) == methods.end()) {
+        socks_replies_ += static_cast<char>(Socks5::VERSION);
+        socks_replies_ += static_cast<char>(Socks5::NO_ACCEPTABLE);
+        send_socks_replies();
+        static LogSite& site = Logger::site("proxy.socks_method");
+        Logger::warning(site, "Клиент SOCKS5 " + client_ip_ + ":" + std::to_string(client_port_) +
+                             " не предложил допустимого метода аутентификации");
+        close_reason_ = CloseReason::DENIED;
         return false;
     }
-
-    // Настройка таймаута
-    struct timeval timeout;
-    timeout.tv_sec = 10;  // Увеличиваем таймаут до 10 секунд
-    timeout.tv_usec = 0;
+    socks_replies_ += static_cast<char>(Socks5::VERSION);
+    socks_replies_ += static_cast<char>(method);
     
-    setsockopt(target_socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(target_socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-
-    // Настройка адреса целевого сервера
-    sockaddr_in target_addr{};
-    target_addr.sin_family = AF_INET;
-    target_addr.sin_port = htons(port);
-
-    // Попытка интерпретировать как IP адрес
-    if (inet_pton(AF_INET, host.c_str(), &target_addr.sin_addr) > 0) {
-        Logger::info("Используется IP адрес: " + host);
-    } else {
-        // Если не IP адрес, то резолвим доменное имя
-        Logger::info("Резолвим домен: " + host);
-        struct hostent* host_entry = gethostbyname(host.c_str());
-        if (!host_entry) {
-            Logger::error("Ошибка DNS резолва для " + host + ": " + std::string(hstrerror(h_errno)));
-            close(target_socket_);
-            target_socket_ = -1;
+    if (authenticate) {
+        std::string username;
+        std::string password;
+        if (!read_socks_message([&](const uint8_t* data, size_t size) {
+                return Socks5::parse_credentials(data, size, username, password);
+            })) {
             return false;
         }
-        
-        // Получаем первый IP адрес
-        char* ip_str = inet_ntoa(*((struct in_addr*)host_entry->h_addr_list[0]));
-        Logger::info("DNS резолв: " + host + " -> " + std::string(ip_str));
-        
-        // Копируем первый IP адрес
-        memcpy(&target_addr.sin_addr, host_entry->h_addr_list[0], host_entry->h_length);
+        bool valid = context_.credentials.verify_password(username, password, client_ip_);
+        socks_replies_ += static_cast<char>(Socks5::AUTH_VERSION);
+        socks_replies_ += static_cast<char>(valid ? 0x00 : 0x01);
+        if (!valid) {
+            send_socks_replies();
+            static MetricValue& failed = Metrics::counter("socks5_auth_failed_total");
+            failed.add();
+            static LogSite& site = Logger::site("proxy.socks_auth");
+            Logger::warning(site, "Неверные учетные данные SOCKS5 от " + client_ip_ + ":" +
+                                 std::to_string(client_port_));
+            close_reason_ = CloseReason::AUTH_FAILED;
+            return false;
+        }
+        auth_user_ = std::move(username);
     }
-
-    Logger::info("Попытка подключения...");
-    // Подключение к целевому серверу
-    if (connect(target_socket_, reinterpret_cast<sockaddr*>(&target_addr), 
-                sizeof(target_addr)) < 0) {
-        Logger::error("Не удалось подключиться к " + host + ":" + 
-                     std::to_string(port) + " - " + strerror(errno));
-        close(target_socket_);
-        target_socket_ = -1;
+    
+    uint8_t command = 0;
+    if (!read_socks_message([&](const uint8_t* data, size_t size) {
+            return Socks5::parse_request(data, size, command, target_host, target_port);
+        })) {
         return false;
     }
-
-    Logger::info("Успешно подключились к " + host + ":" + std::to_string(port));
+    // UDP ASSOCIATE: адрес в запросе - откуда клиент будет слать датаграммы
+    if (command == Socks5::UDP_ASSOCIATE && context_.udp_relay.is_running()) {
+        protocol_ = AccessProtocol::SOCKS5_UDP;
+        debug("Запрос SOCKS5 UDP ASSOCIATE от " + target_host + ":" + std::to_string(target_port));
+        return true;
+    }
+    if (command != Socks5::CONNECT) {
+        socks_replies_ += Socks5::make_reply(Socks5::COMMAND_NOT_SUPPORTED, nullptr);
+        send_socks_replies();
+        static LogSite& site = Logger::site("proxy.socks_command");
+        Logger::warning(site, "Команда SOCKS5 " + std::to_string(command) + " не поддерживается");
+        return false;
+    }
+    if (!Utils::is_valid_port(target_port)) {
+        socks_replies_ += Socks5::make_reply(Socks5::ADDRESS_NOT_SUPPORTED, nullptr);
+        send_socks_replies();
+        return false;
+    }
+    
+    // Ни один ответ еще не отправлен - рукопожатие укладывается в один круг
+    if (socks_replies_.size() == (authenticate ? 4u : 2u)) {
+        static MetricValue& pipelined = Metrics::counter("socks5_pipelined_handshakes_total");
+        pipelined.add();
+    }
+    debug("Запрос SOCKS5 CONNECT к " + target_host + ":" + std::to_string(target_port));
     return true;
 }
 
-void ProxyHandler::send_connection_response(bool success) {
-    try {
-        if (is_http_connect_) {
-            // Для CONNECT запросов отправляем HTTP ответ
-            send_http_response(success);
-        } else if (!success) {
-            // Для обычных HTTP запросов отправляем ошибку только при неудаче
-            std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n"
-                                       "Content-Type: text/html\r\n"
-                                       "Content-Length: 54\r\n"
-                                       "\r\n"
-                                       "<html><body><h1>502 Bad Gateway</h1></body></html>";
-            send(client_socket_, error_response.c_str(), error_response.length(), 0);
+bool ProxyHandler::open_udp_association(int client_port) {
+    // Датаграммы принимаются только с адреса управляющего соединения,
+    // а отвечать клиенту нужно на тот адрес, к которому он подключился
+    sockaddr_storage client{};
+    sockaddr_storage local{};
+    sockaddr_storage bound{};
+    socklen_t client_len = sizeof(client);
+    socklen_t local_len = sizeof(local);
+    if (getpeername(client_socket_, reinterpret_cast<sockaddr*>(&client), &client_len) == 0 &&
+        getsockname(client_socket_, reinterpret_cast<sockaddr*>(&local), &local_len) == 0) {
+        uint16_t port = htons(static_cast<uint16_t>(client_port));
+        if (client.ss_family == AF_INET6) {
+            reinterpret_cast<sockaddr_in6*>(&client)->sin6_port = port;
+        } else {
+            reinterpret_cast<sockaddr_in*>(&client)->sin_port = port;
         }
-        // Для обычных HTTP запросов при успехе не отправляем ответ здесь - 
-        // данные будут переданы напрямую от целевого сервера
-    } catch (const std::exception& e) {
-        Logger::error("Ошибка при отправке ответа клиенту: " + std::string(e.what()));
+        udp_session_ = context_.udp_relay.open(client, local, bound);
+    }
+    if (udp_session_ == 0) {
+        socks_replies_ += Socks5::make_reply(Socks5::GENERAL_FAILURE, nullptr);
+        send_socks_replies();
+        close_reason_ = CloseReason::REJECTED;
+        return false;
+    }
+    
+    socks_replies_ += Socks5::make_reply(Socks5::SUCCEEDED, reinterpret_cast<sockaddr*>(&bound));
+    if (!send_socks_replies()) {
+        return false;
     }
+    static MetricValue& associations = Metrics::counter("socks5_udp_associations_total");
+    associations.add();
+    established_.store(true, std::memory_order_release);
+    close_reason_ = CloseReason::CLIENT_CLOSED;
+    uint16_t bound_port = bound.ss_family == AF_INET6
+        ? reinterpret_cast<sockaddr_in6*>(&bound)->sin6_port
+        : reinterpret_cast<sockaddr_in*>(&bound)->sin_port;
+    Logger::info("Открыта UDP ассоциация " + std::to_string(udp_session_) + " для " +
+                 client_ip_ + ":" + std::to_string(client_port_) + " на порту " +
+                 std::to_string(ntohs(bound_port)));
+    return true;
 }
 
-void ProxyHandler::start_data_transfer() {
-    Logger::info("Начинаем передачу данных");
-    
-    fd_set read_fds;
-    char buffer[4096];
-    
-    while (running_.load()) {
-        FD_ZERO(&read_fds);
-        FD_SET(client_socket_, &read_fds);
-        FD_SET(target_socket_, &read_fds);
-        
-        int max_fd = std::max(client_socket_, target_socket_);
-        
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        
-        int ready = select(max_fd + 1, &read_fds, nullptr, nullptr, &timeout);
+bool ProxyHandler::hold_udp_association() {
+    // Ассоциация живет, пока открыто управляющее соединение (RFC 1928)
+    uint64_t from_client = 0;
+    uint64_t from_target = 0;
+    while (running_.load() && context_.udp_relay.session_bytes(udp_session_, from_client, from_target)) {
+        bytes_from_client_.store(from_client, std::memory_order_relaxed);
+        bytes_from_target_.store(from_target, std::memory_order_relaxed);
         
-        if (ready < 0) {
-            if (errno == EINTR) continue;
-            Logger::error("Ошибка select: " + std::string(strerror(errno)));
+        pollfd pfd{};
+        pfd.fd = client_socket_;
+        pfd.events = POLLIN;
+        int ready = poll(&pfd, 1, 1000);
+        if (ready < 0 && errno != EINTR) {
+            close_reason_ = CloseReason::IO_ERROR;
             break;
         }
-        
-        if (ready == 0) continue;
-        
-        // Передача от клиента к серверу
-        if (FD_ISSET(client_socket_, &read_fds)) {
+        if (ready > 0) {
+            // Данные по управляющему соединению не ожидаются и отбрасываются
+            char buffer[512];
             ssize_t received = recv(client_socket_, buffer, sizeof(buffer), 0);
             if (received <= 0) {
-                if (received < 0) {
-                    Logger::error("Ошибка чтения от клиента: " + std::string(strerror(errno)));
-                } else {
-                    Logger::info("Клиент закрыл соединение");
-                }
                 break;
             }
-            
-            if (send(target_socket_, buffer, received, 0) != received) {
-                Logger::error("Ошибка отправки к серверу");
-                break;
+        }
+    }
+    
+    context_.udp_relay.close(udp_session_, from_client, from_target);
+    bytes_from_client_.store(from_client, std::memory_order_relaxed);
+    bytes_from_target_.store(from_target, std::memory_order_relaxed);
+    debug("UDP ассоциация " + std::to_string(udp_session_) + " закрыта");
+    udp_session_ = 0;
+    return false;  // Управляющее соединение не паркуется
+}
+
+bool ProxyHandler::read_socks_message(const std::function<ssize_t(const uint8_t*, size_t)>& parse) {
+    while (true) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(client_buffer_.data()) + client_buffer_offset_;
+        ssize_t parsed = parse(data, client_buffer_.size() - client_buffer_offset_);
+        if (parsed > 0) {
+            client_buffer_offset_ += static_cast<size_t>(parsed);
+            return true;
+        }
+        if (parsed < 0) {
+            static LogSite& site = Logger::site("proxy.bad_socks");
+            Logger::error(site, std::string(protocol_ == AccessProtocol::BINARY ? "Некорректный бинарный запрос"
+                                                                                : "Некорректное сообщение SOCKS5") +
+                               " от " + client_ip_ + ":" + std::to_string(client_port_));
+            return false;
+        }
+        // Следующего сообщения нет - клиент ждет ответа на предыдущее
+        if (!send_socks_replies() || !receive_client_data(5000)) {
+            return false;
+        }
+    }
+}
+
+bool ProxyHandler::send_socks_replies() {
+    size_t sent_total = 0;
+    while (sent_total < socks_replies_.size()) {
+        ssize_t sent = send(client_socket_, socks_replies_.data() + sent_total,
+                            socks_replies_.size() - sent_total, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            static LogSite& site = Logger::site("proxy.send_error");
+            Logger::error(site, "Ошибка при отправке ответа SOCKS5: " + std::string(strerror(errno)));
+            return false;
+        }
+        sent_total += static_cast<size_t>(sent);
+    }
+    socks_replies_.clear();
+    return true;
+}
+
+bool ProxyHandler::read_request_headers(const std::string& target_host) {
+    if (headers_done_ != std::chrono::steady_clock::time_point{}) {
+        return true;  // Уже прочитаны ради заголовка сессии
+    }
+    
+    // У SOCKS5 и бинарного протокола заголовков нет: все после запроса -
+    // данные клиента
+    if (protocol_ == AccessProtocol::SOCKS5 || protocol_ == AccessProtocol::BINARY) {
+        headers_done_ = std::chrono::steady_clock::now();
+        return true;
+    }
+    
+    if (!is_http_connect_) {
+        return read_http_headers(target_host);
+    }
+    
+    // Для CONNECT заголовки пропускаются, кроме заголовков согласования
+    std::string line;
+    while (running_.load()) {
+        if (!read_client_line(line, 5000)) {
+            Logger::info("Соединение закрыто при чтении заголовков HTTP");
+            return false;
+        }
+        
+        // Пустая строка означает конец заголовков
+        if (line.empty()) {
+            headers_done_ = std::chrono::steady_clock::now();
+            return true;
+        }
+        
+        auto header_value = [&line](const char* name, std::string& value) {
+            size_t length = std::strlen(name);
+            if (line.size() > length && line[length] == ':' && strncasecmp(line.c_str(), name, length) == 0) {
+                value = Utils::trim(line.substr(length + 1));
             }
+        };
+        header_value(SecureChannel::HEADER_NAME, encryption_offer_);
+        header_value(StreamCompression::HEADER_NAME, compression_offer_);
+        header_value(SessionStore::HEADER_NAME, session_request_);
+        header_value("Proxy-Authorization", proxy_authorization_);
+    }
+    return false;
+}
+
+bool ProxyHandler::read_http_headers(const std::string& target_host) {
+    // Заголовки обычного HTTP остаются в буфере приема: после пустой строки
+    // он не меняется до пересылки запроса, и участки заголовков действительны
+    size_t begin = client_buffer_offset_;
+    size_t line_start = begin;
+    while (running_.load()) {
+        size_t eol = client_buffer_.find('\n', line_start);
+        if (eol == std::string::npos) {
+            if (!receive_client_data(5000)) {
+                Logger::info("Соединение закрыто при чтении заголовков HTTP");
+                return false;
+            }
+            continue;
         }
         
-        // Передача от сервера к клиенту  
-        if (FD_ISSET(target_socket_, &read_fds)) {
-            ssize_t received = recv(target_socket_, buffer, sizeof(buffer), 0);
-            if (received <= 0) {
-                if (received < 0) {
-                    Logger::error("Ошибка чтения от сервера: " + std::string(strerror(errno)));
-                } else {
-                    Logger::info("Сервер закрыл соединение");
-                }
-                break;
+        // Пустая строка означает конец заголовков
+        if (eol > line_start + 1 || (eol == line_start + 1 && client_buffer_[line_start] != '\r')) {
+            line_start = eol + 1;
+            continue;
+        }
+        client_buffer_offset_ = eol + 1;
+        headers_done_ = std::chrono::steady_clock::now();
+        
+        http_headers_.parse(std::string_view(client_buffer_).substr(begin, line_start - begin));
+        if (context_.credentials.enabled()) {
+            // Учетные данные предназначены прокси и дальше не пересылаются
+            std::string_view authorization;
+            if (http_headers_.find("Proxy-Authorization", authorization)) {
+                proxy_authorization_ = std::string(authorization);
             }
-            
-            if (send(client_socket_, buffer, received, 0) != received) {
-                Logger::error("Ошибка отправки к клиенту");
-                break;
+            http_headers_.remove("Proxy-Authorization");
+        }
+        context_.filters.current()->apply(HttpFilterContext{target_host, client_ip_}, http_headers_);
+        return true;
+    }
+    return false;
+}
+
+ssize_t ProxyHandler::recv_exact(int socket, void* buffer, size_t size) {
+    size_t total_received = 0;
+    char* buf = static_cast<char*>(buffer);
+
+    while (total_received < size && running_.load()) {
+        ssize_t received = recv(socket, buf + total_received, size - total_received, 0);
+        
+        if (received <= 0) {
+            if (received == 0) {
+                Logger::info("Соединение закрыто клиентом");
+            } else {
+                Logger::error("Ошибка при получении данных: " + std::string(strerror(errno)));
             }
+            return received;
         }
+        
+        total_received += received;
     }
-    
-    Logger::info("Передача данных завершена");
+
+    return total_received;
 }
 
-void ProxyHandler::transfer_data(int source_socket, int destination_socket,
-                                const std::string& direction) {
-    std::vector<char> buffer(config_.get_buffer_size());
-    size_t total_bytes = 0;
+void ProxyHandler::begin_connect(const std::string& host, int port) {
+    debug("Подключение к " + host + ":" + std::to_string(port));
     
-    try {
-        while (running_.load()) {
-            // Проверяем валидность сокетов
-            if (source_socket < 0 || destination_socket < 0) {
-                Logger::info("Недопустимые сокеты в " + direction);
-                break;
+    // Имя не попало под доменные правила - CIDR правила и действие по
+    // умолчанию применяются к адресу целиком: allow и bypass подключаются
+    // напрямую, deny пропускает адрес, upstream запоминается для подключения
+    // через вышестоящий прокси. Фильтр выполняется в потоке резолвера,
+    // поэтому захватывает снимок политики и общее решение.
+    AsyncConnect::AddressFilter filter;
+    if (policy_ && route_by_address_) {
+        std::shared_ptr<const CompiledPolicy> policy = policy_;
+        std::shared_ptr<PolicyDecision> route = std::make_shared<PolicyDecision>();
+        route->action = PolicyAction::DENY;
+        address_route_ = route;
+        filter = [policy, route](const sockaddr* address) {
+            PolicyDecision by_address = policy->evaluate_address(address);
+            if (by_address.action == PolicyAction::UPSTREAM && route->action != PolicyAction::UPSTREAM) {
+                *route = by_address;
             }
+            return by_address.action == PolicyAction::ALLOW || by_address.action == PolicyAction::BYPASS;
+        };
+    }
+    
+    pending_connect_ = std::make_unique<AsyncConnect>(
+        context_.resolver, host, port, std::max(1, config_.get_connect_timeout()) * 1000, std::move(filter));
+    pending_connect_->start();
+}
+
+bool ProxyHandler::connect_to_target(const std::string& host, int port) {
+    if (!pending_connect_) {
+        begin_connect(host, port);
+    }
+    
+    std::string error;
+    AsyncConnect::Status status = pending_connect_->finish(target_socket_, error);
+    std::string address = pending_connect_->address();
+    
+    if (status == AsyncConnect::Status::DENIED) {
+        if (address_route_ && address_route_->action == PolicyAction::UPSTREAM) {
+            debug("Адрес " + address + " для " + host + " направлен на вышестоящий прокси");
+        } else {
+            static LogSite& site = Logger::site("proxy.address_denied");
+            Logger::warning(site, "Адрес " + address + " для " + host + " запрещен политикой");
+        }
+        denied_by_policy_ = true;
+        return false;
+    }
+    if (status != AsyncConnect::Status::CONNECTED) {
+        static LogSite& site = Logger::site("proxy.connect_failed");
+        Logger::error(site, "Не удалось подключиться к " + host + ":" + 
+                           std::to_string(port) + " - " + error);
+        return false;
+    }
 
-            // Использование select для неблокирующего чтения
-            fd_set read_fds;
-            FD_ZERO(&read_fds);
-            FD_SET(source_socket, &read_fds);
+    // Таймаут операций с целевым сервером
+    Utils::set_socket_timeouts(target_socket_, 10);
 
-            struct timeval timeout;
-            timeout.tv_sec = 1;
-            timeout.tv_usec = 0;
+    debug("Успешно подключились к " + host + ":" + std::to_string(port) +
+                 (address.empty() || address == host ? "" : " (" + address + ")"));
+    return true;
+}
+
+void ProxyHandler::report_handshake_overlap(const std::string& host, int port) {
+    static MetricValue& pipelined = Metrics::counter("handshake_pipelined_total");
+    static MetricValue& saved_total = Metrics::counter("handshake_saved_us_total");
+    
+    // Последовательно: заголовки, затем DNS и connect. Параллельно: максимум
+    // из времени заголовков и времени подключения.
+    auto started = pending_connect_->started();
+    auto now = std::chrono::steady_clock::now();
+    int64_t headers_us = std::chrono::duration_cast<std::chrono::microseconds>(headers_done_ - started).count();
+    int64_t connect_us = pending_connect_->resolve_us() + pending_connect_->connect_us();
+    int64_t actual_us = std::chrono::duration_cast<std::chrono::microseconds>(now - started).count();
+    int64_t saved_us = std::max<int64_t>(0, headers_us + connect_us - actual_us);
+    
+    pipelined.add();
+    saved_total.add(saved_us);
+    debug("Параллельное подключение к " + host + ":" + std::to_string(port) +
+                 ": заголовки " + std::to_string(headers_us) + " мкс, DNS " +
+                 std::to_string(pending_connect_->resolve_us()) + " мкс" +
+                 (pending_connect_->resolved_from_cache() ? " (кэш)" : "") +
+                 ", connect " + std::to_string(pending_connect_->connect_us()) +
+                 " мкс, сэкономлено " + std::to_string(saved_us) + " мкс");
+}
 
-            int ready = select(source_socket + 1, &read_fds, nullptr, nullptr, &timeout);
-            
-            if (ready < 0) {
-                if (errno == EINTR) {
-                    continue; // Прерывание, продолжаем
+bool ProxyHandler::forward_early_data() {
+    // Данные, пришедшие вместе с заголовками, уходят к цели первыми
+    size_t pending = client_buffer_.size() - client_buffer_offset_;
+    if (pending > 0 && framing_.active()) {
+        // До ответа сервера клиент не знает, принято ли шифрование или
+        // сжатие, - это не записи канала
+        static LogSite& site = Logger::site("proxy.framed_early_data");
+        Logger::warning(site, "Клиент " + client_ip_ + ":" + std::to_string(client_port_) +
+                             " отправил данные до согласования шифрования или сжатия");
+        close_reason_ = CloseReason::BAD_REQUEST;
+        return false;
+    }
+    if (pending > 0) {
+        static MetricValue& early = Metrics::counter("handshake_early_bytes_total");
+        early.add(pending);
+        bytes_from_client_ += pending;
+        if (session_) {
+            session_->received += pending;
+        }
+        HeavyHitters::add_bytes(hitter_key_, pending);
+        capture_bytes(true, pending);
+        
+        // Отвод записывает только то, что действительно ушло цели
+        const char* data = client_buffer_.data() + client_buffer_offset_;
+        size_t sent_total = 0;
+        while (sent_total < pending) {
+            ssize_t sent = send(target_socket_, data + sent_total, pending - sent_total, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                if (tap_ && sent_total > 0) {
+                    tap_->record(true, data, sent_total);
                 }
-                Logger::error("Ошибка select в передаче данных (" + direction + "): " + 
-                             strerror(errno));
-                break;
-            }
-            
-            if (ready == 0) {
-                continue; // Таймаут
+                static LogSite& site = Logger::site("proxy.send_error");
+                Logger::error(site, "Ошибка при отправке ранних данных клиента: " + std::string(strerror(errno)));
+                return false;
             }
+            sent_total += sent;
+        }
+        if (tap_) {
+            tap_->record(true, data, pending);
+        }
+        debug("Переслано " + std::to_string(pending) + " байт ранних данных клиента");
+    }
+    
+    // Заголовки больше не нужны - их память возвращается в бюджет
+    http_headers_.clear();
+    std::string().swap(client_buffer_);
+    std::string().swap(original_http_request_);
+    client_buffer_offset_ = 0;
+    account_header_memory();
+    return true;
+}
 
-            if (!FD_ISSET(source_socket, &read_fds)) {
-                continue;
-            }
+bool ProxyHandler::connect_via_upstream(const std::string& host, int port) {
+    std::string parent;
+    target_socket_ = context_.upstreams.open_tunnel(decision_.upstream, host, port, parent);
+    if (target_socket_ < 0) {
+        return false;
+    }
+    
+    Utils::set_socket_timeouts(target_socket_, 10);
+    debug("Подключились к " + host + ":" + std::to_string(port) +
+                 " через вышестоящий прокси " + parent);
+    return true;
+}
+
+void ProxyHandler::send_connection_response(bool success) {
+    try {
+        if (protocol_ == AccessProtocol::SOCKS5) {
+            // Клиенту сообщается локальный адрес соединения с целью
+            sockaddr_storage bound{};
+            socklen_t bound_len = sizeof(bound);
+            bool have_bound = success && target_socket_ >= 0 &&
+                getsockname(target_socket_, reinterpret_cast<sockaddr*>(&bound), &bound_len) == 0;
+            socks_replies_ += Socks5::make_reply(success ? Socks5::SUCCEEDED : Socks5::HOST_UNREACHABLE,
+                                                 have_bound ? reinterpret_cast<sockaddr*>(&bound) : nullptr);
+            send_socks_replies();
+        } else if (protocol_ == AccessProtocol::BINARY) {
+            char status = success ? BINARY_STATUS_OK : BINARY_STATUS_ERROR;
+            send(client_socket_, &status, 1, MSG_NOSIGNAL);
+        } else if (is_http_connect_) {
+            // Для CONNECT запросов отправляем HTTP ответ
+            send_http_response(success);
+        } else if (!success) {
+            // Для обычных HTTP запросов отправляем ошибку только при неудаче
+            std::string error_response = "HTTP/1.1 502 Bad Gateway\r\n"
+                                       "Content-Type: text/html\r\n"
+                                       "Content-Length: 50\r\n"
+                                       "\r\n"
+                                       "<html><body><h1>502 Bad Gateway</h1></body></html>";
+            send(client_socket_, error_response.c_str(), error_response.length(), 0);
+        }
+        // Для обычных HTTP запросов при успехе не отправляем ответ здесь - 
+        // данные будут переданы напрямую от целевого сервера
+    } catch (const std::exception& e) {
+        static LogSite& site = Logger::site("proxy.response_error");
+        Logger::error(site, "Ошибка при отправке ответа клиенту: " + std::string(e.what()));
+    }
+}
 
-            // Получение данных
-            ssize_t bytes_received = recv(source_socket, buffer.data(), buffer.size(), 0);
-            
-            if (bytes_received <= 0) {
-                if (bytes_received == 0) {
-                    Logger::info("Соединение закрыто (" + direction + ")");
-                } else if (errno != ECONNRESET && errno != EPIPE) {
-                    Logger::error("Ошибка при получении данных (" + direction + "): " + 
-                                 strerror(errno));
+bool ProxyHandler::start_data_transfer() {
+    if (udp_session_ != 0) {
+        return hold_udp_association();
+    }
+    if (cache_fill_) {
+        return fetch_http_response();
+    }
+    debug("Начинаем передачу данных");
+    
+    // Буферы выделяются при первых данных и отдаются, пока туннель простаивает
+    AdaptiveBuffer upstream_buffer(quota_);
+    AdaptiveBuffer downstream_buffer(quota_);
+    auto last_activity = std::chrono::steady_clock::now();
+    auto park_after = std::chrono::seconds(config_.get_idle_park_after());
+    
+    // poll, а не select: при десятках тысяч туннелей номера сокетов больше FD_SETSIZE
+    pollfd fds[2];
+    fds[0].fd = client_socket_;
+    fds[1].fd = target_socket_;
+    
+    while (running_.load()) {
+        fds[0].events = fds[1].events = POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+        
+        int ready = poll(fds, 2, 1000);
+        
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            Logger::error("Ошибка poll: " + std::string(strerror(errno)));
+            break;
+        }
+        
+        if (ready == 0) {
+            // Неполная запись или кадр от клиента лежит в буфере
+            bool holding = framing_.inbound > 0;
+            auto idle = std::chrono::steady_clock::now() - last_activity;
+            if (idle >= std::chrono::milliseconds(quota_.budget().idle_release_ms()) && !holding) {
+                upstream_buffer.release();
+                downstream_buffer.release();
+                if (compression_) {
+                    compression_->release();
                 }
-                break;
             }
-
-            // Отправка данных с проверкой частичной передачи
-            ssize_t bytes_sent = 0;
-            while (bytes_sent < bytes_received && running_.load()) {
-                ssize_t sent = send(destination_socket, 
-                                   buffer.data() + bytes_sent,
-                                   bytes_received - bytes_sent, 0);
-                
-                if (sent <= 0) {
-                    if (errno != ECONNRESET && errno != EPIPE && errno != ENOTCONN) {
-                        Logger::error("Ошибка при отправке данных (" + direction + "): " + 
-                                     strerror(errno));
-                    }
-                    running_.store(false);
-                    return;
+            if (park_after.count() > 0 && idle >= park_after && !holding && context_.parker.is_running()) {
+                if (compression_) {
+                    compression_->release();
                 }
-                
-                bytes_sent += sent;
+                return true;
             }
-            
-            total_bytes += bytes_received;
+            continue;
+        }
+        last_activity = std::chrono::steady_clock::now();
+        
+        // Передача от клиента к серверу
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+            !relay(client_socket_, target_socket_, upstream_buffer, true)) {
+            break;
+        }
+        
+        // Передача от сервера к клиенту  
+        if ((fds[1].revents & (POLLIN | POLLHUP | POLLERR)) &&
+            !relay(target_socket_, client_socket_, downstream_buffer, false)) {
+            break;
         }
-
-    } catch (const std::exception& e) {
-        Logger::error("Критическая ошибка в передаче данных (" + direction + "): " + 
-                     std::string(e.what()));
-    } catch (...) {
-        Logger::error("Неизвестная ошибка в передаче данных (" + direction + ")");
     }
     
-    Logger::info(direction + ": передано " + std::to_string(total_bytes) + " байт");
-    Logger::info("Передача данных завершена (" + direction + ")");
-    running_.store(false);
+    if (!running_.load()) {
+        close_reason_ = CloseReason::SHUTDOWN;
+    }
+    debug("Передача данных завершена");
+    return false;
 }
 
-bool ProxyHandler::parse_http_connect(const std::string& connect_line, std::string& target_host, int& target_port) {
-    try {
-        // Парсим строку вида "CONNECT example.com:80 HTTP/1.1"
-        std::istringstream iss(connect_line);
-        std::string method, target, version;
-        
-        if (!(iss >> method >> target >> version)) {
-            Logger::error("Неверный формат CONNECT запроса: " + connect_line);
+template <typename SocketOps>
+RelayStatus ProxyHandler::transfer(SocketOps& ops, int source_socket, int destination_socket,
+                                   AdaptiveBuffer& buffer, bool from_client, size_t& received) {
+    if (!framing_.active()) {
+        return relay_step(ops, source_socket, destination_socket, buffer, received);
+    }
+    if (from_client) {
+        return decode_step(ops, source_socket, destination_socket, buffer, framing_, received);
+    }
+    return encode_step(ops, source_socket, destination_socket, buffer, framing_, received);
+}
+
+void ProxyHandler::update_tap() {
+    tap_generation_ = context_.tap.generation();
+    bool wanted = target_socket_ >= 0 && context_.tap.matches(client_ip_, target_host_, target_port_);
+    if (wanted && !tap_) {
+        tap_ = context_.tap.attach(id_, client_socket_, target_socket_, target_host_, target_port_);
+    } else if (!wanted && tap_) {
+        tap_->close();
+        tap_.reset();
+    }
+}
+
+bool ProxyHandler::relay(int source_socket, int destination_socket, AdaptiveBuffer& buffer,
+                         bool from_client) {
+    // Настройки отвода менялись - туннель заново сверяется с фильтром
+    if (tap_generation_ != context_.tap.generation()) {
+        update_tap();
+    }
+    
+    PosixSocketOps posix;
+    size_t received = 0;
+    RelayStatus status;
+    if (session_ && !from_client) {
+        ReplaySocketOps replay{session_->replay};
+        if (tap_) {
+            TapSocketOps<ReplaySocketOps> ops{replay, *tap_, target_socket_};
+            status = transfer(ops, source_socket, destination_socket, buffer, from_client, received);
+        } else {
+            status = transfer(replay, source_socket, destination_socket, buffer, from_client, received);
+        }
+    } else if (tap_) {
+        TapSocketOps<PosixSocketOps> ops{posix, *tap_, target_socket_};
+        status = transfer(ops, source_socket, destination_socket, buffer, from_client, received);
+    } else {
+        status = transfer(posix, source_socket, destination_socket, buffer, from_client, received);
+    }
+    // Разрыв со стороны клиента: цель сессии можно оставить открытой
+    client_lost_ = from_client ? (status == RelayStatus::CLOSED || status == RelayStatus::READ_ERROR)
+                               : status == RelayStatus::SEND_ERROR;
+    switch (status) {
+        case RelayStatus::OK:
+            break;
+        case RelayStatus::BAD_RECORD: {
+            static LogSite& site = Logger::site("proxy.bad_record");
+            static MetricValue& rejected = Metrics::counter("tunnel_records_rejected_total");
+            rejected.add();
+            std::string source = " туннеля от " + client_ip_ + ":" + std::to_string(client_port_);
+            Logger::warning(site, channel_ ? "Запись шифрованного" + source + " не прошла проверку"
+                                           : "Кадр сжатого" + source + " не прошел проверку");
+            close_reason_ = CloseReason::IO_ERROR;
             return false;
         }
-        
-        if (method != "CONNECT") {
-            Logger::error("Ожидался метод CONNECT, получен: " + method);
+        case RelayStatus::NO_MEMORY: {
+            static LogSite& site = Logger::site("proxy.buffer_memory");
+            Logger::warning(site, "Недостаточно памяти для буфера туннеля " + client_ip_ +
+                                 ":" + std::to_string(client_port_));
+            close_reason_ = CloseReason::NO_MEMORY;
             return false;
         }
-        
-        // Парсим target_host:target_port
-        size_t colon_pos = target.find(':');
-        if (colon_pos == std::string::npos) {
-            Logger::error("Не найден порт в CONNECT запросе: " + target);
+        case RelayStatus::READ_ERROR: {
+            static LogSite& site = Logger::site("proxy.relay_read_error");
+            Logger::error(site, std::string(from_client ? "Ошибка чтения от клиента: " : "Ошибка чтения от сервера: ") +
+                               strerror(errno));
+            close_reason_ = CloseReason::IO_ERROR;
             return false;
         }
-        
-        target_host = target.substr(0, colon_pos);
-        try {
-            target_port = std::stoi(target.substr(colon_pos + 1));
-        } catch (const std::exception& e) {
-            Logger::error("Неверный порт в CONNECT запросе: " + target);
+        case RelayStatus::CLOSED:
+            debug(from_client ? "Клиент закрыл соединение" : "Сервер закрыл соединение");
+            close_reason_ = from_client ? CloseReason::CLIENT_CLOSED : CloseReason::TARGET_CLOSED;
+            return false;
+        case RelayStatus::SEND_ERROR: {
+            static LogSite& site = Logger::site("proxy.relay_send_error");
+            Logger::error(site, from_client ? "Ошибка отправки к серверу" : "Ошибка отправки к клиенту");
+            close_reason_ = CloseReason::IO_ERROR;
             return false;
         }
-        
-        is_http_connect_ = true;
-        
-        // Пропускаем остальные заголовки HTTP до пустой строки
-        std::string line;
-        char buffer[1024];
-        int pos = 0;
-        
-        while (running_.load()) {
-            pos = 0;
-            while (pos < sizeof(buffer) - 1) {
-                ssize_t received = recv(client_socket_, &buffer[pos], 1, 0);
-                if (received <= 0) {
-                    if (received == 0) {
-                        Logger::info("Соединение закрыто при чтении заголовков HTTP");
-                    } else {
-                        Logger::error("Ошибка чтения заголовков: " + std::string(strerror(errno)));
-                    }
-                    return false;
-                }
-                
-                if (buffer[pos] == '\n') {
-                    if (pos > 0 && buffer[pos-1] == '\r') {
-                        buffer[pos-1] = '\0';
-                        line = std::string(buffer);
-                        break;
-                    } else {
-                        buffer[pos] = '\0';
-                        line = std::string(buffer);
-                        break;
-                    }
-                }
-                pos++;
-            }
-            
-            // Пустая строка означает конец заголовков
-            if (line.empty()) {
+    }
+    static MetricValue& bytes_up = Metrics::counter("tunnel_bytes_from_client_total");
+    static MetricValue& bytes_down = Metrics::counter("tunnel_bytes_from_target_total");
+    (from_client ? bytes_up : bytes_down).add(received);
+    (from_client ? bytes_from_client_ : bytes_from_target_) += static_cast<uint64_t>(received);
+    if (session_ && from_client) {
+        session_->received += received;
+    }
+    HeavyHitters::add_bytes(hitter_key_, static_cast<uint64_t>(received));
+    capture_bytes(from_client, received);
+    
+    bool& first_byte = from_client ? first_byte_client_ : first_byte_target_;
+    if (!first_byte) {
+        first_byte = true;
+        trace(from_client ? TracePhase::FIRST_BYTE_CLIENT : TracePhase::FIRST_BYTE_TARGET, established_at_);
+    }
+    return true;
+}
+
+bool ProxyHandler::parse_http_connect(const std::string& connect_line, std::string& target_host, int& target_port) {
+    // Парсим строку вида "CONNECT example.com:80 HTTP/1.1"
+    HttpRequest::RequestLine request;
+    HttpRequest::Error error = HttpRequest::parse_connect(connect_line, request);
+    if (error != HttpRequest::Error::NONE) {
+        static LogSite& site = Logger::site("proxy.bad_connect");
+        switch (error) {
+            case HttpRequest::Error::METHOD:
+                Logger::error(site, "Ожидался метод CONNECT, получен: " + request.method);
+                break;
+            case HttpRequest::Error::NO_PORT:
+                Logger::error(site, "Не найден порт в CONNECT запросе: " + request.target);
+                break;
+            case HttpRequest::Error::BAD_PORT:
+                Logger::error(site, "Неверный порт в CONNECT запросе: " + request.target);
+                break;
+            default:
+                Logger::error(site, "Неверный формат CONNECT запроса: " + connect_line);
                 break;
-            }
         }
-        
-        return true;
-        
-    } catch (const std::exception& e) {
-        Logger::error("Исключение в parse_http_connect: " + std::string(e.what()));
-        return false;
-    } catch (...) {
-        Logger::error("Неизвестное исключение в parse_http_connect");
         return false;
     }
+    
+    target_host = std::move(request.host);
+    target_port = request.port;
+    is_http_connect_ = true;
+    return true;
 }
 
-bool ProxyHandler::parse_binary_protocol_from_buffer(char* buffer, int buffer_size, 
-                                                    std::string& target_host, int& target_port) {
-    // Это сложно, так как мы уже прочитали часть данных как строку
-    // Для простоты вернем false - браузеры не используют наш бинарный протокол
-    Logger::warning("Получен неизвестный протокол, ожидался HTTP CONNECT");
-    return false;
+bool ProxyHandler::parse_binary(std::string& target_host, int& target_port) {
+    bool has_credentials = false;
+    std::string username;
+    std::string password;
+    if (!read_socks_message([&](const uint8_t* data, size_t size) {
+            return parse_binary_request(data, size, target_host, target_port,
+                                        has_credentials, username, password);
+        })) {
+        return false;
+    }
+    if (!Utils::is_valid_port(target_port)) {
+        send_connection_response(false);
+        return false;
+    }
+    if (context_.credentials.enabled()) {
+        if (!has_credentials || !context_.credentials.verify_password(username, password, client_ip_)) {
+            static LogSite& site = Logger::site("proxy.binary_auth");
+            Logger::warning(site, "Неверные учетные данные бинарного протокола от " + client_ip_ + ":" +
+                                 std::to_string(client_port_));
+            close_reason_ = CloseReason::AUTH_FAILED;
+            send_auth_required();
+            return false;
+        }
+        auth_user_ = std::move(username);
+    }
+    debug("Бинарный запрос к " + target_host + ":" + std::to_string(target_port));
+    return true;
 }
 
 bool ProxyHandler::parse_http_request(const std::string& request_line, std::string& target_host, int& target_port) {
     // Парсим строку вида "GET http://example.com/path HTTP/1.1"
-    std::istringstream iss(request_line);
-    std::string method, url, version;
-    
-    if (!(iss >> method >> url >> version)) {
-        Logger::error("Неверный формат HTTP запроса: " + request_line);
+    HttpRequest::RequestLine request;
+    HttpRequest::Error error = HttpRequest::parse_absolute(request_line, request);
+    if (error != HttpRequest::Error::NONE) {
+        static LogSite& site = Logger::site("proxy.bad_http");
+        if (error == HttpRequest::Error::SCHEME) {
+            Logger::error(site, "Неподдерживаемый протокол в URL: " + request.target);
+        } else if (error == HttpRequest::Error::BAD_PORT) {
+            Logger::error(site, "Неверный порт в URL: " + request.target);
+        } else {
+            Logger::error(site, "Неверный формат HTTP запроса: " + request_line);
+        }
         return false;
     }
     
-    Logger::info("Получен HTTP " + method + " запрос к " + url);
+    debug("Получен HTTP " + request.method + " запрос к " + request.target);
+    target_host = std::move(request.host);
+    target_port = request.port;
+    
+    // Формируем исходный HTTP запрос с относительным путем
+    original_http_request_ = request.method + " " + request.path + " " + request.version + "\r\n";
+    http_method_ = std::move(request.method);
+    http_url_ = std::move(request.target);
     
-    // Убираем протокол из URL
-    std::string target_url = url;
-    bool is_https = false;
-    std::string path = "/";
+    is_http_connect_ = false; // Это обычный HTTP запрос, не CONNECT
     
-    if (target_url.find("https://") == 0) {
-        target_url = target_url.substr(8); // Убираем "https://"
-        is_https = true;
-        target_port = 443; // Порт по умолчанию для HTTPS
-    } else if (target_url.find("http://") == 0) {
-        target_url = target_url.substr(7); // Убираем "http://"
-        target_port = 80; // Порт по умолчанию для HTTP
+    return true;
+}
+
+void ProxyHandler::send_http_response(bool success) {
+    std::string response;
+    if (success) {
+        response = "HTTP/1.1 200 Connection established\r\n";
+        // Клиент, не получивший заголовок шифрования, решает сам, продолжать ли
+        // без него: выключенное на сервере шифрование - не ошибка туннеля
+        std::string reply;
+        if (!encryption_offer_.empty() && context_.identity.enabled()) {
+            auto channel = std::make_unique<SecureChannel>();
+            if (channel->accept(encryption_offer_, context_.identity, reply)) {
+                channel_ = std::move(channel);
+                response += std::string(SecureChannel::HEADER_NAME) + ": " + reply + "\r\n";
+                static MetricValue& encrypted = Metrics::counter("tunnels_encrypted_total");
+                encrypted.add();
+            } else {
+                static LogSite& site = Logger::site("proxy.bad_encryption_offer");
+                Logger::warning(site, "Некорректное предложение шифрования от " + client_ip_ + ":" +
+                                     std::to_string(client_port_));
+            }
+        }
+        if (!compression_offer_.empty() && config_.is_compression_enabled() &&
+            StreamCompression::accepts(compression_offer_)) {
+            compression_ = std::make_unique<StreamCompression>(quota_);
+            response += std::string(StreamCompression::HEADER_NAME) + ": " + StreamCompression::CODEC + "\r\n";
+            static MetricValue& compressed = Metrics::counter("tunnels_compressed_total");
+            compressed.add();
+        }
+        framing_.channel = channel_.get();
+        framing_.compression = compression_.get();
+        offer_session(response);
+        response += "\r\n";
     } else {
-        Logger::error("Неподдерживаемый протокол в URL: " + url);
+        response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
+    }
+    
+    send(client_socket_, response.c_str(), response.length(), 0);
+}
+
+void ProxyHandler::send_denied_response() {
+    if (protocol_ == AccessProtocol::SOCKS5) {
+        socks_replies_ += Socks5::make_reply(Socks5::NOT_ALLOWED, nullptr);
+        send_socks_replies();
+        return;
+    }
+    
+    if (protocol_ == AccessProtocol::BINARY) {
+        send_connection_response(false);
+        return;
+    }
+    if (!is_http_connect_ && original_http_request_.empty()) {
+        return;  // Не HTTP клиент - просто закрываем соединение
+    }
+    
+    std::string response = "HTTP/1.1 403 Forbidden\r\n"
+                           "Content-Type: text/html\r\n"
+                           "Content-Length: 48\r\n"
+                           "\r\n"
+                           "<html><body><h1>403 Forbidden</h1></body></html>";
+    send(client_socket_, response.c_str(), response.length(), 0);
+}
+
+bool ProxyHandler::authenticate_http(const std::string& target_host) {
+    if (!context_.credentials.enabled() ||
+        (protocol_ != AccessProtocol::CONNECT && protocol_ != AccessProtocol::HTTP)) {
+        return true;  // SOCKS5 и бинарный протокол проверяются при разборе
+    }
+    // Учетные данные - в заголовках: они читаются до политики и подключения,
+    // чтобы клиент без пароля не заставлял сервер подключаться к цели
+    if (!read_request_headers(target_host)) {
         return false;
     }
+    std::string user;
+    if (!proxy_authorization_.empty() && context_.credentials.verify_header(proxy_authorization_, user, client_ip_)) {
+        auth_user_ = std::move(user);
+        debug("Пользователь " + auth_user_ + " прошел проверку");
+        return true;
+    }
+    if (!proxy_authorization_.empty()) {
+        static LogSite& site = Logger::site("proxy.http_auth");
+        Logger::warning(site, "Неверные учетные данные HTTP от " + client_ip_ + ":" +
+                             std::to_string(client_port_));
+    }
+    close_reason_ = CloseReason::AUTH_FAILED;
+    send_auth_required();
+    return false;
+}
+
+void ProxyHandler::send_auth_required() {
+    if (protocol_ == AccessProtocol::BINARY) {
+        char status = BINARY_STATUS_AUTH_FAILED;
+        send(client_socket_, &status, 1, MSG_NOSIGNAL);
+        return;
+    }
+    std::string response = "HTTP/1.1 407 Proxy Authentication Required\r\n"
+                           "Proxy-Authenticate: Basic realm=\"cvpn\"\r\n"
+                           "Proxy-Authenticate: Bearer realm=\"cvpn\"\r\n"
+                           "Content-Length: 0\r\n"
+                           "Connection: close\r\n"
+                           "\r\n";
+    send(client_socket_, response.c_str(), response.length(), MSG_NOSIGNAL);
+}
+
+void ProxyHandler::forward_http_request() {
+    if (original_http_request_.empty()) {
+        Logger::error("Исходный HTTP запрос не сохранен");
+        return;
+    }
+    
+    debug("Пересылка HTTP запроса на целевой сервер");
     
-    // Находим хост, порт и путь
-    size_t path_pos = target_url.find('/');
-    std::string host_port;
-    if (path_pos != std::string::npos) {
-        host_port = target_url.substr(0, path_pos);
-        path = target_url.substr(path_pos);
+    // Строка запроса, неизмененные заголовки из буфера приема и строки
+    // фильтров уходят одним вызовом без копирования
+    static const char END_OF_HEADERS[] = "\r\n";
+    std::vector<iovec> parts;
+    parts.push_back(iovec{&original_http_request_[0], original_http_request_.size()});
+    if (!http_request_rendered_) {
+        http_headers_.gather(parts);
+        parts.push_back(iovec{const_cast<char*>(END_OF_HEADERS), 2});
+    }
+    size_t sent = 0;
+    for (const iovec& part : parts) {
+        sent += part.iov_len;
+    }
+    // send_all сдвигает iov, поэтому для отвода нужна копия
+    std::vector<iovec> recorded;
+    if (tap_) {
+        recorded = parts;
+    }
+    
+    if (!Utils::send_all(target_socket_, parts.data(), parts.size())) {
+        static LogSite& site = Logger::site("proxy.send_error");
+        Logger::error(site, "Ошибка при отправке HTTP запроса: " + std::string(strerror(errno)));
     } else {
-        host_port = target_url;
+        // Отвод записывает только то, что действительно ушло цели
+        for (const iovec& part : recorded) {
+            tap_->record(true, static_cast<const char*>(part.iov_base), part.iov_len);
+        }
+        bytes_from_client_ += static_cast<uint64_t>(sent);
+        HeavyHitters::add_bytes(hitter_key_, static_cast<uint64_t>(sent));
+        capture_bytes(true, sent);
+        debug("HTTP запрос успешно переслан (" + std::to_string(sent) + " байт)");
+    }
+}
+
+void ProxyHandler::render_http_request() {
+    if (http_request_rendered_) {
+        return;
+    }
+    http_headers_.append_to(original_http_request_);
+    original_http_request_ += "\r\n";
+    http_headers_.clear();
+    http_request_rendered_ = true;
+}
+bool ProxyHandler::resume_may_follow() {
+    if (!is_http_connect_) {
+        return false;
+    }
+    // Проверяются только строки блока заголовков (строка запроса уже
+    // прочитана): тело или данные туннеля после пустой строки не должны
+    // превращать запрос в возобновление
+    const char* name = SessionStore::HEADER_NAME;
+    size_t length = std::strlen(name);
+    size_t position = client_buffer_offset_;
+    while (position < client_buffer_.size()) {
+        size_t eol = client_buffer_.find('\n', position);
+        size_t end = eol == std::string::npos ? client_buffer_.size() : eol;
+        if (end == position || (end == position + 1 && client_buffer_[position] == '\r')) {
+            return false;  // Конец заголовков
+        }
+        if (end - position > length && client_buffer_[position + length] == ':' &&
+            strncasecmp(client_buffer_.data() + position, name, length) == 0) {
+            return true;
+        }
+        if (eol == std::string::npos) {
+            break;
+        }
+        position = eol + 1;
+    }
+    return false;
+}
+
+void ProxyHandler::offer_session(std::string& response) {
+    // Сессия - только у туннеля без преобразований потока: буфер повтора
+    // хранит байты в том виде, в котором они ушли клиенту
+    if (session_request_ != "new" || framing_.active() || !context_.sessions.enabled()) {
+        return;
+    }
+    size_t replay_size = context_.sessions.replay_size();
+    std::string token = SessionStore::new_token();
+    if (token.empty() || !quota_.reserve(replay_size)) {
+        return;  // Туннель работает без сессии
+    }
+    session_ = std::make_unique<ResumableSession>(token, target_host_, target_port_, replay_size);
+    limit_send_buffer(client_socket_, replay_size);
+    response += std::string(SessionStore::HEADER_NAME) + ": token=" + token +
+                "; replay=" + std::to_string(replay_size) + "\r\n";
+    static MetricValue& started = Metrics::counter("sessions_started_total");
+    started.add();
+}
+
+bool ProxyHandler::resume_session(const std::string& host, int port) {
+    // resume; token=<hex>; received=<байт, полученных клиентом от цели>
+    std::string token;
+    std::string received;
+    for (const std::string& part : Utils::split(session_request_, ';')) {
+        std::string field = Utils::trim(part);
+        if (field.compare(0, 6, "token=") == 0) {
+            token = field.substr(6);
+        } else if (field.compare(0, 9, "received=") == 0) {
+            received = field.substr(9);
+        }
+    }
+    uint64_t offset = 0;
+    bool valid = !token.empty() && !received.empty() &&
+                 received.find_first_not_of("0123456789") == std::string::npos && received.size() <= 19;
+    if (valid) {
+        offset = std::stoull(received);
+    }
+    
+    std::unique_ptr<ResumableSession> session = valid ? context_.sessions.claim(token, host, port) : nullptr;
+    if (session && (offset < session->replay.begin() || offset > session->replay.end())) {
+        // Непринятые клиентом байты уже вытеснены из буфера повтора -
+        // продолжить поток без потерь нельзя, цель закрывается
+        close(session->target_socket);
+        session.reset();
+    }
+    if (!session) {
+        static MetricValue& failed = Metrics::counter("sessions_resume_failed_total");
+        failed.add();
+        static LogSite& site = Logger::site("proxy.resume_rejected");
+        Logger::warning(site, "Сессия с " + host + ":" + std::to_string(port) + " для " + client_ip_ + ":" +
+                             std::to_string(client_port_) + " не возобновлена");
+        close_reason_ = CloseReason::REJECTED;
+        std::string response = "HTTP/1.1 410 Gone\r\n\r\n";
+        send(client_socket_, response.c_str(), response.length(), MSG_NOSIGNAL);
+        return false;
     }
     
-    size_t colon_pos = host_port.find(':');
-    if (colon_pos != std::string::npos) {
-        target_host = host_port.substr(0, colon_pos);
-        try {
-            target_port = std::stoi(host_port.substr(colon_pos + 1));
-        } catch (const std::exception& e) {
-            Logger::error("Неверный порт в URL: " + host_port);
+    // Буфер повтора снова учитывается в квоте соединения
+    quota_.charge(session->replay.capacity());
+    target_socket_ = session->target_socket;
+    session->target_socket = -1;
+    session_ = std::move(session);
+    limit_send_buffer(client_socket_, session_->replay.capacity());
+    established_.store(true, std::memory_order_release);
+    capture_base_ = std::chrono::steady_clock::now();
+    update_tap();
+    Logger::info("Возобновлена сессия " + client_ip_ + ":" + std::to_string(client_port_) + " -> " +
+                 host + ":" + std::to_string(port) + " с байта " + std::to_string(offset));
+    
+    // Ответ сообщает, сколько байт клиента дошло до цели; за ним - байты,
+    // которые клиент не получил
+    close_reason_ = CloseReason::CLIENT_CLOSED;
+    std::string response = "HTTP/1.1 200 Connection established\r\n" + std::string(SessionStore::HEADER_NAME) +
+                           ": token=" + session_->token + "; received=" + std::to_string(session_->received) +
+                           "\r\n\r\n";
+    std::string replay = session_->replay.read_from(offset);
+    response += replay;
+    size_t sent_total = 0;
+    while (sent_total < response.size()) {
+        ssize_t sent = send(client_socket_, response.data() + sent_total, response.size() - sent_total, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            client_lost_ = true;  // Клиент снова пропал - сессия отсоединяется заново
+            close_reason_ = CloseReason::IO_ERROR;
             return false;
         }
-    } else {
-        target_host = host_port;
-        // target_port уже установлен выше (80 или 443)
+        sent_total += static_cast<size_t>(sent);
     }
+    bytes_from_target_ += replay.size();
     
-    // Формируем исходный HTTP запрос с относительным путем
-    original_http_request_ = method + " " + path + " " + version + "\r\n";
+    bool forwarded = forward_early_data();
+    established_at_ = std::chrono::steady_clock::now();
+    return forwarded;
+}
+
+void ProxyHandler::detach_session() {
+    if (!session_) {
+        return;
+    }
+    // Цель остается открытой, только если пропал клиент, а не цель
+    if (client_lost_ && target_socket_ >= 0 && running_.load()) {
+        session_->target_socket = target_socket_;
+        if (context_.sessions.detach(session_)) {
+            target_socket_ = -1;
+            close_reason_ = CloseReason::DETACHED;
+            Logger::info("Клиент " + client_ip_ + ":" + std::to_string(client_port_) + " отключился, сессия с " +
+                         target_host_ + ":" + std::to_string(target_port_) + " ждет возобновления");
+            return;
+        }
+        session_->target_socket = -1;
+    }
+    session_.reset();
+}
+
+bool ProxyHandler::cache_may_hit() {
+    return protocol_ == AccessProtocol::HTTP && http_method_ == "GET" &&
+           context_.cache.may_serve(http_url_, static_cast<int64_t>(Utils::unix_time_ms()));
+}
+
+bool ProxyHandler::try_cache() {
+    if (protocol_ != AccessProtocol::HTTP || !context_.cache.enabled()) {
+        return false;
+    }
+    if (http_method_ == "POST" || http_method_ == "PUT" || http_method_ == "DELETE") {
+        context_.cache.invalidate(http_url_);
+        return false;
+    }
+    render_http_request();
+    if (!HttpCache::cacheable_request(http_method_, http_url_, original_http_request_)) {
+        return false;
+    }
     
-    is_http_connect_ = false; // Это обычный HTTP запрос, не CONNECT
+    int64_t now_ms = static_cast<int64_t>(Utils::unix_time_ms());
+    std::shared_ptr<const CachedResponse> entry;
+    HttpCache::Result result = context_.cache.lookup(http_url_, original_http_request_, now_ms, entry);
+    if (result == HttpCache::Result::FRESH) {
+        bool not_modified = HttpCache::not_modified(*entry, original_http_request_);
+        if (send_cached_response(*entry, now_ms, not_modified)) {
+            int64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - headers_done_).count();
+            context_.cache.record_hit(entry->body->size(), latency_us);
+            close_reason_ = CloseReason::CACHE_HIT;
+            debug("Ответ на " + http_url_ + " отдан из кэша");
+        }
+        return true;
+    }
+    context_.cache.record_miss();
     
-    // Читаем и сохраняем остальные заголовки HTTP
-    std::string line;
-    char buffer[1024];
-    int pos = 0;
+    // Одновременные запросы URL без собственных условий клиента получают
+    // ответ одной загрузки; первый из них выполняет ее сам
+    bool conditional = HttpCache::conditional(original_http_request_);
+    if (!conditional) {
+        bool leader = false;
+        std::shared_ptr<SharedFetch> fetch = context_.cache.join(http_url_, leader);
+        if (fetch && !leader && serve_collapsed(*fetch)) {
+            return true;
+        }
+        if (leader) {
+            fetch_ = std::move(fetch);
+        }
+    }
     
-    while (true) {
-        pos = 0;
-        while (pos < sizeof(buffer) - 1) {
-            if (recv(client_socket_, &buffer[pos], 1, 0) <= 0) {
+    // Ответ цели читает обработчик, чтобы сохранить его. Устаревший ответ
+    // ревалидируется, если у клиента нет собственных условий.
+    if (result == HttpCache::Result::STALE && entry->has_validators() && !conditional) {
+        cache_stale_ = entry;
+    }
+    cache_request_ = original_http_request_;
+    HttpCache::rewrite_request(original_http_request_, cache_stale_.get());
+    cache_fill_ = true;
+    return !account_header_memory();
+}
+
+bool ProxyHandler::send_cached_response(const CachedResponse& entry, int64_t now_ms, bool not_modified) {
+    // Заголовки и неизменяемое тело из кэша уходят одним вызовом без копирования тела
+    std::string head = HttpCache::response_head(entry, now_ms, not_modified);
+    iovec iov[2];
+    iov[0].iov_base = &head[0];
+    iov[0].iov_len = head.size();
+    iov[1].iov_base = const_cast<char*>(entry.body->data());
+    iov[1].iov_len = entry.body->size();
+    size_t count = not_modified || entry.body->empty() ? 1 : 2;
+    
+    if (!Utils::send_all(client_socket_, iov, count)) {
+        static LogSite& site = Logger::site("proxy.cache_send_error");
+        Logger::error(site, "Ошибка при отправке ответа из кэша: " + std::string(strerror(errno)));
+        close_reason_ = CloseReason::IO_ERROR;
+        return false;
+    }
+    bytes_from_target_ += head.size() + (count == 2 ? entry.body->size() : 0);
+    capture_bytes(false, head.size() + (count == 2 ? entry.body->size() : 0));
+    return true;
+}
+
+bool ProxyHandler::serve_collapsed(SharedFetch& fetch) {
+    // Ожидание ограничено временем до каждой следующей части ответа;
+    // остановка сервера проверяется раз в секунду
+    auto timeout = std::chrono::milliseconds(context_.cache.collapse_timeout_ms());
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    size_t index = 0;
+    size_t body_bytes = 0;
+    while (running_.load()) {
+        std::shared_ptr<const std::string> part;
+        SharedFetch::State state = fetch.wait(index, 1000, part);
+        if (state == SharedFetch::State::TIMEOUT && std::chrono::steady_clock::now() < deadline) {
+            continue;
+        }
+        if (state == SharedFetch::State::DONE) {
+            context_.cache.record_collapsed(body_bytes);
+            close_reason_ = CloseReason::CACHE_HIT;
+            debug("Ответ на " + http_url_ + " получен из общей загрузки");
+            return true;
+        }
+        if (state != SharedFetch::State::DATA ||
+            (index == 0 && !fetch.matches(http_url_, original_http_request_))) {
+            if (index == 0) {
+                // Клиенту еще ничего не отправлено - запрос выполняется отдельно
+                context_.cache.record_collapse_fallback(state == SharedFetch::State::TIMEOUT);
+                debug("Общая загрузка " + http_url_ + " не подошла, запрос к цели");
                 return false;
             }
-            
-            if (buffer[pos] == '\n') {
-                if (pos > 0 && buffer[pos-1] == '\r') {
-                    buffer[pos-1] = '\0';
-                    line = std::string(buffer);
-                    break;
-                } else {
-                    buffer[pos] = '\0';
-                    line = std::string(buffer);
-                    break;
-                }
-            }
-            pos++;
+            static LogSite& site = Logger::site("proxy.collapse_failed");
+            Logger::warning(site, "Общая загрузка " + http_url_ + " прервана");
+            close_reason_ = CloseReason::IO_ERROR;
+            return true;
         }
         
-        // Пустая строка означает конец заголовков
-        if (line.empty()) {
-            original_http_request_ += "\r\n";
-            break;
-        } else {
-            // Модифицируем заголовок Host, если нужно
-            if (line.find("Host:") == 0) {
-                original_http_request_ += "Host: " + target_host + "\r\n";
-            } else {
-                original_http_request_ += line + "\r\n";
-            }
+        iovec iov{const_cast<char*>(part->data()), part->size()};
+        if (!Utils::send_all(client_socket_, &iov, 1)) {
+            static LogSite& site = Logger::site("proxy.relay_send_error");
+            Logger::error(site, "Ошибка отправки к клиенту");
+            close_reason_ = CloseReason::IO_ERROR;
+            return true;
         }
+        bytes_from_target_ += part->size();
+        capture_bytes(false, part->size());
+        body_bytes += index > 0 ? part->size() : 0;
+        ++index;
+        deadline = std::chrono::steady_clock::now() + timeout;
     }
-    
+    close_reason_ = CloseReason::SHUTDOWN;
     return true;
 }
 
-void ProxyHandler::send_http_response(bool success) {
-    std::string response;
-    if (success) {
-        response = "HTTP/1.1 200 Connection established\r\n\r\n";
-    } else {
-        response = "HTTP/1.1 502 Bad Gateway\r\n\r\n";
+void ProxyHandler::end_fetch(bool complete) {
+    if (fetch_) {
+        fetch_->finish(complete);
+        context_.cache.release(http_url_, fetch_);
+        fetch_.reset();
     }
-    
-    send(client_socket_, response.c_str(), response.length(), 0);
 }
 
-void ProxyHandler::forward_http_request() {
-    if (original_http_request_.empty()) {
-        Logger::error("Исходный HTTP запрос не сохранен");
-        return;
+bool ProxyHandler::fetch_http_response() {
+    debug("Чтение ответа на " + http_url_ + " для кэша");
+    static MetricValue& bytes_down = Metrics::counter("tunnel_bytes_from_target_total");
+    auto account = [this](size_t bytes) {
+        bytes_down.add(bytes);
+        bytes_from_target_ += bytes;
+        HeavyHitters::add_bytes(hitter_key_, bytes);
+        capture_bytes(false, bytes);
+        if (!first_byte_target_) {
+            first_byte_target_ = true;
+            trace(TracePhase::FIRST_BYTE_TARGET, established_at_);
+        }
+    };
+    
+    // Заголовки ответа
+    const size_t max_header_size = static_cast<size_t>(std::max(1024, config_.get_max_header_size()));
+    char buffer[16384];
+    std::string head;
+    size_t head_end;
+    while ((head_end = head.find("\r\n\r\n")) == std::string::npos) {
+        if (head.size() >= max_header_size) {
+            static LogSite& site = Logger::site("proxy.response_header_too_long");
+            Logger::error(site, "Слишком длинные заголовки ответа " + http_url_);
+            close_reason_ = CloseReason::IO_ERROR;
+            return false;
+        }
+        ssize_t received = recv(target_socket_, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            close_reason_ = received == 0 ? CloseReason::TARGET_CLOSED : CloseReason::IO_ERROR;
+            debug("Цель закрыла соединение до ответа на " + http_url_);
+            return false;
+        }
+        head.append(buffer, static_cast<size_t>(received));
+        if (tap_) {
+            tap_->record(false, buffer, static_cast<size_t>(received));
+        }
     }
+    std::string body = head.substr(head_end + 4);
+    head.resize(head_end + 2);
+    int64_t response_ms = static_cast<int64_t>(Utils::unix_time_ms());
+    int status = head.compare(0, 7, "HTTP/1.") == 0 && head.size() > 12 ? std::atoi(head.c_str() + 9) : 0;
     
-    Logger::info("Пересылка HTTP запроса на целевой сервер");
+    // Сохраненный ответ подтвержден - клиент и ожидающие получают его целиком
+    if (status == 304 && cache_stale_) {
+        std::shared_ptr<const CachedResponse> refreshed =
+            context_.cache.refresh(*cache_stale_, head, cache_request_ms_, response_ms);
+        if (refreshed) {
+            context_.cache.store(http_url_, cache_request_, refreshed);
+        }
+        const CachedResponse& entry = refreshed ? *refreshed : *cache_stale_;
+        if (fetch_) {
+            fetch_->start(std::make_shared<const std::string>(HttpCache::response_head(entry, response_ms, false)),
+                          HttpCache::variant_key(http_url_, entry.vary, cache_request_), entry.vary);
+            fetch_->append(entry.body);
+            end_fetch(true);
+        }
+        if (send_cached_response(entry, response_ms, false)) {
+            context_.cache.record_revalidated(entry.body->size());
+            close_reason_ = CloseReason::TARGET_CLOSED;
+        }
+        return false;
+    }
     
-    // Отправляем сохраненный HTTP запрос на целевой сервер
-    ssize_t sent = send(target_socket_, original_http_request_.c_str(), 
-                       original_http_request_.length(), 0);
+    // Ответы с Transfer-Encoding пересылаются без сохранения
+    std::string value;
+    bool encoded = HttpCache::header(head, "transfer-encoding", value);
+    int64_t content_length = -1;
+    if (!encoded && HttpCache::header(head, "content-length", value)) {
+        content_length = std::strtoll(value.c_str(), nullptr, 10);
+    }
+    if (status == 204 || status == 304 || (status >= 100 && status < 200)) {
+        content_length = 0;
+    }
+    std::shared_ptr<CachedResponse> entry;
+    if (!encoded && content_length <= static_cast<int64_t>(context_.cache.max_object_size())) {
+        entry = context_.cache.prepare(cache_request_, head, cache_request_ms_, response_ms);
+    }
     
-    if (sent < 0) {
-        Logger::error("Ошибка при отправке HTTP запроса: " + std::string(strerror(errno)));
+    // Ожидающим отдаются только сохраняемые ответы известной длины: их
+    // цепочка буферов ограничена max_object_kb. Остальные запрашивают сами.
+    std::string client_head = HttpCache::closing_head(head);
+    bool shared = fetch_ && entry && content_length >= 0;
+    if (shared) {
+        fetch_->start(std::make_shared<const std::string>(client_head),
+                      HttpCache::variant_key(http_url_, entry->vary, cache_request_), entry->vary);
+        if (!body.empty()) {
+            fetch_->append(std::make_shared<const std::string>(body));
+        }
     } else {
-        Logger::info("HTTP запрос успешно переслан (" + std::to_string(sent) + " байт)");
+        end_fetch(false);
+    }
+    
+    // Клиент получает ответ по мере чтения; тело копится для кэша в пределах
+    // max_object_kb и квоты памяти соединения
+    size_t reserved = 0;
+    auto keep = [&](const char* data, size_t size) {
+        if (!entry) {
+            return;
+        }
+        if (body.size() + size > context_.cache.max_object_size()) {
+            entry.reset();
+        } else {
+            body.append(data, size);
+            if (body.capacity() > reserved && quota_.reserve(body.capacity() - reserved)) {
+                reserved = body.capacity();
+            } else if (body.capacity() > reserved) {
+                entry.reset();
+            }
+        }
+        if (!entry) {
+            std::string().swap(body);
+        }
+    };
+    
+    iovec iov[2];
+    iov[0].iov_base = &client_head[0];
+    iov[0].iov_len = client_head.size();
+    iov[1].iov_base = &body[0];
+    iov[1].iov_len = body.size();
+    account(head_end + 4 + body.size());
+    int64_t received_body = static_cast<int64_t>(body.size());
+    bool sent = Utils::send_all(client_socket_, iov, body.empty() ? 1 : 2);
+    std::string first_part;
+    first_part.swap(body);
+    keep(first_part.data(), first_part.size());
+    
+    // Если клиент ведущего отключился, ответ дочитывается для ожидающих и кэша
+    bool complete = content_length >= 0 && received_body >= content_length;
+    close_reason_ = CloseReason::TARGET_CLOSED;
+    while (!complete && running_.load() && (sent || shared || entry)) {
+        size_t want = sizeof(buffer);
+        if (content_length >= 0) {
+            want = static_cast<size_t>(std::min<int64_t>(want, content_length - received_body));
+        }
+        ssize_t received = recv(target_socket_, buffer, want, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0) {
+            static LogSite& site = Logger::site("proxy.relay_read_error");
+            Logger::error(site, "Ошибка чтения от сервера: " + std::string(strerror(errno)));
+            close_reason_ = CloseReason::IO_ERROR;
+            break;
+        }
+        if (received == 0) {
+            // Без Content-Length конец ответа - закрытие соединения целью
+            complete = content_length < 0;
+            break;
+        }
+        account(static_cast<size_t>(received));
+        if (tap_) {
+            tap_->record(false, buffer, static_cast<size_t>(received));
+        }
+        received_body += received;
+        if (shared) {
+            fetch_->append(std::make_shared<const std::string>(buffer, static_cast<size_t>(received)));
+        }
+        if (sent) {
+            iovec part{buffer, static_cast<size_t>(received)};
+            sent = Utils::send_all(client_socket_, &part, 1);
+        }
+        keep(buffer, static_cast<size_t>(received));
+        complete = content_length >= 0 && received_body >= content_length;
+    }
+    if (!sent) {
+        static LogSite& site = Logger::site("proxy.relay_send_error");
+        Logger::error(site, "Ошибка отправки к клиенту");
+        close_reason_ = CloseReason::IO_ERROR;
+    } else if (!running_.load()) {
+        close_reason_ = CloseReason::SHUTDOWN;
+    }
+    
+    if (complete && entry) {
+        HttpCache::attach_body(*entry, std::move(body));
+        context_.cache.store(http_url_, cache_request_, entry);
+        debug("Ответ на " + http_url_ + " сохранен в кэше");
     }
-}
\ No newline at end of file
+    end_fetch(complete);
+    quota_.release(reserved);
+    cache_stale_.reset();
+    std::string().swap(cache_request_);
+    account_header_memory();
+    return false;
+}
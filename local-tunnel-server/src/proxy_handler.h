@@ -5,12 +5,32 @@
 #include <memory>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <vector>
 #include "config.h"
+#include "access_policy.h"
+#include "server_context.h"
+#include "async_connect.h"
+#include "memory_budget.h"
+#include "tracer.h"
+#include "access_log.h"
+#include "heavy_hitters.h"
+#include "http_cache.h"
+#include "relay_step.h"
+#include "secure_channel.h"
+#include "stream_compression.h"
+#include "session_store.h"
+#include "pcap_tap.h"
+#include "http_filter.h"
 
-class ProxyHandler {
+struct StatsTunnel;
+
+class ProxyHandler : public std::enable_shared_from_this<ProxyHandler> {
 public:
     ProxyHandler(int client_socket, const std::string& client_ip, 
-                int client_port, const Config& config);
+                int client_port, ServerContext& context, size_t reserved_memory = 0);
     ~ProxyHandler() noexcept;
 
     // Основные методы
@@ -19,15 +39,80 @@ public:
     bool is_running() const { return running_.load(); }
 
     // Информация о клиенте
+    uint64_t get_id() const { return id_; }
     std::string get_client_ip() const { return client_ip_; }
     int get_client_port() const { return client_port_; }
+    
+    // Строка таблицы туннелей сегмента статистики (из потока рабочего).
+    // false - туннель еще не установлен
+    bool snapshot(StatsTunnel& row) const;
 
 private:
     // Состояние соединения
+    uint64_t id_;
     std::atomic<bool> running_{false};
     bool is_http_connect_{false};
     std::string original_http_request_;
     
+    // Обычный HTTP: в original_http_request_ - строка запроса с относительным
+    // путем, заголовки - участки client_buffer_ с правками фильтров. Кэшу
+    // запрос нужен текстом: тогда заголовки дописываются в
+    // original_http_request_ (http_request_rendered_)
+    HttpHeaders http_headers_;
+    bool http_request_rendered_{false};
+    
+    // Прочитанные от клиента, но еще не разобранные данные. После заголовков
+    // здесь остаются байты, которые клиент отправил, не дожидаясь ответа.
+    std::string client_buffer_;
+    size_t client_buffer_offset_{0};
+    
+    // Ответы SOCKS5, еще не отправленные клиенту. Клиент, приславший
+    // приветствие, аутентификацию и запрос одним пакетом, получает их
+    // одной отправкой вместе с ответом на запрос.
+    std::string socks_replies_;
+    
+    // UDP ассоциация, которую держит управляющее соединение (0 - нет)
+    uint64_t udp_session_{0};
+    
+    // Кэш HTTP: метод и URL обычного запроса, заголовки запроса для
+    // сохранения ответа и устаревший ответ, который ревалидируется
+    std::string http_method_;
+    std::string http_url_;
+    bool cache_fill_{false};
+    std::string cache_request_;
+    std::shared_ptr<const CachedResponse> cache_stale_;
+    int64_t cache_request_ms_{0};
+    std::shared_ptr<SharedFetch> fetch_;  // Загрузка, которую ведет этот обработчик
+    
+    // Шифрованный и сжатый туннель: предложения клиента из заголовков
+    // CONNECT и принятые сервером преобразования потока
+    std::string encryption_offer_;
+    std::string compression_offer_;
+    std::unique_ptr<SecureChannel> channel_;
+    
+    // Учтенная память соединения и размер учтенных буферов заголовков
+    ConnectionQuota quota_;
+    size_t header_memory_{0};
+    
+    // Буфер сжатия учитывается в квоте, поэтому объявлен после нее
+    std::unique_ptr<StreamCompression> compression_;
+    TunnelFraming framing_;
+    
+    // Возобновляемая сессия: запрос клиента из заголовка CONNECT, сессия
+    // с буфером повтора (учтен в квоте) и признак разрыва со стороны клиента
+    std::string session_request_;
+    std::unique_ptr<ResumableSession> session_;
+    bool client_lost_{false};
+    
+    // Proxy-Authorization из заголовков HTTP и CONNECT и имя пользователя,
+    // прошедшего проверку
+    std::string proxy_authorization_;
+    std::string auth_user_;
+    
+    // Отвод туннеля в pcapng и номер настроек отвода, по которым он выбран
+    std::shared_ptr<TapStream> tap_;
+    uint64_t tap_generation_{0};
+    
     // Сокеты
     int client_socket_{-1};
     int target_socket_{-1};
@@ -36,26 +121,126 @@ private:
     std::string client_ip_;
     int client_port_;
     
-    // Конфигурация
+    // Общие подсистемы сервера и снимок конфигурации на время соединения:
+    // перезагрузка не меняет настройки уже принятого соединения
+    ServerContext& context_;
+    std::shared_ptr<const Config> config_snapshot_;
     const Config& config_;
     
-    // Потоки для передачи данных
+    // Снимок политики доступа и решение для текущего соединения
+    std::shared_ptr<const CompiledPolicy> policy_;
+    PolicyDecision decision_;
+    bool denied_by_policy_{false};
+    // Имя без доменного правила при CIDR правилах решается по адресу цели;
+    // фильтр резолвера записывает сюда решение upstream для адреса
+    bool route_by_address_{false};
+    std::shared_ptr<PolicyDecision> address_route_;
+    
+    // Подключение к цели, начатое до окончания чтения заголовков
+    std::unique_ptr<AsyncConnect> pending_connect_;
+    std::chrono::steady_clock::time_point headers_done_{};
+    
+    // Трассировка этапов (только для попавших в выборку соединений)
+    bool traced_{false};
+    std::chrono::steady_clock::time_point accepted_at_{};
+    std::chrono::steady_clock::time_point established_at_{};
+    std::atomic<bool> established_{false};  // Публикует цель и время подключения для snapshot()
+    bool first_byte_client_{false};
+    bool first_byte_target_{false};
+    
+    // Отладочные сообщения выводятся только для попавших в выборку соединений
+    bool debug_sampled_{false};
+    
+    // Данные для журнала доступа
+    uint64_t accepted_unix_ms_{0};
+    std::string target_host_;
+    int target_port_{0};
+    AccessProtocol protocol_{AccessProtocol::UNKNOWN};
+    CloseReason close_reason_{CloseReason::BAD_REQUEST};
+    int64_t resolve_us_{0};
+    int64_t connect_us_{0};
+    std::atomic<uint64_t> bytes_from_client_{0};  // Читаются и потоком рабочего
+    std::atomic<uint64_t> bytes_from_target_{0};
+    std::atomic<bool> access_logged_{false};
+    
+    // Огибающая туннеля для захвата нагрузки (отсчет от установки туннеля)
+    bool capturing_{false};
+    std::chrono::steady_clock::time_point capture_base_{};
+    std::vector<CaptureEvent> capture_events_;
+    
+    // Ключи цели и клиента для поиска самых нагруженных значений
+    HeavyHitters::Key hitter_key_;
+    
+    // Потоки для передачи данных. thread_mutex_ защищает передачу потока
+    // между park(), resume() и stop() вместе с park_id_
     std::unique_ptr<std::thread> handler_thread_;
+    std::mutex thread_mutex_;
+    
+    // Идентификатор стоянки простаивающего туннеля (0 - не запаркован)
+    std::atomic<uint64_t> park_id_{0};
+    
+    // Оценка памяти записи стоянки и регистрации сокетов в epoll
+    static constexpr size_t PARKED_OVERHEAD = 256;
     
     // Внутренние методы
     void handle();
+    void resume_transfer();
+    void finish();
+    bool park();
+    void resume();
+    bool setup_tunnel();
     bool get_target_info(std::string& target_host, int& target_port);
+    bool read_client_line(std::string& line, int timeout_ms);
+    bool receive_client_data(int timeout_ms);
+    bool parse_socks5(std::string& target_host, int& target_port);
+    bool read_socks_message(const std::function<ssize_t(const uint8_t*, size_t)>& parse);
+    bool send_socks_replies();
+    bool open_udp_association(int client_port);
+    bool hold_udp_association();
+    bool read_request_headers(const std::string& target_host);
+    bool read_http_headers(const std::string& target_host);
+    bool account_header_memory();
     bool parse_http_connect(const std::string& connect_line, std::string& target_host, int& target_port);
     bool parse_http_request(const std::string& request_line, std::string& target_host, int& target_port);
-    bool parse_binary_protocol_from_buffer(char* buffer, int buffer_size, std::string& target_host, int& target_port);
+    bool parse_binary(std::string& target_host, int& target_port);
+    bool authenticate_http(const std::string& target_host);
+    void send_auth_required();
+    void begin_connect(const std::string& host, int port);
     bool connect_to_target(const std::string& host, int port);
+    void report_handshake_overlap(const std::string& host, int port);
+    bool forward_early_data();
+    bool connect_via_upstream(const std::string& host, int port);
     void send_connection_response(bool success);
     void send_http_response(bool success);
+    void send_denied_response();
     void forward_http_request();
-    void start_data_transfer();
-    void transfer_data(int source_socket, int destination_socket, 
-                      const std::string& direction);
+    void render_http_request();
+    bool cache_may_hit();
+    bool resume_may_follow();
+    bool resuming() const { return session_request_.compare(0, 6, "resume") == 0; }
+    bool resume_session(const std::string& host, int port);
+    void offer_session(std::string& response);
+    void detach_session();
+    bool try_cache();
+    bool send_cached_response(const CachedResponse& entry, int64_t now_ms, bool not_modified);
+    bool serve_collapsed(SharedFetch& fetch);
+    void end_fetch(bool complete);
+    bool fetch_http_response();
+    bool start_data_transfer();
+    bool relay(int source_socket, int destination_socket, AdaptiveBuffer& buffer,
+               bool from_client);
+    template <typename SocketOps>
+    RelayStatus transfer(SocketOps& ops, int source_socket, int destination_socket, AdaptiveBuffer& buffer,
+                         bool from_client, size_t& received);
+    void update_tap();
     ssize_t recv_exact(int socket, void* buffer, size_t size);
+    void log_access();
+    void report_compression();
+    void capture_bytes(bool from_client, size_t bytes);
+    void capture_tunnel();
+    void debug(const std::string& message);
+    void trace(TracePhase phase, std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now());
     
     // Запрет копирования
     ProxyHandler(const ProxyHandler&) = delete;
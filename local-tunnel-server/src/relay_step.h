@@ -0,0 +1,213 @@
+#ifndef RELAY_STEP_H
+#define RELAY_STEP_H
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "memory_budget.h"
+#include "secure_channel.h"
+#include "stream_compression.h"
+
+// Результат одного шага пересылки туннеля
+enum class RelayStatus {
+    OK,
+    NO_MEMORY,   // Буфер не выделен - квота или бюджет исчерпаны
+    CLOSED,      // Источник закрыл соединение
+    READ_ERROR,  // errno содержит причину
+    SEND_ERROR,
+    BAD_RECORD   // Запись или кадр от клиента повреждены или слишком длинные
+};
+
+// Операции с сокетами туннеля на настоящих сокетах. Шаг пересылки
+// параметризован ими, чтобы тот же код выполнялся в симуляторе сети
+// (bench/sim_network.h)
+struct PosixSocketOps {
+    ssize_t recv(int socket, char* data, size_t size) {
+        return ::recv(socket, data, size, 0);
+    }
+
+    // Отправка блокируется, пока все байты не попадут в буфер сокета
+    bool send(int socket, const char* data, size_t size) {
+        return ::send(socket, data, size, 0) == static_cast<ssize_t>(size);
+    }
+};
+
+// Один шаг: чтение доступных данных источника в адаптивный буфер и отправка
+// их получателю. Размер буфера подстраивается по результату чтения.
+template <typename SocketOps>
+RelayStatus relay_step(SocketOps& ops, int source, int destination, AdaptiveBuffer& buffer, size_t& moved) {
+    moved = 0;
+    if (!buffer.ensure()) {
+        return RelayStatus::NO_MEMORY;
+    }
+
+    ssize_t received = ops.recv(source, buffer.data(), buffer.size());
+    if (received == 0) {
+        return RelayStatus::CLOSED;
+    }
+    if (received < 0) {
+        return RelayStatus::READ_ERROR;
+    }
+
+    if (!ops.send(destination, buffer.data(), static_cast<size_t>(received))) {
+        return RelayStatus::SEND_ERROR;
+    }
+    moved = static_cast<size_t>(received);
+    buffer.on_read(moved);
+    return RelayStatus::OK;
+}
+
+// Преобразования потока между клиентом и сервером: шифрование записями
+// (secure_channel.h) и сжатие кадрами (stream_compression.h). Любое может
+// отсутствовать; при обоих кадр - содержимое записи.
+struct TunnelFraming {
+    SecureChannel* channel{nullptr};
+    StreamCompression* compression{nullptr};
+    size_t inbound{0};  // Байты неполной записи (кадра) от клиента в начале буфера
+
+    bool active() const { return channel != nullptr || compression != nullptr; }
+};
+
+// Шаг к клиенту: открытый текст читается сразу на место в записи или кадре
+// (при сжатии - в буфер сжатия), кадр собирается и шифруется на месте и
+// уходит одной отправкой
+template <typename SocketOps>
+RelayStatus encode_step(SocketOps& ops, int source, int destination, AdaptiveBuffer& buffer,
+                        TunnelFraming& framing, size_t& moved) {
+    moved = 0;
+    SecureChannel* channel = framing.channel;
+    StreamCompression* compression = framing.compression;
+    if (!buffer.ensure()) {
+        return RelayStatus::NO_MEMORY;
+    }
+
+    size_t record_header = channel ? SecureChannel::HEADER : 0;
+    size_t prefix = record_header + (compression ? StreamCompression::HEADER : 0);
+    size_t suffix = channel ? SecureChannel::TAG : 0;
+    size_t limit = channel ? std::min(buffer.size(), SecureChannel::MAX_RECORD) : buffer.size();
+    size_t room = limit - prefix - suffix;
+    char* frame = buffer.data() + record_header;
+
+    char* input = frame;
+    bool packing = false;
+    if (compression) {
+        room = std::min(room, StreamCompression::MAX_INPUT);
+        packing = compression->compressing();
+        input = packing ? compression->scratch() : frame + StreamCompression::HEADER;
+        if (input == nullptr) {
+            return RelayStatus::NO_MEMORY;
+        }
+    }
+
+    ssize_t received = ops.recv(source, input, room);
+    if (received == 0) {
+        return RelayStatus::CLOSED;
+    }
+    if (received < 0) {
+        return RelayStatus::READ_ERROR;
+    }
+    size_t plain = static_cast<size_t>(received);
+
+    size_t payload = plain;
+    if (packing) {
+        payload = compression->encode(plain, frame);
+    } else if (compression) {
+        payload = compression->store(frame, plain);
+    }
+    size_t total = channel ? channel->seal(buffer.data(), payload) : payload;
+    if (!ops.send(destination, buffer.data(), total)) {
+        return RelayStatus::SEND_ERROR;
+    }
+    moved = plain;
+    buffer.on_read(prefix + plain + suffix);
+    return RelayStatus::OK;
+}
+
+// Шаг от клиента: записи (кадры) собираются в буфере, каждая полная
+// расшифровывается на месте, распаковывается и отправляется цели.
+// Неполная остается в начале буфера до следующего шага (framing.inbound).
+template <typename SocketOps>
+RelayStatus decode_step(SocketOps& ops, int source, int destination, AdaptiveBuffer& buffer,
+                        TunnelFraming& framing, size_t& moved) {
+    moved = 0;
+    SecureChannel* channel = framing.channel;
+    StreamCompression* compression = framing.compression;
+    size_t& pending = framing.inbound;
+    if (!buffer.ensure()) {
+        return RelayStatus::NO_MEMORY;
+    }
+
+    // Заголовки записи и кадра одной длины
+    static_assert(SecureChannel::HEADER == StreamCompression::HEADER, "заголовки записи и кадра");
+    constexpr size_t HEADER = SecureChannel::HEADER;
+    auto unit_size = [channel](const char* header) {
+        return channel ? SecureChannel::record_size(header) : StreamCompression::frame_size(header);
+    };
+
+    // Буфер вмещает хотя бы ожидаемую запись целиком
+    size_t wanted = HEADER;
+    if (pending >= HEADER) {
+        wanted = unit_size(buffer.data());
+        if (wanted == 0) {
+            return RelayStatus::BAD_RECORD;
+        }
+    }
+    if (!buffer.grow(wanted, pending)) {
+        return RelayStatus::NO_MEMORY;
+    }
+
+    ssize_t received = ops.recv(source, buffer.data() + pending, buffer.size() - pending);
+    if (received == 0) {
+        return RelayStatus::CLOSED;
+    }
+    if (received < 0) {
+        return RelayStatus::READ_ERROR;
+    }
+    size_t available = pending + static_cast<size_t>(received);
+
+    size_t offset = 0;
+    while (available - offset >= HEADER) {
+        char* unit = buffer.data() + offset;
+        size_t size = unit_size(unit);
+        if (size == 0) {
+            return RelayStatus::BAD_RECORD;
+        }
+        if (available - offset < size) {
+            break;
+        }
+
+        const char* data = unit;
+        size_t length = size;
+        if (channel) {
+            if (!channel->open(unit, length)) {
+                return RelayStatus::BAD_RECORD;
+            }
+            data = unit + SecureChannel::HEADER;
+        }
+        if (compression) {
+            if (length >= StreamCompression::HEADER && StreamCompression::compressed(data) &&
+                compression->scratch() == nullptr) {
+                return RelayStatus::NO_MEMORY;
+            }
+            if (!compression->decode(data, length, data, length)) {
+                return RelayStatus::BAD_RECORD;
+            }
+        }
+        if (length > 0 && !ops.send(destination, data, length)) {
+            return RelayStatus::SEND_ERROR;
+        }
+        moved += length;
+        offset += size;
+    }
+
+    pending = available - offset;
+    if (offset > 0 && pending > 0) {
+        std::memmove(buffer.data(), buffer.data() + offset, pending);
+    }
+    buffer.on_read(static_cast<size_t>(received), pending);
+    return RelayStatus::OK;
+}
+
+#endif // RELAY_STEP_H
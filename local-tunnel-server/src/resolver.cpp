@@ -0,0 +1,253 @@
+#include "resolver.h"
+#include "logger.h"
+#include "metrics.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+Resolver::Resolver() {
+}
+
+Resolver::~Resolver() {
+    stop();
+}
+
+void Resolver::configure(const Config& config) {
+    cache_ttl_.store(std::max(0, config.get_dns_cache_ttl()));
+    negative_ttl_.store(std::max(0, config.get_dns_negative_ttl()));
+    cache_size_.store(static_cast<size_t>(std::max(1, config.get_dns_cache_size())));
+    if (!running_.load()) {
+        worker_count_ = std::max(1, config.get_dns_workers());
+    }
+}
+
+void Resolver::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    for (int i = 0; i < worker_count_; ++i) {
+        workers_.emplace_back(&Resolver::worker_loop, this);
+    }
+}
+
+void Resolver::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    queue_cv_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    workers_.clear();
+
+    // Ожидающим запросам сообщаем об отмене
+    std::unordered_map<std::string, std::vector<Waiter>> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending.swap(in_flight_);
+        queue_.clear();
+    }
+    ResolveResult cancelled;
+    cancelled.error = EAI_AGAIN;
+    for (auto& entry : pending) {
+        for (auto& waiter : entry.second) {
+            waiter.callback(cancelled);
+        }
+    }
+}
+
+bool Resolver::resolve_literal(const std::string& host, ResolveResult& result) {
+    sockaddr_storage storage{};
+    std::string literal = host;
+    if (literal.size() > 2 && literal.front() == '[' && literal.back() == ']') {
+        literal = literal.substr(1, literal.size() - 2);
+    }
+
+    auto* v4 = reinterpret_cast<sockaddr_in*>(&storage);
+    if (inet_pton(AF_INET, literal.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        result.addresses.push_back(storage);
+        result.lengths.push_back(sizeof(sockaddr_in));
+        return true;
+    }
+    auto* v6 = reinterpret_cast<sockaddr_in6*>(&storage);
+    if (inet_pton(AF_INET6, literal.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        result.addresses.push_back(storage);
+        result.lengths.push_back(sizeof(sockaddr_in6));
+        return true;
+    }
+    return false;
+}
+
+ResolveResult Resolver::with_port(const ResolveResult& result, int port) {
+    ResolveResult copy = result;
+    for (auto& address : copy.addresses) {
+        if (address.ss_family == AF_INET) {
+            reinterpret_cast<sockaddr_in*>(&address)->sin_port = htons(static_cast<uint16_t>(port));
+        } else if (address.ss_family == AF_INET6) {
+            reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = htons(static_cast<uint16_t>(port));
+        }
+    }
+    return copy;
+}
+
+ResolveResult Resolver::lookup(const std::string& host) {
+    ResolveResult result;
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    addrinfo* list = nullptr;
+    result.error = getaddrinfo(host.c_str(), nullptr, &hints, &list);
+    if (result.error != 0) {
+        return result;
+    }
+    for (addrinfo* ai = list; ai; ai = ai->ai_next) {
+        if (ai->ai_addrlen > sizeof(sockaddr_storage)) {
+            continue;
+        }
+        sockaddr_storage storage{};
+        std::memcpy(&storage, ai->ai_addr, ai->ai_addrlen);
+        result.addresses.push_back(storage);
+        result.lengths.push_back(ai->ai_addrlen);
+    }
+    freeaddrinfo(list);
+    if (result.addresses.empty()) {
+        result.error = EAI_NONAME;
+    }
+    return result;
+}
+
+Resolver::CacheShard& Resolver::shard_for(const std::string& host) {
+    return cache_[std::hash<std::string>()(host) % CACHE_SHARDS];
+}
+
+void Resolver::store(const std::string& host, const ResolveResult& result) {
+    int ttl = result.error == 0 ? cache_ttl_.load() : negative_ttl_.load();
+    if (ttl <= 0 || result.error == EAI_AGAIN) {
+        return;
+    }
+
+    CacheShard& shard = shard_for(host);
+    size_t limit = std::max<size_t>(1, cache_size_.load() / CACHE_SHARDS);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // Ограничение размера: сначала удаляются устаревшие записи, затем произвольная
+    auto now = Clock::now();
+    auto& entries = shard.entries;
+    if (entries.size() >= limit) {
+        for (auto it = entries.begin(); it != entries.end();) {
+            it = (it->second.expires <= now) ? entries.erase(it) : std::next(it);
+        }
+        if (entries.size() >= limit) {
+            entries.erase(entries.begin());
+        }
+    }
+    entries[host] = CacheEntry{result, now + std::chrono::seconds(ttl)};
+}
+
+void Resolver::resolve_async(const std::string& host, int port, Callback callback) {
+    static MetricValue& hits = Metrics::counter("dns_cache_hits_total");
+    static MetricValue& misses = Metrics::counter("dns_cache_misses_total");
+
+    ResolveResult literal;
+    if (resolve_literal(host, literal)) {
+        callback(with_port(literal, port));
+        return;
+    }
+
+    {
+        CacheShard& shard = shard_for(host);
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(host);
+        if (it != shard.entries.end() && it->second.expires > Clock::now()) {
+            ResolveResult cached = with_port(it->second.result, port);
+            lock.unlock();
+            hits.add();
+            cached.from_cache = true;
+            callback(cached);
+            return;
+        }
+    }
+    misses.add();
+
+    {
+        // Результат сохраняется в кэш до снятия запроса с выполнения, поэтому
+        // промах здесь в худшем случае приводит к повторному разрешению
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!running_.load()) {
+            lock.unlock();
+            // Пул не запущен (утилиты, бенчмарки) - разрешаем в текущем потоке
+            ResolveResult result = lookup(host);
+            callback(with_port(result, port));
+            return;
+        }
+
+        // Запрос этого имени уже выполняется - присоединяемся к нему
+        auto& waiters = in_flight_[host];
+        waiters.push_back(Waiter{port, std::move(callback)});
+        if (waiters.size() > 1) {
+            return;
+        }
+        queue_.push_back(host);
+    }
+    queue_cv_.notify_one();
+}
+
+ResolveResult Resolver::resolve(const std::string& host, int port, int timeout_ms) {
+    auto promise = std::make_shared<std::promise<ResolveResult>>();
+    std::future<ResolveResult> future = promise->get_future();
+    resolve_async(host, port, [promise](const ResolveResult& result) {
+        promise->set_value(result);
+    });
+    if (future.wait_for(std::chrono::milliseconds(timeout_ms)) != std::future_status::ready) {
+        ResolveResult timeout;
+        timeout.error = EAI_AGAIN;
+        return timeout;
+    }
+    return future.get();
+}
+
+void Resolver::worker_loop() {
+    static MetricValue& failures = Metrics::counter("dns_failures_total");
+
+    while (true) {
+        std::string host;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_cv_.wait(lock, [this] { return !running_.load() || !queue_.empty(); });
+            if (!running_.load()) {
+                return;
+            }
+            host = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        ResolveResult result = lookup(host);
+        if (result.error != 0) {
+            failures.add();
+        }
+
+        store(host, result);
+
+        std::vector<Waiter> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = in_flight_.find(host);
+            if (it != in_flight_.end()) {
+                waiters.swap(it->second);
+                in_flight_.erase(it);
+            }
+        }
+        for (auto& waiter : waiters) {
+            waiter.callback(with_port(result, waiter.port));
+        }
+    }
+}
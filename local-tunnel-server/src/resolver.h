@@ -0,0 +1,94 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sys/socket.h>
+#include "config.h"
+
+// Результат разрешения имени. Порт в адресах уже проставлен.
+struct ResolveResult {
+    int error{0};                               // 0 или код getaddrinfo (EAI_*)
+    std::vector<sockaddr_storage> addresses;
+    std::vector<socklen_t> lengths;
+    bool from_cache{false};
+
+    bool ok() const { return error == 0 && !addresses.empty(); }
+};
+
+// Асинхронный DNS резолвер с кэшем. Имена разрешаются пулом потоков
+// (getaddrinfo блокирующий), одновременные запросы одного имени
+// объединяются в один вызов getaddrinfo.
+class Resolver {
+public:
+    using Callback = std::function<void(const ResolveResult&)>;
+
+    Resolver();
+    ~Resolver();
+
+    void configure(const Config& config);
+    void start();
+    void stop();
+
+    // Обратный вызов выполняется синхронно для IP литералов и попаданий
+    // в кэш, иначе - в потоке резолвера
+    void resolve_async(const std::string& host, int port, Callback callback);
+
+    // Синхронное разрешение с ограничением времени
+    ResolveResult resolve(const std::string& host, int port, int timeout_ms);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct CacheEntry {
+        ResolveResult result;
+        Clock::time_point expires;
+    };
+
+    struct Waiter {
+        int port;
+        Callback callback;
+    };
+
+    // Кэш разбит на сегменты по хэшу имени: попадания из потоков разных
+    // процессоров не конкурируют за одну блокировку
+    static constexpr size_t CACHE_SHARDS = 16;
+
+    struct CacheShard {
+        std::mutex mutex;
+        std::unordered_map<std::string, CacheEntry> entries;
+    };
+
+    CacheShard cache_[CACHE_SHARDS];
+
+    // Очередь и выполняющиеся запросы
+    std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::unordered_map<std::string, std::vector<Waiter>> in_flight_;
+    std::deque<std::string> queue_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> running_{false};
+
+    std::atomic<int> cache_ttl_{60};
+    std::atomic<int> negative_ttl_{5};
+    std::atomic<size_t> cache_size_{4096};
+    int worker_count_{4};
+
+    void worker_loop();
+    CacheShard& shard_for(const std::string& host);
+    void store(const std::string& host, const ResolveResult& result);
+    static ResolveResult lookup(const std::string& host);
+    static ResolveResult with_port(const ResolveResult& result, int port);
+    static bool resolve_literal(const std::string& host, ResolveResult& result);
+};
+
+#endif // RESOLVER_H
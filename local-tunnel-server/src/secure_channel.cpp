@@ -0,0 +1,223 @@
+#include "secure_channel.h"
+#include "chacha20_poly1305.h"
+#include "config.h"
+#include "logger.h"
+#include "utils.h"
+#include <cstring>
+
+const char* const SecureChannel::HEADER_NAME = "X-Tunnel-Encryption";
+const char* const SecureChannel::SUITE = "x25519-chacha20-poly1305";
+
+namespace {
+
+// "suite; key=...; identity=..." - набор и значение параметра name
+bool read_parameter(const std::string& value, const std::string& name, std::string& out) {
+    std::vector<std::string> parts = Utils::split(value, ';');
+    if (parts.empty() || Utils::trim(parts[0]) != SecureChannel::SUITE) {
+        return false;
+    }
+    for (size_t i = 1; i < parts.size(); ++i) {
+        std::string part = Utils::trim(parts[i]);
+        if (part.compare(0, name.size() + 1, name + "=") == 0) {
+            out = part.substr(name.size() + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Nonce записи: 4 нулевых байта и номер записи (little-endian независимо
+// от порядка байт платформы)
+void make_nonce(uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE], uint64_t sequence) {
+    std::memset(nonce, 0, 4);
+    for (int i = 0; i < 8; ++i) {
+        nonce[4 + i] = static_cast<uint8_t>(sequence >> (8 * i));
+    }
+}
+
+}  // namespace
+
+void TunnelIdentity::configure(const Config& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    enabled_ = config.is_encryption_enabled();
+
+    std::string configured = config.get_encryption_private_key();
+    uint8_t key[Crypto::KEY_SIZE];
+    if (!configured.empty()) {
+        if (!Crypto::from_hex(configured, key, sizeof(key))) {
+            Logger::error("encryption.private_key должен содержать 64 шестнадцатеричных символа");
+            return;  // Остается прежний ключ
+        }
+        generated_ = false;
+    } else if (!have_key_ || !generated_) {
+        if (!Crypto::random_bytes(key, sizeof(key))) {
+            Logger::error("Не удалось создать ключ сервера для шифрованных туннелей");
+            return;
+        }
+        generated_ = true;
+    } else {
+        return;  // Созданный при запуске ключ сохраняется при перезагрузке
+    }
+
+    uint8_t public_key[Crypto::KEY_SIZE];
+    Crypto::x25519_base(public_key, key);
+    bool changed = !have_key_ || std::memcmp(public_key, public_key_, sizeof(public_key)) != 0;
+    std::memcpy(private_key_, key, sizeof(key));
+    std::memcpy(public_key_, public_key, sizeof(public_key));
+    have_key_ = true;
+    std::memset(key, 0, sizeof(key));
+    if (changed && enabled_) {
+        Logger::info("Ключ сервера для шифрованных туннелей: " + Crypto::to_hex(public_key_, sizeof(public_key_)) +
+                     (generated_ ? " (создан при запуске)" : ""));
+    }
+}
+
+bool TunnelIdentity::enabled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return enabled_ && have_key_;
+}
+
+bool TunnelIdentity::keys(uint8_t private_key[Crypto::KEY_SIZE], uint8_t public_key[Crypto::KEY_SIZE]) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_ || !have_key_) {
+        return false;
+    }
+    std::memcpy(private_key, private_key_, Crypto::KEY_SIZE);
+    std::memcpy(public_key, public_key_, Crypto::KEY_SIZE);
+    return true;
+}
+
+std::string SecureChannel::offer() {
+    Crypto::random_bytes(ephemeral_private_, sizeof(ephemeral_private_));
+    Crypto::x25519_base(ephemeral_public_, ephemeral_private_);
+    return std::string(SUITE) + "; key=" + Crypto::to_hex(ephemeral_public_, sizeof(ephemeral_public_));
+}
+
+bool SecureChannel::complete(const std::string& reply, const std::string& pinned_identity, std::string& identity) {
+    std::string key_hex;
+    uint8_t server_ephemeral[Crypto::KEY_SIZE];
+    uint8_t server_identity[Crypto::KEY_SIZE];
+    if (!read_parameter(reply, "key", key_hex) || !read_parameter(reply, "identity", identity) ||
+        !Crypto::from_hex(key_hex, server_ephemeral, sizeof(server_ephemeral)) ||
+        !Crypto::from_hex(identity, server_identity, sizeof(server_identity))) {
+        return false;
+    }
+    if (!pinned_identity.empty()) {
+        uint8_t pinned[Crypto::KEY_SIZE];
+        if (!Crypto::from_hex(pinned_identity, pinned, sizeof(pinned)) ||
+            std::memcmp(pinned, server_identity, sizeof(pinned)) != 0) {
+            return false;
+        }
+    }
+
+    uint8_t ephemeral_secret[Crypto::KEY_SIZE];
+    uint8_t identity_secret[Crypto::KEY_SIZE];
+    bool valid = Crypto::x25519(ephemeral_secret, ephemeral_private_, server_ephemeral) &&
+                 Crypto::x25519(identity_secret, ephemeral_private_, server_identity);
+    if (valid) {
+        derive(ephemeral_public_, server_ephemeral, server_identity, ephemeral_secret, identity_secret, false);
+    }
+    std::memset(ephemeral_private_, 0, sizeof(ephemeral_private_));
+    std::memset(ephemeral_secret, 0, sizeof(ephemeral_secret));
+    std::memset(identity_secret, 0, sizeof(identity_secret));
+    return valid;
+}
+
+bool SecureChannel::accept(const std::string& offer, const TunnelIdentity& identity, std::string& reply) {
+    std::string key_hex;
+    uint8_t client_public[Crypto::KEY_SIZE];
+    uint8_t identity_private[Crypto::KEY_SIZE];
+    uint8_t identity_public[Crypto::KEY_SIZE];
+    if (!read_parameter(offer, "key", key_hex) ||
+        !Crypto::from_hex(key_hex, client_public, sizeof(client_public)) ||
+        !identity.keys(identity_private, identity_public)) {
+        return false;
+    }
+
+    uint8_t ephemeral_secret[Crypto::KEY_SIZE];
+    uint8_t identity_secret[Crypto::KEY_SIZE];
+    bool valid = Crypto::random_bytes(ephemeral_private_, sizeof(ephemeral_private_));
+    if (valid) {
+        Crypto::x25519_base(ephemeral_public_, ephemeral_private_);
+        valid = Crypto::x25519(ephemeral_secret, ephemeral_private_, client_public) &&
+                Crypto::x25519(identity_secret, identity_private, client_public);
+    }
+    if (valid) {
+        derive(client_public, ephemeral_public_, identity_public, ephemeral_secret, identity_secret, true);
+        reply = std::string(SUITE) + "; key=" + Crypto::to_hex(ephemeral_public_, sizeof(ephemeral_public_)) +
+                "; identity=" + Crypto::to_hex(identity_public, sizeof(identity_public));
+    }
+    std::memset(ephemeral_private_, 0, sizeof(ephemeral_private_));
+    std::memset(identity_private, 0, sizeof(identity_private));
+    std::memset(ephemeral_secret, 0, sizeof(ephemeral_secret));
+    std::memset(identity_secret, 0, sizeof(identity_secret));
+    return valid;
+}
+
+void SecureChannel::derive(const uint8_t client_public[Crypto::KEY_SIZE],
+                           const uint8_t server_ephemeral[Crypto::KEY_SIZE],
+                           const uint8_t server_identity[Crypto::KEY_SIZE],
+                           const uint8_t ephemeral_secret[Crypto::KEY_SIZE],
+                           const uint8_t identity_secret[Crypto::KEY_SIZE], bool server) {
+    // HKDF-SHA256: соль - хэш открытых ключей, ключи направлений - по метке
+    static const char LABEL[] = "cvpn tunnel v1";
+    uint8_t transcript[sizeof(LABEL) - 1 + 3 * Crypto::KEY_SIZE];
+    std::memcpy(transcript, LABEL, sizeof(LABEL) - 1);
+    std::memcpy(transcript + sizeof(LABEL) - 1, client_public, Crypto::KEY_SIZE);
+    std::memcpy(transcript + sizeof(LABEL) - 1 + Crypto::KEY_SIZE, server_ephemeral, Crypto::KEY_SIZE);
+    std::memcpy(transcript + sizeof(LABEL) - 1 + 2 * Crypto::KEY_SIZE, server_identity, Crypto::KEY_SIZE);
+    uint8_t salt[Crypto::HASH_SIZE];
+    Crypto::sha256(transcript, sizeof(transcript), salt);
+
+    uint8_t secrets[2 * Crypto::KEY_SIZE];
+    std::memcpy(secrets, ephemeral_secret, Crypto::KEY_SIZE);
+    std::memcpy(secrets + Crypto::KEY_SIZE, identity_secret, Crypto::KEY_SIZE);
+    uint8_t master[Crypto::HASH_SIZE];
+    Crypto::hmac_sha256(salt, sizeof(salt), secrets, sizeof(secrets), master);
+
+    static const uint8_t TO_SERVER[] = "client to server\x01";
+    static const uint8_t TO_CLIENT[] = "server to client\x01";
+    Crypto::hmac_sha256(master, sizeof(master), TO_SERVER, sizeof(TO_SERVER) - 1,
+                        server ? receive_key_ : send_key_);
+    Crypto::hmac_sha256(master, sizeof(master), TO_CLIENT, sizeof(TO_CLIENT) - 1,
+                        server ? send_key_ : receive_key_);
+    std::memset(secrets, 0, sizeof(secrets));
+    std::memset(master, 0, sizeof(master));
+}
+
+size_t SecureChannel::seal(char* record, size_t payload) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(record);
+    bytes[0] = static_cast<uint8_t>(payload >> 24);
+    bytes[1] = static_cast<uint8_t>(payload >> 16);
+    bytes[2] = static_cast<uint8_t>(payload >> 8);
+    bytes[3] = static_cast<uint8_t>(payload);
+
+    uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE];
+    make_nonce(nonce, send_sequence_++);
+    ChaCha20Poly1305::seal(send_key_, nonce, bytes, HEADER, bytes + HEADER, payload, bytes + HEADER + payload);
+    return payload + OVERHEAD;
+}
+
+size_t SecureChannel::record_size(const char* header) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(header);
+    size_t payload = static_cast<size_t>(bytes[0]) << 24 | static_cast<size_t>(bytes[1]) << 16 |
+                     static_cast<size_t>(bytes[2]) << 8 | bytes[3];
+    return payload > MAX_PAYLOAD ? 0 : payload + OVERHEAD;
+}
+
+bool SecureChannel::open(char* record, size_t& payload) {
+    size_t size = record_size(record);
+    if (size == 0) {
+        return false;
+    }
+    payload = size - OVERHEAD;
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(record);
+    uint8_t nonce[ChaCha20Poly1305::NONCE_SIZE];
+    make_nonce(nonce, receive_sequence_);
+    if (!ChaCha20Poly1305::open(receive_key_, nonce, bytes, HEADER, bytes + HEADER, payload,
+                                bytes + HEADER + payload)) {
+        return false;
+    }
+    ++receive_sequence_;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef SECURE_CHANNEL_H
+#define SECURE_CHANNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "crypto.h"
+
+class Config;
+
+// Ключ сервера для шифрованных туннелей. Если закрытый ключ не задан в
+// конфигурации, он создается при запуске и сохраняется до перезапуска;
+// открытый ключ пишется в журнал, чтобы клиенты могли его закрепить.
+class TunnelIdentity {
+public:
+    void configure(const Config& config);
+
+    bool enabled() const;
+    // false - шифрование выключено или ключа нет
+    bool keys(uint8_t private_key[Crypto::KEY_SIZE], uint8_t public_key[Crypto::KEY_SIZE]) const;
+
+private:
+    mutable std::mutex mutex_;
+    bool enabled_{false};
+    bool have_key_{false};
+    bool generated_{false};
+    uint8_t private_key_[Crypto::KEY_SIZE] = {};
+    uint8_t public_key_[Crypto::KEY_SIZE] = {};
+};
+
+// Шифрованный канал клиент - сервер поверх CONNECT.
+//
+// Согласование: клиент добавляет к CONNECT заголовок
+//   X-Tunnel-Encryption: x25519-chacha20-poly1305; key=<одноразовый ключ>
+// сервер отвечает в 200 тем же заголовком с одноразовым ключом сервера и
+// постоянным ключом identity. Ключи направлений выводятся HMAC-SHA256 из
+// двух общих секретов X25519 (одноразовый - одноразовый и одноразовый
+// клиента - постоянный сервера) и всех трех открытых ключей.
+//
+// Записи: 4 байта длины открытого текста (big-endian), шифртекст той же
+// длины и 16 байт тега. Nonce - номер записи в направлении, заголовок
+// записи входит в проверяемые данные. Шифрование и расшифровка - на месте.
+class SecureChannel {
+public:
+    static constexpr size_t HEADER = 4;
+    static constexpr size_t TAG = 16;
+    static constexpr size_t OVERHEAD = HEADER + TAG;
+    static constexpr size_t MAX_RECORD = 64 * 1024;
+    static constexpr size_t MAX_PAYLOAD = MAX_RECORD - OVERHEAD;
+
+    static const char* const HEADER_NAME;
+    static const char* const SUITE;
+
+    // Клиент: значение заголовка для CONNECT
+    std::string offer();
+    // Клиент: разбор ответа сервера. identity - открытый ключ сервера (hex);
+    // если pinned_identity не пуст, ключ сервера должен с ним совпасть
+    bool complete(const std::string& reply, const std::string& pinned_identity, std::string& identity);
+
+    // Сервер: разбор предложения клиента и значение заголовка ответа
+    bool accept(const std::string& offer, const TunnelIdentity& identity, std::string& reply);
+
+    // Запись из payload байт, уже лежащих в record + HEADER. Возвращает
+    // полный размер записи (payload + OVERHEAD)
+    size_t seal(char* record, size_t payload);
+    // Полный размер записи по заголовку; 0 - длина больше MAX_PAYLOAD
+    static size_t record_size(const char* header);
+    // Проверка и расшифровка полной записи; открытый текст - в record + HEADER
+    bool open(char* record, size_t& payload);
+
+private:
+    uint8_t ephemeral_private_[Crypto::KEY_SIZE] = {};
+    uint8_t ephemeral_public_[Crypto::KEY_SIZE] = {};
+    uint8_t send_key_[Crypto::KEY_SIZE] = {};
+    uint8_t receive_key_[Crypto::KEY_SIZE] = {};
+    uint64_t send_sequence_{0};
+    uint64_t receive_sequence_{0};
+
+    void derive(const uint8_t client_public[Crypto::KEY_SIZE], const uint8_t server_ephemeral[Crypto::KEY_SIZE],
+                const uint8_t server_identity[Crypto::KEY_SIZE], const uint8_t ephemeral_secret[Crypto::KEY_SIZE],
+                const uint8_t identity_secret[Crypto::KEY_SIZE], bool server);
+};
+
+#endif // SECURE_CHANNEL_H
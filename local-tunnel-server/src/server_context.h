@@ -0,0 +1,41 @@
+#ifndef SERVER_CONTEXT_H
+#define SERVER_CONTEXT_H
+
+#include "config.h"
+#include "access_policy.h"
+#include "upstream.h"
+#include "circuit_breaker.h"
+#include "resolver.h"
+#include "memory_budget.h"
+#include "idle_parker.h"
+#include "access_log.h"
+#include "udp_relay.h"
+#include "http_cache.h"
+#include "traffic_capture.h"
+#include "secure_channel.h"
+#include "session_store.h"
+#include "pcap_tap.h"
+#include "http_filter.h"
+#include "credential_store.h"
+
+// Общие подсистемы сервера, которые VPNServer передает обработчикам соединений
+struct ServerContext {
+    SharedConfig& config;
+    AccessPolicy& policy;
+    UpstreamManager& upstreams;
+    CircuitBreakerRegistry& breakers;
+    Resolver& resolver;
+    MemoryBudget& memory;
+    IdleParker& parker;
+    AccessLog& access_log;
+    UdpRelay& udp_relay;
+    HttpCache& cache;
+    TrafficCapture& capture;
+    TunnelIdentity& identity;
+    SessionStore& sessions;
+    PcapTap& tap;
+    HttpFilters& filters;
+    CredentialStore& credentials;
+};
+
+#endif // SERVER_CONTEXT_H
@@ -0,0 +1,173 @@
+#include "session_store.h"
+#include "config.h"
+#include "crypto.h"
+#include "logger.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+const char* const SessionStore::HEADER_NAME = "X-Tunnel-Session";
+
+ReplayBuffer::ReplayBuffer(size_t capacity) : data_(new char[capacity]), capacity_(capacity) {
+}
+
+void ReplayBuffer::append(const char* data, size_t size) {
+    // Из куска длиннее буфера нужен только хвост
+    if (size > capacity_) {
+        end_ += size - capacity_;
+        data += size - capacity_;
+        size = capacity_;
+    }
+    size_t position = static_cast<size_t>(end_ % capacity_);
+    size_t first = std::min(size, capacity_ - position);
+    std::memcpy(data_.get() + position, data, first);
+    std::memcpy(data_.get(), data + first, size - first);
+    end_ += size;
+}
+
+std::string ReplayBuffer::read_from(uint64_t offset) const {
+    if (offset < begin() || offset > end_) {
+        return std::string();
+    }
+    size_t size = static_cast<size_t>(end_ - offset);
+    size_t position = static_cast<size_t>(offset % capacity_);
+    size_t first = std::min(size, capacity_ - position);
+    std::string bytes(data_.get() + position, first);
+    bytes.append(data_.get(), size - first);
+    return bytes;
+}
+
+SessionStore::SessionStore(MemoryBudget& memory) : memory_(memory) {
+    Metrics::register_provider("sessions", [this](std::ostream& out) {
+        render_metrics(out);
+    });
+}
+
+SessionStore::~SessionStore() {
+    stop();
+    Metrics::unregister_provider("sessions");
+}
+
+void SessionStore::configure(const Config& config) {
+    // Новые значения действуют на сессии, отсоединенные после перезагрузки
+    enabled_.store(config.is_sessions_enabled());
+    grace_seconds_.store(std::max(1, config.get_session_grace_seconds()));
+    replay_size_.store(static_cast<size_t>(std::max(1, config.get_session_replay_kb())) << 10);
+    max_sessions_.store(static_cast<size_t>(std::max(0, config.get_max_sessions())));
+}
+
+bool SessionStore::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return true;
+    }
+    running_ = true;
+    thread_ = std::make_unique<std::thread>(&SessionStore::loop, this);
+    return true;
+}
+
+void SessionStore::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    changed_.notify_all();
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+
+    // При остановке сервера отсоединенные цели закрываются сразу
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : sessions_) {
+        close(*entry.second);
+    }
+    sessions_.clear();
+}
+
+std::string SessionStore::new_token() {
+    uint8_t bytes[16];
+    if (!Crypto::random_bytes(bytes, sizeof(bytes))) {
+        return std::string();
+    }
+    return Crypto::to_hex(bytes, sizeof(bytes));
+}
+
+bool SessionStore::detach(std::unique_ptr<ResumableSession>& session) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || sessions_.size() >= max_sessions_.load()) {
+            return false;
+        }
+        // Буфер повтора уже выделен - учитывается без проверки лимита
+        memory_.charge(session->replay.capacity());
+        session->expires = std::chrono::steady_clock::now() + std::chrono::seconds(grace_seconds_.load());
+        std::string token = session->token;
+        sessions_[token] = std::move(session);
+    }
+    detached_total_.fetch_add(1, std::memory_order_relaxed);
+    changed_.notify_all();
+    return true;
+}
+
+std::unique_ptr<ResumableSession> SessionStore::claim(const std::string& token, const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(token);
+    if (it == sessions_.end() || it->second->target_host != host || it->second->target_port != port) {
+        return nullptr;
+    }
+    std::unique_ptr<ResumableSession> session = std::move(it->second);
+    sessions_.erase(it);
+    memory_.release(session->replay.capacity());
+    resumed_total_.fetch_add(1, std::memory_order_relaxed);
+    return session;
+}
+
+size_t SessionStore::detached() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.size();
+}
+
+void SessionStore::close(ResumableSession& session) {
+    if (session.target_socket >= 0) {
+        ::close(session.target_socket);
+        session.target_socket = -1;
+    }
+    memory_.release(session.replay.capacity());
+}
+
+void SessionStore::loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_) {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + std::chrono::seconds(grace_seconds_.load());
+        std::vector<std::string> expired;
+        for (auto& entry : sessions_) {
+            if (entry.second->expires <= now) {
+                expired.push_back(entry.first);
+            } else {
+                next = std::min(next, entry.second->expires);
+            }
+        }
+        for (const std::string& token : expired) {
+            auto it = sessions_.find(token);
+            static LogSite& site = Logger::site("sessions.expired");
+            Logger::info(site, "Сессия с " + it->second->target_host + ":" +
+                               std::to_string(it->second->target_port) + " не возобновлена, цель закрыта");
+            close(*it->second);
+            sessions_.erase(it);
+            expired_total_.fetch_add(1, std::memory_order_relaxed);
+        }
+        changed_.wait_until(lock, next);
+    }
+}
+
+void SessionStore::render_metrics(std::ostream& out) {
+    out << "sessions_detached " << detached() << "\n"
+        << "sessions_detached_total " << detached_total_.load() << "\n"
+        << "sessions_resumed_total " << resumed_total_.load() << "\n"
+        << "sessions_expired_total " << expired_total_.load() << "\n";
+}
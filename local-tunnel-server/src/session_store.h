@@ -0,0 +1,131 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "relay_step.h"
+
+class Config;
+class MemoryBudget;
+
+// Последние байты, отправленные клиенту, с их смещениями в потоке сессии
+class ReplayBuffer {
+public:
+    explicit ReplayBuffer(size_t capacity);
+
+    size_t capacity() const { return capacity_; }
+    // Смещение следующего байта потока и самого старого сохраненного
+    uint64_t end() const { return end_; }
+    uint64_t begin() const { return end_ > capacity_ ? end_ - capacity_ : 0; }
+
+    void append(const char* data, size_t size);
+    // Байты с offset (begin() <= offset <= end()) до конца потока
+    std::string read_from(uint64_t offset) const;
+
+private:
+    std::unique_ptr<char[]> data_;
+    size_t capacity_;
+    uint64_t end_{0};
+};
+
+// Сессия CONNECT туннеля, которая может пережить разрыв соединения с клиентом
+struct ResumableSession {
+    std::string token;
+    std::string target_host;
+    int target_port{0};
+    int target_socket{-1};      // Владеет хранилище, пока сессия отсоединена
+    uint64_t received{0};       // Байты клиента, переданные цели
+    ReplayBuffer replay;
+    std::chrono::steady_clock::time_point expires{};
+
+    ResumableSession(std::string session_token, const std::string& host, int port, size_t replay_size)
+        : token(std::move(session_token)), target_host(host), target_port(port), replay(replay_size) {}
+};
+
+// Шаг пересылки к клиенту сохраняет отправляемое в буфере повтора до
+// отправки: байты, которые клиент мог не получить, остаются в буфере. Не
+// дошедшими могут оказаться прочитанная порция (не больше четверти буфера
+// повтора), буфер отправки сокета (половина) и буфер приема клиента. Его
+// сервер ограничить не может: если там застряло больше оставшейся четверти,
+// начало недоставленного вытеснено и возобновление получает 410
+struct ReplaySocketOps {
+    ReplayBuffer& replay;
+
+    ssize_t recv(int socket, char* data, size_t size) {
+        return ::recv(socket, data, std::min(size, replay.capacity() / 4), 0);
+    }
+
+    bool send(int socket, const char* data, size_t size) {
+        replay.append(data, size);
+        return ::send(socket, data, size, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+    }
+};
+
+// Отсоединенные сессии. Когда клиент CONNECT туннеля с сессией пропадает,
+// обработчик передает сюда сокет цели и буфер повтора; цель не читается,
+// поэтому ее данные сдерживает окно TCP. Переподключившийся клиент забирает
+// сессию по токену, по истечении grace_seconds сокет цели закрывается.
+// Память буферов повтора отсоединенных сессий учитывается в общем бюджете.
+class SessionStore {
+public:
+    static const char* const HEADER_NAME;
+
+    explicit SessionStore(MemoryBudget& memory);
+    ~SessionStore();
+
+    void configure(const Config& config);
+    bool start();
+    void stop();
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    size_t replay_size() const { return replay_size_.load(std::memory_order_relaxed); }
+
+    // Случайный токен новой сессии (32 шестнадцатеричных символа)
+    static std::string new_token();
+
+    // Хранение сессии после разрыва; false - хранилище заполнено или
+    // остановлено, session остается у вызывающего
+    bool detach(std::unique_ptr<ResumableSession>& session);
+
+    // Сессия с токеном и той же целью; nullptr - нет или истекла
+    std::unique_ptr<ResumableSession> claim(const std::string& token, const std::string& host, int port);
+
+    size_t detached() const;
+
+    void render_metrics(std::ostream& out);
+
+private:
+    MemoryBudget& memory_;
+    std::atomic<bool> enabled_{true};
+    std::atomic<int> grace_seconds_{30};
+    std::atomic<size_t> replay_size_{256u << 10};
+    std::atomic<size_t> max_sessions_{1024};
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::unordered_map<std::string, std::unique_ptr<ResumableSession>> sessions_;
+    bool running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    std::atomic<uint64_t> detached_total_{0};
+    std::atomic<uint64_t> resumed_total_{0};
+    std::atomic<uint64_t> expired_total_{0};
+
+    void loop();
+    void close(ResumableSession& session);
+
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+};
+
+#endif // SESSION_STORE_H
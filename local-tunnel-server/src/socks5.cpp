@@ -0,0 +1,196 @@
+#include "socks5.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+namespace Socks5 {
+
+ssize_t parse_greeting(const uint8_t* data, size_t size, std::vector<uint8_t>& methods) {
+    if (size < 2) {
+        return 0;
+    }
+    if (data[0] != VERSION || data[1] == 0) {
+        return -1;
+    }
+    size_t length = 2 + static_cast<size_t>(data[1]);
+    if (size < length) {
+        return 0;
+    }
+    methods.assign(data + 2, data + length);
+    return static_cast<ssize_t>(length);
+}
+
+ssize_t parse_credentials(const uint8_t* data, size_t size, std::string& username, std::string& password) {
+    if (size < 2) {
+        return 0;
+    }
+    if (data[0] != AUTH_VERSION) {
+        return -1;
+    }
+    size_t username_length = data[1];
+    if (size < 2 + username_length + 1) {
+        return 0;
+    }
+    size_t password_length = data[2 + username_length];
+    size_t length = 3 + username_length + password_length;
+    if (size < length) {
+        return 0;
+    }
+    username.assign(reinterpret_cast<const char*>(data + 2), username_length);
+    password.assign(reinterpret_cast<const char*>(data + 3 + username_length), password_length);
+    return static_cast<ssize_t>(length);
+}
+
+ssize_t parse_address(const uint8_t* data, size_t size, std::string& host, int& port) {
+    if (size < 1) {
+        return 0;
+    }
+
+    size_t address_length;
+    switch (data[0]) {
+        case IPV4:
+            address_length = 4;
+            break;
+        case IPV6:
+            address_length = 16;
+            break;
+        case DOMAIN:
+            if (size < 2) {
+                return 0;
+            }
+            if (data[1] == 0) {
+                return -1;
+            }
+            address_length = 1 + static_cast<size_t>(data[1]);
+            break;
+        default:
+            return -1;
+    }
+
+    size_t length = 1 + address_length + 2;
+    if (size < length) {
+        return 0;
+    }
+
+    char buffer[INET6_ADDRSTRLEN] = {0};
+    if (data[0] == IPV4) {
+        inet_ntop(AF_INET, data + 1, buffer, sizeof(buffer));
+        host = buffer;
+    } else if (data[0] == IPV6) {
+        inet_ntop(AF_INET6, data + 1, buffer, sizeof(buffer));
+        host = buffer;
+    } else {
+        host.assign(reinterpret_cast<const char*>(data + 2), data[1]);
+        // Имя уходит в резолвер и в журналы - нулевые байты недопустимы
+        if (host.find('\0') != std::string::npos) {
+            return -1;
+        }
+    }
+    port = (static_cast<int>(data[1 + address_length]) << 8) | data[2 + address_length];
+    return static_cast<ssize_t>(length);
+}
+
+ssize_t parse_request(const uint8_t* data, size_t size, uint8_t& command, std::string& host, int& port) {
+    if (size < 3) {
+        return 0;
+    }
+    if (data[0] != VERSION || data[2] != 0) {
+        return -1;
+    }
+    ssize_t address = parse_address(data + 3, size - 3, host, port);
+    if (address <= 0) {
+        return address;
+    }
+    command = data[1];
+    return 3 + address;
+}
+
+ssize_t parse_udp_header(const uint8_t* data, size_t size, uint8_t& fragment,
+                         sockaddr_storage& address, socklen_t& length,
+                         std::string& host, int& port) {
+    if (size < 4 || data[0] != 0 || data[1] != 0) {
+        return -1;
+    }
+    fragment = data[2];
+
+    // Адрес цели разбирается на каждую датаграмму - без inet_ntop
+    if (data[3] == IPV4) {
+        if (size < 10) {
+            return -1;
+        }
+        sockaddr_in* ipv4 = reinterpret_cast<sockaddr_in*>(&address);
+        std::memset(ipv4, 0, sizeof(*ipv4));
+        ipv4->sin_family = AF_INET;
+        std::memcpy(&ipv4->sin_addr, data + 4, 4);
+        std::memcpy(&ipv4->sin_port, data + 8, 2);
+        length = sizeof(sockaddr_in);
+        return 10;
+    }
+    if (data[3] == IPV6) {
+        if (size < 22) {
+            return -1;
+        }
+        sockaddr_in6* ipv6 = reinterpret_cast<sockaddr_in6*>(&address);
+        std::memset(ipv6, 0, sizeof(*ipv6));
+        ipv6->sin6_family = AF_INET6;
+        std::memcpy(&ipv6->sin6_addr, data + 4, 16);
+        std::memcpy(&ipv6->sin6_port, data + 20, 2);
+        length = sizeof(sockaddr_in6);
+        return 22;
+    }
+
+    // Датаграмма приходит целиком: нехватка данных - тоже ошибка
+    ssize_t parsed = parse_address(data + 3, size - 3, host, port);
+    if (parsed <= 0) {
+        return -1;
+    }
+    length = 0;
+    return 3 + parsed;
+}
+
+size_t write_udp_header(uint8_t* out, const sockaddr* source) {
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = 0;
+    if (source->sa_family == AF_INET6) {
+        const sockaddr_in6* ipv6 = reinterpret_cast<const sockaddr_in6*>(source);
+        out[3] = IPV6;
+        std::memcpy(out + 4, &ipv6->sin6_addr, 16);
+        std::memcpy(out + 20, &ipv6->sin6_port, 2);
+        return 22;
+    }
+    const sockaddr_in* ipv4 = reinterpret_cast<const sockaddr_in*>(source);
+    out[3] = IPV4;
+    std::memcpy(out + 4, &ipv4->sin_addr, 4);
+    std::memcpy(out + 8, &ipv4->sin_port, 2);
+    return 10;
+}
+
+std::string encode_address(const sockaddr* address) {
+    std::string out;
+    if (address && address->sa_family == AF_INET6) {
+        const sockaddr_in6* ipv6 = reinterpret_cast<const sockaddr_in6*>(address);
+        out += static_cast<char>(IPV6);
+        out.append(reinterpret_cast<const char*>(&ipv6->sin6_addr), 16);
+        out.append(reinterpret_cast<const char*>(&ipv6->sin6_port), 2);
+    } else if (address && address->sa_family == AF_INET) {
+        const sockaddr_in* ipv4 = reinterpret_cast<const sockaddr_in*>(address);
+        out += static_cast<char>(IPV4);
+        out.append(reinterpret_cast<const char*>(&ipv4->sin_addr), 4);
+        out.append(reinterpret_cast<const char*>(&ipv4->sin_port), 2);
+    } else {
+        out.assign("\x01\0\0\0\0\0\0", 7);
+    }
+    return out;
+}
+
+std::string make_reply(uint8_t reply, const sockaddr* bound) {
+    std::string out;
+    out += static_cast<char>(VERSION);
+    out += static_cast<char>(reply);
+    out += '\0';
+    out += encode_address(bound);
+    return out;
+}
+
+}  // namespace Socks5
@@ -0,0 +1,82 @@
+#ifndef SOCKS5_H
+#define SOCKS5_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+// Разбор и формирование сообщений SOCKS5 (RFC 1928) и аутентификации по
+// имени и паролю (RFC 1929). Функции разбора работают с уже принятыми
+// байтами и возвращают длину разобранного сообщения, 0 - если данных
+// пока не хватает, -1 - если сообщение некорректно. Это позволяет разбирать
+// приветствие, аутентификацию, запрос и ранние данные, пришедшие одним пакетом.
+namespace Socks5 {
+    constexpr uint8_t VERSION = 0x05;
+    constexpr uint8_t AUTH_VERSION = 0x01;
+
+    enum Method : uint8_t {
+        NO_AUTH = 0x00,
+        USERNAME_PASSWORD = 0x02,
+        NO_ACCEPTABLE = 0xFF
+    };
+
+    enum Command : uint8_t {
+        CONNECT = 0x01,
+        BIND = 0x02,
+        UDP_ASSOCIATE = 0x03
+    };
+
+    enum AddressType : uint8_t {
+        IPV4 = 0x01,
+        DOMAIN = 0x03,
+        IPV6 = 0x04
+    };
+
+    enum Reply : uint8_t {
+        SUCCEEDED = 0x00,
+        GENERAL_FAILURE = 0x01,
+        NOT_ALLOWED = 0x02,
+        NETWORK_UNREACHABLE = 0x03,
+        HOST_UNREACHABLE = 0x04,
+        CONNECTION_REFUSED = 0x05,
+        TTL_EXPIRED = 0x06,
+        COMMAND_NOT_SUPPORTED = 0x07,
+        ADDRESS_NOT_SUPPORTED = 0x08
+    };
+
+    // VER NMETHODS METHODS...
+    ssize_t parse_greeting(const uint8_t* data, size_t size, std::vector<uint8_t>& methods);
+
+    // VER ULEN UNAME PLEN PASSWD
+    ssize_t parse_credentials(const uint8_t* data, size_t size, std::string& username, std::string& password);
+
+    // ATYP ADDR PORT (общая часть запроса и заголовка UDP датаграммы)
+    ssize_t parse_address(const uint8_t* data, size_t size, std::string& host, int& port);
+
+    // VER CMD RSV ATYP ADDR PORT
+    ssize_t parse_request(const uint8_t* data, size_t size, uint8_t& command, std::string& host, int& port);
+
+    // RSV FRAG ATYP ADDR PORT заголовка UDP датаграммы. IPv4 и IPv6 адрес
+    // заполняется в address без перевода в текст (length > 0), для доменного
+    // имени - host и port (length = 0). Возвращает длину заголовка или -1
+    ssize_t parse_udp_header(const uint8_t* data, size_t size, uint8_t& fragment,
+                             sockaddr_storage& address, socklen_t& length,
+                             std::string& host, int& port);
+
+    // ATYP ADDR PORT для адреса сокета (nullptr - 0.0.0.0:0)
+    std::string encode_address(const sockaddr* address);
+
+    // Наибольший заголовок UDP датаграммы SOCKS5 (адрес IPv6)
+    constexpr size_t MAX_UDP_HEADER = 22;
+
+    // RSV FRAG ATYP ADDR PORT для ответа цели, пересылаемого клиенту.
+    // Возвращает длину заголовка (буфер не меньше MAX_UDP_HEADER байт)
+    size_t write_udp_header(uint8_t* out, const sockaddr* source);
+
+    // VER REP RSV ATYP BND.ADDR BND.PORT
+    std::string make_reply(uint8_t reply, const sockaddr* bound);
+}
+
+#endif // SOCKS5_H
@@ -0,0 +1,91 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// Очередь без блокировок для одного писателя и одного читателя.
+// Индексы писателя и читателя разнесены по разным строкам кэша, чтобы
+// ядра не делили строку при каждой операции.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+
+public:
+    // Только поток-писатель. false - очередь заполнена.
+    bool push(const T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ == Capacity) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ == Capacity) {
+                return false;
+            }
+        }
+        slots_[head & (Capacity - 1)] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Только поток-читатель. false - очередь пуста.
+    bool pop(T& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cached_head_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail == cached_head_) {
+                return false;
+            }
+        }
+        value = slots_[tail & (Capacity - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Только поток-писатель: слот для заполнения на месте (больших
+    // элементов, которые дорого копировать) и его публикация. nullptr -
+    // очередь заполнена.
+    T* claim() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ == Capacity) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head - cached_tail_ == Capacity) {
+                return nullptr;
+            }
+        }
+        return &slots_[head & (Capacity - 1)];
+    }
+
+    void publish() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Только поток-читатель: первый элемент без копирования и его
+    // освобождение. nullptr - очередь пуста.
+    T* front() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == cached_head_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail == cached_head_) {
+                return nullptr;
+            }
+        }
+        return &slots_[tail & (Capacity - 1)];
+    }
+
+    void release() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};   // Пишет только писатель
+    size_t cached_tail_{0};                     // Копия tail_ у писателя
+    alignas(64) std::atomic<size_t> tail_{0};   // Пишет только читатель
+    size_t cached_head_{0};                     // Копия head_ у читателя
+    alignas(64) T slots_[Capacity];
+};
+
+#endif // SPSC_QUEUE_H
@@ -0,0 +1,116 @@
+#include "stats_segment.h"
+#include "logger.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <cerrno>
+#include <cstring>
+
+StatsSegment::~StatsSegment() {
+    close();
+}
+
+bool StatsSegment::open(const std::string& path) {
+    close();
+
+    // Каталог вроде /dev/shm доступен на запись всем: файл прежнего запуска
+    // удаляется, а новый создается только заново (O_EXCL) и не по
+    // символической ссылке. Чужой файл в каталоге с sticky битом не
+    // удаляется, и открытие завершается ошибкой. Таблица туннелей содержит
+    // адреса клиентов и целей, поэтому сегмент доступен только владельцу
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        Logger::error("Не удалось удалить прежний сегмент статистики " + path + ": " + std::string(strerror(errno)));
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        Logger::error("Не удалось открыть сегмент статистики " + path + ": " + std::string(strerror(errno)));
+        return false;
+    }
+    if (ftruncate(fd, sizeof(StatsSegmentLayout)) < 0) {
+        Logger::error("Не удалось задать размер сегмента статистики: " + std::string(strerror(errno)));
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, sizeof(StatsSegmentLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        Logger::error("Не удалось отобразить сегмент статистики: " + std::string(strerror(errno)));
+        ::close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    path_ = path;
+    segment_ = static_cast<StatsSegmentLayout*>(mapped);
+    segment_->header.version = StatsLayout::VERSION;
+    segment_->header.data_size = sizeof(StatsData);
+    segment_->header.pid = static_cast<uint64_t>(getpid());
+    segment_->header.sequence.store(0, std::memory_order_relaxed);
+    // Сигнатура последней: читатель не примет наполовину заполненный заголовок
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(segment_->header.magic, StatsLayout::MAGIC, sizeof(StatsLayout::MAGIC));
+    return true;
+}
+
+void StatsSegment::close() {
+    if (segment_) {
+        munmap(segment_, sizeof(StatsSegmentLayout));
+        segment_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        // Удаляется только собственный файл, а не подмененный по тому же пути
+        struct stat own{};
+        struct stat current{};
+        if (fstat(fd_, &own) == 0 && lstat(path_.c_str(), &current) == 0 &&
+            own.st_dev == current.st_dev && own.st_ino == current.st_ino) {
+            unlink(path_.c_str());
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+    path_.clear();
+}
+
+void StatsSegment::publish(const StatsData& data) {
+    if (!segment_) {
+        return;
+    }
+
+    // Таблица туннелей копируется только до заполненной строки
+    size_t size = offsetof(StatsData, tunnels) +
+                  static_cast<size_t>(data.tunnel_count) * sizeof(StatsTunnel);
+
+    std::atomic<uint64_t>& sequence = segment_->header.sequence;
+    uint64_t current = sequence.load(std::memory_order_relaxed);
+    sequence.store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&segment_->data, &data, size);
+    sequence.store(current + 2, std::memory_order_release);
+}
+
+bool StatsSegment::read(const StatsSegmentLayout* segment, StatsData& out) {
+    if (std::memcmp(segment->header.magic, StatsLayout::MAGIC, sizeof(StatsLayout::MAGIC)) != 0 ||
+        segment->header.version != StatsLayout::VERSION ||
+        segment->header.data_size != sizeof(StatsData)) {
+        return false;
+    }
+
+    // Снимок публикуется раз в интервал и копируется за микросекунды,
+    // поэтому повтор почти никогда не нужен
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        uint64_t before = segment->header.sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        std::memcpy(&out, &segment->data, sizeof(StatsData));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = segment->header.sequence.load(std::memory_order_relaxed);
+        if (before == after) {
+            return true;
+        }
+    }
+    return false;
+}
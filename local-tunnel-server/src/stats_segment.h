@@ -0,0 +1,114 @@
+#ifndef STATS_SEGMENT_H
+#define STATS_SEGMENT_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Раскладка сегмента статистики в разделяемой памяти. Общая для сервера
+// (писатель) и cvpnctl (читатель), поэтому только POD структуры фиксированного
+// размера; при несовместимом изменении увеличивается VERSION.
+namespace StatsLayout {
+    constexpr char MAGIC[8] = {'C', 'V', 'P', 'N', 'S', 'T', 'S', '1'};
+    constexpr uint32_t VERSION = 1;
+
+    constexpr size_t MAX_COUNTERS = 128;
+    constexpr size_t MAX_WORKERS = 256;
+    constexpr size_t MAX_TUNNELS = 1024;
+    constexpr size_t NAME_SIZE = 48;
+    constexpr size_t IP_SIZE = 48;
+    constexpr size_t HOST_SIZE = 64;
+}
+
+struct StatsCounter {
+    char name[StatsLayout::NAME_SIZE];
+    int64_t value;
+};
+
+struct StatsWorker {
+    int32_t index;
+    int32_t cpu;
+    int32_t node;
+    int32_t active;
+    uint64_t accepted;
+};
+
+// Установленный туннель
+struct StatsTunnel {
+    uint64_t id;
+    uint64_t age_ms;
+    uint64_t bytes_from_client;
+    uint64_t bytes_from_target;
+    uint32_t handshake_us;  // Разрешение имени + подключение к цели
+    uint16_t client_port;
+    uint16_t target_port;
+    uint8_t protocol;       // AccessProtocol
+    uint8_t parked;
+    uint16_t worker;
+    char client_ip[StatsLayout::IP_SIZE];
+    char target_host[StatsLayout::HOST_SIZE];
+};
+
+// Данные одного снимка (копируются целиком под seqlock)
+struct StatsData {
+    uint64_t started_unix_ms;
+    uint64_t published_unix_ms;
+    uint32_t counter_count;
+    uint32_t worker_count;
+    uint32_t tunnel_count;
+    uint32_t tunnels_total;  // Всего установленных туннелей (в таблице - не больше MAX_TUNNELS)
+    StatsCounter counters[StatsLayout::MAX_COUNTERS];
+    StatsWorker workers[StatsLayout::MAX_WORKERS];
+    StatsTunnel tunnels[StatsLayout::MAX_TUNNELS];
+};
+
+struct StatsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t data_size;
+    uint64_t pid;
+    // Нечетное значение - идет запись; читатель повторяет чтение, если
+    // значение изменилось или было нечетным
+    std::atomic<uint64_t> sequence;
+};
+
+struct alignas(64) StatsSegmentLayout {
+    StatsHeader header;
+    StatsData data;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "seqlock сегмента требует атомарного 64-битного счетчика без блокировок");
+
+// Сегмент статистики: сервер раз в stats.interval_ms публикует счетчики,
+// нагрузку рабочих и таблицу активных туннелей в файл в /dev/shm. Снимок
+// защищен seqlock: писатель никогда не ждет читателей, читатели (cvpnctl)
+// только отображают файл и копируют снимок, не обращаясь к серверу.
+class StatsSegment {
+public:
+    StatsSegment() = default;
+    ~StatsSegment();
+
+    bool open(const std::string& path);
+    void close();  // Удаляет файл: читатели увидят, что сервер остановлен
+    bool is_open() const { return segment_ != nullptr; }
+    const std::string& path() const { return path_; }
+
+    // Только из одного потока (основной цикл сервера)
+    void publish(const StatsData& data);
+
+    // Согласованная копия снимка из отображенного сегмента. false - сегмент
+    // несовместим или писатель не дал прочитать снимок за отведенные попытки
+    static bool read(const StatsSegmentLayout* segment, StatsData& out);
+
+private:
+    std::string path_;
+    StatsSegmentLayout* segment_{nullptr};
+    int fd_{-1};
+
+    StatsSegment(const StatsSegment&) = delete;
+    StatsSegment& operator=(const StatsSegment&) = delete;
+};
+
+#endif // STATS_SEGMENT_H
@@ -0,0 +1,140 @@
+#include "stream_compression.h"
+#include "lz4.h"
+#include "memory_budget.h"
+#include "utils.h"
+#include <chrono>
+#include <cstring>
+
+const char* const StreamCompression::HEADER_NAME = "X-Tunnel-Compression";
+const char* const StreamCompression::CODEC = "lz4";
+
+namespace {
+
+constexpr uint32_t COMPRESSED_FLAG = 0x80000000u;
+
+void write_header(char* frame, uint32_t value) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(frame);
+    bytes[0] = static_cast<uint8_t>(value >> 24);
+    bytes[1] = static_cast<uint8_t>(value >> 16);
+    bytes[2] = static_cast<uint8_t>(value >> 8);
+    bytes[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t read_header(const char* frame) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(frame);
+    return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+           static_cast<uint32_t>(bytes[2]) << 8 | bytes[3];
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+}  // namespace
+
+StreamCompression::StreamCompression(ConnectionQuota& quota) : quota_(quota) {
+}
+
+StreamCompression::~StreamCompression() {
+    release();
+}
+
+bool StreamCompression::accepts(const std::string& value) {
+    // Список кодеков через запятую, в порядке предпочтения клиента
+    for (const std::string& codec : Utils::split(value, ',')) {
+        if (Utils::trim(codec) == CODEC) {
+            return true;
+        }
+    }
+    return false;
+}
+
+char* StreamCompression::scratch() {
+    if (!scratch_) {
+        if (!quota_.reserve(MAX_INPUT)) {
+            return nullptr;
+        }
+        scratch_.reset(new char[MAX_INPUT]);
+    }
+    return scratch_.get();
+}
+
+void StreamCompression::release() {
+    if (scratch_) {
+        scratch_.reset();
+        quota_.release(MAX_INPUT);
+    }
+}
+
+size_t StreamCompression::encode(size_t size, char* frame) {
+    auto start = std::chrono::steady_clock::now();
+    // Сжатый кадр должен быть короче исходного, иначе тело - открытый текст
+    size_t packed = size > 1 ? Lz4::compress(reinterpret_cast<const uint8_t*>(scratch_.get()), size,
+                                             reinterpret_cast<uint8_t*>(frame + HEADER), size - 1)
+                             : 0;
+    size_t body = packed;
+    if (packed > 0) {
+        write_header(frame, COMPRESSED_FLAG | static_cast<uint32_t>(packed));
+    } else {
+        std::memcpy(frame + HEADER, scratch_.get(), size);
+        write_header(frame, static_cast<uint32_t>(size));
+        body = size;
+    }
+    stats_.cpu_ns += elapsed_ns(start);
+    stats_.sent_plain += size;
+    stats_.sent_wire += HEADER + body;
+
+    window_plain_ += size;
+    window_wire_ += HEADER + body;
+    if (window_plain_ >= SAMPLE_BYTES) {
+        if (window_wire_ * 100 > window_plain_ * (100 - MIN_SAVING_PERCENT)) {
+            compressing_ = false;
+            stats_.disabled_after = stats_.sent_plain;
+            release();
+        }
+        window_plain_ = 0;
+        window_wire_ = 0;
+    }
+    return HEADER + body;
+}
+
+size_t StreamCompression::store(char* frame, size_t size) {
+    write_header(frame, static_cast<uint32_t>(size));
+    stats_.sent_plain += size;
+    stats_.sent_wire += HEADER + size;
+    return HEADER + size;
+}
+
+size_t StreamCompression::frame_size(const char* header) {
+    size_t body = read_header(header) & ~COMPRESSED_FLAG;
+    return body > MAX_INPUT ? 0 : HEADER + body;
+}
+
+bool StreamCompression::compressed(const char* header) {
+    return (read_header(header) & COMPRESSED_FLAG) != 0;
+}
+
+bool StreamCompression::decode(const char* frame, size_t size, const char*& data, size_t& length) {
+    if (size < HEADER || frame_size(frame) != size) {
+        return false;
+    }
+    stats_.received_wire += size;
+    if (!compressed(frame)) {
+        data = frame + HEADER;
+        length = size - HEADER;
+        stats_.received_plain += length;
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool valid = scratch_ && Lz4::decompress(reinterpret_cast<const uint8_t*>(frame + HEADER), size - HEADER,
+                                             reinterpret_cast<uint8_t*>(scratch_.get()), MAX_INPUT, length);
+    stats_.cpu_ns += elapsed_ns(start);
+    if (!valid) {
+        return false;
+    }
+    data = scratch_.get();
+    stats_.received_plain += length;
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef STREAM_COMPRESSION_H
+#define STREAM_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class ConnectionQuota;
+
+// Сжатие потока клиент - сервер кадрами LZ4.
+//
+// Согласование: клиент добавляет к CONNECT заголовок
+//   X-Tunnel-Compression: lz4
+// сервер, принявший сжатие, повторяет его в ответе 200. Дальше данные в
+// обе стороны идут кадрами: 4 байта заголовка (старший бит - тело сжато,
+// остальные - длина тела, big-endian) и тело. В кадре не больше MAX_INPUT
+// байт открытого текста; кадр отправляется сразу после чтения, сжатие не
+// задерживает данные. В шифрованном туннеле кадр - содержимое записи.
+//
+// Отправитель оценивает сжатие окнами по SAMPLE_BYTES. Окно, сэкономившее
+// меньше MIN_SAVING_PERCENT, выключает сжатие в этом направлении до конца
+// туннеля: дальше кадры идут без сжатия и без лишнего копирования (TLS,
+// видео, архивы).
+class StreamCompression {
+public:
+    static constexpr size_t HEADER = 4;
+    static constexpr size_t MAX_INPUT = 16 * 1024;
+    static constexpr size_t SAMPLE_BYTES = 64 * 1024;
+    static constexpr uint64_t MIN_SAVING_PERCENT = 10;
+
+    static const char* const HEADER_NAME;
+    static const char* const CODEC;
+
+    // Счетчики одного туннеля для отчета при закрытии
+    struct Stats {
+        uint64_t sent_plain{0};      // Открытый текст, отправленный кадрами
+        uint64_t sent_wire{0};       // Отправленные кадры с заголовками
+        uint64_t received_plain{0};
+        uint64_t received_wire{0};
+        uint64_t cpu_ns{0};          // Время сжатия и распаковки
+        uint64_t disabled_after{0};  // Открытый текст до выключения сжатия (0 - не выключалось)
+    };
+
+    explicit StreamCompression(ConnectionQuota& quota);
+    ~StreamCompression();
+
+    // Значение заголовка согласования называет поддерживаемый кодек
+    static bool accepts(const std::string& value);
+
+    // Буфер сжатия и распаковки на MAX_INPUT байт; nullptr - нет памяти
+    char* scratch();
+    // Возврат буфера в бюджет, пока туннель простаивает
+    void release();
+
+    // Отправка. Пока сжатие не выключено, открытый текст читается в
+    // scratch() и кодируется в frame (места - HEADER + size)
+    bool compressing() const { return compressing_; }
+    size_t encode(size_t size, char* frame);
+    // Кадр без сжатия из size байт, уже лежащих в frame + HEADER
+    size_t store(char* frame, size_t size);
+
+    // Прием. Размер кадра по заголовку; 0 - тело длиннее MAX_INPUT
+    static size_t frame_size(const char* header);
+    static bool compressed(const char* header);
+    // Открытый текст полного кадра: тело кадра или распакованное в
+    // scratch(), который для сжатого кадра должен быть выделен заранее
+    bool decode(const char* frame, size_t size, const char*& data, size_t& length);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    ConnectionQuota& quota_;
+    std::unique_ptr<char[]> scratch_;
+    bool compressing_{true};
+    uint64_t window_plain_{0};
+    uint64_t window_wire_{0};
+    Stats stats_;
+
+    StreamCompression(const StreamCompression&) = delete;
+    StreamCompression& operator=(const StreamCompression&) = delete;
+};
+
+#endif // STREAM_COMPRESSION_H
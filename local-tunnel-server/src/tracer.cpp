@@ -0,0 +1,156 @@
+#include "tracer.h"
+#include "config.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+std::mutex Tracer::mutex_;
+std::vector<std::unique_ptr<Tracer::Ring>> Tracer::rings_;
+std::vector<Tracer::Ring*> Tracer::free_rings_;
+std::atomic<int> Tracer::sample_one_in_{0};
+std::atomic<size_t> Tracer::ring_size_{4096};
+const Tracer::Clock::time_point Tracer::epoch_ = Tracer::Clock::now();
+
+void Tracer::configure(const Config& config) {
+    sample_one_in_.store(std::max(0, config.get_trace_sample_one_in()));
+    // Новый размер действует для колец, созданных после перезагрузки
+    ring_size_.store(static_cast<size_t>(std::max(16, config.get_trace_ring_size())));
+}
+
+bool Tracer::sampled(uint64_t connection_id) {
+    int one_in = sample_one_in_.load(std::memory_order_relaxed);
+    return one_in > 0 && connection_id % static_cast<uint64_t>(one_in) == 0;
+}
+
+Tracer::Lease::~Lease() {
+    if (ring) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_rings_.push_back(ring);
+    }
+}
+
+Tracer::Ring* Tracer::thread_ring() {
+    thread_local Lease lease;
+    if (!lease.ring) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_rings_.empty()) {
+            lease.ring = free_rings_.back();
+            free_rings_.pop_back();
+        } else {
+            rings_.push_back(std::make_unique<Ring>(ring_size_.load()));
+            lease.ring = rings_.back().get();
+        }
+    }
+    return lease.ring;
+}
+
+void Tracer::record(uint64_t connection_id, TracePhase phase,
+                    Clock::time_point start, Clock::time_point end) {
+    static MetricValue& spans = Metrics::counter("trace_spans_total");
+
+    Ring* ring = thread_ring();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event& event = ring->events[head % ring->events.size()];
+
+    auto since_epoch = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch_).count();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    event.connection.store(connection_id, std::memory_order_relaxed);
+    event.start_us.store(static_cast<uint64_t>(std::max<int64_t>(0, since_epoch)), std::memory_order_relaxed);
+    event.duration_us.store(static_cast<uint64_t>(std::max<int64_t>(0, duration)), std::memory_order_relaxed);
+    event.phase.store(static_cast<uint32_t>(phase), std::memory_order_relaxed);
+    ring->head.store(head + 1, std::memory_order_release);
+    spans.add();
+}
+
+const char* Tracer::phase_name(TracePhase phase) {
+    switch (phase) {
+        case TracePhase::ACCEPT: return "accept";
+        case TracePhase::PARSE: return "parse";
+        case TracePhase::RESOLVE: return "resolve";
+        case TracePhase::CONNECT: return "connect";
+        case TracePhase::RESPONSE: return "response";
+        case TracePhase::FIRST_BYTE_CLIENT: return "first_byte_client";
+        case TracePhase::FIRST_BYTE_TARGET: return "first_byte_target";
+        case TracePhase::CLOSE: return "close";
+        case TracePhase::TUNNEL: return "tunnel";
+    }
+    return "unknown";
+}
+
+bool Tracer::dump(const std::string& path) {
+    struct Snapshot {
+        uint64_t connection;
+        uint64_t start_us;
+        uint64_t duration_us;
+        TracePhase phase;
+    };
+    std::vector<Snapshot> snapshots;
+
+    {
+        // Кольца не удаляются, блокировка защищает только список
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& ring : rings_) {
+            size_t capacity = ring->events.size();
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t first = head > capacity ? head - capacity : 0;
+            size_t copied_from = snapshots.size();
+            for (uint64_t i = first; i < head; ++i) {
+                const Event& event = ring->events[i % capacity];
+                snapshots.push_back(Snapshot{
+                    event.connection.load(std::memory_order_relaxed),
+                    event.start_us.load(std::memory_order_relaxed),
+                    event.duration_us.load(std::memory_order_relaxed),
+                    static_cast<TracePhase>(event.phase.load(std::memory_order_relaxed))});
+            }
+
+            // События, которые владелец успел перезаписать во время копирования,
+            // отбрасываются
+            uint64_t head_after = ring->head.load(std::memory_order_acquire);
+            uint64_t valid_from = head_after > capacity ? head_after - capacity : 0;
+            if (valid_from > first) {
+                size_t overwritten = static_cast<size_t>(std::min<uint64_t>(valid_from - first, head - first));
+                snapshots.erase(snapshots.begin() + copied_from,
+                                snapshots.begin() + copied_from + overwritten);
+            }
+        }
+    }
+
+    std::sort(snapshots.begin(), snapshots.end(), [](const Snapshot& a, const Snapshot& b) {
+        return a.start_us < b.start_us;
+    });
+
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+             << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"local-tunnel-server\"}}";
+
+        // Одна строка (tid) на соединение
+        std::vector<uint64_t> connections;
+        connections.reserve(snapshots.size());
+        for (const auto& snapshot : snapshots) {
+            connections.push_back(snapshot.connection);
+        }
+        std::sort(connections.begin(), connections.end());
+        connections.erase(std::unique(connections.begin(), connections.end()), connections.end());
+        for (uint64_t connection : connections) {
+            file << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << connection
+                 << ",\"name\":\"thread_name\",\"args\":{\"name\":\"conn " << connection << "\"}}";
+        }
+
+        for (const auto& snapshot : snapshots) {
+            file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << snapshot.connection
+                 << ",\"name\":\"" << phase_name(snapshot.phase) << "\",\"ts\":" << snapshot.start_us
+                 << ",\"dur\":" << snapshot.duration_us << "}";
+        }
+        file << "\n]}\n";
+        if (!file.good()) {
+            return false;
+        }
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
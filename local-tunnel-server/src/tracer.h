@@ -0,0 +1,80 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+class Config;
+
+// Этапы жизни соединения
+enum class TracePhase : uint32_t {
+    ACCEPT = 0,         // От accept() до запуска потока обработчика
+    PARSE,              // Чтение строки запроса и заголовков
+    RESOLVE,            // Разрешение имени цели
+    CONNECT,            // TCP рукопожатие с целью (или вышестоящим прокси)
+    RESPONSE,           // Ответ клиенту и пересылка запроса/ранних данных
+    FIRST_BYTE_CLIENT,  // От установки туннеля до первых данных клиента
+    FIRST_BYTE_TARGET,  // От установки туннеля до первых данных цели
+    CLOSE,              // Завершение обработчика
+    TUNNEL              // Все время жизни соединения
+};
+
+// Выборочная трассировка этапов соединений. Каждый поток пишет события
+// в свое кольцо без блокировок; кольца берутся из общего пула, поэтому
+// короткоживущие потоки обработчиков не создают новых буферов. По запросу
+// (SIGUSR2) кольца выгружаются в формате Chrome trace (chrome://tracing,
+// Perfetto): одна строка на соединение.
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static void configure(const Config& config);
+
+    // Детерминированная выборка: трассируется каждое N-е соединение
+    static bool sampled(uint64_t connection_id);
+
+    static void record(uint64_t connection_id, TracePhase phase,
+                       Clock::time_point start, Clock::time_point end);
+
+    // Атомарная запись снимка всех колец в файл
+    static bool dump(const std::string& path);
+
+    static const char* phase_name(TracePhase phase);
+
+private:
+    struct Event {
+        std::atomic<uint64_t> connection{0};
+        std::atomic<uint64_t> start_us{0};
+        std::atomic<uint64_t> duration_us{0};
+        std::atomic<uint32_t> phase{0};
+    };
+
+    // Кольцо одного потока: пишет только владелец, читает выгрузка
+    struct Ring {
+        explicit Ring(size_t capacity) : events(capacity) {}
+        std::vector<Event> events;
+        std::atomic<uint64_t> head{0};
+    };
+
+    // Возвращает кольцо в пул при завершении потока
+    struct Lease {
+        Ring* ring{nullptr};
+        ~Lease();
+    };
+
+    static std::mutex mutex_;
+    static std::vector<std::unique_ptr<Ring>> rings_;
+    static std::vector<Ring*> free_rings_;
+    static std::atomic<int> sample_one_in_;
+    static std::atomic<size_t> ring_size_;
+    static const Clock::time_point epoch_;
+
+    static Ring* thread_ring();
+};
+
+#endif // TRACER_H
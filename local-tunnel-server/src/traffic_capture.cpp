@@ -0,0 +1,364 @@
+#include "traffic_capture.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+namespace {
+
+// Целые числа кодируются в LEB128: малые значения занимают один байт
+void put_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool get_varint(const char* data, size_t size, size_t& offset, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(data[offset++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Ограничение длины записи защищает от поврежденных файлов
+constexpr uint64_t MAX_RECORD_SIZE = 16u << 20;
+
+}  // namespace
+
+constexpr char TrafficCapture::MAGIC[8];
+
+TrafficCapture::TrafficCapture() {
+    std::random_device random;
+    salt_ = (static_cast<uint64_t>(random()) << 32) ^ random();
+}
+
+TrafficCapture::~TrafficCapture() {
+    stop();
+}
+
+void TrafficCapture::configure(const Config& config) {
+    std::lock_guard<std::mutex> lock(settings_mutex_);
+    std::string path = config.get_capture_file();
+    if (path != path_) {
+        reopen_requested_ = true;
+    }
+    path_ = path;
+    max_size_ = static_cast<uint64_t>(std::max(0, config.get_capture_max_size_mb())) * 1024 * 1024;
+    slot_ms_.store(static_cast<uint32_t>(std::max(1, config.get_capture_slot_ms())));
+    max_events_.store(static_cast<size_t>(std::max(1, config.get_capture_max_events())));
+    enabled_.store(config.is_capture_enabled() && !path_.empty());
+}
+
+bool TrafficCapture::start() {
+    if (running_.load()) {
+        return true;
+    }
+    running_.store(true);
+    thread_ = std::make_unique<std::thread>(&TrafficCapture::loop, this);
+    return true;
+}
+
+void TrafficCapture::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        running_.store(false);
+    }
+    queue_cv_.notify_all();
+    if (thread_ && thread_->joinable()) {
+        thread_->join();  // Поток дописывает очередь перед выходом
+    }
+    thread_.reset();
+}
+
+void TrafficCapture::write(const CaptureRecord& record) {
+    static MetricValue& records = Metrics::counter("capture_records_total");
+    static MetricValue& dropped = Metrics::counter("capture_dropped_total");
+
+    if (!enabled() || !running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::string encoded = encode(record);
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (pending_.size() + encoded.size() > MAX_PENDING) {
+            dropped.add();
+            return;
+        }
+        pending_ += encoded;
+    }
+    records.add();
+}
+
+void TrafficCapture::add_event(std::vector<CaptureEvent>& events, uint32_t offset_ms, bool from_client,
+                               uint64_t bytes, uint32_t slot_ms, size_t max_events) {
+    if (!events.empty()) {
+        CaptureEvent& last = events.back();
+        if (last.from_client == from_client && offset_ms - last.offset_ms < slot_ms) {
+            last.bytes += bytes;
+            return;
+        }
+    }
+    if (events.size() >= max_events) {
+        // Байты уходят в последнее событие того же направления: порядок
+        // событий сохраняется, воспроизведение лишь отправляет их раньше.
+        // Первое событие направления добавляется и сверх ограничения
+        for (auto it = events.rbegin(); it != events.rend(); ++it) {
+            if (it->from_client == from_client) {
+                it->bytes += bytes;
+                return;
+            }
+        }
+    }
+    events.push_back(CaptureEvent{offset_ms, from_client, bytes});
+}
+
+std::string TrafficCapture::anonymize(const std::string& host) const {
+    // FNV-1a по соли и имени в нижнем регистре
+    uint64_t hash = 1469598103934665603ULL;
+    auto mix = [&hash](uint8_t byte) {
+        hash ^= byte;
+        hash *= 1099511628211ULL;
+    };
+    for (int i = 0; i < 8; ++i) {
+        mix(static_cast<uint8_t>(salt_ >> (8 * i)));
+    }
+    for (unsigned char c : host) {
+        mix(static_cast<uint8_t>(std::tolower(c)));
+    }
+    char label[16];
+    std::snprintf(label, sizeof(label), "t%012llx",
+                  static_cast<unsigned long long>(hash & 0xffffffffffffULL));
+    return label;
+}
+
+std::string TrafficCapture::handshake_line(AccessProtocol protocol, const std::string& method,
+                                           const std::string& url, const std::string& host, int port) const {
+    std::string target = anonymize(host) + ":" + std::to_string(port);
+    switch (protocol) {
+        case AccessProtocol::CONNECT:
+            return "CONNECT " + target + " HTTP/1.1";
+        case AccessProtocol::HTTP: {
+            // Путь с запросом заменяется строкой той же длины
+            size_t authority = url.find("://");
+            size_t path = url.find('/', authority == std::string::npos ? 0 : authority + 3);
+            size_t length = path == std::string::npos ? 1 : url.size() - path;
+            return method + " http://" + target + "/" + std::string(length - 1, 'x') + " HTTP/1.1";
+        }
+        case AccessProtocol::SOCKS5:
+            return "SOCKS5 CONNECT " + target;
+        case AccessProtocol::SOCKS5_UDP:
+            return "SOCKS5 UDP ASSOCIATE";
+        case AccessProtocol::BINARY:
+            return "BINARY " + target;
+        default:
+            return "";
+    }
+}
+
+std::string TrafficCapture::encode(const CaptureRecord& record) {
+    std::string body;
+    body.reserve(64 + record.line.size() + record.events.size() * 4);
+    put_varint(body, record.start_unix_ms);
+    put_varint(body, record.setup_us);
+    put_varint(body, record.duration_ms);
+    put_varint(body, record.bytes_from_client);
+    put_varint(body, record.bytes_from_target);
+    body.push_back(static_cast<char>(record.protocol));
+    body.push_back(static_cast<char>(record.reason));
+    put_varint(body, record.target_port);
+    put_varint(body, record.line.size());
+    body += record.line;
+    put_varint(body, record.events.size());
+    // Смещения событий - разницей с предыдущим, направление - младшим битом
+    uint32_t previous = 0;
+    for (const CaptureEvent& event : record.events) {
+        put_varint(body, event.offset_ms - std::min(previous, event.offset_ms));
+        put_varint(body, (event.bytes << 1) | (event.from_client ? 1 : 0));
+        previous = event.offset_ms;
+    }
+
+    std::string out;
+    put_varint(out, body.size());
+    out += body;
+    return out;
+}
+
+size_t TrafficCapture::decode(const char* data, size_t size, CaptureRecord& record) {
+    size_t offset = 0;
+    uint64_t length = 0;
+    if (!get_varint(data, size, offset, length) || length > MAX_RECORD_SIZE || size - offset < length) {
+        return 0;
+    }
+    size_t end = offset + static_cast<size_t>(length);
+
+    uint64_t values[5];
+    for (uint64_t& value : values) {
+        if (!get_varint(data, end, offset, value)) {
+            return 0;
+        }
+    }
+    record.start_unix_ms = values[0];
+    record.setup_us = static_cast<uint32_t>(values[1]);
+    record.duration_ms = static_cast<uint32_t>(values[2]);
+    record.bytes_from_client = values[3];
+    record.bytes_from_target = values[4];
+
+    uint64_t port = 0;
+    uint64_t line_size = 0;
+    if (end - offset < 2) {
+        return 0;
+    }
+    record.protocol = static_cast<AccessProtocol>(static_cast<uint8_t>(data[offset++]));
+    record.reason = static_cast<CloseReason>(static_cast<uint8_t>(data[offset++]));
+    if (!get_varint(data, end, offset, port) || !get_varint(data, end, offset, line_size) ||
+        end - offset < line_size) {
+        return 0;
+    }
+    record.target_port = static_cast<uint16_t>(port);
+    record.line.assign(data + offset, static_cast<size_t>(line_size));
+    offset += static_cast<size_t>(line_size);
+
+    uint64_t count = 0;
+    if (!get_varint(data, end, offset, count) || count > end - offset) {
+        return 0;
+    }
+    record.events.clear();
+    record.events.reserve(static_cast<size_t>(count));
+    uint64_t time = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t delta = 0;
+        uint64_t packed = 0;
+        if (!get_varint(data, end, offset, delta) || !get_varint(data, end, offset, packed)) {
+            return 0;
+        }
+        time += delta;
+        record.events.push_back(CaptureEvent{static_cast<uint32_t>(time), (packed & 1) != 0, packed >> 1});
+    }
+    return offset == end ? end : 0;
+}
+
+void TrafficCapture::loop() {
+    std::string batch;
+    while (true) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait_for(lock, std::chrono::milliseconds(FLUSH_MS), [this] { return !running_.load(); });
+            stopping = !running_.load();
+            batch.swap(pending_);
+        }
+        flush(batch);
+        batch.clear();
+        if (stopping) {
+            break;
+        }
+    }
+    close_file();
+}
+
+void TrafficCapture::flush(const std::string& batch) {
+    static MetricValue& dropped = Metrics::counter("capture_dropped_total");
+    static MetricValue& errors = Metrics::counter("capture_write_errors_total");
+
+    bool reopen;
+    uint64_t max_size;
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex_);
+        reopen = reopen_requested_;
+        reopen_requested_ = false;
+        max_size = max_size_;
+    }
+    if (reopen) {
+        close_file();
+        full_ = false;
+    }
+    if (batch.empty()) {
+        return;
+    }
+    if (fd_ < 0 && !open_file()) {
+        errors.add();
+        return;
+    }
+    if (full_ || (max_size > 0 && file_size_ + batch.size() > max_size)) {
+        if (!full_) {
+            Logger::warning("Файл захвата достиг max_size_mb, захват остановлен");
+            full_ = true;
+        }
+        dropped.add();
+        return;
+    }
+
+    size_t written_total = 0;
+    while (written_total < batch.size()) {
+        ssize_t written = ::write(fd_, batch.data() + written_total, batch.size() - written_total);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errors.add();
+            Logger::error("Ошибка записи файла захвата: " + std::string(strerror(errno)));
+            close_file();
+            return;
+        }
+        written_total += static_cast<size_t>(written);
+    }
+    file_size_ += written_total;
+}
+
+bool TrafficCapture::open_file() {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(settings_mutex_);
+        path = path_;
+    }
+    if (path.empty()) {
+        return false;
+    }
+
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        Logger::error("Не удалось открыть файл захвата " + path + ": " + strerror(errno));
+        return false;
+    }
+    struct stat info{};
+    fstat(fd_, &info);
+    file_size_ = static_cast<uint64_t>(info.st_size);
+
+    // Дописывается только файл захвата, чужой файл не трогается
+    if (file_size_ > 0) {
+        char header[sizeof(MAGIC)] = {};
+        if (pread(fd_, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+            std::memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+            Logger::error("Файл " + path + " не является файлом захвата");
+            close_file();
+            return false;
+        }
+    } else if (::write(fd_, MAGIC, sizeof(MAGIC)) == static_cast<ssize_t>(sizeof(MAGIC))) {
+        file_size_ = sizeof(MAGIC);
+    }
+    return true;
+}
+
+void TrafficCapture::close_file() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    file_size_ = 0;
+}
@@ -0,0 +1,113 @@
+#ifndef TRAFFIC_CAPTURE_H
+#define TRAFFIC_CAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "access_log.h"
+
+class Config;
+
+// Байты одного направления туннеля за интервал огибающей
+struct CaptureEvent {
+    uint32_t offset_ms{0};     // От установки туннеля
+    bool from_client{false};
+    uint64_t bytes{0};
+};
+
+// Запись захвата: обезличенное рукопожатие и огибающая одного туннеля
+struct CaptureRecord {
+    uint64_t start_unix_ms{0};
+    uint32_t setup_us{0};      // От приема соединения до установки туннеля
+    uint32_t duration_ms{0};
+    uint64_t bytes_from_client{0};
+    uint64_t bytes_from_target{0};
+    AccessProtocol protocol{AccessProtocol::UNKNOWN};
+    CloseReason reason{CloseReason::CLIENT_CLOSED};
+    uint16_t target_port{0};
+    std::string line;          // Строка рукопожатия с обезличенной целью
+    std::vector<CaptureEvent> events;
+};
+
+// Захват нагрузки для воспроизведения (capture-replay): на каждый туннель -
+// строка рукопожатия, в которой имя цели заменено меткой, а путь - строкой
+// той же длины, объемы и огибающая передачи: байты по направлениям,
+// сгруппированные в интервалы slot_ms. Записи кодируются в потоке
+// обработчика, файл пишет отдельный поток; при переполнении очереди записи
+// отбрасываются (capture_dropped_total), по достижении max_size_mb захват
+// останавливается.
+class TrafficCapture {
+public:
+    // Заголовок файла
+    static constexpr char MAGIC[8] = {'C', 'V', 'P', 'N', 'C', 'A', 'P', '1'};
+
+    TrafficCapture();
+    ~TrafficCapture();
+
+    void configure(const Config& config);
+    bool start();
+    void stop();
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+    uint32_t slot_ms() const { return slot_ms_.load(std::memory_order_relaxed); }
+    size_t max_events() const { return max_events_.load(std::memory_order_relaxed); }
+
+    void write(const CaptureRecord& record);
+
+    // Добавление байт к огибающей: в пределах интервала и направления
+    // события объединяются, сверх max_events байты добавляются к последнему
+    static void add_event(std::vector<CaptureEvent>& events, uint32_t offset_ms, bool from_client,
+                          uint64_t bytes, uint32_t slot_ms, size_t max_events);
+
+    // Строка рукопожатия с обезличенной целью. Метка цели - хэш имени с
+    // солью процесса: в одном захвате одинаковые цели получают одну метку
+    std::string handshake_line(AccessProtocol protocol, const std::string& method,
+                               const std::string& url, const std::string& host, int port) const;
+
+    static std::string encode(const CaptureRecord& record);
+    // Возвращает длину разобранной записи или 0, если данных не хватает
+    // либо запись повреждена
+    static size_t decode(const char* data, size_t size, CaptureRecord& record);
+
+private:
+    std::atomic<bool> enabled_{false};
+    std::atomic<uint32_t> slot_ms_{10};
+    std::atomic<size_t> max_events_{256};
+    uint64_t salt_{0};
+
+    std::mutex settings_mutex_;
+    std::string path_;
+    uint64_t max_size_{0};
+    bool reopen_requested_{false};
+
+    // Закодированные записи, ожидающие записи в файл
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    std::string pending_;
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    // Состояние потока записи
+    int fd_{-1};
+    uint64_t file_size_{0};
+    bool full_{false};
+
+    static constexpr size_t MAX_PENDING = 4u << 20;
+    static constexpr int FLUSH_MS = 1000;
+
+    void loop();
+    void flush(const std::string& batch);
+    bool open_file();
+    void close_file();
+    std::string anonymize(const std::string& host) const;
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+};
+
+#endif // TRAFFIC_CAPTURE_H
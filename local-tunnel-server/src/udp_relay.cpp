@@ -0,0 +1,998 @@
+#include "udp_relay.h"
+#include "socks5.h"
+#include "logger.h"
+#include "metrics.h"
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// Старые заголовки glibc не знают об опциях UDP GSO/GRO (Linux 4.18/5.0)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+namespace {
+    // Управляющее сообщение с размером сегмента (UDP_SEGMENT - uint16_t, UDP_GRO - int)
+    union ControlBuffer {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    };
+
+    constexpr uint64_t WAKE_EVENT = 0;
+    constexpr int MAX_ROUNDS = 4;  // Пачек подряд с одного сокета, чтобы не задерживать остальные
+
+    bool supports_option(int option) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        int value = option == UDP_SEGMENT ? 1400 : 1;
+        bool supported = setsockopt(fd, SOL_UDP, option, &value, sizeof(value)) == 0;
+        close(fd);
+        return supported;
+    }
+}
+
+struct UdpRelay::RxBatch {
+    explicit RxBatch(size_t capacity)
+        : buffers(capacity * SLOT_SIZE), messages(capacity), iovecs(capacity),
+          sources(capacity), controls(capacity) {}
+
+    int receive(int fd) {
+        for (size_t i = 0; i < messages.size(); ++i) {
+            iovecs[i].iov_base = buffers.data() + i * SLOT_SIZE;
+            iovecs[i].iov_len = SLOT_SIZE;
+            msghdr& header = messages[i].msg_hdr;
+            std::memset(&header, 0, sizeof(header));
+            header.msg_name = &sources[i];
+            header.msg_namelen = sizeof(sockaddr_storage);
+            header.msg_iov = &iovecs[i];
+            header.msg_iovlen = 1;
+            header.msg_control = controls[i].buffer;
+            header.msg_controllen = sizeof(controls[i].buffer);
+            messages[i].msg_len = 0;
+        }
+        return recvmmsg(fd, messages.data(), static_cast<unsigned int>(messages.size()), MSG_DONTWAIT, nullptr);
+    }
+
+    const uint8_t* data(size_t i) const { return buffers.data() + i * SLOT_SIZE; }
+
+    // Размер сегмента склеенной при GRO датаграммы (0 - датаграмма одна)
+    size_t segment_size(size_t i) {
+        msghdr& header = messages[i].msg_hdr;
+        for (cmsghdr* control = CMSG_FIRSTHDR(&header); control; control = CMSG_NXTHDR(&header, control)) {
+            if (control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO) {
+                int size = 0;
+                std::memcpy(&size, CMSG_DATA(control), sizeof(size));
+                return size > 0 ? static_cast<size_t>(size) : 0;
+            }
+        }
+        return 0;
+    }
+
+    std::vector<uint8_t> buffers;
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iovecs;
+    std::vector<sockaddr_storage> sources;
+    std::vector<ControlBuffer> controls;
+};
+
+// Пачка датаграмм для sendmmsg. Датаграммы одному адресату подряд с равным
+// размером сегмента (последняя может быть короче) складываются в одно
+// сообщение, которое ядро режет на датаграммы (UDP_SEGMENT). Ответ цели
+// занимает в арене слот приема и заголовок SOCKS5.
+struct UdpRelay::TxBatch {
+    explicit TxBatch(size_t capacity)
+        : arena(capacity * (SLOT_SIZE + Socks5::MAX_UDP_HEADER)), messages(capacity), iovecs(capacity), names(capacity),
+          name_lengths(capacity), controls(capacity), segment_sizes(capacity),
+          segments(capacity), closed(capacity) {}
+
+    // false - сообщений больше не помещается, пачку нужно отправить
+    bool add(const sockaddr_storage& address, socklen_t length, const uint8_t* header,
+             size_t header_size, const uint8_t* payload, size_t size, bool gso) {
+        size_t segment = header_size + size;
+        if (used + segment > arena.size()) {
+            return false;
+        }
+        if (gso && count > 0) {
+            size_t last = count - 1;
+            if (!closed[last] && segment <= segment_sizes[last] &&
+                segment_sizes[last] <= GSO_MAX_SEGMENT && segments[last] < GSO_MAX_SEGMENTS &&
+                iovecs[last].iov_len + segment <= GSO_MAX_BYTES &&
+                name_lengths[last] == length && std::memcmp(&names[last], &address, length) == 0) {
+                append(header, header_size, payload, size);
+                iovecs[last].iov_len += segment;
+                ++segments[last];
+                closed[last] = segment < segment_sizes[last];  // Короткий сегмент - только последним
+                return true;
+            }
+        }
+        if (count == messages.size()) {
+            return false;
+        }
+        size_t i = count++;
+        iovecs[i].iov_base = arena.data() + used;
+        iovecs[i].iov_len = segment;
+        names[i] = address;
+        name_lengths[i] = length;
+        segment_sizes[i] = segment;
+        segments[i] = 1;
+        closed[i] = false;
+        append(header, header_size, payload, size);
+        return true;
+    }
+
+    void append(const uint8_t* header, size_t header_size, const uint8_t* payload, size_t size) {
+        if (header_size > 0) {
+            std::memcpy(arena.data() + used, header, header_size);
+            used += header_size;
+        }
+        std::memcpy(arena.data() + used, payload, size);
+        used += size;
+    }
+
+    void clear() {
+        count = 0;
+        used = 0;
+    }
+
+    std::vector<uint8_t> arena;
+    size_t used{0};
+    size_t count{0};
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iovecs;
+    std::vector<sockaddr_storage> names;
+    std::vector<socklen_t> name_lengths;
+    std::vector<ControlBuffer> controls;
+    std::vector<size_t> segment_sizes;
+    std::vector<size_t> segments;
+    std::vector<bool> closed;
+};
+
+size_t UdpRelay::EndpointHash::operator()(const EndpointKey& key) const {
+    uint64_t high;
+    uint64_t low;
+    uint16_t port;
+    std::memcpy(&high, key.bytes.data(), 8);
+    std::memcpy(&low, key.bytes.data() + 8, 8);
+    std::memcpy(&port, key.bytes.data() + 16, 2);
+    uint64_t hash = high ^ (low * 0x9E3779B97F4A7C15ULL) ^ (static_cast<uint64_t>(port) << 48);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash);
+}
+
+UdpRelay::Session::~Session() {
+    if (client_fd >= 0) {
+        ::close(client_fd);
+    }
+    if (outbound_fd >= 0) {
+        ::close(outbound_fd);
+    }
+}
+
+UdpRelay::UdpRelay(Resolver& resolver, AccessPolicy& policy)
+    : resolver_(resolver), policy_(policy) {
+    Metrics::register_provider("udp_relay", [this](std::ostream& out) {
+        render_metrics(out);
+    });
+}
+
+UdpRelay::~UdpRelay() {
+    stop();
+    Metrics::unregister_provider("udp_relay");
+}
+
+void UdpRelay::configure(const Config& config) {
+    batch_size_.store(std::max(1, std::min(config.get_udp_batch_size(), 1024)));
+    buffer_kb_.store(std::max(0, config.get_udp_buffer_kb()));
+    mapping_idle_seconds_.store(std::max(1, config.get_udp_mapping_idle_seconds()));
+    session_idle_seconds_.store(std::max(1, config.get_udp_session_idle_seconds()));
+    max_sessions_.store(static_cast<size_t>(std::max(1, config.get_udp_max_sessions())));
+    max_mappings_.store(static_cast<size_t>(std::max(1, config.get_udp_max_mappings())));
+    gso_wanted_.store(config.is_udp_gso());
+    gro_wanted_.store(config.is_udp_gro());
+}
+
+bool UdpRelay::start() {
+    if (running_.load()) {
+        return true;
+    }
+
+    gso_supported_ = supports_option(UDP_SEGMENT);
+    gro_supported_ = supports_option(UDP_GRO);
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        Logger::error("Не удалось создать epoll для UDP ретранслятора: " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_EVENT;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+    running_.store(true);
+    thread_ = std::make_unique<std::thread>(&UdpRelay::loop, this);
+    Logger::info(std::string("UDP ретранслятор запущен (GSO: ") +
+                 (gso_supported_ && gso_wanted_.load() ? "да" : "нет") + ", GRO: " +
+                 (gro_supported_ && gro_wanted_.load() ? "да" : "нет") + ")");
+    return true;
+}
+
+void UdpRelay::stop() {
+    if (running_.exchange(false) && wake_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd_, &one, sizeof(one));
+        (void)written;
+    }
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+
+    // Обработчики управляющих соединений увидят закрытие и завершатся
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_.clear();
+    ready_.clear();
+    if (epoll_fd_ >= 0) {
+        ::close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+    if (wake_fd_ >= 0) {
+        ::close(wake_fd_);
+        wake_fd_ = -1;
+    }
+}
+
+uint64_t UdpRelay::open(const sockaddr_storage& client, const sockaddr_storage& local,
+                        sockaddr_storage& bound) {
+    if (!running_.load()) {
+        return 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (sessions_.size() >= max_sessions_.load()) {
+            static LogSite& site = Logger::site("udp.session_limit");
+            Logger::warning(site, "Достигнут предел UDP ассоциаций: " + std::to_string(sessions_.size()));
+            return 0;
+        }
+    }
+
+    auto session = std::make_shared<Session>();
+    int family = local.ss_family;
+    socklen_t length = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+
+    // Клиент отправляет датаграммы на тот же адрес, к которому подключился по TCP
+    sockaddr_storage address = local;
+    set_port(address, 0);
+    session->client_fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (session->client_fd < 0 ||
+        bind(session->client_fd, reinterpret_cast<sockaddr*>(&address), length) < 0 ||
+        getsockname(session->client_fd, reinterpret_cast<sockaddr*>(&bound), &length) < 0) {
+        static LogSite& site = Logger::site("udp.socket_error");
+        Logger::error(site, "Не удалось создать UDP сокет клиента: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    // Один сокет для целей обоих семейств: IPv4 адреса - в виде ::ffff:a.b.c.d
+    session->outbound_fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (session->outbound_fd >= 0) {
+        int off = 0;
+        setsockopt(session->outbound_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        session->outbound_family = AF_INET6;
+    } else {
+        session->outbound_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        session->outbound_family = AF_INET;
+    }
+    if (session->outbound_fd < 0) {
+        static LogSite& site = Logger::site("udp.socket_error");
+        Logger::error(site, "Не удалось создать UDP сокет для целей: " + std::string(strerror(errno)));
+        return 0;
+    }
+
+    int buffer_bytes = buffer_kb_.load() * 1024;
+    bool gro = gro_supported_ && gro_wanted_.load();
+    for (int fd : {session->client_fd, session->outbound_fd}) {
+        if (buffer_bytes > 0) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_bytes, sizeof(buffer_bytes));
+            setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_bytes, sizeof(buffer_bytes));
+        }
+        if (gro) {
+            int one = 1;
+            setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one));
+        }
+    }
+    session->client_gso = session->outbound_gso = gso_supported_ && gso_wanted_.load();
+
+    session->client = client;
+    session->client_length = client.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+    session->client_key = make_key(reinterpret_cast<const sockaddr*>(&client));
+    session->client_port_known = session->client_key.bytes[16] != 0 || session->client_key.bytes[17] != 0;
+    session->last_active_ms = now_ms();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (epoll_fd_ < 0) {
+        return 0;
+    }
+    uint64_t id = next_id_++;
+    session->id = id;
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = id << 1;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, session->client_fd, &event) < 0) {
+        return 0;
+    }
+    event.data.u64 = (id << 1) | 1;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, session->outbound_fd, &event) < 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session->client_fd, nullptr);
+        return 0;
+    }
+
+    sessions_.emplace(id, std::move(session));
+    sessions_total_.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+void UdpRelay::close(uint64_t id, uint64_t& bytes_from_client, uint64_t& bytes_from_target) {
+    // Сокеты закроются, когда поток ретранслятора отпустит сессию
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end()) {
+        return;
+    }
+    bytes_from_client = it->second->bytes_from_client.load(std::memory_order_relaxed);
+    bytes_from_target = it->second->bytes_from_target.load(std::memory_order_relaxed);
+    unregister(*it->second);
+    sessions_.erase(it);
+}
+
+bool UdpRelay::session_bytes(uint64_t id, uint64_t& bytes_from_client, uint64_t& bytes_from_target) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end()) {
+        return false;
+    }
+    bytes_from_client = it->second->bytes_from_client.load(std::memory_order_relaxed);
+    bytes_from_target = it->second->bytes_from_target.load(std::memory_order_relaxed);
+    return true;
+}
+
+void UdpRelay::unregister(const Session& session) {
+    if (epoll_fd_ >= 0) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session.client_fd, nullptr);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session.outbound_fd, nullptr);
+    }
+}
+
+std::shared_ptr<UdpRelay::Session> UdpRelay::find(uint64_t id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(id);
+    return it == sessions_.end() ? nullptr : it->second;
+}
+
+void UdpRelay::loop() {
+    // Буферы пачек выделяются один раз на поток
+    size_t batch = static_cast<size_t>(batch_size_.load());
+    RxBatch rx(batch);
+    TxBatch tx(batch);
+    std::vector<epoll_event> events(256);
+    std::vector<uint64_t> ready;
+    int64_t swept_at = now_ms();
+
+    while (running_.load()) {
+        int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), 1000);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::error("Ошибка epoll_wait UDP ретранслятора: " + std::string(strerror(errno)));
+            break;
+        }
+
+        int64_t now = now_ms();
+        for (int i = 0; i < count; ++i) {
+            uint64_t data = events[i].data.u64;
+            if (data == WAKE_EVENT) {
+                uint64_t value;
+                ssize_t drained = read(wake_fd_, &value, sizeof(value));
+                (void)drained;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    ready.swap(ready_);
+                }
+                for (uint64_t id : ready) {
+                    if (auto session = find(id)) {
+                        on_resolved(*session, tx, now);
+                    }
+                }
+                ready.clear();
+                continue;
+            }
+
+            std::shared_ptr<Session> session = find(data >> 1);
+            if (!session) {
+                continue;  // Ассоциация закрыта после epoll_wait
+            }
+            if (data & 1) {
+                on_outbound_readable(*session, rx, tx, now);
+            } else {
+                on_client_readable(*session, rx, tx, now);
+            }
+        }
+
+        if (now - swept_at >= 1000) {
+            sweep(now);
+            swept_at = now;
+        }
+    }
+}
+
+void UdpRelay::on_client_readable(Session& session, RxBatch& rx, TxBatch& tx, int64_t now_ms) {
+    for (int round = 0; round < MAX_ROUNDS; ++round) {
+        int received = rx.receive(session.client_fd);
+        recv_calls_.fetch_add(1, std::memory_order_relaxed);
+        if (received <= 0) {
+            break;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            size_t length = rx.messages[i].msg_len;
+            if (rx.messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            // Датаграммы принимаются только с адреса управляющего соединения;
+            // порт клиента фиксируется по первой датаграмме, если не был указан
+            EndpointKey source = make_key(reinterpret_cast<const sockaddr*>(&rx.sources[i]));
+            if (std::memcmp(source.bytes.data(), session.client_key.bytes.data(), 16) != 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (!session.client_port_known) {
+                session.client = rx.sources[i];
+                session.client_length = rx.messages[i].msg_hdr.msg_namelen;
+                session.client_key = source;
+                session.client_port_known = true;
+            } else if (!(source == session.client_key)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            const uint8_t* data = rx.data(i);
+            size_t segment = rx.segment_size(i);
+            if (segment == 0 || segment >= length) {
+                segment = length;
+            } else {
+                gro_datagrams_.fetch_add((length + segment - 1) / segment, std::memory_order_relaxed);
+            }
+            for (size_t offset = 0; offset < length; offset += segment) {
+                forward(session, data + offset, std::min(segment, length - offset), tx, now_ms);
+            }
+        }
+        flush(tx, session.outbound_fd, session.outbound_gso);
+
+        if (static_cast<size_t>(received) < rx.messages.size()) {
+            break;
+        }
+    }
+}
+
+void UdpRelay::forward(Session& session, const uint8_t* data, size_t size, TxBatch& tx, int64_t now_ms) {
+    uint8_t fragment = 0;
+    sockaddr_storage target{};
+    socklen_t target_length = 0;
+    std::string host;
+    int port = 0;
+    ssize_t header = Socks5::parse_udp_header(data, size, fragment, target, target_length, host, port);
+
+    // Фрагменты SOCKS5 не собираются - RFC 1928 разрешает их отбрасывать
+    if (header < 0 || fragment != 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const uint8_t* payload = data + header;
+    size_t payload_size = size - static_cast<size_t>(header);
+    session.last_active_ms = now_ms;
+
+    if (target_length == 0) {
+        forward_named(session, host, port, payload, payload_size, tx, now_ms);
+        return;
+    }
+
+    EndpointKey key = make_key(reinterpret_cast<const sockaddr*>(&target));
+    sockaddr_storage destination;
+    socklen_t destination_length;
+    if ((key.bytes[16] == 0 && key.bytes[17] == 0) ||
+        !to_family(reinterpret_cast<const sockaddr*>(&target), session.outbound_family,
+                   destination, destination_length)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!add_mapping(session, key, reinterpret_cast<const sockaddr*>(&target), true, now_ms)) {
+        return;
+    }
+
+    queue(tx, session.outbound_fd, session.outbound_gso, destination, destination_length,
+          nullptr, 0, payload, payload_size);
+    datagrams_from_client_.fetch_add(1, std::memory_order_relaxed);
+    bytes_from_client_.fetch_add(payload_size, std::memory_order_relaxed);
+    session.bytes_from_client.fetch_add(payload_size, std::memory_order_relaxed);
+}
+
+bool UdpRelay::add_mapping(Session& session, const EndpointKey& key, const sockaddr* address,
+                           bool check_policy, int64_t now_ms) {
+    auto it = session.mappings.find(key);
+    if (it != session.mappings.end()) {
+        it->second = now_ms;
+        return true;
+    }
+    if (session.mappings.size() >= max_mappings_.load()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        static LogSite& site = Logger::site("udp.mapping_limit");
+        Logger::warning(site, "UDP ассоциация " + std::to_string(session.id) +
+                             ": достигнут предел отображений " + std::to_string(session.mappings.size()));
+        return false;
+    }
+
+    // Политика проверяется при создании отображения, а не на каждую датаграмму.
+    // Через вышестоящий HTTP прокси UDP не передается - upstream равен запрету.
+    if (check_policy) {
+        PolicyDecision decision = policy_.current()->evaluate_address(address);
+        if (decision.action == PolicyAction::DENY || decision.action == PolicyAction::UPSTREAM) {
+            denied_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    session.mappings.emplace(key, now_ms);
+    session.mapping_count.store(session.mappings.size(), std::memory_order_relaxed);
+    return true;
+}
+
+void UdpRelay::forward_named(Session& session, const std::string& host, int port,
+                             const uint8_t* payload, size_t size, TxBatch& tx, int64_t now_ms) {
+    sockaddr_storage destination{};
+    socklen_t destination_length = 0;
+    {
+        std::lock_guard<std::mutex> lock(session.names_mutex);
+        auto it = session.names.find(host);
+        if (it != session.names.end() && !it->second.resolving && it->second.expires_ms <= now_ms) {
+            session.names.erase(it);
+            it = session.names.end();
+        }
+
+        if (it == session.names.end()) {
+            if (session.names.size() >= max_mappings_.load() || port == 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            // Доменные правила проверяются по имени до разрешения; без них
+            // при CIDR правилах решение откладывается до адреса
+            NameEntry entry;
+            std::shared_ptr<const CompiledPolicy> policy = policy_.current();
+            PolicyDecision decision = policy->evaluate(host);
+            bool by_address = !decision.matched && policy->has_prefix_rules();
+            if (!by_address &&
+                (decision.action == PolicyAction::DENY || decision.action == PolicyAction::UPSTREAM)) {
+                entry.resolving = false;
+                entry.denied = true;
+                entry.expires_ms = now_ms + NAME_TTL_MS;
+                session.names.emplace(host, std::move(entry));
+                denied_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            entry.pending.push_back(PendingDatagram{port, std::string(payload, payload + size)});
+            session.names.emplace(host, std::move(entry));
+        } else if (it->second.denied) {
+            denied_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else if (it->second.resolving) {
+            if (it->second.pending.size() < MAX_PENDING_PER_NAME) {
+                it->second.pending.push_back(PendingDatagram{port, std::string(payload, payload + size)});
+            } else {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        } else {
+            destination = it->second.address;
+            destination_length = it->second.length;
+        }
+    }
+
+    if (destination_length == 0) {
+        // Ответ из кэша резолвера приходит синхронно - блокировка уже отпущена
+        std::weak_ptr<Session> weak = session.shared_from_this();
+        resolver_.resolve_async(host, 0, [this, weak, host](const ResolveResult& result) {
+            resolved(weak, host, result);
+        });
+        return;
+    }
+
+    set_port(destination, port);
+    EndpointKey key = make_key(reinterpret_cast<const sockaddr*>(&destination));
+    if (!add_mapping(session, key, reinterpret_cast<const sockaddr*>(&destination), false, now_ms)) {
+        return;
+    }
+    queue(tx, session.outbound_fd, session.outbound_gso, destination, destination_length,
+          nullptr, 0, payload, size);
+    datagrams_from_client_.fetch_add(1, std::memory_order_relaxed);
+    bytes_from_client_.fetch_add(size, std::memory_order_relaxed);
+    session.bytes_from_client.fetch_add(size, std::memory_order_relaxed);
+}
+
+void UdpRelay::resolved(const std::weak_ptr<Session>& weak, const std::string& host,
+                        const ResolveResult& result) {
+    std::shared_ptr<Session> session = weak.lock();
+    if (!session) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(session->names_mutex);
+        auto it = session->names.find(host);
+        if (it == session->names.end()) {
+            return;
+        }
+        NameEntry& entry = it->second;
+
+        // Первый адрес, достижимый через сокет целей
+        const sockaddr* chosen = nullptr;
+        if (result.ok()) {
+            for (const sockaddr_storage& address : result.addresses) {
+                const sockaddr* candidate = reinterpret_cast<const sockaddr*>(&address);
+                if (to_family(candidate, session->outbound_family, entry.address, entry.length)) {
+                    chosen = candidate;
+                    break;
+                }
+            }
+        }
+        if (!chosen) {
+            // Отрицательные ответы кэширует резолвер
+            dropped_.fetch_add(entry.pending.size(), std::memory_order_relaxed);
+            session->names.erase(it);
+            return;
+        }
+
+        entry.resolving = false;
+        entry.expires_ms = now_ms() + NAME_TTL_MS;
+        // Имя без доменного правила решается по адресу целиком, включая
+        // действие по умолчанию
+        std::shared_ptr<const CompiledPolicy> policy = policy_.current();
+        PolicyDecision by_address = policy->evaluate(host).matched ? PolicyDecision{}
+                                                                    : policy->evaluate_address(chosen);
+        if (by_address.action == PolicyAction::DENY || by_address.action == PolicyAction::UPSTREAM) {
+            entry.denied = true;
+            denied_.fetch_add(entry.pending.size(), std::memory_order_relaxed);
+            entry.pending.clear();
+            return;
+        }
+
+        for (PendingDatagram& pending : entry.pending) {
+            ResolvedDatagram datagram{entry.address, entry.length, std::move(pending.payload)};
+            set_port(datagram.address, pending.port);
+            session->resolved.push_back(std::move(datagram));
+        }
+        entry.pending.clear();
+    }
+
+    // Отложенные датаграммы отправляет поток ретранслятора - он владеет отображениями
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (wake_fd_ >= 0) {
+        ready_.push_back(session->id);
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void UdpRelay::on_resolved(Session& session, TxBatch& tx, int64_t now_ms) {
+    std::vector<ResolvedDatagram> datagrams;
+    {
+        std::lock_guard<std::mutex> lock(session.names_mutex);
+        datagrams.swap(session.resolved);
+    }
+    for (ResolvedDatagram& datagram : datagrams) {
+        EndpointKey key = make_key(reinterpret_cast<const sockaddr*>(&datagram.address));
+        if (!add_mapping(session, key, reinterpret_cast<const sockaddr*>(&datagram.address), false, now_ms)) {
+            continue;
+        }
+        const uint8_t* payload = reinterpret_cast<const uint8_t*>(datagram.payload.data());
+        queue(tx, session.outbound_fd, session.outbound_gso, datagram.address, datagram.length,
+              nullptr, 0, payload, datagram.payload.size());
+        datagrams_from_client_.fetch_add(1, std::memory_order_relaxed);
+        bytes_from_client_.fetch_add(datagram.payload.size(), std::memory_order_relaxed);
+        session.bytes_from_client.fetch_add(datagram.payload.size(), std::memory_order_relaxed);
+    }
+    flush(tx, session.outbound_fd, session.outbound_gso);
+}
+
+void UdpRelay::on_outbound_readable(Session& session, RxBatch& rx, TxBatch& tx, int64_t now_ms) {
+    for (int round = 0; round < MAX_ROUNDS; ++round) {
+        int received = rx.receive(session.outbound_fd);
+        recv_calls_.fetch_add(1, std::memory_order_relaxed);
+        if (received <= 0) {
+            break;
+        }
+
+        for (int i = 0; i < received; ++i) {
+            size_t length = rx.messages[i].msg_len;
+            if (rx.messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            // Ответ принимается только от цели, которой клиент отправлял датаграммы
+            EndpointKey source = make_key(reinterpret_cast<const sockaddr*>(&rx.sources[i]));
+            auto it = session.mappings.find(source);
+            if (it == session.mappings.end()) {
+                filtered_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            it->second = now_ms;
+            session.last_active_ms = now_ms;
+            if (!session.client_port_known) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            // Одинаковый заголовок и равные сегменты GRO снова склеиваются при отправке
+            sockaddr_storage origin;
+            from_key(source, origin);
+            uint8_t header[Socks5::MAX_UDP_HEADER];
+            size_t header_size = Socks5::write_udp_header(header, reinterpret_cast<const sockaddr*>(&origin));
+
+            const uint8_t* data = rx.data(i);
+            size_t segment = rx.segment_size(i);
+            if (segment == 0 || segment >= length) {
+                segment = length;
+            } else {
+                gro_datagrams_.fetch_add((length + segment - 1) / segment, std::memory_order_relaxed);
+            }
+            for (size_t offset = 0; offset < length; offset += segment) {
+                size_t size = std::min(segment, length - offset);
+                queue(tx, session.client_fd, session.client_gso, session.client, session.client_length,
+                      header, header_size, data + offset, size);
+                datagrams_from_target_.fetch_add(1, std::memory_order_relaxed);
+            }
+            bytes_from_target_.fetch_add(length, std::memory_order_relaxed);
+            session.bytes_from_target.fetch_add(length, std::memory_order_relaxed);
+        }
+        flush(tx, session.client_fd, session.client_gso);
+
+        if (static_cast<size_t>(received) < rx.messages.size()) {
+            break;
+        }
+    }
+}
+
+void UdpRelay::queue(TxBatch& tx, int fd, bool& gso, const sockaddr_storage& address, socklen_t length,
+                     const uint8_t* header, size_t header_size, const uint8_t* payload, size_t size) {
+    // Ответ цели у предела UDP не помещается в датаграмму вместе с
+    // заголовком SOCKS5 - отправить его нельзя
+    size_t limit = address.ss_family == AF_INET6 ? MAX_UDP_PAYLOAD_V6 : MAX_UDP_PAYLOAD_V4;
+    if (header_size + size > limit) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!tx.add(address, length, header, header_size, payload, size, gso)) {
+        flush(tx, fd, gso);
+        tx.add(address, length, header, header_size, payload, size, gso);
+    }
+}
+
+void UdpRelay::flush(TxBatch& tx, int fd, bool& gso) {
+    for (size_t i = 0; i < tx.count; ++i) {
+        msghdr& header = tx.messages[i].msg_hdr;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_name = &tx.names[i];
+        header.msg_namelen = tx.name_lengths[i];
+        header.msg_iov = &tx.iovecs[i];
+        header.msg_iovlen = 1;
+        if (tx.segments[i] > 1) {
+            header.msg_control = tx.controls[i].buffer;
+            header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsghdr* control = CMSG_FIRSTHDR(&header);
+            control->cmsg_level = SOL_UDP;
+            control->cmsg_type = UDP_SEGMENT;
+            control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segment = static_cast<uint16_t>(tx.segment_sizes[i]);
+            std::memcpy(CMSG_DATA(control), &segment, sizeof(segment));
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < tx.count) {
+        int result = sendmmsg(fd, &tx.messages[sent], static_cast<unsigned int>(tx.count - sent), 0);
+        send_calls_.fetch_add(1, std::memory_order_relaxed);
+        if (result > 0) {
+            for (size_t i = sent; i < sent + static_cast<size_t>(result); ++i) {
+                if (tx.segments[i] > 1) {
+                    gso_datagrams_.fetch_add(tx.segments[i], std::memory_order_relaxed);
+                }
+            }
+            sent += static_cast<size_t>(result);
+            continue;
+        }
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (tx.segments[sent] > 1 && (errno == EIO || errno == EINVAL)) {
+            // Путь до адресата не поддерживает GSO - сегменты уходят по одному
+            gso = false;
+            static LogSite& site = Logger::site("udp.gso_fallback");
+            Logger::warning(site, "UDP GSO отклонено ядром (" + std::string(strerror(errno)) +
+                                 "), сокет переключен на отправку по одной датаграмме");
+            const uint8_t* data = static_cast<const uint8_t*>(tx.iovecs[sent].iov_base);
+            size_t total = tx.iovecs[sent].iov_len;
+            size_t segment = tx.segment_sizes[sent];
+            for (size_t offset = 0; offset < total; offset += segment) {
+                if (sendto(fd, data + offset, std::min(segment, total - offset), 0,
+                           reinterpret_cast<const sockaddr*>(&tx.names[sent]), tx.name_lengths[sent]) < 0) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                }
+                send_calls_.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else {
+            // Переполнен буфер сокета или адресат недоступен: UDP просто теряет датаграммы
+            dropped_.fetch_add(tx.segments[sent], std::memory_order_relaxed);
+        }
+        ++sent;
+    }
+    tx.clear();
+}
+
+void UdpRelay::sweep(int64_t now_ms) {
+    std::vector<std::shared_ptr<Session>> alive;
+    std::vector<std::shared_ptr<Session>> expired;
+    int64_t session_idle = static_cast<int64_t>(session_idle_seconds_.load()) * 1000;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = sessions_.begin(); it != sessions_.end();) {
+            if (now_ms - it->second->last_active_ms > session_idle) {
+                unregister(*it->second);
+                expired.push_back(it->second);
+                it = sessions_.erase(it);
+            } else {
+                alive.push_back(it->second);
+                ++it;
+            }
+        }
+    }
+
+    // Отображения и имена разбираются вне общей блокировки: обратный вызов
+    // резолвера берет блокировки в порядке имена -> ретранслятор
+    int64_t mapping_idle = static_cast<int64_t>(mapping_idle_seconds_.load()) * 1000;
+    for (auto& session : alive) {
+        for (auto it = session->mappings.begin(); it != session->mappings.end();) {
+            it = now_ms - it->second > mapping_idle ? session->mappings.erase(it) : std::next(it);
+        }
+        session->mapping_count.store(session->mappings.size(), std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(session->names_mutex);
+        for (auto it = session->names.begin(); it != session->names.end();) {
+            bool stale = !it->second.resolving && it->second.expires_ms <= now_ms;
+            it = stale ? session->names.erase(it) : std::next(it);
+        }
+    }
+
+    for (auto& session : expired) {
+        Logger::info("UDP ассоциация " + std::to_string(session->id) + " закрыта по простою");
+    }
+}
+
+void UdpRelay::render_metrics(std::ostream& out) {
+    size_t sessions = 0;
+    size_t mappings = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sessions = sessions_.size();
+        for (const auto& entry : sessions_) {
+            mappings += entry.second->mapping_count.load(std::memory_order_relaxed);
+        }
+    }
+    out << "udp_sessions " << sessions << "\n"
+        << "udp_sessions_total " << sessions_total_.load() << "\n"
+        << "udp_mappings " << mappings << "\n"
+        << "udp_datagrams_from_client_total " << datagrams_from_client_.load() << "\n"
+        << "udp_datagrams_from_target_total " << datagrams_from_target_.load() << "\n"
+        << "udp_bytes_from_client_total " << bytes_from_client_.load() << "\n"
+        << "udp_bytes_from_target_total " << bytes_from_target_.load() << "\n"
+        << "udp_dropped_total " << dropped_.load() << "\n"
+        << "udp_filtered_total " << filtered_.load() << "\n"
+        << "udp_denied_total " << denied_.load() << "\n"
+        << "udp_recv_calls_total " << recv_calls_.load() << "\n"
+        << "udp_send_calls_total " << send_calls_.load() << "\n"
+        << "udp_gso_datagrams_total " << gso_datagrams_.load() << "\n"
+        << "udp_gro_datagrams_total " << gro_datagrams_.load() << "\n";
+}
+
+int64_t UdpRelay::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        Clock::now().time_since_epoch()).count();
+}
+
+UdpRelay::EndpointKey UdpRelay::make_key(const sockaddr* address) {
+    EndpointKey key;
+    if (address->sa_family == AF_INET) {
+        const sockaddr_in* ipv4 = reinterpret_cast<const sockaddr_in*>(address);
+        key.bytes[10] = 0xff;
+        key.bytes[11] = 0xff;
+        std::memcpy(key.bytes.data() + 12, &ipv4->sin_addr, 4);
+        std::memcpy(key.bytes.data() + 16, &ipv4->sin_port, 2);
+    } else if (address->sa_family == AF_INET6) {
+        const sockaddr_in6* ipv6 = reinterpret_cast<const sockaddr_in6*>(address);
+        std::memcpy(key.bytes.data(), &ipv6->sin6_addr, 16);
+        std::memcpy(key.bytes.data() + 16, &ipv6->sin6_port, 2);
+    }
+    return key;
+}
+
+void UdpRelay::from_key(const EndpointKey& key, sockaddr_storage& out) {
+    static const uint8_t mapped_prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    std::memset(&out, 0, sizeof(out));
+    if (std::memcmp(key.bytes.data(), mapped_prefix, sizeof(mapped_prefix)) == 0) {
+        sockaddr_in* ipv4 = reinterpret_cast<sockaddr_in*>(&out);
+        ipv4->sin_family = AF_INET;
+        std::memcpy(&ipv4->sin_addr, key.bytes.data() + 12, 4);
+        std::memcpy(&ipv4->sin_port, key.bytes.data() + 16, 2);
+    } else {
+        sockaddr_in6* ipv6 = reinterpret_cast<sockaddr_in6*>(&out);
+        ipv6->sin6_family = AF_INET6;
+        std::memcpy(&ipv6->sin6_addr, key.bytes.data(), 16);
+        std::memcpy(&ipv6->sin6_port, key.bytes.data() + 16, 2);
+    }
+}
+
+bool UdpRelay::to_family(const sockaddr* address, int family, sockaddr_storage& out, socklen_t& length) {
+    // Через ключ адрес приводится к IPv4, если это ::ffff:a.b.c.d
+    sockaddr_storage normalized;
+    from_key(make_key(address), normalized);
+    if (normalized.ss_family == family) {
+        out = normalized;
+        length = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+        return true;
+    }
+    if (normalized.ss_family == AF_INET && family == AF_INET6) {
+        const sockaddr_in* ipv4 = reinterpret_cast<const sockaddr_in*>(&normalized);
+        std::memset(&out, 0, sizeof(out));
+        sockaddr_in6* mapped = reinterpret_cast<sockaddr_in6*>(&out);
+        mapped->sin6_family = AF_INET6;
+        mapped->sin6_addr.s6_addr[10] = 0xff;
+        mapped->sin6_addr.s6_addr[11] = 0xff;
+        std::memcpy(&mapped->sin6_addr.s6_addr[12], &ipv4->sin_addr, 4);
+        mapped->sin6_port = ipv4->sin_port;
+        length = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;  // IPv6 цель без IPv6 сокета
+}
+
+void UdpRelay::set_port(sockaddr_storage& address, int port) {
+    uint16_t network = htons(static_cast<uint16_t>(port));
+    if (address.ss_family == AF_INET6) {
+        reinterpret_cast<sockaddr_in6*>(&address)->sin6_port = network;
+    } else {
+        reinterpret_cast<sockaddr_in*>(&address)->sin_port = network;
+    }
+}
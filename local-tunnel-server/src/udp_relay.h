@@ -0,0 +1,197 @@
+#ifndef UDP_RELAY_H
+#define UDP_RELAY_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/socket.h>
+#include "config.h"
+#include "resolver.h"
+#include "access_policy.h"
+
+// Ретранслятор UDP для SOCKS5 UDP ASSOCIATE. Каждая ассоциация получает
+// сокет для датаграмм клиента и сокет для датаграмм целей; оба обслуживает
+// один поток на epoll. Датаграммы читаются и отправляются пачками
+// (recvmmsg/sendmmsg), а при поддержке ядром одинаковые по размеру
+// датаграммы одному адресату склеиваются (UDP GSO) и принимаются склеенными
+// (UDP GRO). Ответы принимаются только от целей, которым клиент сам отправлял
+// датаграммы (таблица отображений в духе NAT с истечением по простою).
+class UdpRelay {
+public:
+    UdpRelay(Resolver& resolver, AccessPolicy& policy);
+    ~UdpRelay();
+
+    void configure(const Config& config);
+    bool start();
+    void stop();
+    bool is_running() const { return running_.load(); }
+
+    // Открывает ассоциацию для клиента с адресом client (порт 0 - узнается по
+    // первой датаграмме); сокет клиента привязывается к local - адресу, на
+    // котором принято управляющее TCP соединение. Возвращает идентификатор
+    // (0 - отказ) и адрес сокета клиента в bound
+    uint64_t open(const sockaddr_storage& client, const sockaddr_storage& local,
+                  sockaddr_storage& bound);
+
+    // Закрытие при разрыве управляющего соединения; итоговые счетчики
+    // байт возвращаются, если ассоциация еще не закрыта по простою
+    void close(uint64_t id, uint64_t& bytes_from_client, uint64_t& bytes_from_target);
+
+    // Текущие счетчики байт. false - ассоциация закрыта по простою или остановке
+    bool session_bytes(uint64_t id, uint64_t& bytes_from_client, uint64_t& bytes_from_target) const;
+
+    void render_metrics(std::ostream& out);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Буфер на датаграмму: при GRO ядро отдает склеенные датаграммы одного
+    // отправителя одним буфером до 64 КБ
+    static constexpr size_t SLOT_SIZE = 65536;
+    // Склеиваются только датаграммы, проходящие без фрагментации при MTU 1500
+    static constexpr size_t GSO_MAX_SEGMENT = 1472;
+    static constexpr size_t GSO_MAX_SEGMENTS = 64;
+    static constexpr size_t GSO_MAX_BYTES = 65000;
+    // Наибольшая полезная нагрузка UDP датаграммы по семейству адресата
+    static constexpr size_t MAX_UDP_PAYLOAD_V4 = 65507;
+    static constexpr size_t MAX_UDP_PAYLOAD_V6 = 65527;
+    // Датаграммы с доменным адресом, ожидающие разрешения имени
+    static constexpr size_t MAX_PENDING_PER_NAME = 8;
+    static constexpr int NAME_TTL_MS = 30000;
+
+    struct RxBatch;
+    struct TxBatch;
+
+    // Адрес IPv6 (IPv4 - в виде ::ffff:a.b.c.d) и порт
+    struct EndpointKey {
+        std::array<uint8_t, 18> bytes{};
+        bool operator==(const EndpointKey& other) const { return bytes == other.bytes; }
+    };
+
+    struct EndpointHash {
+        size_t operator()(const EndpointKey& key) const;
+    };
+
+    // Датаграмма, ожидающая разрешения имени цели
+    struct PendingDatagram {
+        int port;
+        std::string payload;
+    };
+
+    struct NameEntry {
+        sockaddr_storage address{};  // Порт не задан; семейство - как у сокета целей
+        socklen_t length{0};
+        bool denied{false};
+        bool resolving{true};
+        int64_t expires_ms{0};
+        std::vector<PendingDatagram> pending;
+    };
+
+    // Датаграмма с разрешенным именем, которую отправит поток ретранслятора
+    struct ResolvedDatagram {
+        sockaddr_storage address;
+        socklen_t length;
+        std::string payload;
+    };
+
+    struct Session : std::enable_shared_from_this<Session> {
+        uint64_t id{0};
+        int client_fd{-1};
+        int outbound_fd{-1};
+        int outbound_family{AF_INET6};
+        sockaddr_storage client{};
+        socklen_t client_length{0};
+        EndpointKey client_key;
+        bool client_port_known{false};
+        bool client_gso{true};
+        bool outbound_gso{true};
+        int64_t last_active_ms{0};
+
+        // Только поток ретранслятора: время последней датаграммы каждой цели
+        std::unordered_map<EndpointKey, int64_t, EndpointHash> mappings;
+        std::atomic<size_t> mapping_count{0};
+
+        // Заполняются и из потоков резолвера
+        std::mutex names_mutex;
+        std::unordered_map<std::string, NameEntry> names;
+        std::vector<ResolvedDatagram> resolved;
+
+        std::atomic<uint64_t> bytes_from_client{0};
+        std::atomic<uint64_t> bytes_from_target{0};
+
+        ~Session();
+    };
+
+    Resolver& resolver_;
+    AccessPolicy& policy_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, std::shared_ptr<Session>> sessions_;
+    std::vector<uint64_t> ready_;  // Ассоциации с разрешенными именами
+    uint64_t next_id_{1};
+    int epoll_fd_{-1};
+    int wake_fd_{-1};
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    // Настройки (batch_size и буферы применяются при запуске)
+    std::atomic<int> batch_size_{32};
+    std::atomic<int> buffer_kb_{1024};
+    std::atomic<int> mapping_idle_seconds_{60};
+    std::atomic<int> session_idle_seconds_{300};
+    std::atomic<size_t> max_sessions_{1024};
+    std::atomic<size_t> max_mappings_{256};
+    std::atomic<bool> gso_wanted_{true};
+    std::atomic<bool> gro_wanted_{true};
+    bool gso_supported_{false};
+    bool gro_supported_{false};
+
+    std::atomic<uint64_t> sessions_total_{0};
+    std::atomic<uint64_t> datagrams_from_client_{0};
+    std::atomic<uint64_t> datagrams_from_target_{0};
+    std::atomic<uint64_t> bytes_from_client_{0};
+    std::atomic<uint64_t> bytes_from_target_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> filtered_{0};
+    std::atomic<uint64_t> denied_{0};
+    std::atomic<uint64_t> recv_calls_{0};
+    std::atomic<uint64_t> send_calls_{0};
+    std::atomic<uint64_t> gso_datagrams_{0};
+    std::atomic<uint64_t> gro_datagrams_{0};
+
+    void loop();
+    void sweep(int64_t now_ms);
+    void unregister(const Session& session);
+    std::shared_ptr<Session> find(uint64_t id) const;
+    void on_client_readable(Session& session, RxBatch& rx, TxBatch& tx, int64_t now_ms);
+    void on_outbound_readable(Session& session, RxBatch& rx, TxBatch& tx, int64_t now_ms);
+    void on_resolved(Session& session, TxBatch& tx, int64_t now_ms);
+    void forward(Session& session, const uint8_t* data, size_t size, TxBatch& tx, int64_t now_ms);
+    bool add_mapping(Session& session, const EndpointKey& key, const sockaddr* address,
+                     bool check_policy, int64_t now_ms);
+    void forward_named(Session& session, const std::string& host, int port,
+                       const uint8_t* payload, size_t size, TxBatch& tx, int64_t now_ms);
+    void resolved(const std::weak_ptr<Session>& weak, const std::string& host, const ResolveResult& result);
+    void queue(TxBatch& tx, int fd, bool& gso, const sockaddr_storage& address, socklen_t length,
+               const uint8_t* header, size_t header_size, const uint8_t* payload, size_t size);
+    void flush(TxBatch& tx, int fd, bool& gso);
+
+    static int64_t now_ms();
+    static EndpointKey make_key(const sockaddr* address);
+    static bool to_family(const sockaddr* address, int family, sockaddr_storage& out, socklen_t& length);
+    static void from_key(const EndpointKey& key, sockaddr_storage& out);
+    static void set_port(sockaddr_storage& address, int port);
+
+    UdpRelay(const UdpRelay&) = delete;
+    UdpRelay& operator=(const UdpRelay&) = delete;
+};
+
+#endif // UDP_RELAY_H
@@ -0,0 +1,9 @@
+#ifndef UINT128_H
+#define UINT128_H
+
+// 128-битное беззнаковое целое для произведений 64x64 в X25519 и Poly1305.
+// __int128 - расширение GCC/Clang; __extension__ убирает предупреждение
+// -pedantic
+__extension__ typedef unsigned __int128 uint128_t;
+
+#endif // UINT128_H
@@ -0,0 +1,499 @@
+#include "upstream.h"
+#include "logger.h"
+#include "metrics.h"
+#include "utils.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Число точек кольца на единицу веса
+const int VIRTUAL_NODES_PER_WEIGHT = 100;
+
+int64_t elapsed_us(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+bool is_connection_alive(int socket) {
+    char byte;
+    ssize_t result = recv(socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (result == 0) {
+        return false;  // Прокси закрыл соединение
+    }
+    if (result < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return false;  // Неожиданные данные в простаивающем соединении
+}
+
+} // namespace
+
+UpstreamParent::~UpstreamParent() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    for (const auto& connection : pool) {
+        close(connection.socket);
+    }
+    pool.clear();
+}
+
+UpstreamManager::UpstreamManager() : set_(std::make_shared<UpstreamSet>()) {
+    Metrics::register_provider("upstream", [this](std::ostream& out) {
+        render_metrics(out);
+    });
+}
+
+UpstreamManager::~UpstreamManager() {
+    Metrics::unregister_provider("upstream");
+    stop();
+}
+
+uint64_t UpstreamManager::hash_key(const std::string& key) {
+    // FNV-1a с финальным перемешиванием для равномерного распределения по кольцу
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        hash ^= (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c | 0x20) : c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool UpstreamManager::parse_parent(const std::string& line, UpstreamParent& parent, std::string& error) {
+    // Формат: "<имя> <хост>:<порт> [weight=N] [group=G]"
+    std::istringstream iss(line);
+    std::string address;
+    if (!(iss >> parent.name >> address)) {
+        error = "ожидается '<имя> <хост>:<порт>'";
+        return false;
+    }
+    if (!Utils::parse_address(address, parent.host, parent.port)) {
+        error = "неверный адрес '" + address + "'";
+        return false;
+    }
+
+    parent.group = "default";
+    std::string option;
+    while (iss >> option) {
+        if (option.compare(0, 7, "weight=") == 0) {
+            try {
+                parent.weight = std::stoi(option.substr(7));
+            } catch (const std::exception&) {
+                parent.weight = 0;
+            }
+            if (parent.weight < 1 || parent.weight > 100) {
+                error = "вес должен быть от 1 до 100";
+                return false;
+            }
+        } else if (option.compare(0, 6, "group=") == 0 && option.size() > 6) {
+            parent.group = option.substr(6);
+        } else {
+            error = "неизвестный параметр '" + option + "'";
+            return false;
+        }
+    }
+
+    // Адрес прокси разрешается один раз при загрузке
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    int rc = getaddrinfo(parent.host.c_str(), std::to_string(parent.port).c_str(), &hints, &result);
+    if (rc != 0 || !result) {
+        error = "не удалось разрешить " + parent.host + ": " + gai_strerror(rc);
+        return false;
+    }
+    std::memcpy(&parent.address, result->ai_addr, result->ai_addrlen);
+    parent.address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+bool UpstreamManager::load(const Config& config) {
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    auto previous = current();
+
+    auto set = std::make_shared<UpstreamSet>();
+    set->pool_size = std::max(0, config.get_upstream_pool_size());
+    set->connect_timeout_ms = std::max(1, config.get_upstream_connect_timeout()) * 1000;
+    set->health_interval = std::max(1, config.get_upstream_health_interval());
+    set->max_idle = std::max(1, config.get_upstream_max_idle());
+    set->failure_threshold = std::max(1, config.get_upstream_failure_threshold());
+
+    for (const auto& line : config.get_upstream_parents()) {
+        auto parent = std::make_shared<UpstreamParent>();
+        std::string error;
+        if (!parse_parent(Utils::trim(line), *parent, error)) {
+            Logger::error("Неверное описание вышестоящего прокси '" + line + "': " + error);
+            return false;
+        }
+        for (const auto& existing : set->parents) {
+            if (existing->name == parent->name) {
+                Logger::error("Повторное имя вышестоящего прокси: " + parent->name);
+                return false;
+            }
+        }
+        // Неизмененный прокси переносится вместе со здоровьем, счетчиками и пулом
+        for (const auto& old : previous->parents) {
+            if (old->name == parent->name && old->host == parent->host && old->port == parent->port &&
+                old->weight == parent->weight && old->group == parent->group &&
+                old->address_length == parent->address_length &&
+                std::memcmp(&old->address, &parent->address, parent->address_length) == 0) {
+                parent = old;
+                break;
+            }
+        }
+        set->parents.push_back(parent);
+    }
+
+    // Кольца: по группе и по имени каждого прокси (маршрут на конкретный узел)
+    for (uint32_t index = 0; index < set->parents.size(); ++index) {
+        const auto& parent = set->parents[index];
+        int points = parent->weight * VIRTUAL_NODES_PER_WEIGHT;
+        for (int i = 0; i < points; ++i) {
+            uint64_t hash = hash_key(parent->name + "#" + std::to_string(i));
+            set->rings[parent->group].push_back(UpstreamSet::RingPoint{hash, index});
+            if (parent->name != parent->group) {
+                set->rings[parent->name].push_back(UpstreamSet::RingPoint{hash, index});
+            }
+        }
+    }
+    for (auto& ring : set->rings) {
+        std::sort(ring.second.begin(), ring.second.end(),
+                  [](const UpstreamSet::RingPoint& a, const UpstreamSet::RingPoint& b) {
+                      return a.hash < b.hash;
+                  });
+    }
+
+    size_t count = set->parents.size();
+    size_t groups = set->rings.size();
+    std::atomic_store(&set_, std::shared_ptr<const UpstreamSet>(std::move(set)));
+    wait_cv_.notify_all();
+
+    if (count > 0) {
+        Logger::info("Загружено вышестоящих прокси: " + std::to_string(count) +
+                     ", маршрутов: " + std::to_string(groups));
+    }
+    return true;
+}
+
+std::shared_ptr<const UpstreamSet> UpstreamManager::current() const {
+    return std::atomic_load(&set_);
+}
+
+bool UpstreamManager::has_group(const std::string& group) const {
+    auto set = current();
+    return set->rings.count(group) > 0;
+}
+
+void UpstreamManager::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    maintenance_thread_ = std::make_unique<std::thread>(&UpstreamManager::maintenance_loop, this);
+}
+
+void UpstreamManager::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    wait_cv_.notify_all();
+    if (maintenance_thread_ && maintenance_thread_->joinable()) {
+        maintenance_thread_->join();
+    }
+}
+
+std::vector<uint32_t> UpstreamManager::candidates(const UpstreamSet& set, const std::string& group,
+                                                  const std::string& host) const {
+    std::vector<uint32_t> order;
+    auto ring_it = set.rings.find(group);
+    if (ring_it == set.rings.end() || ring_it->second.empty()) {
+        return order;
+    }
+
+    // Первый узел кольца после хеша хоста - основной, далее по часовой
+    // стрелке следующие различные прокси. Доля точек на кольце пропорциональна
+    // весу, поэтому при отказе нагрузка распределяется с учетом весов.
+    const auto& ring = ring_it->second;
+    uint64_t hash = hash_key(host);
+    auto it = std::lower_bound(ring.begin(), ring.end(), hash,
+                               [](const UpstreamSet::RingPoint& point, uint64_t value) {
+                                   return point.hash < value;
+                               });
+    size_t start = (it == ring.end()) ? 0 : static_cast<size_t>(it - ring.begin());
+
+    std::vector<bool> seen(set.parents.size(), false);
+    for (size_t step = 0; step < ring.size(); ++step) {
+        uint32_t parent = ring[(start + step) % ring.size()].parent;
+        if (!seen[parent]) {
+            seen[parent] = true;
+            order.push_back(parent);
+        }
+    }
+    return order;
+}
+
+void UpstreamManager::update_ewma(std::atomic<int64_t>& value, int64_t sample) {
+    int64_t current = value.load(std::memory_order_relaxed);
+    int64_t next = current == 0 ? sample : current + (sample - current) / 8;
+    value.store(next, std::memory_order_relaxed);
+}
+
+int UpstreamManager::dial(UpstreamParent& parent, const UpstreamSet& set) {
+    auto start = Clock::now();
+    int sock = Utils::connect_with_timeout(reinterpret_cast<const sockaddr*>(&parent.address),
+                                           parent.address_length, set.connect_timeout_ms);
+    if (sock >= 0) {
+        update_ewma(parent.dial_latency_us, elapsed_us(start));
+    }
+    return sock;
+}
+
+int UpstreamManager::acquire_connection(UpstreamParent& parent, const UpstreamSet& set, bool& pooled) {
+    pooled = false;
+    {
+        std::lock_guard<std::mutex> lock(parent.pool_mutex);
+        auto now = Clock::now();
+        while (!parent.pool.empty()) {
+            UpstreamParent::PooledConnection connection = parent.pool.front();
+            parent.pool.pop_front();
+            if (now - connection.created < std::chrono::seconds(set.max_idle) &&
+                is_connection_alive(connection.socket)) {
+                parent.pool_hits.fetch_add(1, std::memory_order_relaxed);
+                pooled = true;
+                return connection.socket;
+            }
+            close(connection.socket);
+        }
+    }
+    wait_cv_.notify_all();  // Пул опустел - пусть фоновый поток пополнит его
+    return dial(parent, set);
+}
+
+bool UpstreamManager::send_connect(int socket, const std::string& host, int port,
+                                   int timeout_ms, int& status) {
+    std::string authority = (host.find(':') != std::string::npos && host.front() != '[')
+                                ? "[" + host + "]:" + std::to_string(port)
+                                : host + ":" + std::to_string(port);
+    std::string request = "CONNECT " + authority + " HTTP/1.1\r\n"
+                          "Host: " + authority + "\r\n"
+                          "\r\n";
+    iovec iov{const_cast<char*>(request.data()), request.size()};
+    if (!Utils::send_all(socket, &iov, 1)) {
+        return false;
+    }
+
+    // Ответ читается побайтово: данные туннеля после заголовков
+    // не должны попасть в наш буфер
+    std::string response;
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (response.size() < 8192) {
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - Clock::now()).count());
+        if (remaining <= 0) {
+            return false;
+        }
+        pollfd pfd{socket, POLLIN, 0};
+        int ready = poll(&pfd, 1, remaining);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return false;
+        }
+        char c;
+        if (recv(socket, &c, 1, 0) != 1) {
+            return false;
+        }
+        response += c;
+        if (response.size() >= 4 && response.compare(response.size() - 4, 4, "\r\n\r\n") == 0) {
+            break;
+        }
+    }
+
+    // "HTTP/1.1 200 Connection established"
+    std::istringstream iss(response);
+    std::string version;
+    status = 0;
+    iss >> version >> status;
+    return version.compare(0, 5, "HTTP/") == 0;
+}
+
+void UpstreamManager::record_success(UpstreamParent& parent) {
+    parent.consecutive_failures.store(0, std::memory_order_relaxed);
+    if (!parent.healthy.exchange(true)) {
+        Logger::info("Вышестоящий прокси " + parent.name + " снова доступен");
+    }
+}
+
+void UpstreamManager::record_failure(UpstreamParent& parent, const UpstreamSet& set,
+                                     const std::string& reason) {
+    parent.failures.fetch_add(1, std::memory_order_relaxed);
+    int failures = parent.consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (failures >= set.failure_threshold && parent.healthy.exchange(false)) {
+        Logger::warning("Вышестоящий прокси " + parent.name + " помечен недоступным: " + reason);
+    }
+}
+
+int UpstreamManager::open_tunnel(const std::string& group, const std::string& host, int port,
+                                 std::string& parent_name) {
+    auto set = current();
+    std::vector<uint32_t> order = candidates(*set, group, host);
+    if (order.empty()) {
+        Logger::error("Нет вышестоящих прокси для маршрута '" + group + "'");
+        return -1;
+    }
+
+    // Недоступные прокси пропускаются; если доступных нет совсем,
+    // пробуем все по порядку кольца, чтобы не отказывать по устаревшему статусу
+    bool any_healthy = false;
+    for (uint32_t index : order) {
+        any_healthy = any_healthy || set->parents[index]->healthy.load();
+    }
+
+    for (uint32_t index : order) {
+        UpstreamParent& parent = *set->parents[index];
+        if (any_healthy && !parent.healthy.load()) {
+            continue;
+        }
+
+        parent.requests.fetch_add(1, std::memory_order_relaxed);
+        auto start = Clock::now();
+
+        bool pooled = false;
+        int sock = acquire_connection(parent, *set, pooled);
+        if (sock < 0) {
+            record_failure(parent, *set, std::string("подключение: ") + strerror(errno));
+            continue;
+        }
+
+        int status = 0;
+        bool answered = send_connect(sock, host, port, set->connect_timeout_ms, status);
+        if (!answered && pooled) {
+            // Соединение из пула могло быть закрыто прокси по простою - это
+            // не отказ прокси: одна повторная попытка через новое соединение
+            close(sock);
+            sock = dial(parent, *set);
+            if (sock < 0) {
+                record_failure(parent, *set, std::string("подключение: ") + strerror(errno));
+                continue;
+            }
+            answered = send_connect(sock, host, port, set->connect_timeout_ms, status);
+        }
+        if (!answered) {
+            close(sock);
+            record_failure(parent, *set, "нет ответа на CONNECT");
+            continue;
+        }
+
+        // Прокси ответил - он исправен, даже если отказал в туннеле
+        record_success(parent);
+        if (status != 200) {
+            close(sock);
+            Logger::warning("Вышестоящий прокси " + parent.name + " отказал в CONNECT к " +
+                            host + ":" + std::to_string(port) + " (статус " + std::to_string(status) + ")");
+            return -1;
+        }
+
+        update_ewma(parent.tunnel_latency_us, elapsed_us(start));
+        parent_name = parent.name;
+        return sock;
+    }
+
+    Logger::error("Все вышестоящие прокси маршрута '" + group + "' недоступны");
+    return -1;
+}
+
+void UpstreamManager::maintain_parent(UpstreamParent& parent, const UpstreamSet& set) {
+    auto now = Clock::now();
+
+    // Удаление устаревших и закрытых прокси соединений
+    size_t idle = 0;
+    {
+        std::lock_guard<std::mutex> lock(parent.pool_mutex);
+        auto it = parent.pool.begin();
+        while (it != parent.pool.end()) {
+            if (now - it->created >= std::chrono::seconds(set.max_idle) || !is_connection_alive(it->socket)) {
+                close(it->socket);
+                it = parent.pool.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        idle = parent.pool.size();
+    }
+
+    if (!parent.healthy.load()) {
+        // Активная проверка недоступного прокси не чаще health_check_interval
+        if (now - parent.last_probe < std::chrono::seconds(set.health_interval)) {
+            return;
+        }
+        parent.last_probe = now;
+        int sock = dial(parent, set);
+        if (sock < 0) {
+            return;
+        }
+        record_success(parent);
+        std::lock_guard<std::mutex> lock(parent.pool_mutex);
+        parent.pool.push_back(UpstreamParent::PooledConnection{sock, Clock::now()});
+        return;
+    }
+
+    // Пополнение пула до pool_size
+    while (running_.load() && idle < static_cast<size_t>(set.pool_size)) {
+        int sock = dial(parent, set);
+        if (sock < 0) {
+            record_failure(parent, set, std::string("подключение: ") + strerror(errno));
+            return;
+        }
+        std::lock_guard<std::mutex> lock(parent.pool_mutex);
+        parent.pool.push_back(UpstreamParent::PooledConnection{sock, Clock::now()});
+        idle = parent.pool.size();
+    }
+}
+
+void UpstreamManager::maintenance_loop() {
+    while (running_.load()) {
+        auto set = current();
+        for (const auto& parent : set->parents) {
+            if (!running_.load()) {
+                break;
+            }
+            maintain_parent(*parent, *set);
+        }
+
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        wait_cv_.wait_for(lock, std::chrono::seconds(1), [this] { return !running_.load(); });
+    }
+}
+
+void UpstreamManager::render_metrics(std::ostream& out) const {
+    auto set = current();
+    for (const auto& parent : set->parents) {
+        size_t idle;
+        {
+            std::lock_guard<std::mutex> lock(parent->pool_mutex);
+            idle = parent->pool.size();
+        }
+        std::string labels = "{parent=\"" + parent->name + "\",group=\"" + parent->group + "\"}";
+        out << "upstream_healthy" << labels << " " << (parent->healthy.load() ? 1 : 0) << "\n"
+            << "upstream_dial_latency_us" << labels << " " << parent->dial_latency_us.load() << "\n"
+            << "upstream_tunnel_latency_us" << labels << " " << parent->tunnel_latency_us.load() << "\n"
+            << "upstream_requests_total" << labels << " " << parent->requests.load() << "\n"
+            << "upstream_failures_total" << labels << " " << parent->failures.load() << "\n"
+            << "upstream_pool_hits_total" << labels << " " << parent->pool_hits.load() << "\n"
+            << "upstream_pool_idle" << labels << " " << idle << "\n";
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+#include <sys/socket.h>
+#include "config.h"
+
+// Вышестоящий (родительский) HTTP прокси, умеющий CONNECT
+struct UpstreamParent {
+    std::string name;
+    std::string host;
+    int port{0};
+    int weight{1};
+    std::string group;
+
+    sockaddr_storage address{};
+    socklen_t address_length{0};
+
+    // Состояние здоровья
+    std::atomic<bool> healthy{true};
+    std::atomic<int> consecutive_failures{0};
+    std::chrono::steady_clock::time_point last_probe{};
+
+    // Сглаженные задержки (EWMA) в микросекундах
+    std::atomic<int64_t> dial_latency_us{0};
+    std::atomic<int64_t> tunnel_latency_us{0};
+
+    // Счетчики
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> pool_hits{0};
+
+    // Пул заранее установленных TCP соединений
+    struct PooledConnection {
+        int socket;
+        std::chrono::steady_clock::time_point created;
+    };
+    std::mutex pool_mutex;
+    std::deque<PooledConnection> pool;
+
+    ~UpstreamParent();
+};
+
+// Неизменяемая топология: список прокси и кольца консистентного
+// хеширования по группам. Состояние прокси (здоровье, пул) изменяемо.
+struct UpstreamSet {
+    struct RingPoint {
+        uint64_t hash;
+        uint32_t parent;
+    };
+
+    std::vector<std::shared_ptr<UpstreamParent>> parents;
+    std::map<std::string, std::vector<RingPoint>> rings;
+
+    int pool_size{2};
+    int connect_timeout_ms{5000};
+    int health_interval{5};
+    int max_idle{30};
+    int failure_threshold{3};
+};
+
+// Подсистема вышестоящих прокси: выбор родителя консистентным хешированием
+// по целевому хосту, переключение на следующий узел кольца при отказе,
+// пул предустановленных соединений и фоновая проверка здоровья.
+class UpstreamManager {
+public:
+    UpstreamManager();
+    ~UpstreamManager();
+
+    bool load(const Config& config);
+    void start();
+    void stop();
+
+    bool has_group(const std::string& group) const;
+
+    // Открывает туннель к host:port через прокси группы. Возвращает
+    // сокет туннеля или -1; имя выбранного прокси - в parent_name
+    int open_tunnel(const std::string& group, const std::string& host, int port,
+                    std::string& parent_name);
+
+    void render_metrics(std::ostream& out) const;
+
+    static uint64_t hash_key(const std::string& key);
+
+private:
+    std::shared_ptr<const UpstreamSet> set_;
+    std::mutex load_mutex_;
+
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> maintenance_thread_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+
+    std::shared_ptr<const UpstreamSet> current() const;
+    std::vector<uint32_t> candidates(const UpstreamSet& set, const std::string& group,
+                                     const std::string& host) const;
+
+    // pooled - сокет взят из пула, а не установлен заново
+    int acquire_connection(UpstreamParent& parent, const UpstreamSet& set, bool& pooled);
+    int dial(UpstreamParent& parent, const UpstreamSet& set);
+    bool send_connect(int socket, const std::string& host, int port, int timeout_ms, int& status);
+
+    void record_success(UpstreamParent& parent);
+    void record_failure(UpstreamParent& parent, const UpstreamSet& set, const std::string& reason);
+
+    void maintenance_loop();
+    void maintain_parent(UpstreamParent& parent, const UpstreamSet& set);
+
+    static bool parse_parent(const std::string& line, UpstreamParent& parent, std::string& error);
+    static void update_ewma(std::atomic<int64_t>& value, int64_t sample);
+};
+
+#endif // UPSTREAM_H
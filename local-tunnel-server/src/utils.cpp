@@ -6,6 +6,14 @@
 #include <fstream>
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
 
 namespace Utils {
 
@@ -45,6 +53,11 @@ std::string get_current_time() {
     return ss.str();
 }
 
+uint64_t unix_time_ms() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
 std::string format_bytes(size_t bytes) {
     const char* suffixes[] = {"B", "KB", "MB", "GB", "TB"};
     int suffix_index = 0;
@@ -94,4 +107,154 @@ bool file_exists(const std::string& filename) {
     return file.good();
 }
 
+int connect_with_timeout(const sockaddr* addr, socklen_t addr_len, int timeout_ms) {
+    int sock = socket(addr->sa_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    
+    if (connect(sock, addr, addr_len) < 0) {
+        if (errno != EINPROGRESS) {
+            int saved = errno;
+            close(sock);
+            errno = saved;
+            return -1;
+        }
+        
+        pollfd pfd{sock, POLLOUT, 0};
+        int ready;
+        do {
+            ready = poll(&pfd, 1, timeout_ms);
+        } while (ready < 0 && errno == EINTR);
+        
+        if (ready <= 0) {
+            int saved = ready == 0 ? ETIMEDOUT : errno;
+            close(sock);
+            errno = saved;
+            return -1;
+        }
+        
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len);
+        if (error != 0) {
+            close(sock);
+            errno = error;
+            return -1;
+        }
+    }
+    
+    fcntl(sock, F_SETFL, flags);
+    return sock;
+}
+
+void set_socket_timeouts(int socket, int seconds) {
+    struct timeval timeout;
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+bool send_all(int socket, iovec* iov, size_t count) {
+    while (count > 0) {
+        // Больше IOV_MAX буферов sendmsg не принимает (EMSGSIZE) - остаток
+        // уходит следующими вызовами
+        msghdr message{};
+        message.msg_iov = iov;
+        message.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+        ssize_t sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        size_t left = static_cast<size_t>(sent);
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+std::string address_to_string(const sockaddr* addr) {
+    char buffer[INET6_ADDRSTRLEN] = {0};
+    if (addr->sa_family == AF_INET) {
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(addr)->sin_addr, buffer, sizeof(buffer));
+    } else if (addr->sa_family == AF_INET6) {
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6*>(addr)->sin6_addr, buffer, sizeof(buffer));
+    }
+    return buffer;
+}
+
+bool constant_time_equals(const std::string& a, const std::string& b) {
+    // Длина не скрывается, но содержимое сравнивается целиком
+    unsigned char difference = a.size() == b.size() ? 0 : 1;
+    size_t length = std::max(a.size(), b.size());
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char x = i < a.size() ? static_cast<unsigned char>(a[i]) : 0;
+        unsigned char y = i < b.size() ? static_cast<unsigned char>(b[i]) : 0;
+        difference |= x ^ y;
+    }
+    return difference == 0;
+}
+
+std::string base64_encode(const std::string& data) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string text;
+    text.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t chunk = static_cast<uint8_t>(data[i]) << 16;
+        if (i + 1 < data.size()) chunk |= static_cast<uint8_t>(data[i + 1]) << 8;
+        if (i + 2 < data.size()) chunk |= static_cast<uint8_t>(data[i + 2]);
+        text += alphabet[chunk >> 18 & 63];
+        text += alphabet[chunk >> 12 & 63];
+        text += i + 1 < data.size() ? alphabet[chunk >> 6 & 63] : '=';
+        text += i + 2 < data.size() ? alphabet[chunk & 63] : '=';
+    }
+    return text;
+}
+
+bool base64_decode(const std::string& text, std::string& data) {
+    auto digit = [](char c) -> int {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '+') return 62;
+        if (c == '/') return 63;
+        return -1;
+    };
+    if (text.size() % 4 != 0) {
+        return false;
+    }
+    data.clear();
+    data.reserve(text.size() / 4 * 3);
+    for (size_t i = 0; i < text.size(); i += 4) {
+        bool last = i + 4 == text.size();
+        size_t padding = last ? (text[i + 3] == '=') + (text[i + 2] == '=') : 0;
+        uint32_t chunk = 0;
+        for (size_t k = 0; k < 4; ++k) {
+            int value = k >= 4 - padding ? 0 : digit(text[i + k]);
+            if (value < 0) {
+                return false;
+            }
+            chunk = chunk << 6 | static_cast<uint32_t>(value);
+        }
+        data += static_cast<char>(chunk >> 16);
+        if (padding < 2) data += static_cast<char>(chunk >> 8 & 0xff);
+        if (padding < 1) data += static_cast<char>(chunk & 0xff);
+    }
+    return true;
+}
+
 } // namespace Utils
\ No newline at end of file
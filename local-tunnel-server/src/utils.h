@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 namespace Utils {
     // Проверка IP адреса
@@ -17,6 +20,9 @@ namespace Utils {
     // Получение текущего времени в строковом формате
     std::string get_current_time();
     
+    // Текущее время в миллисекундах от эпохи Unix
+    uint64_t unix_time_ms();
+    
     // Преобразование байт в читаемый формат
     std::string format_bytes(size_t bytes);
     
@@ -28,6 +34,27 @@ namespace Utils {
     
     // Проверка существования файла
     bool file_exists(const std::string& filename);
+    
+    // TCP подключение с ограничением времени. Возвращает блокирующий сокет
+    // или -1 (errno содержит причину, ETIMEDOUT при истечении таймаута)
+    int connect_with_timeout(const sockaddr* addr, socklen_t addr_len, int timeout_ms);
+    
+    // Установка таймаутов чтения и записи сокета в секундах
+    void set_socket_timeouts(int socket, int seconds);
+    
+    // Отправка нескольких буферов с дозаписью при частичной отправке (iov
+    // изменяется), не больше IOV_MAX за вызов. false - ошибка или таймаут сокета
+    bool send_all(int socket, iovec* iov, size_t count);
+    
+    // Текстовое представление адреса сокета (без порта)
+    std::string address_to_string(const sockaddr* addr);
+    
+    // Сравнение секретов за время, не зависящее от позиции первого различия
+    bool constant_time_equals(const std::string& a, const std::string& b);
+    
+    // Base64 (RFC 4648) с дополнением '='. false - недопустимый символ или длина
+    std::string base64_encode(const std::string& data);
+    bool base64_decode(const std::string& text, std::string& data);
 }
 
 #endif // UTILS_H
\ No newline at end of file
@@ -1,8 +1,13 @@
 #include "vpn_server.h"
 #include "logger.h"
 #include "utils.h"
+#include "metrics.h"
+#include "cpu_topology.h"
+#include "tracer.h"
+#include "heavy_hitters.h"
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -28,81 +33,104 @@ std::string get_timestamp() {
 VPNServer* VPNServer::instance_ = nullptr;
 
 VPNServer::VPNServer(const std::string& config_file) 
-    : config_(config_file) {
+    : config_(std::make_shared<const Config>(config_file)), context_{config_, policy_, upstreams_, breakers_, resolver_, memory_, parker_, access_log_, udp_relay_, cache_, capture_, identity_, sessions_, tap_, filters_, credentials_} {
     
     // Установка обработчика сигналов
     instance_ = this;
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
+    std::signal(SIGHUP, signal_handler);
+    std::signal(SIGUSR1, signal_handler);
+    std::signal(SIGUSR2, signal_handler);
+    
+    Metrics::register_provider("server", [this](std::ostream& out) {
+        ServerStatus status = get_status();
+        out << "server_active_clients " << status.active_clients << "\n";
+        render_worker_metrics(out);
+    });
     
     std::cout << get_timestamp() << " [INFO] VPN сервер инициализирован" << std::endl;
 }
 
 VPNServer::~VPNServer() {
     stop();
+    Metrics::unregister_provider("server");
     instance_ = nullptr;
 }
 
 bool VPNServer::start() {
+    std::shared_ptr<const Config> config = config_.current();
     if (running_.load()) {
         Logger::warning("Сервер уже запущен");
         return false;
     }
 
-    // Создание серверного сокета
-    server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket_ < 0) {
-        Logger::error("Не удалось создать серверный сокет");
-        return false;
-    }
-
-    // Настройка сокета для повторного использования адреса
-    int opt = 1;
-    if (setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        Logger::error("Не удалось настроить SO_REUSEADDR");
-        close(server_socket_);
+    // Загрузка политики доступа до начала приема соединений
+    if (!policy_.load(*config)) {
+        Logger::error("Не удалось загрузить политику доступа");
         return false;
     }
-
-    // Настройка адреса сервера
-    sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(config_.get_server_port());
     
-    if (config_.get_server_host() == "0.0.0.0") {
-        server_addr.sin_addr.s_addr = INADDR_ANY;
-    } else {
-        if (inet_pton(AF_INET, config_.get_server_host().c_str(), &server_addr.sin_addr) <= 0) {
-            Logger::error("Некорректный IP адрес сервера: " + config_.get_server_host());
-            close(server_socket_);
-            return false;
-        }
+    if (!upstreams_.load(*config)) {
+        Logger::error("Не удалось загрузить вышестоящие прокси");
+        return false;
     }
-
-    // Привязка сокета к адресу
-    if (bind(server_socket_, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
-        Logger::error("Не удалось привязать сокет к адресу " + 
-                     config_.get_server_host() + ":" + std::to_string(config_.get_server_port()));
-        close(server_socket_);
+    if (!credentials_.load(*config)) {
+        Logger::error("Не удалось загрузить пользователей");
         return false;
     }
-
-    // Начало прослушивания
-    if (listen(server_socket_, config_.get_max_connections()) < 0) {
-        Logger::error("Не удалось начать прослушивание сокета");
-        close(server_socket_);
+    breakers_.configure(*config);
+    resolver_.configure(*config);
+    memory_.configure(*config);
+    Tracer::configure(*config);
+    HeavyHitters::configure(*config);
+    access_log_.configure(*config);
+    udp_relay_.configure(*config);
+    cache_.configure(*config);
+    capture_.configure(*config);
+    identity_.configure(*config);
+    sessions_.configure(*config);
+    tap_.configure(*config);
+    filters_.configure(*config);
+    Logger::set_rate_limit(config->get_log_rate_limit(), config->get_log_rate_burst());
+    Logger::set_debug_sampling(config->get_log_debug_sample_one_in());
+    raise_file_limit();
+    access_log_.start();
+    capture_.start();
+    sessions_.start();
+    tap_.start();
+
+    if (!start_workers()) {
+        for (auto& worker : workers_) {
+            worker->stop();
+        }
+        workers_.clear();
+        access_log_.stop();
+        capture_.stop();
+        sessions_.stop();
+        tap_.stop();
         return false;
     }
 
     running_.store(true);
+    started_unix_ms_ = Utils::unix_time_ms();
+    upstreams_.start();
+    resolver_.start();
+    if (config->get_idle_park_after() > 0) {
+        parker_.start();
+    }
+    if (config->is_udp_enabled()) {
+        udp_relay_.start();
+    }
     
     // Запуск серверного потока
     server_thread_ = std::make_unique<std::thread>(&VPNServer::server_loop, this);
 
-    Logger::info("VPN сервер запущен на " + config_.get_server_host() + 
-                ":" + std::to_string(config_.get_server_port()));
+    Logger::info("VPN сервер запущен на " + config->get_server_host() + 
+                ":" + std::to_string(config->get_server_port()));
     Logger::info("Максимальное количество соединений: " + 
-                std::to_string(config_.get_max_connections()));
+                std::to_string(config->get_max_connections()));
+    Logger::info("Рабочих потоков приема: " + std::to_string(workers_.size()));
 
     return true;
 }
@@ -115,168 +143,319 @@ void VPNServer::stop() {
     Logger::info("Остановка VPN сервера...");
     running_.store(false);
 
-    // Закрытие серверного сокета
-    if (server_socket_ >= 0) {
-        close(server_socket_);
-        server_socket_ = -1;
-    }
-
     // Ожидание завершения серверного потока
     if (server_thread_ && server_thread_->joinable()) {
         server_thread_->join();
     }
 
-    // Закрытие всех клиентских соединений
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        for (auto& client : clients_) {
-            client->stop();
-        }
-        clients_.clear();
+    upstreams_.stop();
+    resolver_.stop();  // Ожидающие разрешения имен обработчики получат отказ
+    udp_relay_.stop(); // Управляющие соединения UDP ассоциаций завершатся
+    parker_.stop();    // Запаркованные туннели больше не возобновляются
+
+    // Остановка приема и закрытие всех клиентских соединений
+    for (auto& worker : workers_) {
+        worker->stop();
     }
+    sessions_.stop();    // Отсоединенные цели закрываются после обработчиков
+    tap_.stop();         // После обработчиков: их отводы уже закрыты
+    access_log_.stop();  // После обработчиков: их последние записи дописываются
+    capture_.stop();
+    stats_.close();
+    stats_path_.clear();
 
     Logger::info("VPN сервер остановлен");
 }
 
 void VPNServer::server_loop() {
+    // Прием соединений ведут рабочие потоки, здесь только служебные задачи
     while (running_.load()) {
-        // Используем select для неблокирующего ожидания соединений
-        fd_set read_fds;
-        FD_ZERO(&read_fds);
-        FD_SET(server_socket_, &read_fds);
-        
-        struct timeval timeout;
-        timeout.tv_sec = 1;  // Проверяем каждую секунду
-        timeout.tv_usec = 0;
-        
-        int ready = select(server_socket_ + 1, &read_fds, nullptr, nullptr, &timeout);
-        
-        if (ready < 0) {
-            if (errno == EINTR) {
-                Logger::info("Получен сигнал прерывания");
-                break;
-            }
-            if (running_.load()) {
-                Logger::error("Ошибка select: " + std::string(strerror(errno)));
-            }
-            continue;
+        if (reload_requested_.exchange(false)) {
+            reload_configuration();
         }
-        
-        if (ready == 0) {
-            // Таймаут - очищаем клиентов и продолжаем
-            cleanup_finished_clients();
-            continue;
+        HeavyHitters::merge();  // До выгрузки, чтобы снимок включал последнюю секунду
+        export_metrics(metrics_requested_.exchange(false));
+        if (trace_requested_.exchange(false)) {
+            dump_trace();
         }
+        publish_stats();
+        Logger::report_suppressed();
         
-        if (!FD_ISSET(server_socket_, &read_fds)) {
-            continue;
-        }
-
-        sockaddr_in client_addr{};
-        socklen_t client_len = sizeof(client_addr);
-
-        // Принятие нового соединения
-        int client_socket = accept(server_socket_, 
-                                  reinterpret_cast<sockaddr*>(&client_addr), 
-                                  &client_len);
+        // Сигналы прерывают ожидание, и запрос обрабатывается сразу
+        std::shared_ptr<const Config> config = config_.current();
+        int timeout = config->is_stats_enabled()
+            ? std::max(10, std::min(1000, config->get_stats_interval_ms()))
+            : 1000;
+        poll(nullptr, 0, timeout);
+    }
+    
+    Logger::info("Выход из основного цикла сервера");
+}
 
-        if (client_socket < 0) {
-            if (errno == EINTR || errno == EWOULDBLOCK) {
-                continue;
-            }
-            if (running_.load()) {
-                Logger::error("Ошибка при принятии соединения: " + std::string(strerror(errno)));
-            }
-            continue;
+bool VPNServer::start_workers() {
+    std::shared_ptr<const Config> config = config_.current();
+    // Настройка адреса сервера
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(config->get_server_port());
+    
+    if (config->get_server_host() == "0.0.0.0") {
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+    } else {
+        if (inet_pton(AF_INET, config->get_server_host().c_str(), &server_addr.sin_addr) <= 0) {
+            Logger::error("Некорректный IP адрес сервера: " + config->get_server_host());
+            return false;
         }
+    }
 
-        // Получение информации о клиенте
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
-        int client_port = ntohs(client_addr.sin_port);
+    // Рабочие распределяются по процессорам из cpu_set по кругу
+    std::vector<int> cpus = Topology::parse_cpu_list(config->get_cpu_set());
+    int count = config->get_workers() > 0 ? config->get_workers() : static_cast<int>(cpus.size());
+    
+    workers_.clear();
+    for (int i = 0; i < count; ++i) {
+        workers_.push_back(std::make_unique<Worker>(i, cpus[i % cpus.size()],
+                                                    config->is_pin_workers(), context_));
+    }
+    
+    int limit = worker_connection_limit();
+    for (auto& worker : workers_) {
+        if (!worker->start(server_addr, config->get_listen_backlog(), limit)) {
+            Logger::error("Не удалось привязать сокет к адресу " + 
+                         config->get_server_host() + ":" + std::to_string(config->get_server_port()));
+            return false;
+        }
+    }
+    return true;
+}
 
-        Logger::info("Новое соединение от " + std::string(client_ip) + 
-                    ":" + std::to_string(client_port));
+int VPNServer::worker_connection_limit() const {
+    std::shared_ptr<const Config> config = config_.current();
+    // Каждый рабочий получает свою долю общего лимита (с округлением вверх)
+    int count = std::max<int>(1, static_cast<int>(workers_.size()));
+    return (config->get_max_connections() + count - 1) / count;
+}
 
-        // Обработка клиентского соединения
-        handle_client_connection(client_socket, client_ip, client_port);
+void VPNServer::render_worker_metrics(std::ostream& out) const {
+    for (const auto& worker : workers_) {
+        std::string labels = "{worker=\"" + std::to_string(worker->index()) +
+                             "\",cpu=\"" + std::to_string(worker->cpu()) +
+                             "\",node=\"" + std::to_string(worker->node()) + "\"}";
+        out << "worker_active_clients" << labels << " " << worker->active() << "\n"
+            << "worker_accepted_total" << labels << " " << worker->accepted() << "\n";
+    }
+}
 
-        // Очистка завершенных клиентских соединений
-        cleanup_finished_clients();
+void VPNServer::raise_file_limit() {
+    std::shared_ptr<const Config> config = config_.current();
+    // Каждый туннель занимает два дескриптора
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        return;
     }
     
-    Logger::info("Выход из основного цикла сервера");
+    rlim_t wanted = config->get_max_open_files() > 0
+        ? static_cast<rlim_t>(config->get_max_open_files())
+        : limit.rlim_max;
+    if (limit.rlim_max != RLIM_INFINITY && wanted > limit.rlim_max) {
+        wanted = limit.rlim_max;
+    }
+    if (wanted > limit.rlim_cur) {
+        limit.rlim_cur = wanted;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            Logger::warning("Не удалось поднять лимит открытых файлов: " + std::string(strerror(errno)));
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+    
+    rlim_t needed = static_cast<rlim_t>(config->get_max_connections()) * 2 + 64;
+    Logger::info("Лимит открытых файлов: " + std::to_string(limit.rlim_cur));
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+        Logger::warning("Лимита открытых файлов недостаточно для " +
+                       std::to_string(config->get_max_connections()) + " соединений (нужно " +
+                       std::to_string(needed) + ")");
+    }
 }
 
-void VPNServer::handle_client_connection(int client_socket, 
-                                       const std::string& client_ip, 
-                                       int client_port) {
+void VPNServer::reload_configuration() {
+    Logger::info("Перезагрузка конфигурации...");
+    
+    // Файл разбирается в новый объект: потоки, читающие прежний снимок,
+    // его изменений не видят, а ключи, удаленные из файла, получают
+    // значения по умолчанию
+    auto config = std::make_shared<const Config>(config_.current()->get_config_file());
+    if (!config->is_loaded()) {
+        Logger::error("Не удалось перезагрузить конфигурацию, сохраняется текущая");
+        return;
+    }
+    config_.publish(config);
+    
+    // Новая политика подменяется атомарно, активные соединения
+    // дорабатывают со снимком, взятым при установке туннеля
+    if (!policy_.load(*config)) {
+        Logger::error("Политика доступа не обновлена");
+    }
+    if (!upstreams_.load(*config)) {
+        Logger::error("Список вышестоящих прокси не обновлен");
+    }
+    if (!credentials_.load(*config)) {
+        Logger::error("Список пользователей не обновлен");
+    }
+    breakers_.configure(*config);
+    resolver_.configure(*config);
+    memory_.configure(*config);
+    Tracer::configure(*config);
+    HeavyHitters::configure(*config);
+    access_log_.configure(*config);
+    udp_relay_.configure(*config);  // Размер пачки и GSO/GRO - только при запуске
+    cache_.configure(*config);      // Отключение кэша освобождает его память
+    capture_.configure(*config);
+    identity_.configure(*config);
+    sessions_.configure(*config);
+    tap_.configure(*config);
+    filters_.configure(*config);
+    Logger::set_rate_limit(config->get_log_rate_limit(), config->get_log_rate_burst());
+    Logger::set_debug_sampling(config->get_log_debug_sample_one_in());
     
-    try {
-        // Проверка лимита соединений
-        {
-            std::lock_guard<std::mutex> lock(clients_mutex_);
-            if (static_cast<int>(clients_.size()) >= config_.get_max_connections()) {
-                Logger::warning("Достигнут лимит соединений, отклонение клиента " + 
-                               client_ip + ":" + std::to_string(client_port));
-                close(client_socket);
-                return;
-            }
+    // Число рабочих меняется только перезапуском, лимит соединений - на лету.
+    // Основной поток - единственный писатель очередей команд рабочих.
+    int limit = worker_connection_limit();
+    for (auto& worker : workers_) {
+        if (!worker->send(WorkerCommand{WorkerCommand::SET_CONNECTION_LIMIT, limit})) {
+            Logger::warning("Очередь команд рабочего " + std::to_string(worker->index()) + " заполнена");
         }
+    }
+}
 
-        // Создание обработчика для клиента
-        auto handler = std::make_shared<ProxyHandler>(client_socket, client_ip, client_port, config_);
-        
-        // Запуск обработчика
-        if (handler->start()) {
-            // Добавление в список активных клиентов только если запуск успешен
-            std::lock_guard<std::mutex> lock(clients_mutex_);
-            clients_.push_back(handler);
-        } else {
-            Logger::error("Не удалось запустить обработчик для клиента " + 
-                         client_ip + ":" + std::to_string(client_port));
-            close(client_socket);
-        }
-    } catch (const std::exception& e) {
-        Logger::error("Ошибка обработки клиентского соединения: " + std::string(e.what()));
-        close(client_socket);
-    } catch (...) {
-        Logger::error("Неизвестная ошибка обработки клиентского соединения");
-        close(client_socket);
+void VPNServer::export_metrics(bool force) {
+    std::shared_ptr<const Config> config = config_.current();
+    std::string path = config->get_metrics_file();
+    auto now = std::chrono::steady_clock::now();
+    if (!force && (path.empty() ||
+                   now - last_metrics_export_ < std::chrono::seconds(config->get_metrics_interval()))) {
+        return;
+    }
+    last_metrics_export_ = now;
+    
+    if (path.empty()) {
+        // Файл не настроен - по запросу (SIGUSR1) выводим снимок в лог
+        Logger::info("Метрики сервера:\n" + Metrics::render());
+        return;
+    }
+    if (!Metrics::write_file(path)) {
+        Logger::error("Не удалось записать метрики в " + path);
     }
 }
 
-void VPNServer::cleanup_finished_clients() {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
+void VPNServer::dump_trace() {
+    std::shared_ptr<const Config> config = config_.current();
+    std::string path = config->get_trace_file();
+    if (config->get_trace_sample_one_in() <= 0) {
+        Logger::warning("Трассировка выключена (tracing.sample_one_in = 0), выгружаются только ранее записанные этапы");
+    }
+    if (Tracer::dump(path)) {
+        Logger::info("Трасса соединений записана в " + path);
+    } else {
+        Logger::error("Не удалось записать трассу в " + path);
+    }
+}
+
+void VPNServer::publish_stats() {
+    std::shared_ptr<const Config> config = config_.current();
+    if (!config->is_stats_enabled()) {
+        stats_.close();
+        stats_path_.clear();
+        return;
+    }
+    // Неудачное открытие повторяется только при смене пути
+    std::string path = config->get_stats_file();
+    if (path != stats_path_) {
+        stats_path_ = path;
+        if (stats_.open(path)) {
+            Logger::info("Сегмент статистики: " + path);
+        }
+    }
+    if (!stats_.is_open()) {
+        return;
+    }
+    
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_stats_publish_ < std::chrono::milliseconds(config->get_stats_interval_ms())) {
+        return;
+    }
+    last_stats_publish_ = now;
+    
+    if (!stats_data_) {
+        stats_data_ = std::make_unique<StatsData>();
+    }
+    StatsData& data = *stats_data_;
+    data.started_unix_ms = started_unix_ms_;
+    data.published_unix_ms = Utils::unix_time_ms();
     
-    auto it = clients_.begin();
-    while (it != clients_.end()) {
-        if (!(*it)->is_running()) {
-            try {
-                (*it)->stop(); // Убеждаемся, что полностью остановлен
-                it = clients_.erase(it);
-            } catch (...) {
-                // Игнорируем ошибки при cleanup
-                it = clients_.erase(it);
-            }
-        } else {
-            ++it;
+    auto counters = Metrics::snapshot();
+    data.counter_count = static_cast<uint32_t>(std::min(counters.size(), StatsLayout::MAX_COUNTERS));
+    for (size_t i = 0; i < data.counter_count; ++i) {
+        std::snprintf(data.counters[i].name, sizeof(data.counters[i].name), "%s", counters[i].first.c_str());
+        data.counters[i].value = counters[i].second;
+    }
+    
+    std::vector<StatsTunnel> tunnels;
+    size_t tunnels_total = 0;
+    data.worker_count = static_cast<uint32_t>(std::min(workers_.size(), StatsLayout::MAX_WORKERS));
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        const Worker& worker = *workers_[i];
+        if (i < data.worker_count) {
+            data.workers[i] = StatsWorker{worker.index(), worker.cpu(), worker.node(),
+                                          worker.active(), worker.accepted()};
         }
+        tunnels_total += worker.tunnel_rows(tunnels);
+    }
+    
+    // Каждый рабочий уже ограничил свою таблицу, здесь - общий топ по байтам
+    if (tunnels.size() > StatsLayout::MAX_TUNNELS) {
+        std::partial_sort(tunnels.begin(), tunnels.begin() + StatsLayout::MAX_TUNNELS, tunnels.end(),
+                          [](const StatsTunnel& a, const StatsTunnel& b) {
+                              return a.bytes_from_client + a.bytes_from_target >
+                                     b.bytes_from_client + b.bytes_from_target;
+                          });
+        tunnels.resize(StatsLayout::MAX_TUNNELS);
     }
+    std::copy(tunnels.begin(), tunnels.end(), data.tunnels);
+    data.tunnel_count = static_cast<uint32_t>(tunnels.size());
+    data.tunnels_total = static_cast<uint32_t>(tunnels_total);
+    
+    stats_.publish(data);
 }
 
 VPNServer::ServerStatus VPNServer::get_status() const {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
+    std::shared_ptr<const Config> config = config_.current();
+    int active_clients = 0;
+    for (const auto& worker : workers_) {
+        active_clients += worker->active();
+    }
     
     return ServerStatus{
         running_.load(),
-        static_cast<int>(clients_.size()),
-        config_.get_server_host(),
-        config_.get_server_port()
+        active_clients,
+        config->get_server_host(),
+        config->get_server_port()
     };
 }
 
 void VPNServer::signal_handler(int signal) {
+    if (instance_ && signal == SIGHUP) {
+        // Перезагрузка выполняется в основном цикле сервера
+        instance_->reload_requested_.store(true);
+        return;
+    }
+    if (instance_ && signal == SIGUSR1) {
+        instance_->metrics_requested_.store(true);
+        return;
+    }
+    if (instance_ && signal == SIGUSR2) {
+        instance_->trace_requested_.store(true);
+        return;
+    }
     if (instance_) {
         Logger::info("Получен сигнал " + std::to_string(signal) + 
                     ", завершение работы сервера...");
@@ -7,8 +7,20 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <chrono>
 #include "config.h"
 #include "proxy_handler.h"
+#include "access_policy.h"
+#include "upstream.h"
+#include "circuit_breaker.h"
+#include "resolver.h"
+#include "memory_budget.h"
+#include "idle_parker.h"
+#include "udp_relay.h"
+#include "http_cache.h"
+#include "server_context.h"
+#include "worker.h"
+#include "stats_segment.h"
 
 class VPNServer {
 public:
@@ -32,22 +44,52 @@ public:
 
 private:
     // Конфигурация и состояние
-    Config config_;
+    SharedConfig config_;
+    AccessPolicy policy_;
+    UpstreamManager upstreams_;
+    CircuitBreakerRegistry breakers_;
+    Resolver resolver_;
+    MemoryBudget memory_;
+    IdleParker parker_;
+    AccessLog access_log_;
+    UdpRelay udp_relay_{resolver_, policy_};
+    HttpCache cache_;
+    TrafficCapture capture_;
+    TunnelIdentity identity_;
+    SessionStore sessions_{memory_};
+    PcapTap tap_;
+    HttpFilters filters_;
+    CredentialStore credentials_{memory_};
+    ServerContext context_;
     std::atomic<bool> running_{false};
-    int server_socket_{-1};
+    std::atomic<bool> reload_requested_{false};
+    std::atomic<bool> metrics_requested_{false};
+    std::atomic<bool> trace_requested_{false};
+    std::chrono::steady_clock::time_point last_metrics_export_{};
     
-    // Управление клиентами
-    std::vector<std::shared_ptr<ProxyHandler>> clients_;
-    mutable std::mutex clients_mutex_;
+    // Сегмент статистики для cvpnctl; снимок собирается в куче (сотни КБ)
+    StatsSegment stats_;
+    std::unique_ptr<StatsData> stats_data_;
+    std::string stats_path_;  // Последний путь, который пытались открыть
+    uint64_t started_unix_ms_{0};
+    std::chrono::steady_clock::time_point last_stats_publish_{};
     
-    // Основной поток сервера
+    // Рабочие потоки приема (по одному на процессор), каждый со своими клиентами
+    std::vector<std::unique_ptr<Worker>> workers_;
+    
+    // Основной поток сервера: перезагрузка конфигурации и выгрузка метрик
     std::unique_ptr<std::thread> server_thread_;
     
     // Внутренние методы
     void server_loop();
-    void handle_client_connection(int client_socket, const std::string& client_ip, int client_port);
-    void remove_client(std::shared_ptr<ProxyHandler> handler);
-    void cleanup_finished_clients();
+    bool start_workers();
+    int worker_connection_limit() const;
+    void render_worker_metrics(std::ostream& out) const;
+    void raise_file_limit();
+    void reload_configuration();
+    void export_metrics(bool force);
+    void dump_trace();
+    void publish_stats();
     
     // Обработка сигналов
     static void signal_handler(int signal);
@@ -0,0 +1,332 @@
+#include "worker.h"
+#include "cpu_topology.h"
+#include "logger.h"
+#include "utils.h"
+#include "metrics.h"
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <csignal>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+Worker::Worker(int index, int cpu, bool pin, ServerContext& context)
+    : index_(index), cpu_(cpu), node_(Topology::cpu_node(cpu)), pin_(pin), context_(context) {
+}
+
+Worker::~Worker() {
+    stop();
+}
+
+bool Worker::start(const sockaddr_in& address, int backlog, int connection_limit) {
+    connection_limit_ = connection_limit;
+
+    listen_socket_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_socket_ < 0) {
+        Logger::error("Не удалось создать серверный сокет");
+        return false;
+    }
+
+    int opt = 1;
+    if (setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        Logger::error("Не удалось настроить SO_REUSEADDR/SO_REUSEPORT");
+        stop();
+        return false;
+    }
+
+    if (bind(listen_socket_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+        Logger::error("Не удалось привязать сокет рабочего " + std::to_string(index_) +
+                     ": " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    // Очередь приема не связана с лимитом соединений
+    if (listen(listen_socket_, std::max(1, backlog)) < 0) {
+        Logger::error("Не удалось начать прослушивание сокета");
+        stop();
+        return false;
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        Logger::error("Не удалось создать eventfd рабочего: " + std::string(strerror(errno)));
+        stop();
+        return false;
+    }
+
+    running_.store(true);
+    thread_ = std::make_unique<std::thread>(&Worker::loop, this);
+    return true;
+}
+
+void Worker::stop() {
+    // stop() может вызываться из разных потоков (сигнал, деструктор),
+    // поэтому остановка идет через флаг, а не через очередь команд
+    running_.store(false);
+    wake();
+
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+    thread_.reset();
+
+    // Поток рабочего завершен - список клиентов теперь принадлежит нам
+    for (auto& client : clients_) {
+        client->stop();
+    }
+    clients_.clear();
+    active_.store(0);
+
+    if (listen_socket_ >= 0) {
+        close(listen_socket_);
+        listen_socket_ = -1;
+    }
+    if (wake_fd_ >= 0) {
+        close(wake_fd_);
+        wake_fd_ = -1;
+    }
+}
+
+bool Worker::send(const WorkerCommand& command) {
+    if (!commands_.push(command)) {
+        return false;
+    }
+    wake();
+    return true;
+}
+
+void Worker::wake() {
+    if (wake_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd_, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void Worker::loop() {
+    // Сигналы управления обрабатывают основные потоки: обработчик сигнала
+    // вызывает VPNServer::stop(), который ожидает завершения рабочих.
+    // Маска наследуется потоками обработчиков соединений.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    if (pin_) {
+        // Закрепление и политика памяти наследуются потоками обработчиков
+        if (!Topology::pin_current_thread(cpu_)) {
+            Logger::warning("Не удалось закрепить рабочего " + std::to_string(index_) +
+                           " за процессором " + std::to_string(cpu_));
+        }
+        Topology::prefer_node(node_);
+    }
+    Logger::debug("Рабочий " + std::to_string(index_) + " запущен на процессоре " +
+                 std::to_string(cpu_) + " (NUMA узел " + std::to_string(node_) + ")");
+
+    pollfd fds[2];
+    fds[0] = {listen_socket_, POLLIN, 0};
+    fds[1] = {wake_fd_, POLLIN, 0};
+
+    while (running_.load()) {
+        // Проверяем каждую секунду (или чаще, если так публикуется статистика)
+        std::shared_ptr<const Config> config = context_.config.current();
+        int timeout = config->is_stats_enabled()
+            ? std::max(10, std::min(1000, config->get_stats_interval_ms()))
+            : 1000;
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Logger::error("Ошибка poll: " + std::string(strerror(errno)));
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t value;
+            ssize_t got = read(wake_fd_, &value, sizeof(value));
+            (void)got;
+        }
+        process_commands();
+
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            accept_pending();
+        }
+        cleanup_finished_clients();
+        collect_tunnel_rows();
+    }
+}
+
+void Worker::collect_tunnel_rows() {
+    std::shared_ptr<const Config> config = context_.config.current();
+    if (!config->is_stats_enabled()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - rows_collected_ < std::chrono::milliseconds(config->get_stats_interval_ms())) {
+        return;
+    }
+    rows_collected_ = now;
+
+    std::vector<StatsTunnel> rows;
+    rows.reserve(clients_.size());
+    for (const auto& client : clients_) {
+        StatsTunnel row{};
+        if (client->snapshot(row)) {
+            row.worker = static_cast<uint16_t>(index_);
+            rows.push_back(row);
+        }
+    }
+    size_t total = rows.size();
+
+    // В сегмент попадают самые нагруженные туннели
+    if (rows.size() > StatsLayout::MAX_TUNNELS) {
+        std::partial_sort(rows.begin(), rows.begin() + StatsLayout::MAX_TUNNELS, rows.end(),
+                          [](const StatsTunnel& a, const StatsTunnel& b) {
+                              return a.bytes_from_client + a.bytes_from_target >
+                                     b.bytes_from_client + b.bytes_from_target;
+                          });
+        rows.resize(StatsLayout::MAX_TUNNELS);
+    }
+
+    std::lock_guard<std::mutex> lock(rows_mutex_);
+    rows_.swap(rows);
+    tunnels_total_ = total;
+}
+
+size_t Worker::tunnel_rows(std::vector<StatsTunnel>& out) const {
+    std::lock_guard<std::mutex> lock(rows_mutex_);
+    out.insert(out.end(), rows_.begin(), rows_.end());
+    return tunnels_total_;
+}
+
+void Worker::process_commands() {
+    WorkerCommand command;
+    while (commands_.pop(command)) {
+        switch (command.type) {
+            case WorkerCommand::SET_CONNECTION_LIMIT:
+                connection_limit_ = command.value;
+                break;
+        }
+    }
+}
+
+void Worker::accept_pending() {
+    static MetricValue& accepted = Metrics::counter("connections_accepted_total");
+
+    // Слушающий сокет неблокирующий - забираем всю очередь за одно пробуждение
+    while (running_.load()) {
+        sockaddr_in client_addr{};
+        socklen_t client_len = sizeof(client_addr);
+        int client_socket = accept4(listen_socket_, reinterpret_cast<sockaddr*>(&client_addr),
+                                    &client_len, SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && running_.load()) {
+                static LogSite& site = Logger::site("worker.accept_error");
+                Logger::error(site, "Ошибка при принятии соединения: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+
+        accepted.add();
+        accepted_.fetch_add(1, std::memory_order_relaxed);
+
+        // Получение информации о клиенте
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+        int client_port = ntohs(client_addr.sin_port);
+
+        Logger::debug("Новое соединение от " + std::string(client_ip) +
+                    ":" + std::to_string(client_port));
+
+        handle_client_connection(client_socket, client_ip, client_port);
+    }
+}
+
+void Worker::handle_client_connection(int client_socket,
+                                      const std::string& client_ip,
+                                      int client_port) {
+    // Созданный обработчик владеет сокетом и закрывает его сам (stop() или
+    // деструктор). Повторный close() мог бы закрыть дескриптор, который уже
+    // получил другой accept()
+    bool handed_over = false;
+    try {
+        // Проверка лимита соединений (доля рабочего от общего лимита)
+        if (static_cast<int>(clients_.size()) >= connection_limit_) {
+            cleanup_finished_clients();
+        }
+        if (static_cast<int>(clients_.size()) >= connection_limit_) {
+            static LogSite& site = Logger::site("worker.connection_limit");
+            Logger::warning(site, "Достигнут лимит соединений, отклонение клиента " +
+                                 client_ip + ":" + std::to_string(client_port));
+            close(client_socket);
+            return;
+        }
+
+        // Под нехваткой памяти новые туннели не принимаются
+        size_t reserved = context_.memory.connection_overhead();
+        if (!context_.memory.admit_connection(reserved)) {
+            static LogSite& site = Logger::site("worker.memory_limit");
+            Logger::warning(site, "Недостаточно памяти (занято " + Utils::format_bytes(context_.memory.current()) +
+                                 "), отклонение клиента " + client_ip + ":" + std::to_string(client_port));
+            close(client_socket);
+            return;
+        }
+
+        // Создание обработчика для клиента (зарезервированная память переходит к нему)
+        auto handler = std::make_shared<ProxyHandler>(client_socket, client_ip, client_port,
+                                                      context_, reserved);
+        handed_over = true;
+
+        if (handler->start()) {
+            clients_.push_back(handler);
+            active_.store(static_cast<int>(clients_.size()), std::memory_order_relaxed);
+        } else {
+            static LogSite& site = Logger::site("worker.handler_start");
+            Logger::error(site, "Не удалось запустить обработчик для клиента " +
+                               client_ip + ":" + std::to_string(client_port));
+        }
+    } catch (const std::exception& e) {
+        Logger::error("Ошибка обработки клиентского соединения: " + std::string(e.what()));
+        if (!handed_over) {
+            close(client_socket);
+        }
+    } catch (...) {
+        Logger::error("Неизвестная ошибка обработки клиентского соединения");
+        if (!handed_over) {
+            close(client_socket);
+        }
+    }
+}
+
+void Worker::cleanup_finished_clients() {
+    // Завершенные переносятся в конец и удаляются одним вызовом erase:
+    // при десятках тысяч туннелей удаление по одному из середины вектора дорого
+    auto finished = std::partition(clients_.begin(), clients_.end(),
+                                   [](const std::shared_ptr<ProxyHandler>& client) {
+                                       return client->is_running();
+                                   });
+    for (auto it = finished; it != clients_.end(); ++it) {
+        try {
+            (*it)->stop(); // Убеждаемся, что полностью остановлен
+        } catch (...) {
+            // Игнорируем ошибки при cleanup
+        }
+    }
+    clients_.erase(finished, clients_.end());
+    active_.store(static_cast<int>(clients_.size()), std::memory_order_relaxed);
+}
@@ -0,0 +1,88 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <netinet/in.h>
+#include "proxy_handler.h"
+#include "server_context.h"
+#include "spsc_queue.h"
+#include "stats_segment.h"
+
+// Команда основного потока сервера рабочему потоку
+struct WorkerCommand {
+    enum Type { SET_CONNECTION_LIMIT } type;
+    int value;
+};
+
+// Рабочий поток приема соединений, закрепленный за одним процессором.
+// У каждого рабочего свой слушающий сокет (SO_REUSEPORT - ядро само
+// распределяет входящие соединения) и свой список клиентов, поэтому на
+// пути приема нет общих блокировок. Потоки обработчиков создаются рабочим
+// и наследуют его процессор и NUMA узел, так что буферы соединения
+// выделяются в локальной памяти.
+class Worker {
+public:
+    Worker(int index, int cpu, bool pin, ServerContext& context);
+    ~Worker();
+
+    bool start(const sockaddr_in& address, int backlog, int connection_limit);
+    void stop();
+
+    // Только из основного потока сервера (единственный писатель очереди)
+    bool send(const WorkerCommand& command);
+
+    int index() const { return index_; }
+    int cpu() const { return cpu_; }
+    int node() const { return node_; }
+    int active() const { return active_.load(std::memory_order_relaxed); }
+    uint64_t accepted() const { return accepted_.load(std::memory_order_relaxed); }
+
+    // Последняя собранная рабочим таблица туннелей (для сегмента статистики);
+    // возвращает число установленных туннелей, включая не попавшие в таблицу
+    size_t tunnel_rows(std::vector<StatsTunnel>& out) const;
+
+private:
+    int index_;
+    int cpu_;
+    int node_;
+    bool pin_;
+    ServerContext& context_;
+
+    int listen_socket_{-1};
+    int wake_fd_{-1};
+    int connection_limit_{0};
+    std::atomic<bool> running_{false};
+    std::unique_ptr<std::thread> thread_;
+
+    // Принадлежит рабочему потоку, после его завершения - вызывающему stop()
+    std::vector<std::shared_ptr<ProxyHandler>> clients_;
+    SpscQueue<WorkerCommand, 16> commands_;
+
+    std::atomic<int> active_{0};
+    std::atomic<uint64_t> accepted_{0};
+
+    // Таблица туннелей собирается в потоке рабочего: только он владеет clients_
+    mutable std::mutex rows_mutex_;
+    std::vector<StatsTunnel> rows_;
+    size_t tunnels_total_{0};
+    std::chrono::steady_clock::time_point rows_collected_{};
+
+    void loop();
+    void accept_pending();
+    void handle_client_connection(int client_socket, const std::string& client_ip, int client_port);
+    void cleanup_finished_clients();
+    void process_commands();
+    void collect_tunnel_rows();
+    void wake();
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+};
+
+#endif // WORKER_H
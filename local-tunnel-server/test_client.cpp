@@ -1,111 +1,467 @@
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
 #include <cstdint>
+#include <string>
+#include <vector>
+#include "memory_budget.h"
+#include "secure_channel.h"
+#include "stream_compression.h"
+#include "session_store.h"
+#include "utils.h"
+
+namespace {
+
+bool send_all(int sock, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(sock, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool recv_all(int sock, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(sock, data, size, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Двоичный протокол: длина и имя хоста, порт; ответ - байт статуса
+// credentials - "имя:пароль" или пусто; с ними в длине хоста выставлен
+// старший бит, а имя и пароль идут после порта с байтом длины каждый
+bool open_binary(int sock, const std::string& target_host, int target_port, const std::string& credentials) {
+    uint32_t host_len = static_cast<uint32_t>(target_host.length());
+    if (!credentials.empty()) {
+        host_len |= 0x80000000u;
+    }
+    host_len = htonl(host_len);
+    uint16_t port_net = htons(target_port);
+
+    std::string request(reinterpret_cast<const char*>(&host_len), sizeof(host_len));
+    request += target_host;
+    request.append(reinterpret_cast<const char*>(&port_net), sizeof(port_net));
+    if (!credentials.empty()) {
+        size_t colon = credentials.find(':');
+        std::string user = credentials.substr(0, colon);
+        std::string password = colon == std::string::npos ? std::string() : credentials.substr(colon + 1);
+        request += static_cast<char>(user.size());
+        request += user;
+        request += static_cast<char>(password.size());
+        request += password;
+    }
+    if (!send_all(sock, request.data(), request.size())) {
+        std::cerr << "Ошибка при отправке запроса" << std::endl;
+        return false;
+    }
+
+    // Получение ответа от сервера
+    uint8_t response;
+    if (recv(sock, &response, sizeof(response), 0) <= 0) {
+        std::cerr << "Ошибка при получении ответа от сервера" << std::endl;
+        return false;
+    }
+
+    if (response == 2) {
+        std::cerr << "Сервер отклонил учетные данные" << std::endl;
+        return false;
+    }
+    if (response != 1) {
+        std::cerr << "Сервер не смог установить соединение с " << target_host << ":" << target_port << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Преобразования туннеля, согласованные в CONNECT
+struct Framing {
+    bool encrypt{false};
+    bool compress{false};
+    SecureChannel channel;
+    StreamCompression* compression{nullptr};
+};
+
+// Значение заголовка name из ответа; false - заголовка нет
+bool response_header(const std::string& response, const std::string& name, std::string& value) {
+    size_t header = response.find("\r\n" + name + ":");
+    if (header == std::string::npos) {
+        return false;
+    }
+    size_t value_start = header + name.size() + 3;
+    value = response.substr(value_start, response.find("\r\n", value_start) - value_start);
+    while (!value.empty() && value[0] == ' ') {
+        value.erase(0, 1);
+    }
+    return true;
+}
+
+// CONNECT с предложением шифрования и/или сжатия. Без шифрования в ответе
+// туннель не открывается, без сжатия - идет несжатым
+bool open_connect(int sock, const std::string& target_address, const std::string& server_key,
+                  const std::string& credentials, Framing& framing, StreamCompression& compression) {
+    std::string request = "CONNECT " + target_address + " HTTP/1.1\r\n"
+                          "Host: " + target_address + "\r\n";
+    if (!credentials.empty()) {
+        request += "Proxy-Authorization: Basic " + Utils::base64_encode(credentials) + "\r\n";
+    }
+    if (framing.encrypt) {
+        request += std::string(SecureChannel::HEADER_NAME) + ": " + framing.channel.offer() + "\r\n";
+    }
+    if (framing.compress) {
+        request += std::string(StreamCompression::HEADER_NAME) + ": " + StreamCompression::CODEC + "\r\n";
+    }
+    request += "\r\n";
+    if (!send_all(sock, request.data(), request.size())) {
+        std::cerr << "Ошибка при отправке CONNECT" << std::endl;
+        return false;
+    }
+
+    // Ответ читается по байту, чтобы не захватить записи после заголовков
+    std::string response;
+    char c;
+    while (response.find("\r\n\r\n") == std::string::npos) {
+        if (recv(sock, &c, 1, 0) <= 0 || response.size() > 8192) {
+            std::cerr << "Ошибка при получении ответа от сервера" << std::endl;
+            return false;
+        }
+        response += c;
+    }
+    if (response.compare(0, 12, "HTTP/1.1 200") != 0) {
+        std::cerr << "Сервер отказал: " << response.substr(0, response.find("\r\n")) << std::endl;
+        return false;
+    }
+
+    std::string value;
+    if (framing.encrypt) {
+        if (!response_header(response, SecureChannel::HEADER_NAME, value)) {
+            std::cerr << "Сервер не поддерживает шифрование туннеля" << std::endl;
+            return false;
+        }
+        std::string identity;
+        if (!framing.channel.complete(value, server_key, identity)) {
+            std::cerr << (server_key.empty() ? "Некорректный ответ согласования шифрования"
+                                             : "Ключ сервера не совпадает с --server-key") << std::endl;
+            return false;
+        }
+        std::cout << "Шифрование согласовано, ключ сервера " << identity << std::endl;
+    }
+    if (framing.compress) {
+        if (response_header(response, StreamCompression::HEADER_NAME, value) && StreamCompression::accepts(value)) {
+            framing.compression = &compression;
+            std::cout << "Сжатие согласовано (" << StreamCompression::CODEC << ")" << std::endl;
+        } else {
+            std::cout << "Сервер не принял сжатие, туннель без сжатия" << std::endl;
+        }
+    }
+    return true;
+}
+
+// Данные одной записью (кадром); не больше StreamCompression::MAX_INPUT байт
+bool send_framed(int sock, Framing& framing, const std::string& data) {
+    std::vector<char> buffer(SecureChannel::OVERHEAD + StreamCompression::HEADER + data.size());
+    char* frame = buffer.data() + (framing.encrypt ? SecureChannel::HEADER : 0);
+    size_t payload = data.size();
+    if (framing.compression) {
+        char* input = framing.compression->scratch();
+        if (input == nullptr) {
+            return false;
+        }
+        std::memcpy(input, data.data(), data.size());
+        payload = framing.compression->encode(data.size(), frame);
+    } else {
+        std::memcpy(frame, data.data(), data.size());
+    }
+    size_t size = framing.encrypt ? framing.channel.seal(buffer.data(), payload) : payload;
+    return send_all(sock, buffer.data(), size);
+}
+
+// Одна запись (кадр) от сервера; false - соединение закрыто или данные повреждены
+bool recv_framed(int sock, Framing& framing, std::string& data) {
+    std::vector<char> unit(SecureChannel::HEADER);
+    if (!recv_all(sock, unit.data(), unit.size())) {
+        return false;
+    }
+    size_t size = framing.encrypt ? SecureChannel::record_size(unit.data())
+                                  : StreamCompression::frame_size(unit.data());
+    if (size == 0) {
+        return false;
+    }
+    unit.resize(size);
+    if (!recv_all(sock, unit.data() + SecureChannel::HEADER, size - SecureChannel::HEADER)) {
+        return false;
+    }
+
+    const char* payload = unit.data();
+    size_t length = size;
+    if (framing.encrypt) {
+        if (!framing.channel.open(unit.data(), length)) {
+            return false;
+        }
+        payload = unit.data() + SecureChannel::HEADER;
+    }
+    if (framing.compression &&
+        (framing.compression->scratch() == nullptr || !framing.compression->decode(payload, length, payload, length))) {
+        return false;
+    }
+    data.append(payload, length);
+    return true;
+}
+
+// Ответ на CONNECT до конца заголовков; пустая строка - ошибка
+std::string read_response(int sock) {
+    std::string response;
+    char c;
+    while (response.find("\r\n\r\n") == std::string::npos) {
+        if (recv(sock, &c, 1, 0) <= 0 || response.size() > 8192) {
+            return std::string();
+        }
+        response += c;
+    }
+    return response;
+}
+
+// Поле name=значение из значения заголовка сессии
+std::string session_field(const std::string& value, const std::string& name) {
+    size_t start = value.find(name + "=");
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    start += name.size() + 1;
+    return value.substr(start, value.find(';', start) - start);
+}
+
+int connect_server(const std::string& host, int port, int receive_buffer) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (receive_buffer > 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+    }
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &address.sin_addr);
+    if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Разрыв и возобновление сессии: ответ на GET path читается до drop_after
+// байт, соединение закрывается, остаток приходит по новому соединению.
+// Буфер приема клиента мал, чтобы недочитанное поместилось в буфер повтора
+int run_resume(const std::string& vpn_host, int vpn_port, const std::string& target_address,
+               const std::string& path, size_t drop_after) {
+    const int receive_buffer = 16 * 1024;
+    std::string session = std::string(SessionStore::HEADER_NAME);
+    int sock = connect_server(vpn_host, vpn_port, receive_buffer);
+    std::string request = "CONNECT " + target_address + " HTTP/1.1\r\n" + session + ": new\r\n\r\n";
+    std::string response;
+    std::string value;
+    if (sock < 0 || !send_all(sock, request.data(), request.size()) ||
+        (response = read_response(sock)).compare(0, 12, "HTTP/1.1 200") != 0 ||
+        !response_header(response, session, value)) {
+        std::cerr << "Сервер не выдал сессию" << std::endl;
+        if (sock >= 0) {
+            close(sock);
+        }
+        return 1;
+    }
+    std::string token = session_field(value, "token");
+    std::cout << "Сессия " << token << ", буфер повтора " << session_field(value, "replay") << " байт" << std::endl;
+
+    std::string get = "GET " + path + " HTTP/1.1\r\nHost: " + target_address + "\r\nConnection: close\r\n\r\n";
+    std::string body;
+    char buffer[16384];
+    send_all(sock, get.data(), get.size());
+    while (body.size() < drop_after) {
+        ssize_t received = recv(sock, buffer, std::min(sizeof(buffer), drop_after - body.size()), 0);
+        if (received <= 0) {
+            break;
+        }
+        body.append(buffer, static_cast<size_t>(received));
+    }
+    close(sock);
+    size_t before = body.size();
+    std::cout << "Соединение разорвано после " << before << " байт" << std::endl;
+
+    sock = connect_server(vpn_host, vpn_port, receive_buffer);
+    request = "CONNECT " + target_address + " HTTP/1.1\r\n" + session + ": resume; token=" + token +
+              "; received=" + std::to_string(before) + "\r\n\r\n";
+    if (sock < 0 || !send_all(sock, request.data(), request.size()) ||
+        (response = read_response(sock)).compare(0, 12, "HTTP/1.1 200") != 0 ||
+        !response_header(response, session, value)) {
+        std::cerr << "Сессия не возобновлена: " << response.substr(0, response.find("\r\n")) << std::endl;
+        if (sock >= 0) {
+            close(sock);
+        }
+        return 1;
+    }
+
+    // Запрос, не дошедший до цели, досылается с подтвержденного смещения
+    size_t delivered = std::strtoull(session_field(value, "received").c_str(), nullptr, 10);
+    if (delivered < get.size()) {
+        send_all(sock, get.data() + delivered, get.size() - delivered);
+    }
+    ssize_t received;
+    while ((received = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+        body.append(buffer, static_cast<size_t>(received));
+    }
+    close(sock);
+
+    size_t header_end = body.find("\r\n\r\n");
+    std::string length = "нет";
+    if (header_end != std::string::npos) {
+        response_header(body.substr(0, header_end + 2), "Content-Length", length);
+    }
+    std::cout << "После возобновления " << body.size() - before << " байт, всего " << body.size()
+              << ", тело " << (header_end == std::string::npos ? 0 : body.size() - header_end - 4)
+              << " байт (Content-Length: " << length << ")" << std::endl;
+    return 0;
+}
+
+void usage(const char* program) {
+    std::cout << "Использование: " << program
+              << " [--encrypt] [--server-key ключ] [--compress] [--resume путь] [--user имя:пароль] <vpn_server_ip> <vpn_server_port> <target_host:target_port>" << std::endl;
+    std::cout << "Пример: " << program << " 127.0.0.1 8080 google.com:80" << std::endl;
+    std::cout << "  --encrypt     CONNECT с шифрованием туннеля (X25519, ChaCha20-Poly1305)" << std::endl;
+    std::cout << "  --server-key  ожидаемый ключ сервера (hex) для --encrypt" << std::endl;
+    std::cout << "  --compress    CONNECT со сжатием туннеля (кадры LZ4)" << std::endl;
+    std::cout << "  --resume      GET путь в сессии, разрыв после 256 КБ ответа и возобновление" << std::endl;
+    std::cout << "  --user        учетные данные для сервера с включенной аутентификацией" << std::endl;
+}
+
+}  // namespace
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        std::cout << "Использование: " << argv[0] << " <vpn_server_ip> <vpn_server_port> <target_host:target_port>" << std::endl;
-        std::cout << "Пример: " << argv[0] << " 127.0.0.1 8080 google.com:80" << std::endl;
+    Framing framing;
+    std::string server_key;
+    std::string resume_path;
+    std::string credentials;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--encrypt") {
+            framing.encrypt = true;
+        } else if (arg == "--server-key" && i + 1 < argc) {
+            server_key = argv[++i];
+            framing.encrypt = true;
+        } else if (arg == "--compress") {
+            framing.compress = true;
+        } else if (arg == "--resume" && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (arg == "--user" && i + 1 < argc) {
+            credentials = argv[++i];
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 3) {
+        usage(argv[0]);
         return 1;
     }
-    
-    std::string vpn_host = argv[1];
-    int vpn_port = std::atoi(argv[2]);
-    std::string target_address = argv[3];
-    
+
+    std::string vpn_host = positional[0];
+    int vpn_port = std::atoi(positional[1].c_str());
+    std::string target_address = positional[2];
+    if (!resume_path.empty()) {
+        return run_resume(vpn_host, vpn_port, target_address, resume_path, 256 * 1024);
+    }
+
     // Парсинг целевого адреса
     size_t colon_pos = target_address.find(':');
     if (colon_pos == std::string::npos) {
         std::cerr << "Некорректный формат целевого адреса" << std::endl;
         return 1;
     }
-    
+
     std::string target_host = target_address.substr(0, colon_pos);
     int target_port = std::atoi(target_address.substr(colon_pos + 1).c_str());
-    
+
     // Создание сокета
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         std::cerr << "Не удалось создать сокет" << std::endl;
         return 1;
     }
-    
+
     // Подключение к VPN серверу
     sockaddr_in vpn_addr{};
     vpn_addr.sin_family = AF_INET;
     vpn_addr.sin_port = htons(vpn_port);
     inet_pton(AF_INET, vpn_host.c_str(), &vpn_addr.sin_addr);
-    
+
     if (connect(sock, reinterpret_cast<sockaddr*>(&vpn_addr), sizeof(vpn_addr)) < 0) {
         std::cerr << "Не удалось подключиться к VPN серверу" << std::endl;
         close(sock);
         return 1;
     }
-    
+
     std::cout << "Подключен к VPN серверу " << vpn_host << ":" << vpn_port << std::endl;
-    
-    // Отправка информации о целевом сервере
-    uint32_t host_len = htonl(target_host.length());
-    uint16_t port_net = htons(target_port);
-    
-    // Отправка длины хоста
-    if (send(sock, &host_len, sizeof(host_len), 0) < 0) {
-        std::cerr << "Ошибка при отправке длины хоста" << std::endl;
-        close(sock);
-        return 1;
-    }
-    
-    // Отправка хоста
-    if (send(sock, target_host.c_str(), target_host.length(), 0) < 0) {
-        std::cerr << "Ошибка при отправке хоста" << std::endl;
-        close(sock);
-        return 1;
-    }
-    
-    // Отправка порта
-    if (send(sock, &port_net, sizeof(port_net), 0) < 0) {
-        std::cerr << "Ошибка при отправке порта" << std::endl;
-        close(sock);
-        return 1;
-    }
-    
-    // Получение ответа от сервера
-    uint8_t response;
-    if (recv(sock, &response, sizeof(response), 0) <= 0) {
-        std::cerr << "Ошибка при получении ответа от сервера" << std::endl;
-        close(sock);
-        return 1;
-    }
-    
-    if (response != 1) {
-        std::cerr << "Сервер не смог установить соединение с " << target_host << ":" << target_port << std::endl;
+
+    MemoryBudget budget;
+    ConnectionQuota quota(budget, 0);
+    StreamCompression compression(quota);
+    bool framed = framing.encrypt || framing.compress;
+    bool opened = framed ? open_connect(sock, target_address, server_key, credentials, framing, compression)
+                         : open_binary(sock, target_host, target_port, credentials);
+    if (!opened) {
         close(sock);
         return 1;
     }
-    
+
     std::cout << "Туннель установлен к " << target_host << ":" << target_port << std::endl;
     std::cout << "Теперь можно отправлять данные через прокси" << std::endl;
-    
+
     // Простой тест - отправка HTTP запроса (если это веб-сервер)
     if (target_port == 80 || target_port == 8080) {
         std::string http_request = "GET / HTTP/1.1\r\nHost: " + target_host + "\r\nConnection: close\r\n\r\n";
-        if (send(sock, http_request.c_str(), http_request.length(), 0) > 0) {
+        framed = framing.encrypt || framing.compression;
+        bool sent = framed ? send_framed(sock, framing, http_request)
+                           : send(sock, http_request.c_str(), http_request.length(), 0) > 0;
+        if (sent) {
             std::cout << "HTTP запрос отправлен" << std::endl;
-            
+
             // Получение ответа
-            char buffer[4096];
-            int bytes_received = recv(sock, buffer, sizeof(buffer) - 1, 0);
-            if (bytes_received > 0) {
-                buffer[bytes_received] = '\0';
+            std::string response;
+            if (framed) {
+                // Connection: close - записи читаются до закрытия соединения
+                while (recv_framed(sock, framing, response)) {
+                }
+            } else {
+                char buffer[4096];
+                int bytes_received = recv(sock, buffer, sizeof(buffer), 0);
+                if (bytes_received > 0) {
+                    response.assign(buffer, bytes_received);
+                }
+            }
+            if (!response.empty()) {
                 std::cout << "Получен ответ:" << std::endl;
-                std::cout << buffer << std::endl;
+                std::cout << response << std::endl;
+            }
+            if (framing.compression) {
+                const StreamCompression::Stats& stats = framing.compression->stats();
+                std::cout << "Сжатие ответа: " << stats.received_plain << " байт текста, "
+                          << stats.received_wire << " байт кадров" << std::endl;
             }
         }
     }
-    
+
     close(sock);
     return 0;
-}
\ No newline at end of file
+}
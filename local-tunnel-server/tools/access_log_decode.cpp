@@ -0,0 +1,120 @@
+// Просмотр двоичного журнала доступа (access_log.format = "binary").
+// Выводит записи в виде JSON lines (как при format = "json") или таблицей.
+//
+// Использование: access-log-decode [--table] [файл...]
+// Без файлов читается стандартный ввод.
+
+#include "access_log.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string format_time(uint64_t unix_ms) {
+    std::time_t seconds = static_cast<std::time_t>(unix_ms / 1000);
+    std::tm local{};
+    localtime_r(&seconds, &local);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &local);
+    char result[48];
+    std::snprintf(result, sizeof(result), "%s.%03u", buffer, static_cast<unsigned>(unix_ms % 1000));
+    return result;
+}
+
+void print_table_row(const AccessRecord& record) {
+    std::printf("%s %8llu %s:%u -> %s:%u %s resolve=%uus connect=%uus up=%llu down=%llu %ums %s\n",
+                format_time(record.start_unix_ms).c_str(),
+                static_cast<unsigned long long>(record.connection_id),
+                record.client_ip.c_str(), record.client_port,
+                record.target_host.c_str(), record.target_port,
+                AccessLog::protocol_name(record.protocol),
+                record.resolve_us, record.connect_us,
+                static_cast<unsigned long long>(record.bytes_from_client),
+                static_cast<unsigned long long>(record.bytes_from_target),
+                record.duration_ms,
+                AccessLog::reason_name(record.reason));
+}
+
+// Возвращает false, если файл не в двоичном формате или поврежден
+bool decode_stream(FILE* input, const std::string& name, bool table, size_t& count) {
+    char magic[sizeof(AccessLog::MAGIC)];
+    if (std::fread(magic, 1, sizeof(magic), input) != sizeof(magic) ||
+        std::memcmp(magic, AccessLog::MAGIC, sizeof(magic)) != 0) {
+        std::cerr << name << ": не двоичный журнал доступа" << std::endl;
+        return false;
+    }
+
+    std::vector<char> buffer;
+    size_t offset = 0;
+    char chunk[65536];
+    while (true) {
+        size_t got = std::fread(chunk, 1, sizeof(chunk), input);
+        buffer.insert(buffer.end(), chunk, chunk + got);
+
+        AccessRecord record;
+        while (size_t used = AccessLog::decode_binary(buffer.data() + offset, buffer.size() - offset, record)) {
+            offset += used;
+            ++count;
+            if (table) {
+                print_table_row(record);
+            } else {
+                std::fputs(AccessLog::encode_json(record).c_str(), stdout);
+            }
+        }
+
+        // Разобранное начало буфера больше не нужно
+        buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+        offset = 0;
+
+        if (got == 0) {
+            break;
+        }
+    }
+
+    if (!buffer.empty()) {
+        std::cerr << name << ": запись " << (count + 1) << " повреждена или обрезана ("
+                  << buffer.size() << " байт)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    bool table = false;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--table") {
+            table = true;
+        } else if (arg == "-h" || arg == "--help") {
+            std::cout << "Использование: access-log-decode [--table] [файл...]" << std::endl;
+            return 0;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    bool ok = true;
+    size_t count = 0;
+    if (files.empty()) {
+        ok = decode_stream(stdin, "stdin", table, count);
+    }
+    for (const auto& file : files) {
+        FILE* input = std::fopen(file.c_str(), "rb");
+        if (!input) {
+            std::cerr << file << ": " << std::strerror(errno) << std::endl;
+            ok = false;
+            continue;
+        }
+        ok = decode_stream(input, file, table, count) && ok;
+        std::fclose(input);
+    }
+    return ok ? 0 : 1;
+}
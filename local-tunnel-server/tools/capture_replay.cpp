@@ -0,0 +1,635 @@
+// Воспроизведение захваченной нагрузки (capture.enabled) через прокси.
+// Туннели открываются в моменты из захвата (с ускорением --speed), к
+// локальной подмене цели, которая повторяет записанные объемы ответов и
+// задержки по огибающей. В конце выводится сравнение задержек и пропускной
+// способности с захватом.
+//
+// Использование: capture-replay [--proxy хост:порт] [--speed N] [--limit N]
+//                               [--timeout с] [--dump] файл
+//
+// Туннели CONNECT и SOCKS5 открываются к подмене цели,
+// первые 8 байт от клиента - номер записи (вычитаются из объема захвата).
+// Обычные HTTP запросы идут к подмене с номером записи в пути, ответ
+// запрещает кэширование. UDP ассоциации и несостоявшиеся туннели
+// пропускаются. Сервер должен быть запущен без authentication.enabled.
+// Код возврата 1, если хотя бы один туннель не воспроизведен.
+
+#include "traffic_capture.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t PREAMBLE = 8;  // Номер записи в 8 шестнадцатеричных цифрах
+
+// Результат воспроизведения одного туннеля
+struct Outcome {
+    bool ok{false};
+    double setup_ms{0};
+    double first_byte_ms{-1};   // От начала до первого байта цели
+    double duration_ms{0};
+    uint64_t bytes_to_target{0};
+    uint64_t bytes_from_target{0};
+    Clock::time_point end{};
+};
+
+struct Options {
+    std::string proxy_host{"127.0.0.1"};
+    int proxy_port{8080};
+    double speed{1.0};
+    size_t limit{0};
+    int timeout_seconds{30};
+    bool dump{false};
+    std::string file;
+};
+
+std::vector<CaptureRecord> g_records;
+Options g_options;
+int g_origin_port = 0;
+
+std::string preamble(size_t index) {
+    char text[16];
+    std::snprintf(text, sizeof(text), "%08zx", index);
+    return text;
+}
+
+bool replayable(const CaptureRecord& record) {
+    switch (record.reason) {
+        case CloseReason::BAD_REQUEST:
+        case CloseReason::DENIED:
+        case CloseReason::REJECTED:
+        case CloseReason::CONNECT_FAILED:
+        case CloseReason::NO_MEMORY:
+            return false;
+        default:
+            break;
+    }
+    return record.protocol == AccessProtocol::CONNECT || record.protocol == AccessProtocol::HTTP ||
+           record.protocol == AccessProtocol::SOCKS5;
+}
+
+// Смещение события с учетом ускорения
+Clock::time_point at(Clock::time_point base, uint32_t offset_ms) {
+    return base + std::chrono::microseconds(static_cast<int64_t>(offset_ms * 1000.0 / g_options.speed));
+}
+
+bool send_filler(int fd, uint64_t bytes) {
+    static const std::string filler(64 * 1024, 'x');
+    while (bytes > 0) {
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(bytes, filler.size()));
+        ssize_t sent = send(fd, filler.data(), chunk, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        bytes -= static_cast<uint64_t>(sent);
+    }
+    return true;
+}
+
+bool send_text(int fd, const std::string& text) {
+    size_t total = 0;
+    while (total < text.size()) {
+        ssize_t sent = send(fd, text.data() + total, text.size() - total, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        total += static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Чтение ровно bytes байт; first - время первого прочитанного байта
+bool receive_exact(int fd, uint64_t bytes, Clock::time_point* first = nullptr) {
+    char buffer[64 * 1024];
+    while (bytes > 0) {
+        ssize_t received = recv(fd, buffer, static_cast<size_t>(std::min<uint64_t>(bytes, sizeof(buffer))), 0);
+        if (received <= 0) {
+            return false;
+        }
+        if (first && *first == Clock::time_point{}) {
+            *first = Clock::now();
+        }
+        bytes -= static_cast<uint64_t>(received);
+    }
+    return true;
+}
+
+// Чтение до конца заголовков; лишние байты остаются в rest
+bool receive_head(int fd, std::string& head, std::string& rest, Clock::time_point* first = nullptr) {
+    char buffer[4096];
+    head.clear();
+    while (true) {
+        size_t end = head.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            rest = head.substr(end + 4);
+            head.resize(end + 4);
+            return true;
+        }
+        if (head.size() > 65536) {
+            return false;
+        }
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return false;
+        }
+        if (first && *first == Clock::time_point{}) {
+            *first = Clock::now();
+        }
+        head.append(buffer, static_cast<size_t>(received));
+    }
+}
+
+uint64_t content_length(const std::string& head) {
+    std::string lower = head;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    size_t position = lower.find("\r\ncontent-length:");
+    return position == std::string::npos ? 0 : std::strtoull(lower.c_str() + position + 17, nullptr, 10);
+}
+
+void drain(int fd) {
+    char buffer[4096];
+    while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+    }
+}
+
+void set_timeouts(int fd) {
+    timeval timeout{g_options.timeout_seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Ответ HTTP подмены: заголовки и тело общим объемом как в захвате
+std::string response_head(uint64_t body) {
+    return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body) +
+           "\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n";
+}
+
+uint64_t response_body(const CaptureRecord& record) {
+    uint64_t head = response_head(record.bytes_from_target).size();
+    return record.bytes_from_target > head ? record.bytes_from_target - head : 0;
+}
+
+// Сторона цели: отправляет байты цели по огибающей, читает байты клиента
+void serve_origin(int fd) {
+    set_timeouts(fd);
+    Clock::time_point base = Clock::now();
+    char first;
+    if (recv(fd, &first, 1, MSG_PEEK) != 1) {
+        close(fd);
+        return;
+    }
+
+    // HTTP запрос начинается с метода, туннель - с номера записи
+    if (std::isupper(static_cast<unsigned char>(first))) {
+        std::string head;
+        std::string rest;
+        size_t position;
+        size_t index = 0;
+        if (!receive_head(fd, head, rest) || (position = head.find("/r")) == std::string::npos ||
+            (index = std::strtoul(head.substr(position + 2, PREAMBLE).c_str(), nullptr, 16)) >= g_records.size()) {
+            close(fd);
+            return;
+        }
+        const CaptureRecord& record = g_records[index];
+        uint64_t request_body = content_length(head);
+        receive_exact(fd, request_body > rest.size() ? request_body - rest.size() : 0);
+
+        // Заголовки уходят с первой порцией ответа, тело - порциями огибающей
+        uint64_t remaining = response_body(record);
+        std::string response = response_head(remaining);
+        bool ok = true;
+        bool head_sent = false;
+        for (const CaptureEvent& event : record.events) {
+            if (event.from_client || !ok) {
+                continue;
+            }
+            std::this_thread::sleep_until(at(base, event.offset_ms));
+            uint64_t part = event.bytes;
+            if (!head_sent) {
+                head_sent = true;
+                ok = send_text(fd, response);
+                part = part > response.size() ? part - response.size() : 0;
+            }
+            part = std::min(part, remaining);
+            ok = ok && send_filler(fd, part);
+            remaining -= part;
+        }
+        if (ok && (head_sent || send_text(fd, response))) {
+            send_filler(fd, remaining);
+        }
+        shutdown(fd, SHUT_WR);
+        drain(fd);
+        close(fd);
+        return;
+    }
+
+    char text[PREAMBLE + 1] = {};
+    if (recv(fd, text, PREAMBLE, MSG_WAITALL) != static_cast<ssize_t>(PREAMBLE)) {
+        close(fd);
+        return;
+    }
+    size_t index = std::strtoul(text, nullptr, 16);
+    if (index >= g_records.size()) {
+        close(fd);
+        return;
+    }
+    uint64_t credit = PREAMBLE;
+    for (const CaptureEvent& event : g_records[index].events) {
+        if (event.from_client) {
+            uint64_t skipped = std::min(credit, event.bytes);
+            credit -= skipped;
+            if (!receive_exact(fd, event.bytes - skipped)) {
+                break;
+            }
+        } else {
+            std::this_thread::sleep_until(at(base, event.offset_ms));
+            if (!send_filler(fd, event.bytes)) {
+                break;
+            }
+        }
+    }
+    drain(fd);  // Туннель закрывает клиент
+    close(fd);
+}
+
+// Подмена целей: поток на соединение, как у самого прокси
+int start_origin(std::atomic<bool>& running) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), length) < 0 || listen(listener, 4096) < 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) < 0) {
+        close(listener);
+        return -1;
+    }
+    g_origin_port = ntohs(address.sin_port);
+    std::thread([listener, &running] {
+        while (running.load()) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            std::thread(serve_origin, fd).detach();
+        }
+    }).detach();
+    return listener;
+}
+
+// Рукопожатие с прокси по протоколу записи; false - туннель не открыт
+bool handshake(int fd, const CaptureRecord& record) {
+    std::string origin = "127.0.0.1:" + std::to_string(g_origin_port);
+    std::string head;
+    std::string rest;
+    switch (record.protocol) {
+        case AccessProtocol::CONNECT:
+            return send_text(fd, "CONNECT " + origin + " HTTP/1.1\r\nHost: " + origin + "\r\n\r\n") &&
+                   receive_head(fd, head, rest) && head.find(" 200") != std::string::npos;
+        case AccessProtocol::SOCKS5: {
+            std::string request("\x05\x01\x00\x05\x01\x00\x01\x7f\x00\x00\x01", 11);
+            request.push_back(static_cast<char>(g_origin_port >> 8));
+            request.push_back(static_cast<char>(g_origin_port & 0xff));
+            unsigned char reply[4];
+            if (!send_text(fd, request) || recv(fd, reply, 2, MSG_WAITALL) != 2 || reply[1] != 0x00 ||
+                recv(fd, reply, 4, MSG_WAITALL) != 4 || reply[1] != 0x00) {
+                return false;
+            }
+            size_t address = reply[3] == 0x04 ? 16 : 4;
+            return receive_exact(fd, address + 2);
+        }
+        default:
+            return true;  // Обычный HTTP запрос идет сразу
+    }
+}
+
+// Запрос HTTP с путем той же длины, что в захвате, и номером записи в нем
+std::string http_request(const CaptureRecord& record, size_t index) {
+    std::string method = record.line.substr(0, record.line.find(' '));
+    size_t url = record.line.find("://");
+    size_t path = url == std::string::npos ? std::string::npos : record.line.find('/', url + 3);
+    size_t path_end = record.line.rfind(' ');
+    size_t length = path == std::string::npos || path_end <= path ? 1 : path_end - path;
+    std::string target = "/r" + preamble(index) + "/";
+    if (target.size() < length) {
+        target += std::string(length - target.size(), 'x');
+    }
+    std::string origin = "127.0.0.1:" + std::to_string(g_origin_port);
+    std::string request = method + " http://" + origin + target + " HTTP/1.1\r\nHost: " + origin +
+                          "\r\nUser-Agent: capture-replay\r\n";
+    // Тело запроса - остаток объема от клиента, кроме GET и HEAD
+    uint64_t head_size = request.size() + 2;
+    uint64_t body = method != "GET" && method != "HEAD" && record.bytes_from_client > head_size + 32
+        ? record.bytes_from_client - head_size - 32 : 0;
+    if (body > 0) {
+        request += "Content-Length: " + std::to_string(body) + "\r\n";
+    }
+    return request + "\r\n";
+}
+
+void replay(size_t index, Outcome& outcome) {
+    const CaptureRecord& record = g_records[index];
+    Clock::time_point start = Clock::now();
+    Clock::time_point first{};
+    Clock::time_point end{};
+    auto finish = [&](bool ok) {
+        if (end == Clock::time_point{}) {
+            end = Clock::now();
+        }
+        outcome.ok = ok;
+        outcome.end = end;
+        outcome.duration_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (first != Clock::time_point{}) {
+            outcome.first_byte_ms = std::chrono::duration<double, std::milli>(first - start).count();
+        }
+    };
+
+    sockaddr_in proxy{};
+    proxy.sin_family = AF_INET;
+    proxy.sin_port = htons(static_cast<uint16_t>(g_options.proxy_port));
+    inet_pton(AF_INET, g_options.proxy_host.c_str(), &proxy.sin_addr);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    set_timeouts(fd);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&proxy), sizeof(proxy)) < 0 || !handshake(fd, record)) {
+        close(fd);
+        finish(false);
+        return;
+    }
+    Clock::time_point established = Clock::now();
+    outcome.setup_ms = std::chrono::duration<double, std::milli>(established - start).count();
+
+    bool ok = true;
+    if (record.protocol == AccessProtocol::HTTP) {
+        std::string request = http_request(record, index);
+        uint64_t body = content_length(request);
+        std::string head;
+        std::string rest;
+        ok = send_text(fd, request) && send_filler(fd, body) && receive_head(fd, head, rest, &first);
+        if (ok) {
+            uint64_t length = content_length(head);
+            ok = receive_exact(fd, length > rest.size() ? length - rest.size() : 0);
+            outcome.bytes_to_target = request.size() + body;
+            outcome.bytes_from_target = head.size() + length;
+        }
+    } else {
+        ok = send_text(fd, preamble(index));
+        uint64_t credit = PREAMBLE;
+        outcome.bytes_to_target = PREAMBLE;
+        for (const CaptureEvent& event : record.events) {
+            if (!ok) {
+                break;
+            }
+            if (event.from_client) {
+                uint64_t skipped = std::min(credit, event.bytes);
+                credit -= skipped;
+                std::this_thread::sleep_until(at(established, event.offset_ms));
+                ok = send_filler(fd, event.bytes - skipped);
+                outcome.bytes_to_target += event.bytes - skipped;
+            } else {
+                ok = receive_exact(fd, event.bytes, &first);
+                outcome.bytes_from_target += event.bytes;
+            }
+        }
+        // Хвост туннеля без передачи тоже воспроизводится
+        uint32_t tail_ms = record.duration_ms > record.setup_us / 1000 ? record.duration_ms - record.setup_us / 1000 : 0;
+        if (ok) {
+            std::this_thread::sleep_until(at(established, tail_ms));
+        }
+        // Туннель закончен со стороны клиента; закрытия прокси не ждем в замере
+        end = Clock::now();
+        shutdown(fd, SHUT_WR);
+        drain(fd);
+    }
+    close(fd);
+    finish(ok);
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    return values[index];
+}
+
+// Дополнение пробелами до width символов UTF-8 (printf считает байты)
+std::string pad(const std::string& text, size_t width, bool left = false) {
+    size_t length = 0;
+    for (unsigned char c : text) {
+        length += (c & 0xc0) != 0x80;
+    }
+    std::string spaces(width > length ? width - length : 0, ' ');
+    return left ? spaces + text : text + spaces;
+}
+
+void print_row(const std::string& title, const std::vector<double>& captured, const std::vector<double>& replayed) {
+    std::printf("%s %9.2f %9.2f %9.2f   %9.2f %9.2f %9.2f\n", pad(title, 20).c_str(),
+                percentile(captured, 0.5), percentile(captured, 0.9), percentile(captured, 0.99),
+                percentile(replayed, 0.5), percentile(replayed, 0.9), percentile(replayed, 0.99));
+}
+
+void dump(const std::vector<CaptureRecord>& records) {
+    for (const CaptureRecord& record : records) {
+        std::printf("%llu %-10s %-48s setup=%uus up=%llu down=%llu %ums %s events=%zu\n",
+                    static_cast<unsigned long long>(record.start_unix_ms),
+                    AccessLog::protocol_name(record.protocol), record.line.c_str(), record.setup_us,
+                    static_cast<unsigned long long>(record.bytes_from_client),
+                    static_cast<unsigned long long>(record.bytes_from_target), record.duration_ms,
+                    AccessLog::reason_name(record.reason), record.events.size());
+        for (const CaptureEvent& event : record.events) {
+            std::printf("    +%ums %s %llu\n", event.offset_ms, event.from_client ? "->" : "<-",
+                        static_cast<unsigned long long>(event.bytes));
+        }
+    }
+}
+
+bool load(const std::string& path, std::vector<CaptureRecord>& records, size_t& skipped) {
+    std::ifstream in(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof()) {
+        return false;
+    }
+    if (data.size() < sizeof(TrafficCapture::MAGIC) ||
+        std::memcmp(data.data(), TrafficCapture::MAGIC, sizeof(TrafficCapture::MAGIC)) != 0) {
+        std::cerr << path << ": не файл захвата" << std::endl;
+        return false;
+    }
+    size_t offset = sizeof(TrafficCapture::MAGIC);
+    while (offset < data.size()) {
+        CaptureRecord record;
+        size_t used = TrafficCapture::decode(data.data() + offset, data.size() - offset, record);
+        if (used == 0) {
+            std::cerr << path << ": поврежденная запись на смещении " << offset << std::endl;
+            break;
+        }
+        offset += used;
+        if (g_options.dump || replayable(record)) {
+            records.push_back(std::move(record));
+        } else {
+            ++skipped;
+        }
+    }
+    std::stable_sort(records.begin(), records.end(), [](const CaptureRecord& a, const CaptureRecord& b) {
+        return a.start_unix_ms < b.start_unix_ms;
+    });
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--proxy" && has_value) {
+            if (!Utils::parse_address(argv[++i], g_options.proxy_host, g_options.proxy_port)) {
+                std::cerr << "Некорректный адрес прокси: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if (arg == "--speed" && has_value) {
+            g_options.speed = std::max(0.01, std::atof(argv[++i]));
+        } else if (arg == "--limit" && has_value) {
+            g_options.limit = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--timeout" && has_value) {
+            g_options.timeout_seconds = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--dump") {
+            g_options.dump = true;
+        } else if (g_options.file.empty() && arg[0] != '-') {
+            g_options.file = arg;
+        } else {
+            g_options.file.clear();
+            break;
+        }
+    }
+    if (g_options.file.empty()) {
+        std::cerr << "Использование: capture-replay [--proxy хост:порт] [--speed N] [--limit N]\n"
+                  << "                              [--timeout с] [--dump] файл" << std::endl;
+        return 2;
+    }
+
+    size_t skipped = 0;
+    if (!load(g_options.file, g_records, skipped)) {
+        return 2;
+    }
+    if (g_options.dump) {
+        dump(g_records);
+        return 0;
+    }
+    if (g_options.limit > 0 && g_records.size() > g_options.limit) {
+        g_records.resize(g_options.limit);
+    }
+    if (g_records.empty()) {
+        std::cerr << "Нет туннелей для воспроизведения (пропущено " << skipped << ")" << std::endl;
+        return 2;
+    }
+
+    std::atomic<bool> running{true};
+    int listener = start_origin(running);
+    if (listener < 0) {
+        std::cerr << "Не удалось запустить подмену цели" << std::endl;
+        return 2;
+    }
+
+    std::printf("Туннелей: %zu (пропущено %zu), ускорение x%.2f, прокси %s:%d\n", g_records.size(), skipped,
+                g_options.speed, g_options.proxy_host.c_str(), g_options.proxy_port);
+
+    // Запуск туннелей в моменты из захвата; поток на туннель
+    std::vector<Outcome> outcomes(g_records.size());
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t finished = 0;
+    uint64_t first_start = g_records.front().start_unix_ms;
+    Clock::time_point replay_start = Clock::now();
+    for (size_t i = 0; i < g_records.size(); ++i) {
+        uint64_t offset = g_records[i].start_unix_ms - first_start;
+        std::this_thread::sleep_until(at(replay_start, static_cast<uint32_t>(offset)));
+        std::thread([i, &outcomes, &done_mutex, &done_cv, &finished] {
+            replay(i, outcomes[i]);
+            std::lock_guard<std::mutex> lock(done_mutex);
+            ++finished;
+            done_cv.notify_one();
+        }).detach();
+    }
+    {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done_cv.wait(lock, [&] { return finished == g_records.size(); });
+    }
+    running.store(false);
+    shutdown(listener, SHUT_RDWR);
+    close(listener);
+
+    // Сравнение с захватом
+    std::vector<double> captured_setup, replayed_setup;
+    std::vector<double> captured_first, replayed_first;
+    std::vector<double> captured_duration, replayed_duration;
+    uint64_t captured_bytes = 0;
+    uint64_t replayed_bytes = 0;
+    uint64_t capture_end = first_start;
+    size_t failed = 0;
+    for (size_t i = 0; i < g_records.size(); ++i) {
+        const CaptureRecord& record = g_records[i];
+        const Outcome& outcome = outcomes[i];
+        capture_end = std::max<uint64_t>(capture_end, record.start_unix_ms + record.duration_ms);
+        captured_bytes += record.bytes_from_client + record.bytes_from_target;
+        captured_setup.push_back(record.setup_us / 1000.0);
+        captured_duration.push_back(record.duration_ms);
+        for (const CaptureEvent& event : record.events) {
+            if (!event.from_client) {
+                captured_first.push_back(record.setup_us / 1000.0 + event.offset_ms);
+                break;
+            }
+        }
+        if (!outcome.ok) {
+            ++failed;
+            continue;
+        }
+        replayed_bytes += outcome.bytes_to_target + outcome.bytes_from_target;
+        replayed_setup.push_back(outcome.setup_ms);
+        replayed_duration.push_back(outcome.duration_ms);
+        if (outcome.first_byte_ms >= 0) {
+            replayed_first.push_back(outcome.first_byte_ms);
+        }
+    }
+    Clock::time_point replay_end = replay_start;
+    for (const Outcome& outcome : outcomes) {
+        replay_end = std::max(replay_end, outcome.end);
+    }
+    double replay_seconds = std::max(0.001, std::chrono::duration<double>(replay_end - replay_start).count());
+    double capture_seconds = std::max(0.001, (capture_end - first_start) / 1000.0);
+
+    std::printf("\n%s%s   %s\n", pad("мс", 20).c_str(), pad("захват p50/p90/p99", 30, true).c_str(),
+                pad("воспроизведение p50/p90/p99", 30, true).c_str());
+    print_row("установка туннеля", captured_setup, replayed_setup);
+    print_row("первый байт цели", captured_first, replayed_first);
+    print_row("длительность", captured_duration, replayed_duration);
+    std::printf("\nЗахват: %.1f с, %.2f Мбит/с; воспроизведение: %.1f с, %.2f Мбит/с (ожидается x%.2f)\n",
+                capture_seconds, captured_bytes * 8 / capture_seconds / 1e6, replay_seconds,
+                replayed_bytes * 8 / replay_seconds / 1e6, g_options.speed);
+    std::printf("Воспроизведено %zu из %zu, ошибок %zu\n", g_records.size() - failed, g_records.size(), failed);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+// Строки файла пользователей (authentication.users_file).
+//
+// Использование: cvpn-passwd [--n N] [--r R] [--p P] имя
+//                cvpn-passwd --token имя [токен]
+// Пароль читается первой строкой стандартного ввода и хэшируется scrypt
+// со случайной солью. С --token без токена создается случайный токен: он
+// выводится в stderr, в файл попадает только его SHA-256.
+
+#include "credential_store.h"
+#include "crypto.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace {
+
+void usage(const char* program) {
+    std::cerr << "Использование: " << program << " [--n N] [--r R] [--p P] имя" << std::endl;
+    std::cerr << "               " << program << " --token имя [токен]" << std::endl;
+    std::cerr << "  Пароль читается из стандартного ввода; строка для файла пользователей" << std::endl;
+    std::cerr << "  выводится в стандартный вывод" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    bool token_mode = false;
+    uint64_t n = 16384;
+    unsigned long r = 8;
+    unsigned long p = 1;
+    std::string name;
+    std::string token;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--token") {
+                token_mode = true;
+            } else if (arg == "--n" && i + 1 < argc) {
+                n = std::stoull(argv[++i]);
+            } else if (arg == "--r" && i + 1 < argc) {
+                r = std::stoul(argv[++i]);
+            } else if (arg == "--p" && i + 1 < argc) {
+                p = std::stoul(argv[++i]);
+            } else if (name.empty()) {
+                name = arg;
+            } else if (token_mode && token.empty()) {
+                token = arg;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    } catch (const std::exception&) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (name.empty() || name.find_first_of(":\"\\ \t") != std::string::npos) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (token_mode) {
+        if (token.empty()) {
+            uint8_t random[32];
+            if (!Crypto::random_bytes(random, sizeof(random))) {
+                std::cerr << "Нет случайных байт" << std::endl;
+                return 1;
+            }
+            token = Crypto::to_hex(random, sizeof(random));
+            std::cerr << "Токен: " << token << std::endl;
+        }
+        std::cout << name << " " << CredentialStore::hash_token(token) << std::endl;
+        return 0;
+    }
+
+    std::string password;
+    if (!std::getline(std::cin, password) || password.empty()) {
+        std::cerr << "Пустой пароль" << std::endl;
+        return 1;
+    }
+    if (!password.empty() && password.back() == '\r') {
+        password.pop_back();
+    }
+    std::string secret = CredentialStore::hash_password(password, n, static_cast<uint32_t>(r),
+                                                        static_cast<uint32_t>(p));
+    if (secret.empty()) {
+        std::cerr << "Недопустимые параметры scrypt: n - степень двойки, память 128 * r * n байт не больше "
+                  << (Crypto::SCRYPT_MAX_MEMORY >> 20) << " МБ" << std::endl;
+        return 1;
+    }
+    std::cout << name << " " << secret << std::endl;
+    return 0;
+}
@@ -0,0 +1,334 @@
+// Просмотр сегмента статистики сервера (stats.file) в реальном времени.
+// Читает только разделяемую память и не обращается к серверу.
+//
+// Использование: cvpnctl [-f файл] [-n секунд] [-1] [top|workers|handshakes|counters]
+//   top        - соединения и байты в секунду, самые нагруженные туннели (по умолчанию)
+//   workers    - нагрузка рабочих потоков
+//   handshakes - туннели с самым долгим разрешением имени и подключением
+//   counters   - все счетчики и их скорость
+//   -1         - вывести один снимок и выйти
+
+#include "stats_segment.h"
+#include "access_log.h"
+#include "utils.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t ROWS = 20;
+
+struct Options {
+    std::string file = "/dev/shm/cvpn-stats";
+    double interval = 1.0;
+    bool once = false;
+    std::string view = "top";
+};
+
+// Отображение сегмента только для чтения
+class Mapping {
+public:
+    ~Mapping() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info{};
+        if (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(StatsSegmentLayout)) {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, sizeof(StatsSegmentLayout), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        segment_ = static_cast<const StatsSegmentLayout*>(mapped);
+        inode_ = info.st_ino;
+        return true;
+    }
+
+    void close() {
+        if (segment_) {
+            munmap(const_cast<StatsSegmentLayout*>(segment_), sizeof(StatsSegmentLayout));
+            segment_ = nullptr;
+        }
+    }
+
+    // Сервер при перезапуске создает файл заново
+    bool replaced(const std::string& path) const {
+        struct stat info{};
+        return stat(path.c_str(), &info) < 0 || info.st_ino != inode_;
+    }
+
+    const StatsSegmentLayout* segment() const { return segment_; }
+
+private:
+    const StatsSegmentLayout* segment_{nullptr};
+    ino_t inode_{0};
+};
+
+int64_t counter(const StatsData& data, const char* name) {
+    for (uint32_t i = 0; i < data.counter_count; ++i) {
+        if (std::strcmp(data.counters[i].name, name) == 0) {
+            return data.counters[i].value;
+        }
+    }
+    return 0;
+}
+
+double rate(int64_t now, int64_t before, double seconds) {
+    return seconds > 0 && now >= before ? static_cast<double>(now - before) / seconds : 0.0;
+}
+
+std::string format_rate(double bytes_per_second) {
+    return Utils::format_bytes(static_cast<size_t>(bytes_per_second)) + "/s";
+}
+
+std::string format_duration(uint64_t ms) {
+    uint64_t seconds = ms / 1000;
+    char buffer[32];
+    if (seconds >= 3600) {
+        std::snprintf(buffer, sizeof(buffer), "%lluh%02llum", static_cast<unsigned long long>(seconds / 3600),
+                      static_cast<unsigned long long>(seconds % 3600 / 60));
+    } else if (seconds >= 60) {
+        std::snprintf(buffer, sizeof(buffer), "%llum%02llus", static_cast<unsigned long long>(seconds / 60),
+                      static_cast<unsigned long long>(seconds % 60));
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.1fs", static_cast<double>(ms) / 1000.0);
+    }
+    return buffer;
+}
+
+std::string endpoint(const char* host, unsigned port) {
+    return std::string(host) + ":" + std::to_string(port);
+}
+
+void print_header(const StatsSegmentLayout& segment, const StatsData& data) {
+    uint64_t uptime = data.published_unix_ms > data.started_unix_ms
+        ? data.published_unix_ms - data.started_unix_ms : 0;
+    std::printf("local-tunnel-server pid %llu, работает %s, туннелей %u (в таблице %u), рабочих %u\n",
+                static_cast<unsigned long long>(segment.header.pid), format_duration(uptime).c_str(),
+                data.tunnels_total, data.tunnel_count, data.worker_count);
+}
+
+void print_summary(const StatsData& data, const StatsData* previous, double seconds) {
+    auto per_second = [&](const char* name) {
+        return previous ? rate(counter(data, name), counter(*previous, name), seconds) : 0.0;
+    };
+    std::printf("соединений/с %.1f  туннелей/с %.1f  ошибок/с %.1f  от клиентов %s  от целей %s\n\n",
+                per_second("connections_accepted_total"),
+                per_second("tunnels_established_total"),
+                per_second("tunnels_failed_total"),
+                format_rate(per_second("tunnel_bytes_from_client_total")).c_str(),
+                format_rate(per_second("tunnel_bytes_from_target_total")).c_str());
+}
+
+void print_top(const StatsData& data, const StatsData* previous, double seconds) {
+    print_summary(data, previous, seconds);
+
+    // Скорость туннеля - по разнице с предыдущим снимком
+    std::map<uint64_t, const StatsTunnel*> before;
+    if (previous) {
+        for (uint32_t i = 0; i < previous->tunnel_count; ++i) {
+            before[previous->tunnels[i].id] = &previous->tunnels[i];
+        }
+    }
+    struct Row {
+        const StatsTunnel* tunnel;
+        double up;
+        double down;
+    };
+    std::vector<Row> rows;
+    for (uint32_t i = 0; i < data.tunnel_count; ++i) {
+        const StatsTunnel& tunnel = data.tunnels[i];
+        auto found = before.find(tunnel.id);
+        double up = 0;
+        double down = 0;
+        if (found != before.end()) {
+            up = rate(static_cast<int64_t>(tunnel.bytes_from_client),
+                      static_cast<int64_t>(found->second->bytes_from_client), seconds);
+            down = rate(static_cast<int64_t>(tunnel.bytes_from_target),
+                        static_cast<int64_t>(found->second->bytes_from_target), seconds);
+        }
+        rows.push_back(Row{&tunnel, up, down});
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        if (a.up + a.down != b.up + b.down) {
+            return a.up + a.down > b.up + b.down;
+        }
+        return a.tunnel->bytes_from_client + a.tunnel->bytes_from_target >
+               b.tunnel->bytes_from_client + b.tunnel->bytes_from_target;
+    });
+
+    std::printf("%8s  %-21s  %-32s  %-8s  %12s  %12s  %10s\n",
+                "ID", "CLIENT", "TARGET", "PROTO", "UP", "DOWN", "AGE");
+    for (size_t i = 0; i < rows.size() && i < ROWS; ++i) {
+        const StatsTunnel& tunnel = *rows[i].tunnel;
+        std::printf("%8llu  %-21s  %-32s  %-8s  %12s  %12s  %10s%s\n",
+                    static_cast<unsigned long long>(tunnel.id),
+                    endpoint(tunnel.client_ip, tunnel.client_port).c_str(),
+                    endpoint(tunnel.target_host, tunnel.target_port).c_str(),
+                    AccessLog::protocol_name(static_cast<AccessProtocol>(tunnel.protocol)),
+                    format_rate(rows[i].up).c_str(), format_rate(rows[i].down).c_str(),
+                    format_duration(tunnel.age_ms).c_str(), tunnel.parked ? "  parked" : "");
+    }
+}
+
+void print_workers(const StatsData& data, const StatsData* previous, double seconds) {
+    print_summary(data, previous, seconds);
+    std::printf("%6s  %4s  %4s  %8s  %12s  %10s\n", "WORKER", "CPU", "NODE", "ACTIVE", "ACCEPTED", "ACCEPT/S");
+    for (uint32_t i = 0; i < data.worker_count; ++i) {
+        const StatsWorker& worker = data.workers[i];
+        double per_second = 0;
+        if (previous && i < previous->worker_count) {
+            per_second = rate(static_cast<int64_t>(worker.accepted),
+                              static_cast<int64_t>(previous->workers[i].accepted), seconds);
+        }
+        std::printf("%6d  %4d  %4d  %8d  %12llu  %10.1f\n", worker.index, worker.cpu, worker.node,
+                    worker.active, static_cast<unsigned long long>(worker.accepted), per_second);
+    }
+}
+
+void print_handshakes(const StatsData& data) {
+    std::vector<const StatsTunnel*> rows;
+    for (uint32_t i = 0; i < data.tunnel_count; ++i) {
+        rows.push_back(&data.tunnels[i]);
+    }
+    std::sort(rows.begin(), rows.end(), [](const StatsTunnel* a, const StatsTunnel* b) {
+        return a->handshake_us > b->handshake_us;
+    });
+    std::printf("%8s  %-21s  %-32s  %12s  %10s\n", "ID", "CLIENT", "TARGET", "HANDSHAKE", "AGE");
+    for (size_t i = 0; i < rows.size() && i < ROWS; ++i) {
+        std::printf("%8llu  %-21s  %-32s  %9.3f ms  %10s\n",
+                    static_cast<unsigned long long>(rows[i]->id),
+                    endpoint(rows[i]->client_ip, rows[i]->client_port).c_str(),
+                    endpoint(rows[i]->target_host, rows[i]->target_port).c_str(),
+                    static_cast<double>(rows[i]->handshake_us) / 1000.0,
+                    format_duration(rows[i]->age_ms).c_str());
+    }
+}
+
+void print_counters(const StatsData& data, const StatsData* previous, double seconds) {
+    std::printf("%-48s  %16s  %12s\n", "COUNTER", "VALUE", "PER SEC");
+    for (uint32_t i = 0; i < data.counter_count; ++i) {
+        const StatsCounter& entry = data.counters[i];
+        double per_second = previous ? rate(entry.value, counter(*previous, entry.name), seconds) : 0.0;
+        std::printf("%-48s  %16lld  %12.1f\n", entry.name, static_cast<long long>(entry.value), per_second);
+    }
+}
+
+bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if ((arg == "-f" || arg == "-n") && i + 1 < argc) {
+            if (arg == "-f") {
+                options.file = argv[++i];
+            } else {
+                options.interval = std::max(0.1, std::atof(argv[++i]));
+            }
+        } else if (arg == "-1") {
+            options.once = true;
+        } else if (arg == "top" || arg == "workers" || arg == "handshakes" || arg == "counters") {
+            options.view = arg;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "Использование: cvpnctl [-f файл] [-n секунд] [-1] [top|workers|handshakes|counters]"
+                  << std::endl;
+        return 2;
+    }
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    std::signal(SIGTERM, [](int) { stop_requested = 1; });
+
+    Mapping mapping;
+    auto data = std::make_unique<StatsData>();
+    auto previous = std::make_unique<StatsData>();
+    bool have_previous = false;
+
+    // Для скоростей нужны два снимка: в режиме -1 второй берется через интервал
+    int snapshots_left = options.once ? 2 : -1;
+    while (!stop_requested) {
+        if (!mapping.segment() || mapping.replaced(options.file)) {
+            have_previous = false;
+            if (!mapping.open(options.file)) {
+                std::cerr << options.file << ": сегмент статистики недоступен (сервер не запущен или stats.enabled = false)"
+                          << std::endl;
+                if (options.once) {
+                    return 1;
+                }
+                std::this_thread::sleep_for(std::chrono::duration<double>(options.interval));
+                continue;
+            }
+        }
+
+        const StatsSegmentLayout& segment = *mapping.segment();
+        if (!StatsSegment::read(&segment, *data)) {
+            std::cerr << options.file << ": несовместимая версия сегмента или снимок недоступен" << std::endl;
+            return 1;
+        }
+        if (kill(static_cast<pid_t>(segment.header.pid), 0) < 0 && errno == ESRCH) {
+            std::cerr << "Сервер (pid " << segment.header.pid << ") завершился, данные устарели" << std::endl;
+        }
+
+        if (data->published_unix_ms != 0 && (!options.once || snapshots_left == 1)) {
+            double seconds = have_previous
+                ? static_cast<double>(data->published_unix_ms - previous->published_unix_ms) / 1000.0
+                : 0.0;
+            const StatsData* before = have_previous && seconds > 0 ? previous.get() : nullptr;
+            if (!options.once) {
+                std::printf("\033[H\033[2J");
+            }
+            print_header(segment, *data);
+            if (options.view == "workers") {
+                print_workers(*data, before, seconds);
+            } else if (options.view == "handshakes") {
+                print_handshakes(*data);
+            } else if (options.view == "counters") {
+                print_counters(*data, before, seconds);
+            } else {
+                print_top(*data, before, seconds);
+            }
+            std::fflush(stdout);
+        }
+        if (data->published_unix_ms != 0) {
+            if (!have_previous || data->published_unix_ms != previous->published_unix_ms) {
+                std::swap(data, previous);
+                have_previous = true;
+            }
+            if (snapshots_left > 0 && --snapshots_left == 0) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.interval));
+    }
+    return 0;
+}